@@ -513,6 +513,60 @@ static inline pud_t pud_clear_soft_dirty(pud_t pud)
 
 #endif /* CONFIG_HAVE_ARCH_SOFT_DIRTY */
 
+#ifdef CONFIG_HAVE_ARCH_USERFAULTFD_WP
+static inline int pte_uffd_wp(pte_t pte)
+{
+	return pte_flags(pte) & _PAGE_UFFD_WP;
+}
+
+static inline pte_t pte_mkuffd_wp(pte_t pte)
+{
+	return pte_set_flags(pte, _PAGE_UFFD_WP);
+}
+
+static inline pte_t pte_clear_uffd_wp(pte_t pte)
+{
+	return pte_clear_flags(pte, _PAGE_UFFD_WP);
+}
+
+static inline pte_t pte_swp_mkuffd_wp(pte_t pte)
+{
+	return pte_set_flags(pte, _PAGE_SWP_UFFD_WP);
+}
+
+static inline int pte_swp_uffd_wp(pte_t pte)
+{
+	return pte_flags(pte) & _PAGE_SWP_UFFD_WP;
+}
+
+static inline pte_t pte_swp_clear_uffd_wp(pte_t pte)
+{
+	return pte_clear_flags(pte, _PAGE_SWP_UFFD_WP);
+}
+#endif /* CONFIG_HAVE_ARCH_USERFAULTFD_WP */
+
+#ifdef CONFIG_COW_PAGE_TABLES
+/*
+ * A PTE table shared copy-on-write after fork is mapped by pmds with
+ * _PAGE_RW clear, so that the hardware faults on any write through it.
+ */
+static inline int pmd_cow_table(pmd_t pmd)
+{
+	return (pmd_flags(pmd) & (_PAGE_PRESENT | _PAGE_PSE | _PAGE_RW)) ==
+		_PAGE_PRESENT;
+}
+
+static inline pmd_t pmd_mkcow_table(pmd_t pmd)
+{
+	return pmd_clear_flags(pmd, _PAGE_RW);
+}
+
+static inline pmd_t pmd_clear_cow_table(pmd_t pmd)
+{
+	return pmd_set_flags(pmd, _PAGE_RW);
+}
+#endif /* CONFIG_COW_PAGE_TABLES */
+
 /*
  * Mask out unsupported bits in a present pgprot.  Non-present pgprots
  * can use those bits for other purposes, so leave them be.
@@ -778,7 +832,13 @@ static inline pte_t *pte_offset_kernel(pmd_t *pmd, unsigned long address)
 
 static inline int pmd_bad(pmd_t pmd)
 {
-	return (pmd_flags(pmd) & ~_PAGE_USER) != _KERNPG_TABLE;
+	pmdval_t ignore = _PAGE_USER;
+
+	/* Copy-on-write PTE tables are mapped read-only, see pmd_cow_table() */
+	if (IS_ENABLED(CONFIG_COW_PAGE_TABLES))
+		ignore |= _PAGE_RW;
+
+	return (pmd_flags(pmd) & ~ignore) != (_KERNPG_TABLE & ~ignore);
 }
 
 static inline unsigned long pages_to_mb(unsigned long npg)
@@ -33,6 +33,7 @@
 #include <linux/nmi.h>
 #include <linux/gfp.h>
 #include <linux/kcore.h>
+#include <linux/hugetlb.h>
 
 #include <asm/processor.h>
 #include <asm/bios_ebda.h>
@@ -1404,7 +1405,12 @@ int __meminit vmemmap_populate(unsigned long start, unsigned long end, int node)
 	struct vmem_altmap *altmap = to_vmem_altmap(start);
 	int err;
 
-	if (boot_cpu_has(X86_FEATURE_PSE))
+	/*
+	 * Freeing the vmemmap of HugeTLB pages remaps it page by page, so
+	 * the vmemmap must not be mapped with PMDs then.
+	 */
+	if (boot_cpu_has(X86_FEATURE_PSE) &&
+	    (altmap || !is_hugetlb_free_vmemmap_enabled()))
 		err = vmemmap_populate_hugepages(start, end, node, altmap);
 	else if (altmap) {
 		pr_err_once("%s: no cpu support for altmap allocations\n",
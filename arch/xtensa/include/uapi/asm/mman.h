@@ -107,6 +107,12 @@
 #define MADV_WIPEONFORK 18		/* Zero memory on fork, child only */
 #define MADV_KEEPONFORK 19		/* Undo MADV_WIPEONFORK */
 
+#define MADV_COLD	20		/* deactivate these pages */
+#define MADV_PAGEOUT	21		/* reclaim these pages */
+
+#define MADV_SHARE_PT	26		/* Share page tables with other mappings */
+#define MADV_NOSHARE_PT	27		/* Undo MADV_SHARE_PT */
+
 /* compatibility flags */
 #define MAP_FILE	0
 
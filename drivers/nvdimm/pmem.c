@@ -29,6 +29,7 @@
 #include <linux/pfn_t.h>
 #include <linux/slab.h>
 #include <linux/uio.h>
+#include <linux/backing-dev.h>
 #include <linux/dax.h>
 #include <linux/nd.h>
 #include "pmem.h"
@@ -390,6 +391,7 @@ static int pmem_attach_disk(struct device *dev,
 	blk_queue_max_hw_sectors(q, UINT_MAX);
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, q);
 	queue_flag_set_unlocked(QUEUE_FLAG_DAX, q);
+	q->backing_dev_info->capabilities |= BDI_CAP_SYNCHRONOUS_IO;
 	q->queuedata = pmem;
 
 	disk = alloc_disk_node(0, nid);
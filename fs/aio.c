@@ -21,6 +21,7 @@
 #include <linux/uio.h>
 
 #include <linux/sched/signal.h>
+#include <linux/sched/mm.h>
 #include <linux/fs.h>
 #include <linux/file.h>
 #include <linux/mm.h>
@@ -40,6 +41,7 @@
 #include <linux/ramfs.h>
 #include <linux/percpu-refcount.h>
 #include <linux/mount.h>
+#include <linux/pagemap.h>
 
 #include <asm/kmap_types.h>
 #include <linux/uaccess.h>
@@ -155,6 +157,12 @@ struct kioctx {
 	struct page		*internal_pages[AIO_RING_PAGES];
 	struct file		*aio_ring_file;
 
+	/*
+	 * Address space async buffered reads copy into from the workqueue.
+	 * exit_aio() waits for all requests before it is torn down.
+	 */
+	struct mm_struct	*mm;
+
 	unsigned		id;
 };
 
@@ -188,8 +196,30 @@ struct aio_kiocb {
 	 * this is the underlying eventfd context to deliver events to.
 	 */
 	struct eventfd_ctx	*ki_eventfd;
+
+	/*
+	 * Async buffered read: instead of sleeping on a locked page cache
+	 * page, ki_wpq is queued on it and the read is continued from
+	 * ki_work once the page is unlocked.
+	 */
+	struct wait_page_queue	ki_wpq;
+	struct work_struct	ki_work;
+	struct iov_iter		ki_iter;
+	struct iovec		ki_fast_iov;
+	struct iovec		*ki_iovec;	/* allocated iovec, or NULL */
+	ssize_t			ki_done;	/* bytes read so far */
+	atomic_t		ki_buf_state;	/* AIO_BUF_* */
 };
 
+/*
+ * ki_buf_state: a wakeup can come in while the read which queued ki_wpq is
+ * still unwinding, so only the side which sees the other one done runs
+ * the read on.
+ */
+#define AIO_BUF_IDLE		0	/* waiting for the page */
+#define AIO_BUF_ISSUING		1	/* in ->read_iter() */
+#define AIO_BUF_WOKEN		2	/* page unlocked while issuing */
+
 /*------ sysctl variables----*/
 static DEFINE_SPINLOCK(aio_nr_lock);
 unsigned long aio_nr;		/* current system wide number of aio requests */
@@ -764,6 +794,7 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 		return ERR_PTR(-ENOMEM);
 
 	ctx->max_reqs = max_reqs;
+	ctx->mm = mm;
 
 	spin_lock_init(&ctx->ctx_lock);
 	spin_lock_init(&ctx->completion_lock);
@@ -1511,6 +1542,144 @@ static inline ssize_t aio_ret(struct kiocb *req, ssize_t ret)
 	}
 }
 
+static void aio_buf_read_done(struct aio_kiocb *iocb, ssize_t ret)
+{
+	if (iocb->ki_done)
+		ret = iocb->ki_done;
+	kfree(iocb->ki_iovec);
+	aio_ret(&iocb->common, ret);
+}
+
+/*
+ * Continue an async buffered read from the workqueue.  The read either
+ * finishes, or stops on a page which is still locked for IO with ki_wpq
+ * queued on it: then aio_buf_read_wake() runs us again.
+ */
+static void aio_buf_read_issue(struct aio_kiocb *iocb)
+{
+	struct kiocb *req = &iocb->common;
+	ssize_t ret;
+
+	for (;;) {
+		atomic_set(&iocb->ki_buf_state, AIO_BUF_ISSUING);
+		ret = call_read_iter(req->ki_filp, req, &iocb->ki_iter);
+		if (ret == -EIOCBQUEUED) {
+			if (atomic_cmpxchg(&iocb->ki_buf_state, AIO_BUF_ISSUING,
+					   AIO_BUF_IDLE) == AIO_BUF_ISSUING)
+				return;
+			/* already woken: go on from here */
+			continue;
+		}
+		if (ret <= 0)
+			break;
+		iocb->ki_done += ret;
+		/* a short read stops at a page under IO, or at EOF */
+		if (!iov_iter_count(&iocb->ki_iter))
+			break;
+	}
+
+	aio_buf_read_done(iocb, ret);
+}
+
+static void aio_buf_read_work(struct work_struct *work)
+{
+	struct aio_kiocb *iocb = container_of(work, struct aio_kiocb, ki_work);
+	struct mm_struct *mm = iocb->ki_ctx->mm;
+	mm_segment_t oldfs = get_fs();
+
+	/* The owner is exiting and exit_aio() waits for the read: end it */
+	if (!mmget_not_zero(mm)) {
+		aio_buf_read_done(iocb, -EINTR);
+		return;
+	}
+
+	set_fs(USER_DS);
+	use_mm(mm);
+	aio_buf_read_issue(iocb);
+	unuse_mm(mm);
+	set_fs(oldfs);
+	/* Not the exit_aio() of @mm from here, it might be waiting for us */
+	mmput_async(mm);
+}
+
+/*
+ * Wake function for ki_wpq, called with the page waitqueue lock held and
+ * possibly from IRQ context: hand the read over to the workqueue, unless
+ * the issuer hasn't returned yet and will pick it up itself.
+ */
+static int aio_buf_read_wake(wait_queue_entry_t *wait, unsigned mode,
+			     int sync, void *arg)
+{
+	struct wait_page_queue *wpq;
+	struct aio_kiocb *iocb;
+
+	wpq = container_of(wait, struct wait_page_queue, wait);
+	if (!wake_page_match(wpq, arg))
+		return 0;
+
+	iocb = container_of(wpq, struct aio_kiocb, ki_wpq);
+	list_del_init(&wait->entry);
+	if (atomic_xchg(&iocb->ki_buf_state, AIO_BUF_WOKEN) == AIO_BUF_IDLE)
+		queue_work(system_unbound_wq, &iocb->ki_work);
+	return 1;
+}
+
+/*
+ * Buffered reads on files which support it don't block the submitter on
+ * page cache misses.  The submitter only copies what is cached with
+ * IOCB_NOWAIT, as readahead and ->readpage() can block on the filesystem;
+ * the rest is read from the workqueue, which waits for the pages with
+ * ki_wpq instead of sleeping.  The iov_iter lives in the aio_kiocb.
+ */
+static ssize_t aio_buf_read(struct aio_kiocb *iocb, struct iocb *uiocb,
+			    bool vectored, bool compat)
+{
+	void __user *buf = (void __user *)(uintptr_t)uiocb->aio_buf;
+	struct kiocb *req = &iocb->common;
+	struct iovec *iovec = &iocb->ki_fast_iov;
+	ssize_t ret;
+
+	if (!vectored) {
+		ret = import_single_range(READ, buf, uiocb->aio_nbytes, iovec,
+					  &iocb->ki_iter);
+		iovec = NULL;
+	}
+#ifdef CONFIG_COMPAT
+	else if (compat)
+		ret = compat_import_iovec(READ, buf, uiocb->aio_nbytes, 1,
+					  &iovec, &iocb->ki_iter);
+#endif
+	else
+		ret = import_iovec(READ, buf, uiocb->aio_nbytes, 1, &iovec,
+				   &iocb->ki_iter);
+	if (ret)
+		return ret;
+
+	ret = rw_verify_area(READ, req->ki_filp, &req->ki_pos,
+			     iov_iter_count(&iocb->ki_iter));
+	if (ret) {
+		kfree(iovec);
+		return ret;
+	}
+
+	iocb->ki_iovec = iovec;
+	INIT_WORK(&iocb->ki_work, aio_buf_read_work);
+	init_waitqueue_func_entry(&iocb->ki_wpq.wait, aio_buf_read_wake);
+	iocb->ki_wpq.wait.private = iocb;
+	req->ki_waitq = &iocb->ki_wpq;
+	req->ki_flags |= IOCB_WAITQ | IOCB_NOWAIT;
+
+	ret = call_read_iter(req->ki_filp, req, &iocb->ki_iter);
+	req->ki_flags &= ~IOCB_NOWAIT;
+	if (ret > 0)
+		iocb->ki_done += ret;
+	if ((ret > 0 && iov_iter_count(&iocb->ki_iter)) || ret == -EAGAIN)
+		queue_work(system_unbound_wq, &iocb->ki_work);
+	else
+		aio_buf_read_done(iocb, ret);
+	return 0;
+}
+
 static ssize_t aio_read(struct kiocb *req, struct iocb *iocb, bool vectored,
 		bool compat)
 {
@@ -1524,6 +1693,11 @@ static ssize_t aio_read(struct kiocb *req, struct iocb *iocb, bool vectored,
 	if (unlikely(!file->f_op->read_iter))
 		return -EINVAL;
 
+	if (!(req->ki_flags & (IOCB_DIRECT | IOCB_NOWAIT)) &&
+	    (file->f_mode & FMODE_BUF_RASYNC))
+		return aio_buf_read(container_of(req, struct aio_kiocb, common),
+				    iocb, vectored, compat);
+
 	ret = aio_setup_rw(READ, iocb, &iovec, vectored, compat, &iter);
 	if (ret)
 		return ret;
@@ -2852,6 +2852,9 @@ long do_mount(const char *dev_name, const char __user *dir_name,
 		retval = -EPERM;
 	if (!retval && (flags & SB_MANDLOCK) && !may_mandlock())
 		retval = -EPERM;
+	/* Replicas aren't charged to anyone, see mm/page_replica.c */
+	if (!retval && (flags & MS_REPLICATE) && !capable(CAP_SYS_ADMIN))
+		retval = -EPERM;
 	if (retval)
 		goto dput_out;
 
@@ -2874,6 +2877,8 @@ long do_mount(const char *dev_name, const char __user *dir_name,
 		mnt_flags &= ~(MNT_RELATIME | MNT_NOATIME);
 	if (flags & MS_RDONLY)
 		mnt_flags |= MNT_READONLY;
+	if (flags & MS_REPLICATE)
+		mnt_flags |= MNT_REPLICATE;
 
 	/* The default atime for remount is preservation */
 	if ((flags & MS_REMOUNT) &&
@@ -31,6 +31,7 @@
 #include <linux/ima.h>
 #include <linux/dnotify.h>
 #include <linux/compat.h>
+#include <linux/page_replica.h>
 
 #include "internal.h"
 
@@ -790,6 +791,21 @@ static int do_dentry_open(struct file *f,
 	f->f_write_hint = WRITE_LIFE_NOT_SET;
 	f->f_flags &= ~(O_CREAT | O_EXCL | O_NOCTTY | O_TRUNC);
 
+	/*
+	 * The huge pages khugepaged collapses read-only text into cannot be
+	 * written to.  Drop the whole page cache of the file before anyone
+	 * gets a chance to.  Paired with the smp_mb() in collapse_file():
+	 * either we see the new THP here, or it sees our i_writecount.
+	 * The per-node copies of the page cache go too, the same way, see
+	 * page_replica_fault().
+	 */
+	if (f->f_mode & FMODE_WRITE) {
+		smp_mb();
+		if (filemap_nr_thps(inode->i_mapping))
+			truncate_pagecache(inode, 0);
+		page_replica_invalidate(inode->i_mapping, 0, -1);
+	}
+
 	file_ra_state_init(&f->f_ra, f->f_mapping->host->i_mapping);
 
 	return 0;
@@ -17,6 +17,7 @@
 #include <linux/mmu_notifier.h>
 #include <linux/page_idle.h>
 #include <linux/shmem_fs.h>
+#include <linux/pt_share.h>
 #include <linux/uaccess.h>
 
 #include <asm/elf.h>
@@ -402,11 +403,205 @@ static int tid_maps_open(struct inode *inode, struct file *file)
 	return do_maps_open(inode, file, &proc_tid_maps_op);
 }
 
+#ifdef CONFIG_PROC_PAGE_MONITOR
+static void procmap_fill_rss(struct vm_area_struct *vma,
+			     struct procmap_entry *e);
+#else
+static inline void procmap_fill_rss(struct vm_area_struct *vma,
+				    struct procmap_entry *e)
+{
+}
+#endif
+
+/* Records gathered per mmap_sem hold, and copied out after dropping it */
+#define PROCMAP_BATCH	32
+
+static void procmap_fill_entry(struct vm_area_struct *vma,
+			       struct procmap_entry *e, u64 query_flags)
+{
+	vm_flags_t flags = vma->vm_flags;
+
+	memset(e, 0, sizeof(*e));
+	e->vma_start = vma->vm_start;
+	e->vma_end = vma->vm_end;
+	if (flags & VM_READ)
+		e->vma_flags |= PROCMAP_VMA_READ;
+	if (flags & VM_WRITE)
+		e->vma_flags |= PROCMAP_VMA_WRITE;
+	if (flags & VM_EXEC)
+		e->vma_flags |= PROCMAP_VMA_EXEC;
+	if (flags & VM_MAYSHARE)
+		e->vma_flags |= PROCMAP_VMA_SHARED;
+	e->vma_page_size = vma_kernel_pagesize(vma);
+
+	if (vma->vm_file) {
+		struct inode *inode = file_inode(vma->vm_file);
+
+		e->vma_offset = ((loff_t)vma->vm_pgoff) << PAGE_SHIFT;
+		e->inode = inode->i_ino;
+		e->dev_major = MAJOR(inode->i_sb->s_dev);
+		e->dev_minor = MINOR(inode->i_sb->s_dev);
+	}
+
+	if (query_flags & PROCMAP_RANGE_RSS)
+		procmap_fill_rss(vma, e);
+}
+
+/*
+ * Fill up to @nr records for the mappings of @mm between *@addr and @end,
+ * the gate vma included like in the maps file, and advance *@addr past
+ * the last one.  *@addr is set to @end once there are no more mappings.
+ */
+static unsigned int procmap_fill(struct mm_struct *mm, unsigned long *addr,
+				 unsigned long end, struct procmap_entry *buf,
+				 unsigned int nr, u64 query_flags)
+{
+	struct vm_area_struct *gate = get_gate_vma(mm);
+	struct vm_area_struct *vma = find_vma(mm, *addr);
+	unsigned int n = 0;
+
+	if (!vma && gate && gate->vm_end > *addr)
+		vma = gate;
+
+	while (n < nr) {
+		if (!vma || vma->vm_start >= end) {
+			*addr = end;
+			break;
+		}
+
+		procmap_fill_entry(vma, &buf[n++], query_flags);
+		*addr = vma->vm_end;
+
+		if (vma == gate)
+			vma = NULL;
+		else if (!(vma = vma->vm_next))
+			vma = gate;
+	}
+
+	return n;
+}
+
+static long procmap_range_query(struct proc_maps_private *priv,
+				struct procmap_range_query __user *uarg)
+{
+	struct mm_struct *mm = priv->mm;
+	struct procmap_entry *buf;
+	struct procmap_range_query q;
+	char __user *entries;
+	unsigned long addr, end;
+	unsigned int n, i;
+	u32 done = 0;
+	u64 usize;
+	long err = 0;
+
+	if (get_user(usize, &uarg->size))
+		return -EFAULT;
+	if (usize < sizeof(q))
+		return -EINVAL;
+	if (usize > PAGE_SIZE)
+		return -E2BIG;
+	/*
+	 * A newer struct is fine as long as whatever we don't know about
+	 * is zero, as for sched_setattr().
+	 */
+	if (usize > sizeof(q)) {
+		unsigned char __user *addr = (void __user *)uarg + sizeof(q);
+		unsigned char __user *uend = (void __user *)uarg + usize;
+		unsigned char val;
+
+		for (; addr < uend; addr++) {
+			if (get_user(val, addr))
+				return -EFAULT;
+			if (val)
+				return -E2BIG;
+		}
+	}
+	if (copy_from_user(&q, uarg, sizeof(q)))
+		return -EFAULT;
+
+	if (q.query_flags & ~PROCMAP_RANGE_RSS)
+		return -EINVAL;
+	if ((q.query_flags & PROCMAP_RANGE_RSS) &&
+	    !IS_ENABLED(CONFIG_PROC_PAGE_MONITOR))
+		return -EOPNOTSUPP;
+	if (q.entry_size < sizeof(*buf))
+		return -EINVAL;
+
+	entries = u64_to_user_ptr(q.entries_addr);
+	addr = q.start_addr;
+	end = min_t(u64, q.end_addr, ULONG_MAX);
+	if (addr != q.start_addr)
+		addr = end;
+
+	if (!mm || !mmget_not_zero(mm))
+		return -ESRCH;
+
+	buf = kmalloc_array(PROCMAP_BATCH, sizeof(*buf), GFP_KERNEL);
+	if (!buf) {
+		err = -ENOMEM;
+		goto out_mm;
+	}
+
+	while (done < q.nr_entries && addr < end) {
+		unsigned int want = min_t(u32, PROCMAP_BATCH,
+					  q.nr_entries - done);
+
+		if (fatal_signal_pending(current)) {
+			err = -EINTR;
+			break;
+		}
+
+		down_read(&mm->mmap_sem);
+		n = procmap_fill(mm, &addr, end, buf, want, q.query_flags);
+		up_read(&mm->mmap_sem);
+
+		for (i = 0; i < n; i++, done++) {
+			char __user *e = entries + (u64)done * q.entry_size;
+
+			/* Fields of a newer procmap_entry read as zero */
+			if (copy_to_user(e, &buf[i], sizeof(*buf)) ||
+			    clear_user(e + sizeof(*buf),
+				       q.entry_size - sizeof(*buf))) {
+				err = -EFAULT;
+				goto out;
+			}
+		}
+		cond_resched();
+	}
+
+	/* The last mapping may extend past the range */
+	if (addr > end)
+		addr = end;
+	if (put_user(done, &uarg->nr_entries) ||
+	    put_user((u64)addr, &uarg->start_addr))
+		err = -EFAULT;
+out:
+	kfree(buf);
+out_mm:
+	mmput(mm);
+	return err;
+}
+
+static long proc_map_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct seq_file *seq = file->private_data;
+
+	switch (cmd) {
+	case PROCMAP_RANGE_QUERY:
+		return procmap_range_query(seq->private, (void __user *)arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
 const struct file_operations proc_pid_maps_operations = {
 	.open		= pid_maps_open,
 	.read		= seq_read,
 	.llseek		= seq_lseek,
 	.release	= proc_map_release,
+	.unlocked_ioctl	= proc_map_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
 };
 
 const struct file_operations proc_tid_maps_operations = {
@@ -414,6 +609,8 @@ const struct file_operations proc_tid_maps_operations = {
 	.read		= seq_read,
 	.llseek		= seq_lseek,
 	.release	= proc_map_release,
+	.unlocked_ioctl	= proc_map_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
 };
 
 /*
@@ -455,6 +652,8 @@ struct mem_size_stats {
 	u64 pss;
 	u64 pss_locked;
 	u64 swap_pss;
+	u64 pgtables_saved;
+	int pt_other_users;	/* of the PTE table being walked */
 	bool check_shmem_swap;
 };
 
@@ -480,7 +679,7 @@ static void smaps_account(struct mem_size_stats *mss, struct page *page,
 	 * If any subpage of the compound page mapped with PTE it would elevate
 	 * page_count().
 	 */
-	if (page_count(page) == 1) {
+	if (page_count(page) == 1 && !mss->pt_other_users) {
 		if (dirty || PageDirty(page))
 			mss->private_dirty += size;
 		else
@@ -492,7 +691,8 @@ static void smaps_account(struct mem_size_stats *mss, struct page *page,
 	}
 
 	for (i = 0; i < nr; i++, page++) {
-		int mapcount = page_mapcount(page);
+		/* A PTE in a shared table is one mapping for all its users */
+		int mapcount = page_mapcount(page) + mss->pt_other_users;
 		unsigned long pss = (PAGE_SIZE << PSS_SHIFT);
 
 		if (mapcount >= 2) {
@@ -613,8 +813,10 @@ static int smaps_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 			   struct mm_walk *walk)
 {
 	struct vm_area_struct *vma = walk->vma;
+	struct mem_size_stats *mss = walk->private;
 	pte_t *pte;
 	spinlock_t *ptl;
+	int users;
 
 	ptl = pmd_trans_huge_lock(pmd, vma);
 	if (ptl) {
@@ -626,14 +828,25 @@ static int smaps_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 
 	if (pmd_trans_unstable(pmd))
 		goto out;
+
+	users = pt_share_count(vma, pmd);
+	if (users > 1) {
+		u64 table = ((u64)(end - addr) << PSS_SHIFT) / PTRS_PER_PTE;
+
+		/* Like Pss: each user is credited its share of the others */
+		mss->pgtables_saved += div_u64(table * (users - 1), users);
+	}
+
 	/*
 	 * The mmap_sem held all the way back in m_start() is what
 	 * keeps khugepaged out of here and from collapsing things
 	 * in here.
 	 */
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+	mss->pt_other_users = users - 1;
 	for (; addr != end; pte++, addr += PAGE_SIZE)
 		smaps_pte_entry(pte, addr, walk);
+	mss->pt_other_users = 0;
 	pte_unmap_unlock(pte - 1, ptl);
 out:
 	cond_resched();
@@ -674,6 +887,9 @@ static void show_smap_vma_flags(struct seq_file *m, struct vm_area_struct *vma)
 		[ilog2(VM_ACCOUNT)]	= "ac",
 		[ilog2(VM_NORESERVE)]	= "nr",
 		[ilog2(VM_HUGETLB)]	= "ht",
+#ifdef CONFIG_SHARED_PAGE_TABLES
+		[ilog2(VM_SHARED_PT)]	= "pt",
+#endif
 		[ilog2(VM_ARCH_1)]	= "ar",
 		[ilog2(VM_WIPEONFORK)]	= "wf",
 		[ilog2(VM_DONTDUMP)]	= "dd",
@@ -741,12 +957,12 @@ void __weak arch_show_smap(struct seq_file *m, struct vm_area_struct *vma)
 {
 }
 
-static int show_smap(struct seq_file *m, void *v, int is_pid)
+/*
+ * Add the memory usage of @vma to @mss.  Called with mmap_sem held.
+ */
+static void smap_gather_stats(struct vm_area_struct *vma,
+			      struct mem_size_stats *mss)
 {
-	struct proc_maps_private *priv = m->private;
-	struct vm_area_struct *vma = v;
-	struct mem_size_stats mss_stack;
-	struct mem_size_stats *mss;
 	struct mm_walk smaps_walk = {
 		.pmd_entry = smaps_pte_range,
 #ifdef CONFIG_HUGETLB_PAGE
@@ -754,23 +970,6 @@ static int show_smap(struct seq_file *m, void *v, int is_pid)
 #endif
 		.mm = vma->vm_mm,
 	};
-	int ret = 0;
-	bool rollup_mode;
-	bool last_vma;
-
-	if (priv->rollup) {
-		rollup_mode = true;
-		mss = priv->rollup;
-		if (mss->first) {
-			mss->first_vma_start = vma->vm_start;
-			mss->first = false;
-		}
-		last_vma = !m_next_vma(priv, vma);
-	} else {
-		rollup_mode = false;
-		memset(&mss_stack, 0, sizeof(mss_stack));
-		mss = &mss_stack;
-	}
 
 	smaps_walk.private = mss;
 
@@ -799,8 +998,49 @@ static int show_smap(struct seq_file *m, void *v, int is_pid)
 		}
 	}
 #endif
-	/* mmap_sem is held in m_start */
 	walk_page_vma(vma, &smaps_walk);
+}
+
+static void procmap_fill_rss(struct vm_area_struct *vma,
+			     struct procmap_entry *e)
+{
+	struct mem_size_stats mss;
+
+	memset(&mss, 0, sizeof(mss));
+	smap_gather_stats(vma, &mss);
+
+	e->rss = mss.resident;
+	e->pss = mss.pss >> PSS_SHIFT;
+	e->swap = mss.swap;
+	e->swap_pss = mss.swap_pss >> PSS_SHIFT;
+}
+
+static int show_smap(struct seq_file *m, void *v, int is_pid)
+{
+	struct proc_maps_private *priv = m->private;
+	struct vm_area_struct *vma = v;
+	struct mem_size_stats mss_stack;
+	struct mem_size_stats *mss;
+	int ret = 0;
+	bool rollup_mode;
+	bool last_vma;
+
+	if (priv->rollup) {
+		rollup_mode = true;
+		mss = priv->rollup;
+		if (mss->first) {
+			mss->first_vma_start = vma->vm_start;
+			mss->first = false;
+		}
+		last_vma = !m_next_vma(priv, vma);
+	} else {
+		rollup_mode = false;
+		memset(&mss_stack, 0, sizeof(mss_stack));
+		mss = &mss_stack;
+	}
+
+	/* mmap_sem is held in m_start */
+	smap_gather_stats(vma, mss);
 
 	if (!rollup_mode) {
 		show_map_vma(m, vma, is_pid);
@@ -840,7 +1080,8 @@ static int show_smap(struct seq_file *m, void *v, int is_pid)
 			   "Private_Hugetlb: %7lu kB\n"
 			   "Swap:           %8lu kB\n"
 			   "SwapPss:        %8lu kB\n"
-			   "Locked:         %8lu kB\n",
+			   "Locked:         %8lu kB\n"
+			   "PgTablesSaved:  %8lu kB\n",
 			   mss->resident >> 10,
 			   (unsigned long)(mss->pss >> (10 + PSS_SHIFT)),
 			   mss->shared_clean  >> 10,
@@ -856,7 +1097,8 @@ static int show_smap(struct seq_file *m, void *v, int is_pid)
 			   mss->private_hugetlb >> 10,
 			   mss->swap >> 10,
 			   (unsigned long)(mss->swap_pss >> (10 + PSS_SHIFT)),
-			   (unsigned long)(mss->pss_locked >> (10 + PSS_SHIFT)));
+			   (unsigned long)(mss->pss_locked >> (10 + PSS_SHIFT)),
+			   (unsigned long)(mss->pgtables_saved >> (10 + PSS_SHIFT)));
 
 	if (!rollup_mode) {
 		arch_show_smap(m, vma);
@@ -1042,7 +1284,7 @@ static int clear_refs_pte_range(pmd_t *pmd, unsigned long addr,
 		return 0;
 	}
 
-	if (pmd_trans_unstable(pmd))
+	if (pmd_trans_unstable(pmd) || pmd_cow_table(*pmd))
 		return 0;
 
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
@@ -1090,6 +1332,12 @@ static int clear_refs_test_walk(unsigned long start, unsigned long end,
 		return 1;
 	if (cp->type == CLEAR_REFS_MAPPED && !vma->vm_file)
 		return 1;
+	/*
+	 * Write-protecting PTEs in a table shared with other mms would
+	 * hit them too, and only this mm's TLB is flushed.
+	 */
+	if (cp->type == CLEAR_REFS_SOFT_DIRTY && (vma->vm_flags & VM_SHARED_PT))
+		return 1;
 	return 0;
 }
 
@@ -1151,7 +1399,9 @@ static ssize_t clear_refs_write(struct file *file, const char __user *buf,
 		tlb_gather_mmu(&tlb, mm, 0, -1);
 		if (type == CLEAR_REFS_SOFT_DIRTY) {
 			for (vma = mm->mmap; vma; vma = vma->vm_next) {
-				if (!(vma->vm_flags & VM_SOFTDIRTY))
+				/* Stays soft-dirty, see clear_refs_test_walk() */
+				if (!(vma->vm_flags & VM_SOFTDIRTY) ||
+				    (vma->vm_flags & VM_SHARED_PT))
 					continue;
 				up_read(&mm->mmap_sem);
 				if (down_write_killable(&mm->mmap_sem)) {
@@ -1177,8 +1427,10 @@ static ssize_t clear_refs_write(struct file *file, const char __user *buf,
 					goto out_mm;
 				}
 				for (vma = mm->mmap; vma; vma = vma->vm_next) {
+					vm_write_begin(vma);
 					vma->vm_flags &= ~VM_SOFTDIRTY;
 					vma_set_page_prot(vma);
+					vm_write_end(vma);
 				}
 				downgrade_write(&mm->mmap_sem);
 				break;
@@ -157,6 +157,9 @@ typedef int (dio_iodone_t)(struct kiocb *iocb, loff_t offset,
 /* File is capable of returning -EAGAIN if I/O will block */
 #define FMODE_NOWAIT	((__force fmode_t)0x8000000)
 
+/* File supports async buffered reads (IOCB_WAITQ) */
+#define FMODE_BUF_RASYNC	((__force fmode_t)0x10000000)
+
 /*
  * Flag for rw_copy_check_uvector and compat_rw_copy_check_uvector
  * that indicates that they should check the contents of the iovec are
@@ -296,6 +299,10 @@ enum rw_hint {
 #define IOCB_SYNC		(1 << 5)
 #define IOCB_WRITE		(1 << 6)
 #define IOCB_NOWAIT		(1 << 7)
+/* buffered read: queue ki_waitq on a locked page instead of sleeping */
+#define IOCB_WAITQ		(1 << 8)
+
+struct wait_page_queue;
 
 struct kiocb {
 	struct file		*ki_filp;
@@ -304,6 +311,7 @@ struct kiocb {
 	void			*private;
 	int			ki_flags;
 	enum rw_hint		ki_hint;
+	struct wait_page_queue	*ki_waitq;	/* for IOCB_WAITQ */
 } __randomize_layout;
 
 static inline bool is_sync_kiocb(struct kiocb *kiocb)
@@ -393,6 +401,8 @@ int pagecache_write_end(struct file *, struct address_space *mapping,
 				loff_t pos, unsigned len, unsigned copied,
 				struct page *page, void *fsdata);
 
+struct page_replicas;
+
 struct address_space {
 	struct inode		*host;		/* owner: inode, block_device */
 	struct radix_tree_root	page_tree;	/* radix tree of all pages */
@@ -412,6 +422,14 @@ struct address_space {
 	struct list_head	private_list;	/* for use by the address_space */
 	void			*private_data;	/* ditto */
 	errseq_t		wb_err;
+#ifdef CONFIG_READ_ONLY_THP_FOR_FS
+	/* number of THPs collapsed by khugepaged in a regular file */
+	atomic_t		nr_thps;
+#endif
+#ifdef CONFIG_PAGECACHE_REPLICATION
+	/* per-node copies of the page cache, see mm/page_replica.c */
+	struct page_replicas	*replicas;
+#endif
 } __attribute__((aligned(sizeof(long)))) __randomize_layout;
 	/*
 	 * On most architectures that alignment is already the case; but
@@ -510,6 +528,33 @@ static inline int mapping_writably_mapped(struct address_space *mapping)
 	return atomic_read(&mapping->i_mmap_writable) > 0;
 }
 
+static inline int filemap_nr_thps(struct address_space *mapping)
+{
+#ifdef CONFIG_READ_ONLY_THP_FOR_FS
+	return atomic_read(&mapping->nr_thps);
+#else
+	return 0;
+#endif
+}
+
+static inline void filemap_nr_thps_inc(struct address_space *mapping)
+{
+#ifdef CONFIG_READ_ONLY_THP_FOR_FS
+	atomic_inc(&mapping->nr_thps);
+#else
+	WARN_ON_ONCE(1);
+#endif
+}
+
+static inline void filemap_nr_thps_dec(struct address_space *mapping)
+{
+#ifdef CONFIG_READ_ONLY_THP_FOR_FS
+	atomic_dec(&mapping->nr_thps);
+#else
+	WARN_ON_ONCE(1);
+#endif
+}
+
 static inline int mapping_map_writable(struct address_space *mapping)
 {
 	return atomic_inc_unless_negative(&mapping->i_mmap_writable) ?
@@ -2419,6 +2464,12 @@ extern int finish_no_open(struct file *file, struct dentry *dentry);
 /* fs/ioctl.c */
 
 extern int ioctl_preallocate(struct file *filp, void __user *argp);
+#ifdef CONFIG_COMPAT
+extern long compat_ptr_ioctl(struct file *file, unsigned int cmd,
+			     unsigned long arg);
+#else
+#define compat_ptr_ioctl NULL
+#endif
 
 /* fs/dcache.c */
 extern void __init vfs_caches_init_early(void);
@@ -567,6 +567,14 @@ extern void page_frag_free(void *addr);
 
 void page_alloc_init(void);
 void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+void drain_zone_thps(struct zone *zone, struct per_cpu_pages *pcp);
+#else
+static inline void drain_zone_thps(struct zone *zone,
+				   struct per_cpu_pages *pcp)
+{
+}
+#endif
 void drain_all_pages(struct zone *zone);
 void drain_local_pages(struct zone *zone);
 
@@ -26,6 +26,9 @@ void __ksm_exit(struct mm_struct *mm);
 
 static inline int ksm_fork(struct mm_struct *mm, struct mm_struct *oldmm)
 {
+	/* dup_mm() copied the parent's counters: the child has merged nothing */
+	mm->ksm_merging_pages = 0;
+	mm->ksm_rmap_items = 0;
 	if (test_bit(MMF_VM_MERGEABLE, &oldmm->flags))
 		return __ksm_enter(mm);
 	return 0;
@@ -64,6 +67,7 @@ struct page *ksm_might_need_to_copy(struct page *page,
 
 void rmap_walk_ksm(struct page *page, struct rmap_walk_control *rwc);
 void ksm_migrate_page(struct page *newpage, struct page *oldpage);
+long ksm_process_profit(struct mm_struct *mm);
 
 #else  /* !CONFIG_KSM */
 
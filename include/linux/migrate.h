@@ -26,6 +26,7 @@ enum migrate_reason {
 	MR_MEMPOLICY_MBIND,
 	MR_NUMA_MISPLACED,
 	MR_CMA,
+	MR_DEMOTION,
 	MR_TYPES
 };
 
@@ -124,6 +125,22 @@ static inline void __ClearPageMovable(struct page *page)
 }
 #endif
 
+#ifdef CONFIG_NUMA_DEMOTION
+extern bool numa_demotion_enabled;
+extern int next_demotion_node(int node);
+extern bool node_is_demotion_target(int node);
+#else
+#define numa_demotion_enabled	false
+static inline int next_demotion_node(int node)
+{
+	return NUMA_NO_NODE;
+}
+static inline bool node_is_demotion_target(int node)
+{
+	return false;
+}
+#endif
+
 #ifdef CONFIG_NUMA_BALANCING
 extern bool pmd_trans_migrating(pmd_t pmd);
 extern int migrate_misplaced_page(struct page *page,
@@ -44,9 +44,152 @@ static __always_inline void update_lru_size(struct lruvec *lruvec,
 #endif
 }
 
+#ifdef CONFIG_LRU_GEN
+
+#ifdef CONFIG_LRU_GEN_ENABLED
+DECLARE_STATIC_KEY_TRUE(lru_gen_key);
+
+static inline bool lru_gen_enabled(void)
+{
+	return static_branch_likely(&lru_gen_key);
+}
+#else
+DECLARE_STATIC_KEY_FALSE(lru_gen_key);
+
+static inline bool lru_gen_enabled(void)
+{
+	return static_branch_unlikely(&lru_gen_key);
+}
+#endif
+
+static inline int lru_gen_from_seq(unsigned long seq)
+{
+	return seq % MAX_NR_GENS;
+}
+
+/* The generation of a page on the multi-gen LRU lists, or -1 */
+static inline int page_lru_gen(struct page *page)
+{
+	unsigned long flags = READ_ONCE(page->flags);
+
+	return ((flags & LRU_GEN_MASK) >> LRU_GEN_PGOFF) - 1;
+}
+
+static inline bool lru_gen_is_active(struct lruvec *lruvec, int gen)
+{
+	unsigned long max_seq = lruvec->lrugen.max_seq;
+
+	return gen == lru_gen_from_seq(max_seq) ||
+	       gen == lru_gen_from_seq(max_seq - 1);
+}
+
+/* Update lrugen.nr_pages[] and the NR_LRU statistics they feed into */
+static inline void lru_gen_update_size(struct lruvec *lruvec,
+				struct page *page, int old_gen, int new_gen)
+{
+	int type = page_is_file_cache(page);
+	int zone = page_zonenum(page);
+	int delta = hpage_nr_pages(page);
+	enum lru_list lru = type ? LRU_INACTIVE_FILE : LRU_INACTIVE_ANON;
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+
+	if (old_gen >= 0) {
+		lrugen->nr_pages[old_gen][type][zone] -= delta;
+		update_lru_size(lruvec, lru + lru_gen_is_active(lruvec, old_gen),
+				zone, -delta);
+	}
+	if (new_gen >= 0) {
+		lrugen->nr_pages[new_gen][type][zone] += delta;
+		update_lru_size(lruvec, lru + lru_gen_is_active(lruvec, new_gen),
+				zone, delta);
+	}
+}
+
+static inline bool lru_gen_add_page(struct lruvec *lruvec, struct page *page,
+				    bool tail)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int type = page_is_file_cache(page);
+	unsigned long seq;
+	int gen;
+
+	if (PageUnevictable(page) || !lru_gen_enabled())
+		return false;
+
+	/*
+	 * Activated pages go to the youngest generation.  Anon pages not
+	 * yet in the swap cache were just faulted in and are not evicted
+	 * before the next aging either; the rest start in the oldest.
+	 */
+	if (PageActive(page))
+		seq = lrugen->max_seq;
+	else if (!type && !PageSwapCache(page))
+		seq = lrugen->max_seq - 1;
+	else
+		seq = lrugen->min_seq[type];
+
+	gen = lru_gen_from_seq(seq);
+	VM_BUG_ON_PAGE(page_lru_gen(page) != -1, page);
+	set_mask_bits(&page->flags, LRU_GEN_MASK | BIT(PG_active),
+		      (gen + 1UL) << LRU_GEN_PGOFF);
+	lru_gen_update_size(lruvec, page, -1, gen);
+
+	if (tail)
+		list_add_tail(&page->lru, &lrugen->lists[gen][type][page_zonenum(page)]);
+	else
+		list_add(&page->lru, &lrugen->lists[gen][type][page_zonenum(page)]);
+
+	return true;
+}
+
+static inline bool lru_gen_del_page(struct lruvec *lruvec, struct page *page,
+				    bool reclaiming)
+{
+	unsigned long flags;
+	int gen = page_lru_gen(page);
+
+	if (gen < 0)
+		return false;
+
+	/*
+	 * Pages isolated from the two youngest generations keep PG_active,
+	 * so that putting them back does not make them the oldest.  Reclaim
+	 * and pages on their way to be freed (no references left) don't.
+	 */
+	flags = !reclaiming && page_ref_count(page) &&
+		lru_gen_is_active(lruvec, gen) ? BIT(PG_active) : 0;
+
+	list_del(&page->lru);
+	lru_gen_update_size(lruvec, page, gen, -1);
+	set_mask_bits(&page->flags, LRU_GEN_MASK, flags);
+
+	return true;
+}
+#else
+static inline bool lru_gen_enabled(void)
+{
+	return false;
+}
+
+static inline bool lru_gen_add_page(struct lruvec *lruvec, struct page *page,
+				    bool tail)
+{
+	return false;
+}
+
+static inline bool lru_gen_del_page(struct lruvec *lruvec, struct page *page,
+				    bool reclaiming)
+{
+	return false;
+}
+#endif /* CONFIG_LRU_GEN */
+
 static __always_inline void add_page_to_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
+	if (lru_gen_add_page(lruvec, page, false))
+		return;
+
 	update_lru_size(lruvec, lru, page_zonenum(page), hpage_nr_pages(page));
 	list_add(&page->lru, &lruvec->lists[lru]);
 }
@@ -54,6 +197,9 @@ static __always_inline void add_page_to_lru_list(struct page *page,
 static __always_inline void add_page_to_lru_list_tail(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
+	if (lru_gen_add_page(lruvec, page, true))
+		return;
+
 	update_lru_size(lruvec, lru, page_zonenum(page), hpage_nr_pages(page));
 	list_add_tail(&page->lru, &lruvec->lists[lru]);
 }
@@ -61,6 +207,9 @@ static __always_inline void add_page_to_lru_list_tail(struct page *page,
 static __always_inline void del_page_from_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
+	if (lru_gen_del_page(lruvec, page, false))
+		return;
+
 	list_del(&page->lru);
 	update_lru_size(lruvec, lru, page_zonenum(page), -hpage_nr_pages(page));
 }
@@ -9,6 +9,7 @@
 #include <linux/spinlock.h>
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
+#include <linux/seqlock.h>
 #include <linux/completion.h>
 #include <linux/cpumask.h>
 #include <linux/uprobes.h>
@@ -342,6 +343,18 @@ struct vm_area_struct {
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
 #endif
 	struct vm_userfaultfd_ctx vm_userfaultfd_ctx;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	/*
+	 * Speculative page faults look the VMA up under RCU, without
+	 * mmap_sem.  vm_sequence is bumped around every modification of
+	 * the fields they depend on, vm_ref_count keeps the VMA and its
+	 * file alive while a speculative fault uses it, and vm_rcu defers
+	 * the final free past concurrent lockless rbtree walkers.
+	 */
+	seqcount_t vm_sequence;
+	atomic_t vm_ref_count;
+	struct rcu_head vm_rcu;
+#endif
 } __randomize_layout;
 
 struct core_thread {
@@ -409,6 +422,11 @@ struct mm_struct {
 						 * together off init_mm.mmlist, and are protected
 						 * by mmlist_lock
 						 */
+#ifdef CONFIG_LRU_GEN
+	struct list_head lru_gen_list;		/* Page tables walked by the multi-gen LRU aging,
+						 * see lru_gen_add_mm()
+						 */
+#endif
 
 
 	unsigned long hiwater_rss;	/* High-watermark of RSS usage */
@@ -510,6 +528,14 @@ struct mm_struct {
 	/* HMM needs to track a few things per mm */
 	struct hmm *hmm;
 #endif
+#ifdef CONFIG_KSM
+	/*
+	 * Number of pages of this mm mapping a KSM page, and number of
+	 * rmap_items ksmd keeps for it; both protected by ksm_thread_mutex.
+	 */
+	unsigned long ksm_merging_pages;
+	unsigned long ksm_rmap_items;
+#endif
 } __randomize_layout;
 
 extern struct mm_struct init_mm;
@@ -161,8 +161,14 @@ enum node_stat_item {
 	NR_SLAB_UNRECLAIMABLE,
 	NR_ISOLATED_ANON,	/* Temporary isolated pages from anon lru */
 	NR_ISOLATED_FILE,	/* Temporary isolated pages from file lru */
-	WORKINGSET_REFAULT,
+	WORKINGSET_REFAULT,	/* anon and file, as before the split */
+	WORKINGSET_REFAULT_BASE,
+	WORKINGSET_REFAULT_ANON = WORKINGSET_REFAULT_BASE,
+	WORKINGSET_REFAULT_FILE,
 	WORKINGSET_ACTIVATE,
+	WORKINGSET_ACTIVATE_BASE,
+	WORKINGSET_ACTIVATE_ANON = WORKINGSET_ACTIVATE_BASE,
+	WORKINGSET_ACTIVATE_FILE,
 	WORKINGSET_NODERECLAIM,
 	NR_ANON_MAPPED,	/* Mapped anonymous pages */
 	NR_FILE_MAPPED,	/* pagecache pages mapped into pagetables.
@@ -174,6 +180,9 @@ enum node_stat_item {
 	NR_SHMEM,		/* shmem pages (included tmpfs/GEM pages) */
 	NR_SHMEM_THPS,
 	NR_SHMEM_PMDMAPPED,
+	NR_FILE_THPS,		/* THPs of regular files, see khugepaged */
+	NR_FILE_PMDMAPPED,
+	NR_REPLICA_PAGES,	/* per-node page cache copies, see page_replica.c */
 	NR_ANON_THPS,
 	NR_UNSTABLE_NFS,	/* NFS unstable pages */
 	NR_VMSCAN_WRITE,
@@ -233,13 +242,46 @@ struct zone_reclaim_stat {
 	unsigned long		recent_scanned[2];
 };
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * The multi-gen LRU replaces the active/inactive lists of evictable pages
+ * with generations, numbered by a sequence that grows as pages are aged.
+ * max_seq is the youngest generation, shared by anon and file pages;
+ * min_seq[] is the oldest one of each type, the one reclaim evicts from.
+ * Aging starts a new generation and moves the pages found accessed in
+ * the page tables into it.  A page's generation is kept in page->flags,
+ * see LRU_GEN_MASK, as (seq % MAX_NR_GENS) + 1.
+ *
+ * The two youngest generations are accounted as active in the NR_LRU
+ * statistics, the others as inactive.
+ */
+#define MIN_NR_GENS		2
+#define MAX_NR_GENS		4
+
+struct lru_gen_struct {
+	/* the youngest generation */
+	unsigned long		max_seq;
+	/* the oldest generation of anon [0] and file [1] pages */
+	unsigned long		min_seq[2];
+	/* when each generation was created, in jiffies */
+	unsigned long		timestamps[MAX_NR_GENS];
+	/* pages of each generation, type and zone, newest at the head */
+	struct list_head	lists[MAX_NR_GENS][2][MAX_NR_ZONES];
+	/* their sizes, updated with lists[] under the lru_lock */
+	long			nr_pages[MAX_NR_GENS][2][MAX_NR_ZONES];
+};
+#endif /* CONFIG_LRU_GEN */
+
 struct lruvec {
 	struct list_head		lists[NR_LRU_LISTS];
 	struct zone_reclaim_stat	reclaim_stat;
-	/* Evictions & activations on the inactive file list */
+	/* Evictions & activations on the inactive lists */
 	atomic_long_t			inactive_age;
-	/* Refaults at the time of last reclaim cycle */
-	unsigned long			refaults;
+	/* Refaults at the time of last reclaim cycle, anon in [0] */
+	unsigned long			refaults[2];
+#ifdef CONFIG_LRU_GEN
+	struct lru_gen_struct		lrugen;
+#endif
 #ifdef CONFIG_MEMCG
 	struct pglist_data *pgdat;
 #endif
@@ -271,13 +313,33 @@ enum zone_watermarks {
 #define low_wmark_pages(z) (z->watermark[WMARK_LOW])
 #define high_wmark_pages(z) (z->watermark[WMARK_HIGH])
 
+/*
+ * The pcp-lists have one list per migrate type for each order up to
+ * PAGE_ALLOC_COSTLY_ORDER, and one more for THP-sized pages.  The THP
+ * lists hold at most one page each, are not counted against ->high and
+ * are only emptied when the whole pageset is drained.
+ */
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+#define NR_PCP_THP 1
+#else
+#define NR_PCP_THP 0
+#endif
+#define NR_LOWORDER_PCP_LISTS (MIGRATE_PCPTYPES * (PAGE_ALLOC_COSTLY_ORDER + 1))
+#define NR_PCP_LISTS (NR_LOWORDER_PCP_LISTS + MIGRATE_PCPTYPES * NR_PCP_THP)
+
 struct per_cpu_pages {
 	int count;		/* number of pages in the list */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
+	int thp_count;		/* pages of count on the THP lists, emptied
+				 * by the vmstat updater */
 
-	/* Lists of pages, one per migrate type stored on the pcp-lists */
-	struct list_head lists[MIGRATE_PCPTYPES];
+	/* order > 0 allocations served from / refilled into the lists */
+	unsigned long high_order_hit;
+	unsigned long high_order_miss;
+
+	/* Lists of pages, one per migrate type and order */
+	struct list_head lists[NR_PCP_LISTS];
 };
 
 struct per_cpu_pageset {
@@ -666,6 +728,7 @@ typedef struct pglist_data {
 	enum zone_type kcompactd_classzone_idx;
 	wait_queue_head_t kcompactd_wait;
 	struct task_struct *kcompactd;
+	bool proactive_compact_trigger;
 #endif
 #ifdef CONFIG_NUMA_BALANCING
 	/* Lock serializing the migrate rate limiting window */
@@ -676,6 +739,10 @@ typedef struct pglist_data {
 
 	/* Number of pages migrated during the rate limiting time interval */
 	unsigned long numabalancing_migrate_nr_pages;
+
+	/* Same, for promotion from a demotion target to this node */
+	unsigned long numabalancing_promote_next_window;
+	unsigned long numabalancing_promote_nr_pages;
 #endif
 	/*
 	 * This is a per-node reserve of pages that are not available
@@ -799,6 +866,13 @@ extern void init_currently_empty_zone(struct zone *zone, unsigned long start_pfn
 				     unsigned long size);
 
 extern void lruvec_init(struct lruvec *lruvec);
+#ifdef CONFIG_LRU_GEN
+extern void lru_gen_init_lruvec(struct lruvec *lruvec);
+#else
+static inline void lru_gen_init_lruvec(struct lruvec *lruvec)
+{
+}
+#endif
 
 static inline struct pglist_data *lruvec_pgdat(struct lruvec *lruvec)
 {
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_PAGE_REPLICA_H
+#define _LINUX_PAGE_REPLICA_H
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/mount.h>
+#include <linux/pagemap.h>
+
+#ifdef CONFIG_PAGECACHE_REPLICATION
+
+struct page *page_replica_fault(struct vm_fault *vmf, struct page *page);
+struct page *page_replica_map(struct vm_fault *vmf, struct page *page);
+void __page_replica_invalidate(struct address_space *mapping,
+			       pgoff_t start, pgoff_t end);
+void page_replica_free(struct address_space *mapping);
+bool page_replica_drop(struct page *page);
+
+/*
+ * Whether faults on @vma may map a copy of the page cache on the local
+ * node.  The file must have asked for it with FADV_REPLICATE or live on
+ * a mount with MS_REPLICATE.  mlocked mappings, shared page tables and
+ * shared mappings which could be made writable always map the page
+ * cache itself.
+ */
+static inline bool vma_page_replica(struct vm_area_struct *vma)
+{
+	struct file *file = vma->vm_file;
+
+	if (!file || !S_ISREG(file_inode(file)->i_mode))
+		return false;
+	if (vma->vm_flags & (VM_LOCKED | VM_SHARED_PT))
+		return false;
+	if ((vma->vm_flags & (VM_SHARED | VM_MAYWRITE)) ==
+	    (VM_SHARED | VM_MAYWRITE))
+		return false;
+	return mapping_replicate(file->f_mapping) ||
+	       (file->f_path.mnt->mnt_flags & MNT_REPLICATE);
+}
+
+/* Drop the replicas of the pages from @start to @end, both included */
+static inline void page_replica_invalidate(struct address_space *mapping,
+					   pgoff_t start, pgoff_t end)
+{
+	if (READ_ONCE(mapping->replicas))
+		__page_replica_invalidate(mapping, start, end);
+}
+
+#else /* CONFIG_PAGECACHE_REPLICATION */
+
+static inline struct page *page_replica_fault(struct vm_fault *vmf,
+					      struct page *page)
+{
+	return page;
+}
+
+static inline struct page *page_replica_map(struct vm_fault *vmf,
+					    struct page *page)
+{
+	return page;
+}
+
+static inline void page_replica_invalidate(struct address_space *mapping,
+					   pgoff_t start, pgoff_t end)
+{
+}
+
+static inline void page_replica_free(struct address_space *mapping)
+{
+}
+
+static inline bool page_replica_drop(struct page *page)
+{
+	return false;
+}
+
+static inline bool vma_page_replica(struct vm_area_struct *vma)
+{
+	return false;
+}
+
+#endif /* CONFIG_PAGECACHE_REPLICATION */
+
+#endif /* _LINUX_PAGE_REPLICA_H */
@@ -27,6 +27,7 @@ enum mapping_flags {
 	AS_EXITING	= 4, 	/* final truncate in progress */
 	/* writeback related tags are not used */
 	AS_NO_WRITEBACK_TAGS = 5,
+	AS_REPLICATE	= 6,	/* copy to the faulting node, FADV_REPLICATE */
 };
 
 /**
@@ -95,6 +96,21 @@ static inline int mapping_use_writeback_tags(struct address_space *mapping)
 	return !test_bit(AS_NO_WRITEBACK_TAGS, &mapping->flags);
 }
 
+static inline void mapping_set_replicate(struct address_space *mapping)
+{
+	set_bit(AS_REPLICATE, &mapping->flags);
+}
+
+static inline void mapping_clear_replicate(struct address_space *mapping)
+{
+	clear_bit(AS_REPLICATE, &mapping->flags);
+}
+
+static inline int mapping_replicate(struct address_space *mapping)
+{
+	return test_bit(AS_REPLICATE, &mapping->flags);
+}
+
 static inline gfp_t mapping_gfp_mask(struct address_space * mapping)
 {
 	return mapping->gfp_mask;
@@ -458,8 +474,40 @@ static inline pgoff_t linear_page_index(struct vm_area_struct *vma,
 	return pgoff;
 }
 
+/* This has the same layout as wait_bit_key - see fs/cachefiles/rdwr.c */
+struct wait_page_key {
+	struct page *page;
+	int bit_nr;
+	int page_match;
+};
+
+struct wait_page_queue {
+	struct page *page;
+	int bit_nr;
+	wait_queue_entry_t wait;
+};
+
+/*
+ * wake_page_match - for a custom wake function on a page waitqueue, tell
+ * whether the wakeup in @key is for the page and bit @wait_page waits on,
+ * and that bit is still clear.
+ */
+static inline bool wake_page_match(struct wait_page_queue *wait_page,
+				   struct wait_page_key *key)
+{
+	if (wait_page->page != key->page)
+		return false;
+	key->page_match = 1;
+
+	if (wait_page->bit_nr != key->bit_nr)
+		return false;
+
+	return !test_bit(key->bit_nr, &key->page->flags);
+}
+
 extern void __lock_page(struct page *page);
 extern int __lock_page_killable(struct page *page);
+extern int __lock_page_async(struct page *page, struct wait_page_queue *wait);
 extern int __lock_page_or_retry(struct page *page, struct mm_struct *mm,
 				unsigned int flags);
 extern void unlock_page(struct page *page);
@@ -493,6 +541,19 @@ static inline int lock_page_killable(struct page *page)
 	return 0;
 }
 
+/*
+ * lock_page_async - Lock the page if it is free, or else queue @wait on it
+ * and return -EIOCBQUEUED: @wait->wait.func is then called once the page
+ * is unlocked, and the caller has to try again from there.
+ */
+static inline int lock_page_async(struct page *page,
+				  struct wait_page_queue *wait)
+{
+	if (!trylock_page(page))
+		return __lock_page_async(page, wait);
+	return 0;
+}
+
 /*
  * lock_page_or_retry - Lock the page, unless this would block and the
  * caller indicated that it can handle a retry.
@@ -513,6 +574,8 @@ static inline int lock_page_or_retry(struct page *page, struct mm_struct *mm,
  */
 extern void wait_on_page_bit(struct page *page, int bit_nr);
 extern int wait_on_page_bit_killable(struct page *page, int bit_nr);
+extern int wait_on_page_locked_async(struct page *page,
+				     struct wait_page_queue *wait);
 
 /* 
  * Wait for a page to be unlocked.
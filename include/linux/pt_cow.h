@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_PT_COW_H
+#define _LINUX_PT_COW_H
+
+#include <linux/mm.h>
+#include <linux/mmu_notifier.h>
+#include <linux/sched/coredump.h>
+
+#ifdef CONFIG_COW_PAGE_TABLES
+
+bool pt_cow_fork(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		 pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *vma,
+		 unsigned long addr, unsigned long end);
+int pt_cow_unshare(struct vm_area_struct *vma, pmd_t *pmd,
+		   unsigned long addr, gfp_t gfp);
+bool pt_cow_zap(struct vm_area_struct *vma, pmd_t *pmd,
+		unsigned long addr, unsigned long end);
+
+/*
+ * Whether fork may share the PTE tables of @vma with the child rather
+ * than copy them.  mlocked, KSM and userfaultfd mappings need PTEs of
+ * their own, and so do mms with secondary MMUs.
+ */
+static inline bool vma_pt_cow(struct vm_area_struct *vma)
+{
+	return test_bit(MMF_COW_PGTABLE, &vma->vm_mm->flags) &&
+	       vma_is_anonymous(vma) &&
+	       !(vma->vm_flags & (VM_LOCKED | VM_MERGEABLE |
+				  VM_UFFD_MISSING | VM_UFFD_WP)) &&
+	       !mm_has_notifiers(vma->vm_mm);
+}
+
+#else /* CONFIG_COW_PAGE_TABLES */
+
+static inline bool pt_cow_fork(struct mm_struct *dst_mm,
+			       struct mm_struct *src_mm, pmd_t *dst_pmd,
+			       pmd_t *src_pmd, struct vm_area_struct *vma,
+			       unsigned long addr, unsigned long end)
+{
+	return false;
+}
+
+static inline int pt_cow_unshare(struct vm_area_struct *vma, pmd_t *pmd,
+				 unsigned long addr, gfp_t gfp)
+{
+	return 0;
+}
+
+static inline bool pt_cow_zap(struct vm_area_struct *vma, pmd_t *pmd,
+			      unsigned long addr, unsigned long end)
+{
+	return false;
+}
+
+static inline bool vma_pt_cow(struct vm_area_struct *vma)
+{
+	return false;
+}
+
+#endif /* CONFIG_COW_PAGE_TABLES */
+
+#endif /* _LINUX_PT_COW_H */
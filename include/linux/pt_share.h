@@ -0,0 +1,88 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_PT_SHARE_H
+#define _LINUX_PT_SHARE_H
+
+#include <linux/mm.h>
+
+#include <asm/tlbflush.h>
+
+#ifdef CONFIG_SHARED_PAGE_TABLES
+
+void pt_share(struct vm_area_struct *vma, unsigned long addr, pmd_t *pmd);
+bool pt_unshare(struct vm_area_struct *vma, pmd_t *pmd, unsigned long addr);
+int pt_share_madvise(struct vm_area_struct *vma, unsigned long start,
+		     unsigned long end, int advice, unsigned long *vm_flags);
+
+static inline bool vma_pt_shareable(struct vm_area_struct *vma,
+				    unsigned long addr)
+{
+	unsigned long base = addr & PMD_MASK;
+
+	return vma->vm_flags & VM_SHARED_PT &&
+	       range_in_vma(vma, base, base + PMD_SIZE);
+}
+
+/*
+ * Number of page tables using the PTE table under @pmd: more than one
+ * only if it is shared.
+ */
+static inline int pt_share_count(struct vm_area_struct *vma, pmd_t *pmd)
+{
+	pmd_t pmdval;
+
+	if (!(vma->vm_flags & VM_SHARED_PT))
+		return 1;
+	pmdval = READ_ONCE(*pmd);
+	if (!pmd_present(pmdval) || pmd_trans_huge(pmdval))
+		return 1;
+	return page_count(pmd_page(pmdval));
+}
+
+/*
+ * A PTE changed through a shared table may be cached in the TLB of any
+ * of its users, and those are not tracked.
+ */
+static inline void pt_share_flush(struct vm_area_struct *vma, pmd_t *pmd)
+{
+	if (pt_share_count(vma, pmd) > 1)
+		flush_tlb_all();
+}
+
+#else /* CONFIG_SHARED_PAGE_TABLES */
+
+static inline void pt_share(struct vm_area_struct *vma, unsigned long addr,
+			    pmd_t *pmd)
+{
+}
+
+static inline bool pt_unshare(struct vm_area_struct *vma, pmd_t *pmd,
+			      unsigned long addr)
+{
+	return false;
+}
+
+static inline int pt_share_madvise(struct vm_area_struct *vma,
+				   unsigned long start, unsigned long end,
+				   int advice, unsigned long *vm_flags)
+{
+	return -EINVAL;
+}
+
+static inline bool vma_pt_shareable(struct vm_area_struct *vma,
+				    unsigned long addr)
+{
+	return false;
+}
+
+static inline int pt_share_count(struct vm_area_struct *vma, pmd_t *pmd)
+{
+	return 1;
+}
+
+static inline void pt_share_flush(struct vm_area_struct *vma, pmd_t *pmd)
+{
+}
+
+#endif /* CONFIG_SHARED_PAGE_TABLES */
+
+#endif /* _LINUX_PT_SHARE_H */
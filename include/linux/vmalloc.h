@@ -44,6 +44,13 @@ struct vm_struct {
 struct vmap_area {
 	unsigned long va_start;
 	unsigned long va_end;
+
+	/*
+	 * Largest free block in the subtree, for areas in the free
+	 * tree only.
+	 */
+	unsigned long subtree_max_size;
+
 	unsigned long flags;
 	struct rb_node rb_node;         /* address sorted rbtree */
 	struct list_head list;          /* address sorted list */
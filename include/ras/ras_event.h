@@ -357,6 +357,7 @@ TRACE_EVENT(aer_event,
 	EM ( MF_MSG_DIRTY_LRU, "dirty LRU page" )			\
 	EM ( MF_MSG_CLEAN_LRU, "clean LRU page" )			\
 	EM ( MF_MSG_TRUNCATED_LRU, "already truncated LRU page" )	\
+	EM ( MF_MSG_REPLICA, "page cache replica" )			\
 	EM ( MF_MSG_BUDDY, "free buddy page" )				\
 	EM ( MF_MSG_BUDDY_2ND, "free buddy page (2nd try)" )		\
 	EMe ( MF_MSG_UNKNOWN, "unknown page" )
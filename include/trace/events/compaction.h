@@ -353,6 +353,37 @@ DEFINE_EVENT(kcompactd_wake_template, mm_compaction_kcompactd_wake,
 	TP_ARGS(nid, order, classzone_idx)
 );
 
+TRACE_EVENT(mm_compaction_proactive,
+
+	TP_PROTO(int nid, unsigned int score_before, unsigned int score_after,
+		 unsigned int wmark_low, unsigned int wmark_high),
+
+	TP_ARGS(nid, score_before, score_after, wmark_low, wmark_high),
+
+	TP_STRUCT__entry(
+		__field(int, nid)
+		__field(unsigned int, score_before)
+		__field(unsigned int, score_after)
+		__field(unsigned int, wmark_low)
+		__field(unsigned int, wmark_high)
+	),
+
+	TP_fast_assign(
+		__entry->nid = nid;
+		__entry->score_before = score_before;
+		__entry->score_after = score_after;
+		__entry->wmark_low = wmark_low;
+		__entry->wmark_high = wmark_high;
+	),
+
+	TP_printk("nid=%d score_before=%u score_after=%u wmark_low=%u wmark_high=%u",
+		__entry->nid,
+		__entry->score_before,
+		__entry->score_after,
+		__entry->wmark_low,
+		__entry->wmark_high)
+);
+
 #endif /* _TRACE_COMPACTION_H */
 
 /* This part must be outside protection */
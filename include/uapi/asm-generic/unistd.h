@@ -732,9 +732,18 @@ __SYSCALL(__NR_pkey_alloc,    sys_pkey_alloc)
 __SYSCALL(__NR_pkey_free,     sys_pkey_free)
 #define __NR_statx 291
 __SYSCALL(__NR_statx,     sys_statx)
+/*
+ * Same number as upstream, so that libcs and binaries built against it
+ * work unchanged.  292 to 439 are upstream syscalls this tree doesn't
+ * have: reusing them would clash with those, so they stay unassigned.
+ * The tables fill the hole with sys_ni_syscall, which costs 148 table
+ * entries and returns -ENOSYS like any other missing syscall.
+ */
+#define __NR_process_madvise 440
+__SYSCALL(__NR_process_madvise, sys_process_madvise)
 
 #undef __NR_syscalls
-#define __NR_syscalls 292
+#define __NR_syscalls 441
 
 /*
  * All syscalls below here should go away really,
@@ -19,4 +19,8 @@
 #define POSIX_FADV_NOREUSE	5 /* Data will be accessed once.  */
 #endif
 
+/* Linux specific: keep copies of the page cache on each NUMA node */
+#define FADV_REPLICATE		8
+#define FADV_NOREPLICATE	9
+
 #endif	/* FADVISE_H_INCLUDED */
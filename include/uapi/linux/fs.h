@@ -113,6 +113,7 @@ struct inodes_stat_t {
 #define MS_REMOUNT	32	/* Alter flags of a mounted FS */
 #define MS_MANDLOCK	64	/* Allow mandatory locks on an FS */
 #define MS_DIRSYNC	128	/* Directory modifications are synchronous */
+#define MS_REPLICATE	512	/* Replicate page cache on each NUMA node */
 #define MS_NOATIME	1024	/* Do not update access times. */
 #define MS_NODIRATIME	2048	/* Do not update directory access times */
 #define MS_BIND		4096
@@ -380,4 +381,57 @@ typedef int __bitwise __kernel_rwf_t;
 /* mask of flags supported by the kernel */
 #define RWF_SUPPORTED	(RWF_HIPRI | RWF_DSYNC | RWF_SYNC | RWF_NOWAIT)
 
+/*
+ * Binary query of the mappings of a process, an ioctl on
+ * /proc/<pid>/maps and /proc/<pid>/task/<tid>/maps.
+ *
+ * Fills up to nr_entries records, one for each mapping that intersects
+ * [start_addr, end_addr), in address order, into the array at
+ * entries_addr.  Records are written entry_size bytes apart and are
+ * not clipped to the range.  On return nr_entries is the number of
+ * records filled and start_addr the address to resume the query from,
+ * end_addr once the range has been covered.
+ *
+ * The ioctl number is well above the 'f' numbers taken by the FS_IOC_*
+ * ioctls and by upstream's procfs ioctls.
+ */
+#define PROCFS_IOCTL_MAGIC	'f'
+#define PROCMAP_RANGE_QUERY	_IOWR(PROCFS_IOCTL_MAGIC, 0x80, \
+				      struct procmap_range_query)
+
+/* procmap_range_query.query_flags */
+#define PROCMAP_RANGE_RSS	0x01	/* fill in the rss, pss and swap counters */
+
+/* procmap_entry.vma_flags, as shown in the maps file */
+#define PROCMAP_VMA_READ	0x01
+#define PROCMAP_VMA_WRITE	0x02
+#define PROCMAP_VMA_EXEC	0x04
+#define PROCMAP_VMA_SHARED	0x08
+
+struct procmap_range_query {
+	__u64 size;		/* sizeof(struct procmap_range_query) */
+	__u64 query_flags;	/* PROCMAP_RANGE_* */
+	__u64 start_addr;	/* in: first address, out: where to resume */
+	__u64 end_addr;		/* end of the range, exclusive */
+	__u64 entries_addr;	/* user address of the record array */
+	__u32 entry_size;	/* sizeof(struct procmap_entry) */
+	__u32 nr_entries;	/* in: room in the array, out: records filled */
+};
+
+struct procmap_entry {
+	__u64 vma_start;
+	__u64 vma_end;
+	__u64 vma_flags;	/* PROCMAP_VMA_* */
+	__u64 vma_page_size;	/* kernel page size backing the mapping */
+	__u64 vma_offset;	/* offset in the file, in bytes */
+	__u64 inode;		/* backing file, 0 if none */
+	__u32 dev_major;
+	__u32 dev_minor;
+	/* Counters in bytes, only with PROCMAP_RANGE_RSS */
+	__u64 rss;
+	__u64 pss;
+	__u64 swap;
+	__u64 swap_pss;
+};
+
 #endif /* _UAPI_LINUX_FS_H */
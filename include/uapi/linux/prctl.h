@@ -211,4 +211,12 @@ struct prctl_mm_map {
 # define PR_SPEC_DISABLE		(1UL << 2)
 # define PR_SPEC_FORCE_DISABLE		(1UL << 3)
 
+/*
+ * Share anonymous page tables copy-on-write at fork.  The numbers after
+ * PR_SET_SPECULATION_CTRL are taken upstream, these are "SCOW" and
+ * "GCOW" in ASCII to stay out of their way.
+ */
+#define PR_SET_COW_PGTABLE		0x53434f57
+#define PR_GET_COW_PGTABLE		0x47434f57
+
 #endif /* _LINUX_PRCTL_H */
@@ -31,6 +31,7 @@
 #include <linux/sysfs.h>
 #include <linux/rcupdate.h>
 #include <linux/module.h>
+#include <linux/completion.h>
 
 #define MAX_OBJ_NUM 1000
 
@@ -1002,6 +1003,133 @@ void padata_free(struct padata_instance *pinst)
 }
 EXPORT_SYMBOL(padata_free);
 
+struct padata_mt_job_state {
+	spinlock_t		lock;
+	struct completion	completion;
+	struct padata_mt_job	*job;
+	int			nworks;
+	int			nworks_fini;
+	unsigned long		chunk_size;
+};
+
+struct padata_mt_work {
+	struct work_struct		work;
+	struct padata_mt_job_state	*ps;
+};
+
+/*
+ * Take chunks of the job until none is left.  Run by the caller of
+ * padata_do_multithreaded() and by each of the helper works.
+ */
+static void __init padata_mt_helper(struct padata_mt_job_state *ps)
+{
+	struct padata_mt_job *job = ps->job;
+	bool done;
+
+	spin_lock(&ps->lock);
+
+	while (job->size > 0) {
+		unsigned long start, size, end;
+
+		start = job->start;
+		/* So end is chunk size aligned if enough work remains. */
+		size = roundup(start + 1, ps->chunk_size) - start;
+		size = min(size, job->size);
+		end = start + size;
+
+		job->start = end;
+		job->size -= size;
+
+		spin_unlock(&ps->lock);
+		job->thread_fn(start, end, job->fn_arg);
+		spin_lock(&ps->lock);
+	}
+
+	++ps->nworks_fini;
+	done = (ps->nworks_fini == ps->nworks);
+	spin_unlock(&ps->lock);
+
+	if (done)
+		complete(&ps->completion);
+}
+
+static void __init padata_mt_workfn(struct work_struct *w)
+{
+	struct padata_mt_work *pw = container_of(w, struct padata_mt_work, work);
+
+	padata_mt_helper(pw->ps);
+}
+
+/**
+ * padata_do_multithreaded - run a multithreaded job
+ * @job: Description of the job.
+ *
+ * The job is split into chunks which the calling thread and up to
+ * @job->max_threads - 1 unbound workqueue workers take in turn until it
+ * is done.  Since unbound workers are local to the node of the queueing
+ * CPU, a caller bound to a node keeps the work on that node.
+ *
+ * Only for use during boot, before the first user process is started.
+ *
+ * Return: the number of threads the job ran on, the caller's included.
+ */
+int __init padata_do_multithreaded(struct padata_mt_job *job)
+{
+	/* In case threads finish at different times. */
+	static const unsigned long load_balance_factor = 4;
+	struct padata_mt_job_state ps;
+	struct padata_mt_work *works;
+	int nworks, i;
+
+	if (job->size == 0)
+		return 0;
+
+	/* Ensure at least one thread when size < min_chunk. */
+	nworks = max(job->size / job->min_chunk, 1ul);
+	nworks = min(nworks, job->max_threads);
+
+	/* The calling thread is one of the workers. */
+	works = NULL;
+	if (nworks > 1)
+		works = kmalloc_array(nworks - 1, sizeof(*works), GFP_KERNEL);
+	if (!works) {
+		/* Single thread, no coordination needed, cut to the chase. */
+		job->thread_fn(job->start, job->start + job->size, job->fn_arg);
+		return 1;
+	}
+
+	spin_lock_init(&ps.lock);
+	init_completion(&ps.completion);
+	ps.job	       = job;
+	ps.nworks      = nworks;
+	ps.nworks_fini = 0;
+
+	/*
+	 * Chunk size is the amount of work a helper does per call to the
+	 * thread function.  Load balance large jobs between threads by
+	 * increasing the number of chunks, guarantee at least the minimum
+	 * chunk size from the caller, and honor the caller's alignment.
+	 */
+	ps.chunk_size = job->size / (ps.nworks * load_balance_factor);
+	ps.chunk_size = max(ps.chunk_size, job->min_chunk);
+	ps.chunk_size = roundup(ps.chunk_size, job->align);
+
+	for (i = 0; i < nworks - 1; i++) {
+		INIT_WORK(&works[i].work, padata_mt_workfn);
+		works[i].ps = &ps;
+		queue_work(system_unbound_wq, &works[i].work);
+	}
+
+	/* Use the current thread, which saves starting a workqueue worker. */
+	padata_mt_helper(&ps);
+
+	/* Wait for all the helpers to finish. */
+	wait_for_completion(&ps.completion);
+
+	kfree(works);
+	return nworks;
+}
+
 #ifdef CONFIG_HOTPLUG_CPU
 
 static __init int padata_driver_init(void)
@@ -7,6 +7,7 @@
 #include <linux/seq_file.h>
 #include <linux/rcupdate.h>
 #include <linux/kernel_stat.h>
+#include <linux/u64_stats_sync.h>
 #include <linux/err.h>
 
 #include "sched.h"
@@ -16,6 +17,10 @@
  *
  * Based on the work by Paul Menage (menage@google.com) and Balbir Singh
  * (balbir@in.ibm.com).
+ *
+ * Execution time is charged to the per-cpu counters of the task's own
+ * group only.  The usage of a group's subtree is folded together by
+ * cgroup rstat when it is read, see cpuacct_css_rstat_flush().
  */
 
 /* Time spent by the tasks of the cpu accounting group executing in ... */
@@ -32,7 +37,17 @@ static const char * const cpuacct_stat_desc[] = {
 };
 
 struct cpuacct_usage {
+	/* time charged to this group on this cpu, under rq->lock */
+	u64	local[CPUACCT_STAT_NSTATS];
+	struct u64_stats_sync sync;
+
+	/* the rest is protected by cgroup_rstat_lock */
+	u64	local_prev[CPUACCT_STAT_NSTATS];
+	u64	cputime_prev[CPUACCT_STAT_NSTATS];
+	/* usage of the group and its descendants on this cpu */
 	u64	usages[CPUACCT_STAT_NSTATS];
+	/* usage of the descendants not yet added to ->usages */
+	u64	pending[CPUACCT_STAT_NSTATS];
 };
 
 /* track cpu usage of a group of tasks and its child groups */
@@ -40,7 +55,11 @@ struct cpuacct {
 	struct cgroup_subsys_state css;
 	/* cpuusage holds pointer to a u64-type object on every cpu */
 	struct cpuacct_usage __percpu *cpuusage;
+	/* the group's own user and system time, the system's for the root */
 	struct kernel_cpustat __percpu *cpustat;
+	/* user and system time of the subtree, protected by cgroup_rstat_lock */
+	u64	cputime[CPUACCT_STAT_NSTATS];
+	u64	cputime_pending[CPUACCT_STAT_NSTATS];
 };
 
 static inline struct cpuacct *css_ca(struct cgroup_subsys_state *css)
@@ -70,6 +89,7 @@ static struct cgroup_subsys_state *
 cpuacct_css_alloc(struct cgroup_subsys_state *parent_css)
 {
 	struct cpuacct *ca;
+	int cpu;
 
 	if (!parent_css)
 		return &root_cpuacct.css;
@@ -81,6 +101,8 @@ cpuacct_css_alloc(struct cgroup_subsys_state *parent_css)
 	ca->cpuusage = alloc_percpu(struct cpuacct_usage);
 	if (!ca->cpuusage)
 		goto out_free_ca;
+	for_each_possible_cpu(cpu)
+		u64_stats_init(&per_cpu_ptr(ca->cpuusage, cpu)->sync);
 
 	ca->cpustat = alloc_percpu(struct kernel_cpustat);
 	if (!ca->cpustat)
@@ -106,6 +128,65 @@ static void cpuacct_css_free(struct cgroup_subsys_state *css)
 	kfree(ca);
 }
 
+/* Sum up the user and system time of a kernel_cpustat */
+static void cpuacct_cputime(u64 *cpustat, u64 *val)
+{
+	val[CPUACCT_STAT_USER] = cpustat[CPUTIME_USER] + cpustat[CPUTIME_NICE];
+	val[CPUACCT_STAT_SYSTEM] = cpustat[CPUTIME_SYSTEM] +
+				   cpustat[CPUTIME_IRQ] +
+				   cpustat[CPUTIME_SOFTIRQ];
+}
+
+/*
+ * Fold what was charged to @css on @cpu since the last flush into the
+ * usage of the group and pass it on to the parent.  rstat flushes the
+ * children first, so their usage is already waiting in ->pending.
+ */
+static void cpuacct_css_rstat_flush(struct cgroup_subsys_state *css, int cpu)
+{
+	struct cpuacct *ca = css_ca(css);
+	struct cpuacct *parent = parent_ca(ca);
+	struct cpuacct_usage *cpuusage = per_cpu_ptr(ca->cpuusage, cpu);
+	u64 local[CPUACCT_STAT_NSTATS], cputime[CPUACCT_STAT_NSTATS];
+	unsigned int seq;
+	u64 delta;
+	int i;
+
+	do {
+		seq = u64_stats_fetch_begin(&cpuusage->sync);
+		memcpy(local, cpuusage->local, sizeof(local));
+	} while (u64_stats_fetch_retry(&cpuusage->sync, seq));
+
+	for (i = 0; i < CPUACCT_STAT_NSTATS; i++) {
+		delta = local[i] - cpuusage->local_prev[i] +
+			cpuusage->pending[i];
+		cpuusage->local_prev[i] = local[i];
+		cpuusage->pending[i] = 0;
+
+		cpuusage->usages[i] += delta;
+		if (parent)
+			per_cpu_ptr(parent->cpuusage, cpu)->pending[i] += delta;
+	}
+
+	/* The user and system time of the root is that of the system */
+	if (!parent)
+		return;
+
+	cpuacct_cputime(per_cpu_ptr(ca->cpustat, cpu)->cpustat, cputime);
+	for (i = 0; i < CPUACCT_STAT_NSTATS; i++) {
+		/* The pending time of the subtree is collected only once */
+		delta = cputime[i] - cpuusage->cputime_prev[i] +
+			ca->cputime_pending[i];
+		cpuusage->cputime_prev[i] = cputime[i];
+		ca->cputime_pending[i] = 0;
+
+		ca->cputime[i] += delta;
+		if (parent != &root_cpuacct)
+			parent->cputime_pending[i] += delta;
+	}
+}
+
+/* Called with the usage of @ca's subtree flushed and held */
 static u64 cpuacct_cpuusage_read(struct cpuacct *ca, int cpu,
 				 enum cpuacct_stat_index index)
 {
@@ -118,13 +199,6 @@ static u64 cpuacct_cpuusage_read(struct cpuacct *ca, int cpu,
 	 */
 	BUG_ON(index > CPUACCT_STAT_NSTATS);
 
-#ifndef CONFIG_64BIT
-	/*
-	 * Take rq->lock to make 64-bit read safe on 32-bit platforms.
-	 */
-	raw_spin_lock_irq(&cpu_rq(cpu)->lock);
-#endif
-
 	if (index == CPUACCT_STAT_NSTATS) {
 		int i = 0;
 
@@ -135,33 +209,9 @@ static u64 cpuacct_cpuusage_read(struct cpuacct *ca, int cpu,
 		data = cpuusage->usages[index];
 	}
 
-#ifndef CONFIG_64BIT
-	raw_spin_unlock_irq(&cpu_rq(cpu)->lock);
-#endif
-
 	return data;
 }
 
-static void cpuacct_cpuusage_write(struct cpuacct *ca, int cpu, u64 val)
-{
-	struct cpuacct_usage *cpuusage = per_cpu_ptr(ca->cpuusage, cpu);
-	int i;
-
-#ifndef CONFIG_64BIT
-	/*
-	 * Take rq->lock to make 64-bit write safe on 32-bit platforms.
-	 */
-	raw_spin_lock_irq(&cpu_rq(cpu)->lock);
-#endif
-
-	for (i = 0; i < CPUACCT_STAT_NSTATS; i++)
-		cpuusage->usages[i] = val;
-
-#ifndef CONFIG_64BIT
-	raw_spin_unlock_irq(&cpu_rq(cpu)->lock);
-#endif
-}
-
 /* return total cpu usage (in nanoseconds) of a group */
 static u64 __cpuusage_read(struct cgroup_subsys_state *css,
 			   enum cpuacct_stat_index index)
@@ -170,8 +220,10 @@ static u64 __cpuusage_read(struct cgroup_subsys_state *css,
 	u64 totalcpuusage = 0;
 	int i;
 
+	cgroup_rstat_flush_hold(css->cgroup);
 	for_each_possible_cpu(i)
 		totalcpuusage += cpuacct_cpuusage_read(ca, i, index);
+	cgroup_rstat_flush_release();
 
 	return totalcpuusage;
 }
@@ -205,8 +257,18 @@ static int cpuusage_write(struct cgroup_subsys_state *css, struct cftype *cft,
 	if (val)
 		return -EINVAL;
 
+	/*
+	 * Fold in what is pending first, or it would survive the reset.
+	 * The user and system time restart from zero with the usage, so
+	 * that cpuacct.stat and cpuacct.usage cover the same period; the
+	 * root's are the system's and stay.
+	 */
+	cgroup_rstat_flush_hold(css->cgroup);
 	for_each_possible_cpu(cpu)
-		cpuacct_cpuusage_write(ca, cpu, 0);
+		memset(per_cpu_ptr(ca->cpuusage, cpu)->usages, 0,
+		       sizeof(ca->cpuusage->usages));
+	memset(ca->cputime, 0, sizeof(ca->cputime));
+	cgroup_rstat_flush_release();
 
 	return 0;
 }
@@ -218,10 +280,12 @@ static int __cpuacct_percpu_seq_show(struct seq_file *m,
 	u64 percpu;
 	int i;
 
+	cgroup_rstat_flush_hold(ca->css.cgroup);
 	for_each_possible_cpu(i) {
 		percpu = cpuacct_cpuusage_read(ca, i, index);
 		seq_printf(m, "%llu ", (unsigned long long) percpu);
 	}
+	cgroup_rstat_flush_release();
 	seq_printf(m, "\n");
 	return 0;
 }
@@ -252,47 +316,39 @@ static int cpuacct_all_seq_show(struct seq_file *m, void *V)
 		seq_printf(m, " %s", cpuacct_stat_desc[index]);
 	seq_puts(m, "\n");
 
+	cgroup_rstat_flush_hold(ca->css.cgroup);
 	for_each_possible_cpu(cpu) {
-		struct cpuacct_usage *cpuusage = per_cpu_ptr(ca->cpuusage, cpu);
-
 		seq_printf(m, "%d", cpu);
-
-		for (index = 0; index < CPUACCT_STAT_NSTATS; index++) {
-#ifndef CONFIG_64BIT
-			/*
-			 * Take rq->lock to make 64-bit read safe on 32-bit
-			 * platforms.
-			 */
-			raw_spin_lock_irq(&cpu_rq(cpu)->lock);
-#endif
-
-			seq_printf(m, " %llu", cpuusage->usages[index]);
-
-#ifndef CONFIG_64BIT
-			raw_spin_unlock_irq(&cpu_rq(cpu)->lock);
-#endif
-		}
+		for (index = 0; index < CPUACCT_STAT_NSTATS; index++)
+			seq_printf(m, " %llu",
+				   cpuacct_cpuusage_read(ca, cpu, index));
 		seq_puts(m, "\n");
 	}
+	cgroup_rstat_flush_release();
 	return 0;
 }
 
 static int cpuacct_stats_show(struct seq_file *sf, void *v)
 {
 	struct cpuacct *ca = css_ca(seq_css(sf));
-	s64 val[CPUACCT_STAT_NSTATS];
+	u64 val[CPUACCT_STAT_NSTATS];
 	int cpu;
 	int stat;
 
-	memset(val, 0, sizeof(val));
-	for_each_possible_cpu(cpu) {
-		u64 *cpustat = per_cpu_ptr(ca->cpustat, cpu)->cpustat;
+	if (ca == &root_cpuacct) {
+		memset(val, 0, sizeof(val));
+		for_each_possible_cpu(cpu) {
+			u64 cputime[CPUACCT_STAT_NSTATS];
 
-		val[CPUACCT_STAT_USER]   += cpustat[CPUTIME_USER];
-		val[CPUACCT_STAT_USER]   += cpustat[CPUTIME_NICE];
-		val[CPUACCT_STAT_SYSTEM] += cpustat[CPUTIME_SYSTEM];
-		val[CPUACCT_STAT_SYSTEM] += cpustat[CPUTIME_IRQ];
-		val[CPUACCT_STAT_SYSTEM] += cpustat[CPUTIME_SOFTIRQ];
+			cpuacct_cputime(per_cpu_ptr(ca->cpustat, cpu)->cpustat,
+					cputime);
+			for (stat = 0; stat < CPUACCT_STAT_NSTATS; stat++)
+				val[stat] += cputime[stat];
+		}
+	} else {
+		cgroup_rstat_flush_hold(ca->css.cgroup);
+		memcpy(val, ca->cputime, sizeof(val));
+		cgroup_rstat_flush_release();
 	}
 
 	for (stat = 0; stat < CPUACCT_STAT_NSTATS; stat++) {
@@ -348,6 +404,7 @@ static struct cftype files[] = {
  */
 void cpuacct_charge(struct task_struct *tsk, u64 cputime)
 {
+	struct cpuacct_usage *cpuusage;
 	struct cpuacct *ca;
 	int index = CPUACCT_STAT_SYSTEM;
 	struct pt_regs *regs = task_pt_regs(tsk);
@@ -357,8 +414,12 @@ void cpuacct_charge(struct task_struct *tsk, u64 cputime)
 
 	rcu_read_lock();
 
-	for (ca = task_ca(tsk); ca; ca = parent_ca(ca))
-		this_cpu_ptr(ca->cpuusage)->usages[index] += cputime;
+	ca = task_ca(tsk);
+	cpuusage = this_cpu_ptr(ca->cpuusage);
+	u64_stats_update_begin(&cpuusage->sync);
+	cpuusage->local[index] += cputime;
+	u64_stats_update_end(&cpuusage->sync);
+	cgroup_rstat_updated(ca->css.cgroup, smp_processor_id());
 
 	rcu_read_unlock();
 }
@@ -373,14 +434,18 @@ void cpuacct_account_field(struct task_struct *tsk, int index, u64 val)
 	struct cpuacct *ca;
 
 	rcu_read_lock();
-	for (ca = task_ca(tsk); ca != &root_cpuacct; ca = parent_ca(ca))
+	ca = task_ca(tsk);
+	if (ca != &root_cpuacct) {
 		this_cpu_ptr(ca->cpustat)->cpustat[index] += val;
+		cgroup_rstat_updated(ca->css.cgroup, smp_processor_id());
+	}
 	rcu_read_unlock();
 }
 
 struct cgroup_subsys cpuacct_cgrp_subsys = {
 	.css_alloc	= cpuacct_css_alloc,
 	.css_free	= cpuacct_css_free,
+	.css_rstat_flush = cpuacct_css_rstat_flush,
 	.legacy_cftypes	= files,
 	.early_init	= true,
 };
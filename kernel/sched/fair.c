@@ -2564,6 +2564,14 @@ void task_numa_work(struct callback_head *work)
 			continue;
 		}
 
+		/*
+		 * PTE tables shared with other mms: making their PTEs
+		 * prot_none would fault every sharer, while only this
+		 * mm's TLB gets flushed.
+		 */
+		if (vma->vm_flags & VM_SHARED_PT)
+			continue;
+
 		/*
 		 * Shared library pages mapped by multiple processes are not
 		 * migrated as it is expected they are cache replicated. Avoid
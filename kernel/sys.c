@@ -2377,6 +2377,25 @@ SYSCALL_DEFINE5(prctl, int, option, unsigned long, arg2, unsigned long, arg3,
 			clear_bit(MMF_DISABLE_THP, &me->mm->flags);
 		up_write(&me->mm->mmap_sem);
 		break;
+	case PR_SET_COW_PGTABLE:
+		if (arg3 || arg4 || arg5)
+			return -EINVAL;
+		/* Users of a shared table have to agree on its PTE lock */
+		if (!IS_ENABLED(CONFIG_COW_PAGE_TABLES) || !USE_SPLIT_PTE_PTLOCKS)
+			return -EINVAL;
+		if (down_write_killable(&me->mm->mmap_sem))
+			return -EINTR;
+		if (arg2)
+			set_bit(MMF_COW_PGTABLE, &me->mm->flags);
+		else
+			clear_bit(MMF_COW_PGTABLE, &me->mm->flags);
+		up_write(&me->mm->mmap_sem);
+		break;
+	case PR_GET_COW_PGTABLE:
+		if (arg2 || arg3 || arg4 || arg5)
+			return -EINVAL;
+		error = !!test_bit(MMF_COW_PGTABLE, &me->mm->flags);
+		break;
 	case PR_MPX_ENABLE_MANAGEMENT:
 		if (arg2 || arg3 || arg4 || arg5)
 			return -EINVAL;
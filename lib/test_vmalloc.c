@@ -0,0 +1,569 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/*
+ * Test module for stress and performance analysis of vmalloc allocator.
+ *
+ * Every test runs on each online CPU at the same time, test_loop_count
+ * allocations per round, and reports how long the rounds took along with
+ * percentiles of the latency of individual allocations and frees.  The
+ * module always fails to load so that it can simply be loaded again:
+ *
+ *   modprobe test_vmalloc run_test_mask=8 test_loop_count=100000
+ *   dmesg | grep test_vmalloc
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/random.h>
+#include <linux/kthread.h>
+#include <linux/moduleparam.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
+#include <linux/rwsem.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/bitops.h>
+
+#define __param(type, name, init, msg)		\
+	static type name = init;		\
+	module_param(name, type, 0444);		\
+	MODULE_PARM_DESC(name, msg)		\
+
+__param(bool, single_cpu_test, false,
+	"Use single first online CPU to run tests");
+
+__param(int, test_repeat_count, 1,
+	"Set test repeat counter");
+
+__param(int, test_loop_count, 1000000,
+	"Set test loop counter");
+
+__param(int, run_test_mask, INT_MAX,
+	"Set tests specified in the mask.\n\n"
+		"\t\tid: 1,   name: fix_size_alloc_test\n"
+		"\t\tid: 2,   name: random_size_alloc_test\n"
+		"\t\tid: 4,   name: random_size_align_alloc_test\n"
+		"\t\tid: 8,   name: long_busy_list_alloc_test\n"
+		"\t\tid: 16,  name: full_fit_alloc_test\n"
+		"\t\tid: 32,  name: pcpu_alloc_test\n"
+		/* Add a new test case description here. */
+);
+
+/*
+ * Latencies are accounted in a histogram with four linear buckets per
+ * power of two, which is precise to 25% at any scale and small enough
+ * to keep one per test and CPU.
+ */
+#define LAT_SUB_BITS	2
+#define LAT_BUCKETS	(64 << LAT_SUB_BITS)
+
+struct lat_hist {
+	unsigned long count[LAT_BUCKETS];
+	unsigned long nr;
+	u64 max;
+};
+
+static unsigned int lat_bucket(u64 ns)
+{
+	unsigned int shift;
+
+	if (ns < (1 << LAT_SUB_BITS))
+		return ns;
+
+	shift = fls64(ns) - 1 - LAT_SUB_BITS;
+	return ((shift + 1) << LAT_SUB_BITS) +
+		((ns >> shift) & ((1 << LAT_SUB_BITS) - 1));
+}
+
+/* The lowest latency accounted in bucket @b */
+static u64 lat_bucket_ns(unsigned int b)
+{
+	if (b < (1 << LAT_SUB_BITS))
+		return b;
+
+	return (u64)((1 << LAT_SUB_BITS) + (b & ((1 << LAT_SUB_BITS) - 1))) <<
+		((b >> LAT_SUB_BITS) - 1);
+}
+
+static void lat_add(struct lat_hist *h, u64 start)
+{
+	u64 ns = ktime_get_ns() - start;
+
+	h->count[lat_bucket(ns)]++;
+	h->nr++;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+/* Upper bound of the @pct percentile */
+static u64 lat_percentile(struct lat_hist *h, unsigned int pct)
+{
+	unsigned long want = DIV_ROUND_UP(h->nr * pct, 100);
+	unsigned long seen = 0;
+	unsigned int b;
+
+	for (b = 0; b < LAT_BUCKETS - 1; b++) {
+		seen += h->count[b];
+		if (seen >= want)
+			break;
+	}
+
+	return min(lat_bucket_ns(b + 1) - 1, h->max);
+}
+
+struct test_case_data {
+	int test_failed;
+	int test_passed;
+	u64 time;
+	struct lat_hist alloc;
+	struct lat_hist free;
+};
+
+static void *timed_vmalloc(struct test_case_data *d, unsigned long size,
+			   unsigned long align)
+{
+	u64 start = ktime_get_ns();
+	void *ptr;
+
+	ptr = __vmalloc_node_range(size, align, VMALLOC_START, VMALLOC_END,
+				   GFP_KERNEL, PAGE_KERNEL, 0, NUMA_NO_NODE,
+				   __builtin_return_address(0));
+	lat_add(&d->alloc, start);
+	return ptr;
+}
+
+static void timed_vfree(struct test_case_data *d, const void *ptr)
+{
+	u64 start = ktime_get_ns();
+
+	vfree(ptr);
+	lat_add(&d->free, start);
+}
+
+/*
+ * Read write semaphore for synchronization of setup
+ * phase that is done in main thread and workers.
+ */
+static DECLARE_RWSEM(prepare_for_test_rwsem);
+
+/*
+ * Completion tracking for worker threads.
+ */
+static DECLARE_COMPLETION(test_all_done_comp);
+static atomic_t test_n_undone = ATOMIC_INIT(0);
+
+static inline void
+test_report_one_done(void)
+{
+	if (atomic_dec_and_test(&test_n_undone))
+		complete(&test_all_done_comp);
+}
+
+static int fix_size_alloc_test(struct test_case_data *d)
+{
+	void *ptr;
+	int i;
+
+	for (i = 0; i < test_loop_count; i++) {
+		ptr = timed_vmalloc(d, 3 * PAGE_SIZE, 1);
+		if (!ptr)
+			return -1;
+
+		*((__u8 *)ptr) = 0;
+		timed_vfree(d, ptr);
+	}
+
+	return 0;
+}
+
+static int random_size_alloc_test(struct test_case_data *d)
+{
+	unsigned int n;
+	void *p;
+	int i;
+
+	for (i = 0; i < test_loop_count; i++) {
+		n = prandom_u32();
+		n = (n % 100) + 1;
+
+		p = timed_vmalloc(d, n * PAGE_SIZE, 1);
+		if (!p)
+			return -1;
+
+		*((__u8 *)p) = 1;
+		timed_vfree(d, p);
+	}
+
+	return 0;
+}
+
+static int random_size_align_alloc_test(struct test_case_data *d)
+{
+	unsigned long size, align;
+	void *ptr;
+	int i;
+
+	for (i = 0; i < test_loop_count; i++) {
+		size = ((prandom_u32() % 10) + 1) * PAGE_SIZE;
+		align = PAGE_SIZE << (prandom_u32() % 10);
+
+		ptr = timed_vmalloc(d, size, align);
+		if (!ptr)
+			return -1;
+
+		if (!IS_ALIGNED((unsigned long)ptr, align)) {
+			vfree(ptr);
+			return -1;
+		}
+
+		timed_vfree(d, ptr);
+	}
+
+	return 0;
+}
+
+/*
+ * Leave thousands of one page holes between busy areas: the lowest
+ * fitting free block is then far from the start of the vmalloc space.
+ */
+static int long_busy_list_alloc_test(struct test_case_data *d)
+{
+	void *ptr_1, *ptr_2;
+	void **ptr;
+	int rv = -1;
+	int i;
+
+	ptr = vmalloc(sizeof(void *) * 15000);
+	if (!ptr)
+		return rv;
+
+	for (i = 0; i < 15000; i++)
+		ptr[i] = vmalloc(1 * PAGE_SIZE);
+
+	for (i = 0; i < 15000; i += 2) {
+		vfree(ptr[i]);
+		ptr[i] = NULL;
+	}
+
+	for (i = 0; i < test_loop_count; i++) {
+		ptr_1 = timed_vmalloc(d, 100 * PAGE_SIZE, 1);
+		if (!ptr_1)
+			goto leave;
+
+		ptr_2 = timed_vmalloc(d, 1 * PAGE_SIZE, 1);
+		if (!ptr_2) {
+			vfree(ptr_1);
+			goto leave;
+		}
+
+		*((__u8 *)ptr_1) = 0;
+		*((__u8 *)ptr_2) = 1;
+
+		timed_vfree(d, ptr_1);
+		timed_vfree(d, ptr_2);
+	}
+
+	/*  Success */
+	rv = 0;
+
+leave:
+	for (i = 0; i < 15000; i++)
+		vfree(ptr[i]);
+
+	vfree(ptr);
+	return rv;
+}
+
+/*
+ * Allocate into holes the exact size of the request, so that free
+ * blocks are used up entirely.
+ */
+static int full_fit_alloc_test(struct test_case_data *d)
+{
+	void **ptr, **junk_ptr, *tmp;
+	int junk_length;
+	int rv = -1;
+	int i;
+
+	junk_length = fls(num_online_cpus());
+	junk_length *= (32 * 1024 * 1024 / PAGE_SIZE);
+
+	ptr = vmalloc(sizeof(void *) * junk_length);
+	if (!ptr)
+		return rv;
+
+	junk_ptr = vmalloc(sizeof(void *) * junk_length);
+	if (!junk_ptr) {
+		vfree(ptr);
+		return rv;
+	}
+
+	for (i = 0; i < junk_length; i++) {
+		ptr[i] = vmalloc(1 * PAGE_SIZE);
+		junk_ptr[i] = vmalloc(1 * PAGE_SIZE);
+	}
+
+	for (i = 0; i < junk_length; i++)
+		vfree(junk_ptr[i]);
+
+	for (i = 0; i < test_loop_count; i++) {
+		tmp = timed_vmalloc(d, 1 * PAGE_SIZE, 1);
+
+		if (!tmp)
+			goto error;
+
+		*((__u8 *)tmp) = 1;
+		timed_vfree(d, tmp);
+	}
+
+	/* Success */
+	rv = 0;
+
+error:
+	for (i = 0; i < junk_length; i++)
+		vfree(ptr[i]);
+
+	vfree(ptr);
+	vfree(junk_ptr);
+
+	return rv;
+}
+
+/*
+ * The percpu allocator gets its chunks from pcpu_get_vm_areas() on SMP,
+ * from the top of the vmalloc space.
+ */
+static int pcpu_alloc_test(struct test_case_data *d)
+{
+	void __percpu **pcpu;
+	size_t size, align;
+	int rv = 0;
+	u64 start;
+	int i;
+
+	pcpu = vmalloc(sizeof(void __percpu *) * 35000);
+	if (!pcpu)
+		return -1;
+
+	for (i = 0; i < 35000; i++) {
+		unsigned int r;
+
+		r = prandom_u32();
+		size = (r % (PAGE_SIZE / 4)) + 1;
+
+		/*
+		 * Maximum PAGE_SIZE
+		 */
+		r = prandom_u32();
+		align = 1 << ((r % 11) + 1);
+
+		start = ktime_get_ns();
+		pcpu[i] = __alloc_percpu(size, align);
+		lat_add(&d->alloc, start);
+		if (!pcpu[i])
+			rv = -1;
+	}
+
+	for (i = 0; i < 35000; i++) {
+		start = ktime_get_ns();
+		free_percpu(pcpu[i]);
+		lat_add(&d->free, start);
+	}
+
+	vfree(pcpu);
+	return rv;
+}
+
+struct test_case_desc {
+	const char *test_name;
+	int (*test_func)(struct test_case_data *d);
+};
+
+static struct test_case_desc test_case_array[] = {
+	{ "fix_size_alloc_test", fix_size_alloc_test },
+	{ "random_size_alloc_test", random_size_alloc_test },
+	{ "random_size_align_alloc_test", random_size_align_alloc_test },
+	{ "long_busy_list_alloc_test", long_busy_list_alloc_test },
+	{ "full_fit_alloc_test", full_fit_alloc_test, },
+	{ "pcpu_alloc_test", pcpu_alloc_test, },
+	/* Add a new test case here. */
+};
+
+struct test_driver {
+	struct task_struct *task;
+	unsigned long start;
+	unsigned long stop;
+	int cpu;
+	struct test_case_data data[ARRAY_SIZE(test_case_array)];
+};
+
+static struct test_driver *per_cpu_test_driver;
+
+static int test_func(void *private)
+{
+	struct test_driver *t = private;
+	struct test_case_data *d;
+	ktime_t kt;
+	int i, j;
+
+	if (set_cpus_allowed_ptr(current, cpumask_of(t->cpu)) < 0)
+		pr_err("Failed to set affinity to %d CPU\n", t->cpu);
+
+	/*
+	 * Block until initialization is done.
+	 */
+	down_read(&prepare_for_test_rwsem);
+
+	t->start = get_cycles();
+	for (i = 0; i < ARRAY_SIZE(test_case_array); i++) {
+		if (!(run_test_mask & (1 << i)))
+			continue;
+
+		d = &t->data[i];
+		kt = ktime_get();
+		for (j = 0; j < test_repeat_count; j++) {
+			if (!test_case_array[i].test_func(d))
+				d->test_passed++;
+			else
+				d->test_failed++;
+		}
+
+		/*
+		 * Take an average time that test took.
+		 */
+		d->time = div_s64(ktime_us_delta(ktime_get(), kt),
+				  test_repeat_count);
+	}
+	t->stop = get_cycles();
+
+	up_read(&prepare_for_test_rwsem);
+	test_report_one_done();
+
+	/*
+	 * Wait for the kthread_stop() call.
+	 */
+	while (!kthread_should_stop())
+		msleep(10);
+
+	return 0;
+}
+
+static void test_report_one(struct test_driver *t)
+{
+	struct test_case_data *d;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(test_case_array); i++) {
+		if (!(run_test_mask & (1 << i)))
+			continue;
+
+		d = &t->data[i];
+		pr_info("Summary: %s passed: %d failed: %d repeat: %d loops: %d avg: %llu usec\n",
+			test_case_array[i].test_name, d->test_passed,
+			d->test_failed, test_repeat_count, test_loop_count,
+			d->time);
+
+		if (!d->alloc.nr || !d->free.nr)
+			continue;
+
+		pr_info("Latency: %s alloc p50/p90/p99/max: %llu/%llu/%llu/%llu ns free p50/p90/p99/max: %llu/%llu/%llu/%llu ns\n",
+			test_case_array[i].test_name,
+			lat_percentile(&d->alloc, 50),
+			lat_percentile(&d->alloc, 90),
+			lat_percentile(&d->alloc, 99), d->alloc.max,
+			lat_percentile(&d->free, 50),
+			lat_percentile(&d->free, 90),
+			lat_percentile(&d->free, 99), d->free.max);
+	}
+
+	pr_info("All test took CPU%d=%lu cycles\n",
+		t->cpu, t->stop - t->start);
+}
+
+static void do_concurrent_test(void)
+{
+	const struct cpumask *cpumask;
+	struct test_driver *t;
+	int cpu, ret;
+
+	cpumask = single_cpu_test ? cpumask_of(cpumask_first(cpu_online_mask)) :
+		cpu_online_mask;
+
+	per_cpu_test_driver = vzalloc(sizeof(*t) * nr_cpu_ids);
+	if (!per_cpu_test_driver)
+		return;
+
+	/*
+	 * Set some basic configurations plus sanity check.
+	 */
+	if (test_repeat_count <= 0)
+		test_repeat_count = 1;
+
+	if (test_loop_count <= 0)
+		test_loop_count = 1;
+
+	/*
+	 * Block workers until all are created.
+	 */
+	down_write(&prepare_for_test_rwsem);
+
+	for_each_cpu(cpu, cpumask) {
+		t = &per_cpu_test_driver[cpu];
+
+		t->cpu = cpu;
+		t->task = kthread_run(test_func, t, "vmalloc_test/%d", cpu);
+
+		if (!IS_ERR(t->task))
+			/* Success. */
+			atomic_inc(&test_n_undone);
+		else
+			pr_err("Failed to start kthread for %d CPU\n", cpu);
+	}
+
+	/*
+	 * Now let the workers do their job.
+	 */
+	up_write(&prepare_for_test_rwsem);
+
+	/*
+	 * Sleep quiet until all workers are done with 1 second
+	 * interval. Since the test can take a lot of time we
+	 * can run into a stack trace of the hung task. That is
+	 * why we go with completion_timeout and HZ value.
+	 */
+	do {
+		ret = wait_for_completion_timeout(&test_all_done_comp, HZ);
+	} while (!ret && atomic_read(&test_n_undone));
+
+	for_each_cpu(cpu, cpumask) {
+		t = &per_cpu_test_driver[cpu];
+
+		if (!IS_ERR_OR_NULL(t->task)) {
+			kthread_stop(t->task);
+			test_report_one(t);
+		}
+	}
+
+	vfree(per_cpu_test_driver);
+}
+
+static int vmalloc_test_init(void)
+{
+	do_concurrent_test();
+	return -EAGAIN; /* Fail will directly unload the module */
+}
+
+static void vmalloc_test_exit(void)
+{
+}
+
+module_init(vmalloc_test_init)
+module_exit(vmalloc_test_exit)
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("vmalloc test module");
@@ -0,0 +1,422 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * DAMON Debugfs Interface
+ *
+ * <debugfs>/damon/ has the following files:
+ *
+ *   attrs	"<sample us> <aggr us> <update us> <min regions> <max regions>"
+ *   target_ids	space separated pids of the processes to monitor
+ *   monitor_on	"on" or "off", to start or stop the monitoring
+ *   regions	the regions and their access counts of the last aggregation,
+ *		one "<pid> <start> <end> <nr_accesses>" line per region
+ *
+ * The monitoring results are also exported via the damon_aggregated
+ * tracepoint.
+ */
+
+#define pr_fmt(fmt) "damon-dbgfs: " fmt
+
+#include <linux/damon.h>
+#include <linux/debugfs.h>
+#include <linux/file.h>
+#include <linux/module.h>
+#include <linux/pid.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+struct dbgfs_region_snapshot {
+	pid_t pid;
+	unsigned long start;
+	unsigned long end;
+	unsigned int nr_accesses;
+};
+
+static struct damon_ctx *dbgfs_ctx;
+static struct dentry *dbgfs_root;
+static DEFINE_MUTEX(damon_dbgfs_lock);
+
+/* Regions of the last aggregation, protected by dbgfs_snapshot_lock */
+static DEFINE_MUTEX(dbgfs_snapshot_lock);
+static struct dbgfs_region_snapshot *dbgfs_snapshot;
+static unsigned int dbgfs_nr_snapshot;
+
+/*
+ * Returns non-empty string on success, negative error code otherwise.
+ */
+static char *user_input_str(const char __user *buf, size_t count, loff_t *ppos)
+{
+	char *kbuf;
+	ssize_t ret;
+
+	/* We do not accept continuous write */
+	if (*ppos)
+		return ERR_PTR(-EINVAL);
+
+	kbuf = kmalloc(count + 1, GFP_KERNEL);
+	if (!kbuf)
+		return ERR_PTR(-ENOMEM);
+
+	ret = simple_write_to_buffer(kbuf, count + 1, ppos, buf, count);
+	if (ret != count) {
+		kfree(kbuf);
+		return ERR_PTR(-EIO);
+	}
+	kbuf[ret] = '\0';
+
+	return kbuf;
+}
+
+static ssize_t dbgfs_attrs_read(struct file *file,
+		char __user *buf, size_t count, loff_t *ppos)
+{
+	struct damon_ctx *ctx = file->private_data;
+	char kbuf[128];
+	int ret;
+
+	mutex_lock(&ctx->kdamond_lock);
+	ret = scnprintf(kbuf, ARRAY_SIZE(kbuf), "%lu %lu %lu %lu %lu\n",
+			ctx->sample_interval, ctx->aggr_interval,
+			ctx->primitive_update_interval, ctx->min_nr_regions,
+			ctx->max_nr_regions);
+	mutex_unlock(&ctx->kdamond_lock);
+
+	return simple_read_from_buffer(buf, count, ppos, kbuf, ret);
+}
+
+static ssize_t dbgfs_attrs_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct damon_ctx *ctx = file->private_data;
+	unsigned long s, a, r, minr, maxr;
+	char *kbuf;
+	ssize_t ret;
+
+	kbuf = user_input_str(buf, count, ppos);
+	if (IS_ERR(kbuf))
+		return PTR_ERR(kbuf);
+
+	if (sscanf(kbuf, "%lu %lu %lu %lu %lu",
+				&s, &a, &r, &minr, &maxr) != 5) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	mutex_lock(&ctx->kdamond_lock);
+	if (ctx->kdamond) {
+		ret = -EBUSY;
+		goto unlock_out;
+	}
+
+	ret = damon_set_attrs(ctx, s, a, r, minr, maxr);
+	if (!ret)
+		ret = count;
+unlock_out:
+	mutex_unlock(&ctx->kdamond_lock);
+out:
+	kfree(kbuf);
+	return ret;
+}
+
+static ssize_t dbgfs_target_ids_read(struct file *file,
+		char __user *buf, size_t count, loff_t *ppos)
+{
+	struct damon_ctx *ctx = file->private_data;
+	struct damon_target *t;
+	char *kbuf;
+	ssize_t len = 0, ret;
+
+	kbuf = kmalloc(count, GFP_KERNEL);
+	if (!kbuf)
+		return -ENOMEM;
+
+	mutex_lock(&ctx->kdamond_lock);
+	damon_for_each_target(t, ctx) {
+		ret = scnprintf(&kbuf[len], count - len, "%d ",
+				pid_vnr((struct pid *)t->id));
+		if (!ret)
+			break;
+		len += ret;
+	}
+	mutex_unlock(&ctx->kdamond_lock);
+	if (len)
+		len += scnprintf(&kbuf[len], count - len, "\n");
+
+	ret = simple_read_from_buffer(buf, count, ppos, kbuf, len);
+	kfree(kbuf);
+	return ret;
+}
+
+/*
+ * Converts a string into an array of unsigned long integers
+ *
+ * Returns an array of unsigned long integers if the conversion success, or
+ * NULL otherwise.
+ */
+static unsigned long *str_to_target_ids(const char *str, ssize_t len,
+					ssize_t *nr_ids)
+{
+	unsigned long *ids;
+	const int max_nr_ids = 32;
+	unsigned long id;
+	int pos = 0, parsed, ret;
+
+	*nr_ids = 0;
+	ids = kmalloc_array(max_nr_ids, sizeof(id), GFP_KERNEL);
+	if (!ids)
+		return NULL;
+	while (*nr_ids < max_nr_ids && pos < len) {
+		ret = sscanf(&str[pos], "%lu%n", &id, &parsed);
+		if (ret != 1)
+			break;
+		pos += parsed;
+		ids[*nr_ids] = id;
+		*nr_ids += 1;
+	}
+
+	return ids;
+}
+
+static void dbgfs_put_pids(unsigned long *ids, int nr_ids)
+{
+	int i;
+
+	for (i = 0; i < nr_ids; i++)
+		put_pid((struct pid *)ids[i]);
+}
+
+/* Drop the pid references held by the current targets */
+static void dbgfs_put_targets(struct damon_ctx *ctx)
+{
+	struct damon_target *t, *next;
+
+	damon_for_each_target_safe(t, next, ctx) {
+		put_pid((struct pid *)t->id);
+		damon_destroy_target(t);
+	}
+}
+
+static ssize_t dbgfs_target_ids_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct damon_ctx *ctx = file->private_data;
+	char *kbuf;
+	unsigned long *targets;
+	ssize_t nr_targets;
+	ssize_t ret;
+	int i;
+
+	kbuf = user_input_str(buf, count, ppos);
+	if (IS_ERR(kbuf))
+		return PTR_ERR(kbuf);
+
+	targets = str_to_target_ids(kbuf, count, &nr_targets);
+	if (!targets) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* Convert pid numbers to referenced 'struct pid' pointers */
+	for (i = 0; i < nr_targets; i++) {
+		targets[i] = (unsigned long)find_get_pid(
+				(int)targets[i]);
+		if (!targets[i]) {
+			dbgfs_put_pids(targets, i);
+			ret = -EINVAL;
+			goto free_targets_out;
+		}
+	}
+
+	mutex_lock(&ctx->kdamond_lock);
+	if (ctx->kdamond) {
+		dbgfs_put_pids(targets, nr_targets);
+		ret = -EBUSY;
+		goto unlock_out;
+	}
+
+	/* remove previously set targets */
+	dbgfs_put_targets(ctx);
+
+	ret = damon_set_targets(ctx, targets, nr_targets);
+	if (ret) {
+		dbgfs_put_pids(targets, nr_targets);
+	} else {
+		ret = count;
+	}
+
+unlock_out:
+	mutex_unlock(&ctx->kdamond_lock);
+free_targets_out:
+	kfree(targets);
+out:
+	kfree(kbuf);
+	return ret;
+}
+
+static ssize_t dbgfs_monitor_on_read(struct file *file,
+		char __user *buf, size_t count, loff_t *ppos)
+{
+	char monitor_on_buf[5];
+	bool monitor_on = damon_nr_running_ctxs() != 0;
+	int len;
+
+	len = scnprintf(monitor_on_buf, 5, monitor_on ? "on\n" : "off\n");
+
+	return simple_read_from_buffer(buf, count, ppos, monitor_on_buf, len);
+}
+
+static ssize_t dbgfs_monitor_on_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	ssize_t ret;
+	char *kbuf;
+
+	kbuf = user_input_str(buf, count, ppos);
+	if (IS_ERR(kbuf))
+		return PTR_ERR(kbuf);
+
+	/* Remove white space */
+	if (sscanf(kbuf, "%s", kbuf) != 1) {
+		kfree(kbuf);
+		return -EINVAL;
+	}
+
+	mutex_lock(&damon_dbgfs_lock);
+	if (!strncmp(kbuf, "on", count)) {
+		if (list_empty(&dbgfs_ctx->adaptive_targets))
+			ret = -EINVAL;
+		else
+			ret = damon_start(&dbgfs_ctx, 1);
+	} else if (!strncmp(kbuf, "off", count)) {
+		ret = damon_stop(&dbgfs_ctx, 1);
+	} else {
+		ret = -EINVAL;
+	}
+	mutex_unlock(&damon_dbgfs_lock);
+
+	if (!ret)
+		ret = count;
+	kfree(kbuf);
+	return ret;
+}
+
+static int dbgfs_regions_show(struct seq_file *m, void *v)
+{
+	unsigned int i;
+
+	mutex_lock(&dbgfs_snapshot_lock);
+	for (i = 0; i < dbgfs_nr_snapshot; i++) {
+		struct dbgfs_region_snapshot *s = &dbgfs_snapshot[i];
+
+		seq_printf(m, "%d %lx %lx %u\n", s->pid, s->start, s->end,
+				s->nr_accesses);
+	}
+	mutex_unlock(&dbgfs_snapshot_lock);
+
+	return 0;
+}
+
+static int dbgfs_regions_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dbgfs_regions_show, NULL);
+}
+
+/*
+ * Take a snapshot of the regions for the 'regions' file.  Called by kdamond
+ * right before the access counts are reset, so the results are stable.
+ */
+static int dbgfs_after_aggregation(struct damon_ctx *ctx)
+{
+	struct dbgfs_region_snapshot *snap;
+	struct damon_target *t;
+	struct damon_region *r;
+	unsigned int nr = 0, i = 0;
+
+	damon_for_each_target(t, ctx)
+		nr += damon_nr_regions(t);
+
+	mutex_lock(&dbgfs_snapshot_lock);
+	snap = krealloc(dbgfs_snapshot, nr * sizeof(*snap), GFP_KERNEL);
+	if (!snap && nr) {
+		dbgfs_nr_snapshot = 0;
+		goto out;
+	}
+	dbgfs_snapshot = snap;
+
+	damon_for_each_target(t, ctx) {
+		pid_t pid = pid_vnr((struct pid *)t->id);
+
+		damon_for_each_region(r, t) {
+			snap[i].pid = pid;
+			snap[i].start = r->ar.start;
+			snap[i].end = r->ar.end;
+			snap[i].nr_accesses = r->nr_accesses;
+			i++;
+		}
+	}
+	dbgfs_nr_snapshot = i;
+out:
+	mutex_unlock(&dbgfs_snapshot_lock);
+	return 0;
+}
+
+static int damon_dbgfs_open(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+
+	return nonseekable_open(inode, file);
+}
+
+static const struct file_operations attrs_fops = {
+	.open = damon_dbgfs_open,
+	.read = dbgfs_attrs_read,
+	.write = dbgfs_attrs_write,
+};
+
+static const struct file_operations target_ids_fops = {
+	.open = damon_dbgfs_open,
+	.read = dbgfs_target_ids_read,
+	.write = dbgfs_target_ids_write,
+};
+
+static const struct file_operations monitor_on_fops = {
+	.read = dbgfs_monitor_on_read,
+	.write = dbgfs_monitor_on_write,
+};
+
+static const struct file_operations regions_fops = {
+	.open = dbgfs_regions_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init damon_dbgfs_init(void)
+{
+	dbgfs_ctx = damon_new_ctx();
+	if (!dbgfs_ctx)
+		return -ENOMEM;
+	damon_va_set_primitives(dbgfs_ctx);
+	dbgfs_ctx->callback.after_aggregation = dbgfs_after_aggregation;
+
+	dbgfs_root = debugfs_create_dir("damon", NULL);
+	if (IS_ERR_OR_NULL(dbgfs_root)) {
+		pr_err("failed to create the debugfs dir\n");
+		damon_destroy_ctx(dbgfs_ctx);
+		dbgfs_ctx = NULL;
+		return -ENOMEM;
+	}
+
+	debugfs_create_file("attrs", 0600, dbgfs_root, dbgfs_ctx,
+			&attrs_fops);
+	debugfs_create_file("target_ids", 0600, dbgfs_root, dbgfs_ctx,
+			&target_ids_fops);
+	debugfs_create_file("monitor_on", 0600, dbgfs_root, NULL,
+			&monitor_on_fops);
+	debugfs_create_file("regions", 0400, dbgfs_root, NULL,
+			&regions_fops);
+
+	return 0;
+}
+
+module_init(damon_dbgfs_init);
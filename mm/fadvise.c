@@ -19,6 +19,7 @@
 #include <linux/writeback.h>
 #include <linux/syscalls.h>
 #include <linux/swap.h>
+#include <linux/page_replica.h>
 
 #include <asm/unistd.h>
 
@@ -181,6 +182,31 @@ SYSCALL_DEFINE4(fadvise64_64, int, fd, loff_t, offset, loff_t, len, int, advice)
 			}
 		}
 		break;
+	case FADV_REPLICATE:
+	case FADV_NOREPLICATE:
+		if (!IS_ENABLED(CONFIG_PAGECACHE_REPLICATION) ||
+		    !S_ISREG(inode->i_mode)) {
+			ret = -EINVAL;
+			break;
+		}
+		/*
+		 * The flag sticks to the inode and the replicas aren't
+		 * charged to anyone: a reader of a shared file must not be
+		 * able to turn it on, nor off for everybody else.
+		 */
+		if (!inode_owner_or_capable(inode) &&
+		    !capable(CAP_SYS_ADMIN)) {
+			ret = -EPERM;
+			break;
+		}
+		/* Both apply to the whole file */
+		if (advice == FADV_REPLICATE) {
+			mapping_set_replicate(mapping);
+		} else {
+			mapping_clear_replicate(mapping);
+			page_replica_invalidate(mapping, 0, -1);
+		}
+		break;
 	default:
 		ret = -EINVAL;
 	}
@@ -36,6 +36,7 @@
 #include <linux/memcontrol.h>
 #include <linux/cleancache.h>
 #include <linux/rmap.h>
+#include <linux/page_replica.h>
 #include "internal.h"
 
 #define CREATE_TRACE_POINTS
@@ -188,6 +189,7 @@ void __delete_from_page_cache(struct page *page, void *shadow)
 	struct address_space *mapping = page->mapping;
 	int nr = hpage_nr_pages(page);
 
+	VM_BUG_ON_PAGE(PageReplica(page), page);
 	trace_mm_filemap_delete_from_page_cache(page);
 	/*
 	 * if we're uptodate, flush out into the cleancache, otherwise
@@ -238,8 +240,9 @@ void __delete_from_page_cache(struct page *page, void *shadow)
 		__mod_node_page_state(page_pgdat(page), NR_SHMEM, -nr);
 		if (PageTransHuge(page))
 			__dec_node_page_state(page, NR_SHMEM_THPS);
-	} else {
-		VM_BUG_ON_PAGE(PageTransHuge(page), page);
+	} else if (PageTransHuge(page)) {
+		__dec_node_page_state(page, NR_FILE_THPS);
+		filemap_nr_thps_dec(mapping);
 	}
 
 	/*
@@ -841,10 +844,9 @@ int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 		 * get overwritten with something else, is a waste of memory.
 		 */
 		if (!(gfp_mask & __GFP_WRITE) &&
-		    shadow && workingset_refault(shadow)) {
+		    shadow && workingset_refault(page, shadow))
 			SetPageActive(page);
-			workingset_activation(page);
-		} else
+		else
 			ClearPageActive(page);
 		lru_cache_add(page);
 	}
@@ -902,19 +904,6 @@ void __init pagecache_init(void)
 	page_writeback_init();
 }
 
-/* This has the same layout as wait_bit_key - see fs/cachefiles/rdwr.c */
-struct wait_page_key {
-	struct page *page;
-	int bit_nr;
-	int page_match;
-};
-
-struct wait_page_queue {
-	struct page *page;
-	int bit_nr;
-	wait_queue_entry_t wait;
-};
-
 static int wake_page_function(wait_queue_entry_t *wait, unsigned mode, int sync, void *arg)
 {
 	struct wait_page_key *key = arg;
@@ -1065,6 +1054,56 @@ int wait_on_page_bit_killable(struct page *page, int bit_nr)
 	return wait_on_page_bit_common(q, page, bit_nr, TASK_KILLABLE, false);
 }
 
+/*
+ * Queue @wait for PG_locked on @page instead of sleeping, unless the page
+ * can be had right now (@lock: trylock succeeded, else: page unlocked).
+ * The check is made under the waitqueue lock, so an unlock racing with
+ * us either sees our entry or is seen by the check.
+ */
+static int __wait_on_page_locked_async(struct page *page,
+				       struct wait_page_queue *wait, bool lock)
+{
+	wait_queue_head_t *q = page_waitqueue(page);
+	int ret;
+
+	wait->page = page;
+	wait->bit_nr = PG_locked;
+
+	spin_lock_irq(&q->lock);
+	__add_wait_queue_entry_tail(q, &wait->wait);
+	SetPageWaiters(page);
+	if (lock)
+		ret = !trylock_page(page);
+	else
+		ret = PageLocked(page);
+	/*
+	 * Still under the lock: if we got the page, nobody can have called
+	 * the wake function yet, so just take the entry off again.
+	 */
+	if (!ret)
+		__remove_wait_queue(q, &wait->wait);
+	else
+		ret = -EIOCBQUEUED;
+	spin_unlock_irq(&q->lock);
+	return ret;
+}
+
+/**
+ * wait_on_page_locked_async - wait for a page to be unlocked, asynchronously
+ * @page: the page to wait on
+ * @wait: waitqueue entry to queue, with its wake function set by the caller
+ *
+ * Returns 0 if @page is unlocked, or -EIOCBQUEUED if @wait was queued and
+ * its wake function will be called when @page is unlocked.
+ */
+int wait_on_page_locked_async(struct page *page, struct wait_page_queue *wait)
+{
+	if (!PageLocked(page))
+		return 0;
+	return __wait_on_page_locked_async(compound_head(page), wait, false);
+}
+EXPORT_SYMBOL_GPL(wait_on_page_locked_async);
+
 /**
  * add_page_wait_queue - Add an arbitrary waiter to a page's wait queue
  * @page: Page defining the wait queue of interest
@@ -1206,6 +1245,12 @@ int __lock_page_killable(struct page *__page)
 }
 EXPORT_SYMBOL_GPL(__lock_page_killable);
 
+int __lock_page_async(struct page *page, struct wait_page_queue *wait)
+{
+	return __wait_on_page_locked_async(compound_head(page), wait, true);
+}
+EXPORT_SYMBOL_GPL(__lock_page_async);
+
 /*
  * Return values:
  * 1 - page is locked; mmap_sem is still held.
@@ -1479,12 +1524,12 @@ struct page *pagecache_get_page(struct address_space *mapping, pgoff_t offset,
 		}
 
 		/* Has the page been truncated? */
-		if (unlikely(page->mapping != mapping)) {
+		if (unlikely(compound_head(page)->mapping != mapping)) {
 			unlock_page(page);
 			put_page(page);
 			goto repeat;
 		}
-		VM_BUG_ON_PAGE(page->index != offset, page);
+		VM_BUG_ON_PAGE(page_to_pgoff(page) != offset, page);
 	}
 
 	if (page && (fgp_flags & FGP_ACCESSED))
@@ -2023,7 +2068,17 @@ static ssize_t generic_file_buffered_read(struct kiocb *iocb,
 			 * wait_on_page_locked is used to avoid unnecessarily
 			 * serialisations and why it's safe.
 			 */
-			error = wait_on_page_locked_killable(page);
+			if (iocb->ki_flags & IOCB_WAITQ) {
+				/* Hand back what we have before queueing */
+				if (written) {
+					put_page(page);
+					goto out;
+				}
+				error = wait_on_page_locked_async(page,
+								iocb->ki_waitq);
+			} else {
+				error = wait_on_page_locked_killable(page);
+			}
 			if (unlikely(error))
 				goto readpage_error;
 			if (PageUptodate(page))
@@ -2111,7 +2166,15 @@ static ssize_t generic_file_buffered_read(struct kiocb *iocb,
 
 page_not_up_to_date:
 		/* Get exclusive access to the page ... */
-		error = lock_page_killable(page);
+		if (iocb->ki_flags & IOCB_WAITQ) {
+			if (written) {
+				put_page(page);
+				goto out;
+			}
+			error = lock_page_async(page, iocb->ki_waitq);
+		} else {
+			error = lock_page_killable(page);
+		}
 		if (unlikely(error))
 			goto readpage_error;
 
@@ -2149,7 +2212,15 @@ static ssize_t generic_file_buffered_read(struct kiocb *iocb,
 		}
 
 		if (!PageUptodate(page)) {
-			error = lock_page_killable(page);
+			if (iocb->ki_flags & IOCB_WAITQ) {
+				if (written) {
+					put_page(page);
+					goto out;
+				}
+				error = lock_page_async(page, iocb->ki_waitq);
+			} else {
+				error = lock_page_killable(page);
+			}
 			if (unlikely(error))
 				goto readpage_error;
 			if (!PageUptodate(page)) {
@@ -2444,12 +2515,12 @@ int filemap_fault(struct vm_fault *vmf)
 	}
 
 	/* Did it get truncated? */
-	if (unlikely(page->mapping != mapping)) {
+	if (unlikely(compound_head(page)->mapping != mapping)) {
 		unlock_page(page);
 		put_page(page);
 		goto retry_find;
 	}
-	VM_BUG_ON_PAGE(page->index != offset, page);
+	VM_BUG_ON_PAGE(page_to_pgoff(page) != offset, page);
 
 	/*
 	 * We have a locked page in the page cache, now we need to check
@@ -2469,7 +2540,7 @@ int filemap_fault(struct vm_fault *vmf)
 		return VM_FAULT_SIGBUS;
 	}
 
-	vmf->page = page;
+	vmf->page = page_replica_fault(vmf, page);
 	return ret | VM_FAULT_LOCKED;
 
 no_cached_page:
@@ -2572,16 +2643,22 @@ void filemap_map_pages(struct vm_fault *vmf,
 		if (!trylock_page(page))
 			goto skip;
 
-		if (page->mapping != mapping || !PageUptodate(page))
+		/* A tail page of a file THP: its head has the mapping */
+		if (head->mapping != mapping || !PageUptodate(page))
 			goto unlock;
 
 		max_idx = DIV_ROUND_UP(i_size_read(mapping->host), PAGE_SIZE);
-		if (page->index >= max_idx)
+		if (iter.index >= max_idx)
 			goto unlock;
 
 		if (file->f_ra.mmap_miss > 0)
 			file->f_ra.mmap_miss--;
 
+		/* Map the copy on this node instead, or let the fault make one */
+		page = page_replica_map(vmf, page);
+		if (!page)
+			goto next;
+
 		vmf->address += (iter.index - last_pgoff) << PAGE_SHIFT;
 		if (vmf->pte)
 			vmf->pte += iter.index - last_pgoff;
@@ -2596,7 +2673,8 @@ void filemap_map_pages(struct vm_fault *vmf,
 		put_page(page);
 next:
 		/* Huge page is mapped? No need to proceed. */
-		if (pmd_trans_huge(*vmf->pmd))
+		if (!(vmf->flags & FAULT_FLAG_SPECULATIVE) &&
+		    pmd_trans_huge(*vmf->pmd))
 			break;
 		if (iter.index == end_pgoff)
 			break;
@@ -263,6 +263,9 @@ static struct page *follow_pmd_mask(struct vm_area_struct *vma,
 		if (page)
 			return page;
 	}
+	/* Writing to a PTE table shared with a forked mm has to copy it */
+	if ((flags & FOLL_WRITE) && pmd_cow_table(*pmd))
+		return no_page_table(vma, flags);
 	if (likely(!pmd_trans_huge(*pmd)))
 		return follow_page_pte(vma, address, pmd, flags);
 
@@ -1707,6 +1710,9 @@ static int gup_pmd_range(pud_t pud, unsigned long addr, unsigned long end,
 			if (!gup_huge_pd(__hugepd(pmd_val(pmd)), addr,
 					 PMD_SHIFT, next, write, pages, nr))
 				return 0;
+		} else if (write && pmd_cow_table(pmd)) {
+			/* The slow path copies tables shared after fork */
+			return 0;
 		} else if (!gup_pte_range(pmd, addr, next, write, pages, nr))
 				return 0;
 	} while (pmdp++, addr = next, addr != end);
@@ -25,6 +25,8 @@
 #include <linux/swap.h>
 #include <linux/swapops.h>
 #include <linux/jhash.h>
+#include <linux/llist.h>
+#include <linux/workqueue.h>
 
 #include <asm/page.h>
 #include <asm/pgtable.h>
@@ -36,6 +38,7 @@
 #include <linux/node.h>
 #include <linux/userfaultfd_k.h>
 #include "internal.h"
+#include "hugetlb_vmemmap.h"
 
 int hugepages_treat_as_movable;
 
@@ -1212,16 +1215,11 @@ static inline int alloc_fresh_gigantic_page(struct hstate *h,
 					nodemask_t *nodes_allowed) { return 0; }
 #endif
 
-static void update_and_free_page(struct hstate *h, struct page *page)
+static void __update_and_free_page(struct hstate *h, struct page *page)
 {
 	int i;
 	struct page *subpage = page;
 
-	if (hstate_is_gigantic(h) && !gigantic_page_supported())
-		return;
-
-	h->nr_huge_pages--;
-	h->nr_huge_pages_node[page_to_nid(page)]--;
 	for (i = 0; i < pages_per_huge_page(h);
 	     i++, subpage = mem_map_next(subpage, page, i)) {
 		subpage->flags &= ~(1 << PG_locked | 1 << PG_error |
@@ -1240,6 +1238,71 @@ static void update_and_free_page(struct hstate *h, struct page *page)
 	}
 }
 
+/*
+ * A page whose vmemmap has been freed needs it allocated again before it
+ * can go back to the buddy allocator.  That may sleep, while
+ * update_and_free_page() is called under hugetlb_lock, so such pages are
+ * handed to a worker.  page->mapping of the head page links them up.
+ */
+static LLIST_HEAD(hpage_freelist);
+
+static void free_hpage_workfn(struct work_struct *work)
+{
+	struct llist_node *node;
+
+	node = llist_del_all(&hpage_freelist);
+	while (node) {
+		struct page *page;
+		struct hstate *h;
+		int nid;
+
+		page = container_of((struct address_space **)node,
+				    struct page, mapping);
+		node = node->next;
+		page->mapping = NULL;
+		h = page_hstate(page);
+		nid = page_to_nid(page);
+
+		if (alloc_huge_page_vmemmap(h, page)) {
+			/*
+			 * Out of memory: keep the page in the pool as a
+			 * surplus page, it will be retried when the surplus
+			 * is shrunk.
+			 */
+			spin_lock(&hugetlb_lock);
+			h->nr_huge_pages++;
+			h->nr_huge_pages_node[nid]++;
+			h->surplus_huge_pages++;
+			h->surplus_huge_pages_node[nid]++;
+			INIT_LIST_HEAD(&page->lru);
+			enqueue_huge_page(h, page);
+			spin_unlock(&hugetlb_lock);
+		} else {
+			__update_and_free_page(h, page);
+		}
+		cond_resched();
+	}
+}
+static DECLARE_WORK(free_hpage_work, free_hpage_workfn);
+
+static void update_and_free_page(struct hstate *h, struct page *page)
+{
+	if (hstate_is_gigantic(h) && !gigantic_page_supported())
+		return;
+
+	h->nr_huge_pages--;
+	h->nr_huge_pages_node[page_to_nid(page)]--;
+
+	if (PageHugeVmemmapFreed(page)) {
+		if (llist_add((struct llist_node *)&page->mapping,
+			      &hpage_freelist))
+			schedule_work(&free_hpage_work);
+		return;
+	}
+
+	__update_and_free_page(h, page);
+}
+
 struct hstate *size_to_hstate(unsigned long size)
 {
 	struct hstate *h;
@@ -1335,6 +1398,7 @@ void free_huge_page(struct page *page)
 
 static void prep_new_huge_page(struct hstate *h, struct page *page, int nid)
 {
+	free_huge_page_vmemmap(h, page);
 	INIT_LIST_HEAD(&page->lru);
 	set_compound_page_dtor(page, HUGETLB_PAGE_DTOR);
 	spin_lock(&hugetlb_lock);
@@ -1532,6 +1596,28 @@ int dissolve_free_huge_page(struct page *page)
 			goto retry;
 		}
 
+		list_del(&head->lru);
+		h->free_huge_pages--;
+		h->free_huge_pages_node[nid]--;
+		h->max_huge_pages--;
+
+		/*
+		 * The tail struct pages are about to be written to, so the
+		 * vmemmap has to be restored first.
+		 */
+		if (PageHugeVmemmapFreed(head)) {
+			ClearPageHugeFreed(head);
+			spin_unlock(&hugetlb_lock);
+			rc = alloc_huge_page_vmemmap(h, head);
+			spin_lock(&hugetlb_lock);
+			if (rc) {
+				h->max_huge_pages++;
+				INIT_LIST_HEAD(&head->lru);
+				enqueue_huge_page(h, head);
+				goto out;
+			}
+		}
+
 		/*
 		 * Move PageHWPoison flag from head page to the raw error page,
 		 * which makes any subpages rather than the error page reusable.
@@ -1540,10 +1626,6 @@ int dissolve_free_huge_page(struct page *page)
 			SetPageHWPoison(page);
 			ClearPageHWPoison(head);
 		}
-		list_del(&head->lru);
-		h->free_huge_pages--;
-		h->free_huge_pages_node[nid]--;
-		h->max_huge_pages--;
 		update_and_free_page(h, head);
 	}
 out:
@@ -1634,6 +1716,8 @@ static struct page *__alloc_buddy_huge_page(struct hstate *h, gfp_t gfp_mask,
 	spin_unlock(&hugetlb_lock);
 
 	page = __hugetlb_alloc_buddy_huge_page(h, gfp_mask, nid, nmask);
+	if (page)
+		free_huge_page_vmemmap(h, page);
 
 	spin_lock(&hugetlb_lock);
 	if (page) {
@@ -2892,6 +2976,7 @@ void __init hugetlb_add_hstate(unsigned int order)
 	h->next_nid_to_free = first_memory_node;
 	snprintf(h->name, HSTATE_NAME_LEN, "hugepages-%lukB",
 					huge_page_size(h)/1024);
+	hugetlb_vmemmap_init(h);
 
 	parsed_hstate = h;
 }
@@ -3061,6 +3146,7 @@ void hugetlb_report_meminfo(struct seq_file *m)
 			h->resv_huge_pages,
 			h->surplus_huge_pages,
 			1UL << (huge_page_order(h) + PAGE_SHIFT - 10));
+	hugetlb_vmemmap_report_meminfo(m);
 }
 
 int hugetlb_report_node_meminfo(int nid, char *buf)
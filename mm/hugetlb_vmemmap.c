@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Free some vmemmap pages of HugeTLB
+ *
+ * A HugeTLB page is described by pages_per_huge_page() struct pages, but
+ * only the first few carry any information: the head page and the first
+ * tail pages hold the compound and HugeTLB metadata, and every other tail
+ * page just points back to the head.  With 64 byte struct pages, the
+ * vmemmap of a 2MB HugeTLB page spans 8 pages and that of a 1GB page 4096.
+ *
+ * While a page is owned by HugeTLB, the first RESERVE_VMEMMAP_NR pages of
+ * its vmemmap are kept, and the rest is remapped read-only onto the last
+ * reserved page (which holds nothing but tail struct pages, identical to
+ * the ones being remapped) and freed:
+ *
+ *    HugeTLB                  struct pages(8 pages)         page frame(8 pages)
+ * +-----------+ ---virt_to_page---> +-----------+   mapping to   +-----------+
+ * |           |                     |     0     | -------------> |     0     |
+ * |           |                     +-----------+                +-----------+
+ * |           |                     |     1     | -------------> |     1     |
+ * |           |                     +-----------+                +-----------+
+ * |           |                     |     2     | ----------------^ ^ ^ ^ ^ ^
+ * |           |                     +-----------+                   | | | | |
+ * |           |                     |     3     | ------------------+ | | | |
+ * |           |                     +-----------+                     | | | |
+ * |           |                     |     4     | --------------------+ | | |
+ * |    2MB    |                     +-----------+                       | | |
+ * |           |                     |     5     | ----------------------+ | |
+ * |           |                     +-----------+                         | |
+ * |           |                     |     6     | ------------------------+ |
+ * |           |                     +-----------+                           |
+ * |           |                     |     7     | --------------------------+
+ * |           |                     +-----------+
+ * +-----------+
+ *
+ * When the page is freed back to the buddy allocator, the vmemmap pages are
+ * allocated again and the mapping restored.
+ */
+#define pr_fmt(fmt)	"HugeTLB: " fmt
+
+#include <linux/log2.h>
+#include <linux/seq_file.h>
+#include "hugetlb_vmemmap.h"
+
+/* Number of vmemmap pages kept for the head and the metadata tail pages */
+#define RESERVE_VMEMMAP_NR		2U
+#define RESERVE_VMEMMAP_SIZE		(RESERVE_VMEMMAP_NR << PAGE_SHIFT)
+
+#define GFP_VMEMMAP_PAGE		\
+	(GFP_KERNEL | __GFP_RETRY_MAYFAIL | __GFP_NOWARN | __GFP_THISNODE)
+
+bool hugetlb_free_vmemmap_enabled __read_mostly =
+	IS_ENABLED(CONFIG_HUGETLB_PAGE_FREE_VMEMMAP_DEFAULT_ON);
+
+/* Number of vmemmap pages currently freed, for /proc/meminfo */
+static atomic_long_t hugetlb_vmemmap_freed = ATOMIC_LONG_INIT(0);
+
+static int __init early_hugetlb_free_vmemmap_param(char *buf)
+{
+	if (!buf)
+		return -EINVAL;
+
+	if (!strcmp(buf, "on"))
+		hugetlb_free_vmemmap_enabled = true;
+	else if (!strcmp(buf, "off"))
+		hugetlb_free_vmemmap_enabled = false;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+early_param("hugetlb_free_vmemmap", early_hugetlb_free_vmemmap_param);
+
+static inline void SetPageHugeVmemmapFreed(struct page *head)
+{
+	set_page_private(head + 3, -1UL);
+}
+
+static inline void ClearPageHugeVmemmapFreed(struct page *head)
+{
+	set_page_private(head + 3, 0);
+}
+
+static inline unsigned long free_vmemmap_pages_size_per_hpage(struct hstate *h)
+{
+	return (unsigned long)h->nr_free_vmemmap_pages << PAGE_SHIFT;
+}
+
+/*
+ * Allocate the freed vmemmap pages of @head back.  Must be called before
+ * the struct pages of @head are written to.
+ *
+ * Return: 0 on success, -ENOMEM if the pages could not be allocated.
+ */
+int alloc_huge_page_vmemmap(struct hstate *h, struct page *head)
+{
+	unsigned long vmemmap_addr = (unsigned long)head;
+	unsigned long vmemmap_end, vmemmap_reuse;
+	int ret;
+
+	if (!PageHugeVmemmapFreed(head))
+		return 0;
+
+	vmemmap_addr += RESERVE_VMEMMAP_SIZE;
+	vmemmap_end = vmemmap_addr + free_vmemmap_pages_size_per_hpage(h);
+	vmemmap_reuse = vmemmap_addr - PAGE_SIZE;
+
+	ret = vmemmap_remap_alloc(vmemmap_addr, vmemmap_end, vmemmap_reuse,
+				  GFP_VMEMMAP_PAGE);
+	if (!ret) {
+		ClearPageHugeVmemmapFreed(head);
+		atomic_long_sub(h->nr_free_vmemmap_pages,
+				&hugetlb_vmemmap_freed);
+	}
+
+	return ret;
+}
+
+/* Free the tail vmemmap pages of a freshly allocated HugeTLB page */
+void free_huge_page_vmemmap(struct hstate *h, struct page *head)
+{
+	unsigned long vmemmap_addr = (unsigned long)head;
+	unsigned long vmemmap_end, vmemmap_reuse;
+
+	ClearPageHugeVmemmapFreed(head);
+	if (!h->nr_free_vmemmap_pages)
+		return;
+
+	vmemmap_addr += RESERVE_VMEMMAP_SIZE;
+	vmemmap_end = vmemmap_addr + free_vmemmap_pages_size_per_hpage(h);
+	vmemmap_reuse = vmemmap_addr - PAGE_SIZE;
+
+	if (vmemmap_remap_free(vmemmap_addr, vmemmap_end, vmemmap_reuse))
+		return;
+
+	SetPageHugeVmemmapFreed(head);
+	atomic_long_add(h->nr_free_vmemmap_pages, &hugetlb_vmemmap_freed);
+}
+
+void __init hugetlb_vmemmap_init(struct hstate *h)
+{
+	unsigned int nr_pages = pages_per_huge_page(h);
+	unsigned int vmemmap_pages;
+
+	if (!hugetlb_free_vmemmap_enabled)
+		return;
+
+	/* The tail struct pages must not straddle vmemmap pages. */
+	if (!is_power_of_2(sizeof(struct page))) {
+		pr_warn_once("cannot free vmemmap pages because \"struct page\" crosses page boundaries\n");
+		return;
+	}
+
+	vmemmap_pages = (nr_pages * sizeof(struct page)) >> PAGE_SHIFT;
+	if (vmemmap_pages > RESERVE_VMEMMAP_NR)
+		h->nr_free_vmemmap_pages = vmemmap_pages - RESERVE_VMEMMAP_NR;
+
+	pr_info("can free %d vmemmap pages for %s\n",
+		h->nr_free_vmemmap_pages, h->name);
+}
+
+void hugetlb_vmemmap_report_meminfo(struct seq_file *m)
+{
+	seq_printf(m, "HugetlbVmemmapFreed: %8lu kB\n",
+		   atomic_long_read(&hugetlb_vmemmap_freed) << (PAGE_SHIFT - 10));
+}
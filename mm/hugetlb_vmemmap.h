@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Free some vmemmap pages of HugeTLB
+ */
+#ifndef _LINUX_HUGETLB_VMEMMAP_H
+#define _LINUX_HUGETLB_VMEMMAP_H
+#include <linux/hugetlb.h>
+
+#ifdef CONFIG_HUGETLB_PAGE_FREE_VMEMMAP
+/*
+ * The fourth struct page of a HugeTLB page records whether its vmemmap has
+ * been freed.  It lives in the reserved part of the vmemmap, so it stays
+ * writable.
+ */
+static inline bool PageHugeVmemmapFreed(struct page *head)
+{
+	return page_private(head + 3) == -1UL;
+}
+
+int alloc_huge_page_vmemmap(struct hstate *h, struct page *head);
+void free_huge_page_vmemmap(struct hstate *h, struct page *head);
+void hugetlb_vmemmap_init(struct hstate *h);
+void hugetlb_vmemmap_report_meminfo(struct seq_file *m);
+#else
+static inline bool PageHugeVmemmapFreed(struct page *head)
+{
+	return false;
+}
+
+static inline int alloc_huge_page_vmemmap(struct hstate *h, struct page *head)
+{
+	return 0;
+}
+
+static inline void free_huge_page_vmemmap(struct hstate *h, struct page *head)
+{
+}
+
+static inline void hugetlb_vmemmap_init(struct hstate *h)
+{
+}
+
+static inline void hugetlb_vmemmap_report_meminfo(struct seq_file *m)
+{
+}
+#endif /* CONFIG_HUGETLB_PAGE_FREE_VMEMMAP */
+#endif /* _LINUX_HUGETLB_VMEMMAP_H */
@@ -42,6 +42,7 @@ enum scan_result {
 	SCAN_PMD_NULL,
 	SCAN_EXCEED_NONE_PTE,
 	SCAN_PTE_NON_PRESENT,
+	SCAN_PTE_UFFD_WP,
 	SCAN_PAGE_RO,
 	SCAN_LACK_REFERENCED_PAGE,
 	SCAN_PAGE_NULL,
@@ -61,6 +62,7 @@ enum scan_result {
 	SCAN_CGROUP_CHARGE_FAIL,
 	SCAN_EXCEED_SWAP_PTE,
 	SCAN_TRUNCATED,
+	SCAN_PAGE_HAS_PRIVATE,
 };
 
 #define CREATE_TRACE_POINTS
@@ -446,18 +448,20 @@ int __khugepaged_enter(struct mm_struct *mm)
 	return 0;
 }
 
+static bool hugepage_vma_check(struct vm_area_struct *vma,
+			       unsigned long vm_flags);
+
 int khugepaged_enter_vma_merge(struct vm_area_struct *vma,
 			       unsigned long vm_flags)
 {
 	unsigned long hstart, hend;
-	if (!vma->anon_vma)
-		/*
-		 * Not yet faulted in so we will register later in the
-		 * page fault if needed.
-		 */
-		return 0;
-	if (vma->vm_ops || (vm_flags & VM_NO_KHUGEPAGED))
-		/* khugepaged not yet working on file or special mappings */
+
+	/*
+	 * Anonymous vmas not yet faulted in are registered later in the
+	 * page fault if needed.  Of the file vmas, khugepaged only works
+	 * on shmem and on read-only text of regular files.
+	 */
+	if (!hugepage_vma_check(vma, vm_flags))
 		return 0;
 	hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
 	hend = vma->vm_end & HPAGE_PMD_MASK;
@@ -847,13 +851,34 @@ khugepaged_alloc_page(struct page **hpage, gfp_t gfp, int node)
 }
 #endif
 
-static bool hugepage_vma_check(struct vm_area_struct *vma)
+/*
+ * Executable text of a regular file that nobody has open for writing.
+ * Its page cache can be collapsed like shmem's: do_dentry_open() drops
+ * it again as soon as somebody opens the file for writing.
+ */
+static bool file_thp_text(struct vm_area_struct *vma, unsigned long vm_flags)
+{
+	struct inode *inode;
+
+	if (!IS_ENABLED(CONFIG_READ_ONLY_THP_FOR_FS) || !vma->vm_file)
+		return false;
+	if ((vm_flags & (VM_EXEC | VM_WRITE | VM_SHARED)) != VM_EXEC)
+		return false;
+	inode = file_inode(vma->vm_file);
+	return S_ISREG(inode->i_mode) && atomic_read(&inode->i_writecount) <= 0;
+}
+
+static bool hugepage_vma_check(struct vm_area_struct *vma,
+			       unsigned long vm_flags)
 {
-	if ((!(vma->vm_flags & VM_HUGEPAGE) && !khugepaged_always()) ||
-	    (vma->vm_flags & VM_NOHUGEPAGE) ||
+	if ((!(vm_flags & VM_HUGEPAGE) && !khugepaged_always()) ||
+	    (vm_flags & VM_NOHUGEPAGE) ||
 	    test_bit(MMF_DISABLE_THP, &vma->vm_mm->flags))
 		return false;
-	if (shmem_file(vma->vm_file)) {
+	/* Special mappings of files must not get huge pages either */
+	if (vm_flags & VM_NO_KHUGEPAGED)
+		return false;
+	if (shmem_file(vma->vm_file) || file_thp_text(vma, vm_flags)) {
 		if (!IS_ENABLED(CONFIG_TRANSPARENT_HUGE_PAGECACHE))
 			return false;
 		return IS_ALIGNED((vma->vm_start >> PAGE_SHIFT) - vma->vm_pgoff,
@@ -861,9 +886,7 @@ static bool hugepage_vma_check(struct vm_area_struct *vma)
 	}
 	if (!vma->anon_vma || vma->vm_ops)
 		return false;
-	if (is_vma_temporary_stack(vma))
-		return false;
-	return !(vma->vm_flags & VM_NO_KHUGEPAGED);
+	return !is_vma_temporary_stack(vma);
 }
 
 /*
@@ -890,7 +913,7 @@ static int hugepage_vma_revalidate(struct mm_struct *mm, unsigned long address,
 	hend = vma->vm_end & HPAGE_PMD_MASK;
 	if (address < hstart || address + HPAGE_PMD_SIZE > hend)
 		return SCAN_ADDRESS_RANGE;
-	if (!hugepage_vma_check(vma))
+	if (!hugepage_vma_check(vma, vma->vm_flags))
 		return SCAN_VMA_CHECK;
 	return 0;
 }
@@ -1041,6 +1064,8 @@ static void collapse_huge_page(struct mm_struct *mm,
 	if (mm_find_pmd(mm, address) != pmd)
 		goto out;
 
+	/* Speculative faults must not race with the pmd being cleared */
+	vm_write_begin(vma);
 	anon_vma_lock_write(vma->anon_vma);
 
 	pte = pte_offset_map(pmd, address);
@@ -1076,6 +1101,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 		 */
 		pmd_populate(mm, pmd, pmd_pgtable(_pmd));
 		spin_unlock(pmd_ptl);
+		vm_write_end(vma);
 		anon_vma_unlock_write(vma->anon_vma);
 		result = SCAN_FAIL;
 		goto out;
@@ -1111,6 +1137,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	set_pmd_at(mm, address, pmd, _pmd);
 	update_mmu_cache_pmd(vma, address, pmd);
 	spin_unlock(pmd_ptl);
+	vm_write_end(vma);
 
 	*hpage = NULL;
 
@@ -1155,6 +1182,15 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		pte_t pteval = *_pte;
 		if (is_swap_pte(pteval)) {
 			if (++unmapped <= khugepaged_max_ptes_swap) {
+				/*
+				 * Always be strict with uffd-wp enabled swap
+				 * entries.  Please see comment below for
+				 * pte_uffd_wp().
+				 */
+				if (pte_swp_uffd_wp(pteval)) {
+					result = SCAN_PTE_UFFD_WP;
+					goto out_unmap;
+				}
 				continue;
 			} else {
 				result = SCAN_EXCEED_SWAP_PTE;
@@ -1174,6 +1210,16 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 			result = SCAN_PTE_NON_PRESENT;
 			goto out_unmap;
 		}
+		if (pte_uffd_wp(pteval)) {
+			/*
+			 * Don't collapse the page if any of the small
+			 * PTEs are armed with uffd write protection:
+			 * the huge pmd cannot carry the per-pte
+			 * protection and it would be lost.
+			 */
+			result = SCAN_PTE_UFFD_WP;
+			goto out_unmap;
+		}
 		if (pte_write(pteval))
 			writable = true;
 
@@ -1287,6 +1333,9 @@ static void retract_page_tables(struct address_space *mapping, pgoff_t pgoff)
 		/* probably overkill */
 		if (vma->anon_vma)
 			continue;
+		/* Shared PTE tables are only detached by zapping */
+		if (vma->vm_flags & VM_SHARED_PT)
+			continue;
 		addr = vma->vm_start + ((pgoff - vma->vm_pgoff) << PAGE_SHIFT);
 		if (addr & ~HPAGE_PMD_MASK)
 			continue;
@@ -1309,12 +1358,22 @@ static void retract_page_tables(struct address_space *mapping, pgoff_t pgoff)
 
 				mmu_notifier_invalidate_range_start(mm, addr,
 								    end);
+				vm_write_begin(vma);
 				ptl = pmd_lock(mm, pmd);
 				/* assume page table is clear */
 				_pmd = pmdp_collapse_flush(vma, addr, pmd);
 				spin_unlock(ptl);
+				vm_write_end(vma);
 				atomic_long_dec(&mm->nr_ptes);
 				tlb_remove_table_sync_one();
+				/*
+				 * A speculative fault may still hold the pte
+				 * lock it took before the pmd was cleared;
+				 * wait for it to back off before freeing.
+				 */
+				ptl = pte_lockptr(mm, &_pmd);
+				spin_lock(ptl);
+				spin_unlock(ptl);
 				pte_free(mm, pmd_pgtable(_pmd));
 				mmu_notifier_invalidate_range_end(mm, addr,
 								  end);
@@ -1326,13 +1385,14 @@ static void retract_page_tables(struct address_space *mapping, pgoff_t pgoff)
 }
 
 /**
- * collapse_shmem - collapse small tmpfs/shmem pages into huge one.
+ * collapse_file - collapse small tmpfs/shmem or read-only file pages into
+ * huge one.
  *
  * Basic scheme is simple, details are more complex:
  *  - allocate and lock a new huge page;
  *  - scan over radix tree replacing old pages the new one
  *    + swap in pages if necessary;
- *    + fill in gaps;
+ *    + fill in gaps (shmem) or read them in (regular file);
  *    + keep old pages around in case if rollback is required;
  *  - if replacing succeed:
  *    + copy data over;
@@ -1343,10 +1403,11 @@ static void retract_page_tables(struct address_space *mapping, pgoff_t pgoff)
  *    + restore gaps in the radix-tree;
  *    + unlock and free huge page;
  */
-static void collapse_shmem(struct mm_struct *mm,
-		struct address_space *mapping, pgoff_t start,
+static void collapse_file(struct mm_struct *mm,
+		struct file *file, pgoff_t start,
 		struct page **hpage, int node)
 {
+	struct address_space *mapping = file->f_mapping;
 	gfp_t gfp;
 	struct page *page, *new_page, *tmp;
 	struct mem_cgroup *memcg;
@@ -1355,7 +1416,9 @@ static void collapse_shmem(struct mm_struct *mm,
 	struct radix_tree_iter iter;
 	void **slot;
 	int nr_none = 0, result = SCAN_SUCCEED;
+	bool is_shmem = shmem_file(file);
 
+	VM_BUG_ON(!IS_ENABLED(CONFIG_READ_ONLY_THP_FOR_FS) && !is_shmem);
 	VM_BUG_ON(start & (HPAGE_PMD_NR - 1));
 
 	/* Only allocate from the target node */
@@ -1374,8 +1437,19 @@ static void collapse_shmem(struct mm_struct *mm,
 		goto out;
 	}
 
+	/*
+	 * There is nothing to fill the holes of a regular file with: read
+	 * them in now, the pages are waited for below.
+	 */
+	if (!is_shmem) {
+		force_page_cache_readahead(mapping, file, start, HPAGE_PMD_NR);
+		/* drain pagevecs to help isolate_lru_page() */
+		lru_add_drain();
+	}
+
 	__SetPageLocked(new_page);
-	__SetPageSwapBacked(new_page);
+	if (is_shmem)
+		__SetPageSwapBacked(new_page);
 	new_page->index = start;
 	new_page->mapping = mapping;
 
@@ -1403,8 +1477,9 @@ static void collapse_shmem(struct mm_struct *mm,
 		/*
 		 * Handle holes in the radix tree: charge it from shmem and
 		 * insert relevant subpage of new_page into the radix-tree.
+		 * A regular file must not have any left after the readahead.
 		 */
-		if (n && !shmem_charge(mapping->host, n)) {
+		if (n && (!is_shmem || !shmem_charge(mapping->host, n))) {
 			result = SCAN_FAIL;
 			goto tree_locked;
 		}
@@ -1420,7 +1495,20 @@ static void collapse_shmem(struct mm_struct *mm,
 
 		page = radix_tree_deref_slot_protected(slot,
 				&mapping->tree_lock);
-		if (radix_tree_exceptional_entry(page) || !PageUptodate(page)) {
+		if (!is_shmem) {
+			spin_unlock_irq(&mapping->tree_lock);
+			/* wait for the readahead, the page may be under I/O */
+			page = find_lock_page(mapping, index);
+			if (!page) {
+				result = SCAN_FAIL;
+				goto tree_unlocked;
+			}
+			if (!PageUptodate(page)) {
+				result = SCAN_FAIL;
+				goto out_unlock;
+			}
+		} else if (radix_tree_exceptional_entry(page) ||
+			   !PageUptodate(page)) {
 			spin_unlock_irq(&mapping->tree_lock);
 			/* swap in or instantiate fallocated page */
 			if (shmem_getpage(mapping->host, index, &page,
@@ -1457,11 +1545,29 @@ static void collapse_shmem(struct mm_struct *mm,
 			goto out_unlock;
 		}
 
+		/*
+		 * Nobody has the file open for writing, so a dirty page has
+		 * just not been written back since it was.  Start that now
+		 * and retry on the next scan.
+		 */
+		if (!is_shmem && (PageDirty(page) || PageWriteback(page))) {
+			filemap_flush(mapping);
+			result = SCAN_FAIL;
+			goto out_unlock;
+		}
+
 		if (isolate_lru_page(page)) {
 			result = SCAN_DEL_PAGE_LRU;
 			goto out_unlock;
 		}
 
+		if (page_has_private(page) &&
+		    !try_to_release_page(page, GFP_KERNEL)) {
+			result = SCAN_PAGE_HAS_PRIVATE;
+			putback_lru_page(page);
+			goto out_unlock;
+		}
+
 		if (page_mapped(page))
 			unmap_mapping_range(mapping, index << PAGE_SHIFT,
 					PAGE_SIZE, 0);
@@ -1518,7 +1624,7 @@ static void collapse_shmem(struct mm_struct *mm,
 			result = SCAN_TRUNCATED;
 			goto tree_locked;
 		}
-		if (!shmem_charge(mapping->host, n)) {
+		if (!is_shmem || !shmem_charge(mapping->host, n)) {
 			result = SCAN_FAIL;
 			goto tree_locked;
 		}
@@ -1529,7 +1635,24 @@ static void collapse_shmem(struct mm_struct *mm,
 		nr_none += n;
 	}
 
-	__inc_node_page_state(new_page, NR_SHMEM_THPS);
+	if (is_shmem) {
+		__inc_node_page_state(new_page, NR_SHMEM_THPS);
+	} else {
+		__inc_node_page_state(new_page, NR_FILE_THPS);
+		filemap_nr_thps_inc(mapping);
+		/*
+		 * Paired with the smp_mb() in do_dentry_open(): either it
+		 * sees nr_thps and drops the page cache, or we see that the
+		 * file got opened for writing and back off.
+		 */
+		smp_mb();
+		if (atomic_read(&mapping->host->i_writecount) > 0) {
+			result = SCAN_FAIL;
+			__dec_node_page_state(new_page, NR_FILE_THPS);
+			filemap_nr_thps_dec(mapping);
+			goto tree_locked;
+		}
+	}
 	if (nr_none) {
 		struct zone *zone = page_zone(new_page);
 
@@ -1570,9 +1693,14 @@ static void collapse_shmem(struct mm_struct *mm,
 
 		SetPageUptodate(new_page);
 		page_ref_add(new_page, HPAGE_PMD_NR - 1);
-		set_page_dirty(new_page);
 		mem_cgroup_commit_charge(new_page, memcg, false, true);
-		lru_cache_add_anon(new_page);
+		if (is_shmem) {
+			set_page_dirty(new_page);
+			lru_cache_add_anon(new_page);
+		} else {
+			/* the data is on disk already */
+			lru_cache_add_file(new_page);
+		}
 
 		/*
 		 * Remove pte page tables, so we can re-fault the page as huge.
@@ -1583,7 +1711,8 @@ static void collapse_shmem(struct mm_struct *mm,
 		/* Something went wrong: rollback changes to the radix-tree */
 		spin_lock_irq(&mapping->tree_lock);
 		mapping->nrpages -= nr_none;
-		shmem_uncharge(mapping->host, nr_none);
+		if (is_shmem)
+			shmem_uncharge(mapping->host, nr_none);
 
 		radix_tree_for_each_slot(slot, &mapping->page_tree, &iter,
 				start) {
@@ -1624,13 +1753,16 @@ static void collapse_shmem(struct mm_struct *mm,
 	unlock_page(new_page);
 out:
 	VM_BUG_ON(!list_empty(&pagelist));
+	if (!is_shmem)
+		count_vm_event(result == SCAN_SUCCEED ? THP_COLLAPSE_FILE :
+			       THP_COLLAPSE_FILE_FAILED);
 	/* TODO: tracepoints */
 }
 
-static void khugepaged_scan_shmem(struct mm_struct *mm,
-		struct address_space *mapping,
-		pgoff_t start, struct page **hpage)
+static void khugepaged_scan_file(struct mm_struct *mm,
+		struct file *file, pgoff_t start, struct page **hpage)
 {
+	struct address_space *mapping = file->f_mapping;
 	struct page *page = NULL;
 	struct radix_tree_iter iter;
 	void **slot;
@@ -1652,7 +1784,10 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 			continue;
 		}
 
+		/* shadow entries of a regular file are just holes */
 		if (radix_tree_exception(page)) {
+			if (!shmem_file(file))
+				continue;
 			if (++swap > khugepaged_max_ptes_swap) {
 				result = SCAN_EXCEED_SWAP_PTE;
 				break;
@@ -1677,7 +1812,9 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 			break;
 		}
 
-		if (page_count(page) != 1 + page_mapcount(page)) {
+		/* buffer heads of a regular file are released on collapse */
+		if (page_count(page) !=
+		    1 + page_mapcount(page) + page_has_private(page)) {
 			result = SCAN_PAGE_COUNT;
 			break;
 		}
@@ -1702,16 +1839,15 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 			result = SCAN_EXCEED_NONE_PTE;
 		} else {
 			node = khugepaged_find_target_node();
-			collapse_shmem(mm, mapping, start, hpage, node);
+			collapse_file(mm, file, start, hpage, node);
 		}
 	}
 
 	/* TODO: tracepoints */
 }
 #else
-static void khugepaged_scan_shmem(struct mm_struct *mm,
-		struct address_space *mapping,
-		pgoff_t start, struct page **hpage)
+static void khugepaged_scan_file(struct mm_struct *mm,
+		struct file *file, pgoff_t start, struct page **hpage)
 {
 	BUILD_BUG();
 }
@@ -1760,7 +1896,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			progress++;
 			break;
 		}
-		if (!hugepage_vma_check(vma)) {
+		if (!hugepage_vma_check(vma, vma->vm_flags)) {
 skip:
 			progress++;
 			continue;
@@ -1784,17 +1920,18 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			VM_BUG_ON(khugepaged_scan.address < hstart ||
 				  khugepaged_scan.address + HPAGE_PMD_SIZE >
 				  hend);
-			if (shmem_file(vma->vm_file)) {
+			if (shmem_file(vma->vm_file) ||
+			    file_thp_text(vma, vma->vm_flags)) {
 				struct file *file;
 				pgoff_t pgoff = linear_page_index(vma,
 						khugepaged_scan.address);
-				if (!shmem_huge_enabled(vma))
+				if (shmem_file(vma->vm_file) &&
+				    !shmem_huge_enabled(vma))
 					goto skip;
 				file = get_file(vma->vm_file);
 				up_read(&mm->mmap_sem);
 				ret = 1;
-				khugepaged_scan_shmem(mm, file->f_mapping,
-						pgoff, hpage);
+				khugepaged_scan_file(mm, file, pgoff, hpage);
 				fput(file);
 			} else {
 				ret = khugepaged_scan_pmd(mm, vma,
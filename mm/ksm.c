@@ -39,6 +39,9 @@
 #include <linux/freezer.h>
 #include <linux/oom.h>
 #include <linux/numa.h>
+#include <linux/ktime.h>
+#include <linux/sched/cputime.h>
+#include <linux/workqueue.h>
 
 #include <asm/tlbflush.h>
 #include "internal.h"
@@ -172,6 +175,8 @@ struct stable_node {
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
  * @oldchecksum: previous checksum of the page at that virtual address
+ * @volatile_scans: number of consecutive scans the checksum has changed
+ * @remaining_skips: how many more scans will skip this rmap_item
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
@@ -187,6 +192,8 @@ struct rmap_item {
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
 	unsigned int oldchecksum;	/* when unstable */
+	u8 volatile_scans;		/* when unstable */
+	u8 remaining_skips;		/* when unstable */
 	union {
 		struct rb_node node;	/* when node of unstable tree */
 		struct {		/* when listed from stable tree */
@@ -250,12 +257,101 @@ static int ksm_stable_node_chains_prune_millisecs = 2000;
 /* Maximum number of page slots sharing a stable node */
 static int ksm_max_page_sharing = 256;
 
+#define DEFAULT_PAGES_TO_SCAN	100
+
 /* Number of pages ksmd should scan in one batch */
-static unsigned int ksm_thread_pages_to_scan = 100;
+static unsigned int ksm_thread_pages_to_scan = DEFAULT_PAGES_TO_SCAN;
 
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/* Skip rmap_items whose page keeps changing between scans */
+static bool ksm_smart_scan = true;
+
+/* The number of pages scanned, and of those skipped by smart scan */
+static unsigned long ksm_pages_scanned;
+static unsigned long ksm_pages_skipped;
+
+/*
+ * The advisor adjusts pages_to_scan after every full scan instead of
+ * leaving it to the administrator.
+ */
+enum ksm_advisor_type {
+	KSM_ADVISOR_NONE,
+	KSM_ADVISOR_SCAN_TIME,
+};
+static enum ksm_advisor_type ksm_advisor;
+
+/* Upper bound on the share of a CPU ksmd may use under the advisor */
+static unsigned int ksm_advisor_max_cpu = 70;
+
+/* Seconds a full scan should take under the advisor */
+static unsigned long ksm_advisor_target_scan_time = 200;
+
+/* Range the advisor keeps pages_to_scan in */
+static unsigned long ksm_advisor_min_pages_to_scan = 500;
+static unsigned long ksm_advisor_max_pages_to_scan = 30000;
+
+/**
+ * struct advisor_ctx - state the advisor carries from one full scan to the next
+ * @start_scan: time the current full scan started
+ * @scan_time: duration of the previous full scan, in seconds
+ * @change: smoothed ratio of scan time to previous scan time, in percent
+ * @cpu_time: runtime of ksmd and its scan threads when the current full
+ *	scan started, in ns
+ * @merged: rmap_items merged during the current full scan
+ */
+static struct advisor_ctx {
+	ktime_t start_scan;
+	unsigned long scan_time;
+	unsigned long change;
+	unsigned long long cpu_time;
+	unsigned long merged;
+} advisor_ctx;
+
+/*
+ * Threads checksumming pages for ksmd, ksmd included: 1 keeps ksmd
+ * scanning on its own.
+ */
+#define KSM_SCAN_THREADS_MAX	8
+static unsigned int ksm_scan_threads = 1;
+
+/* Most rmap_items ksmd gathers for the scan threads at a time */
+#define KSM_SCAN_BATCH		256
+
+/**
+ * struct ksm_scan_entry - an rmap_item gathered for the scan threads
+ * @rmap_item: the rmap_item, of the mm ksmd gathered the batch from
+ * @page: its page, with a reference held
+ * @checksum: checksum of @page, when @has_checksum
+ * @has_checksum: false for a KSM page, whose checksum is seldom needed
+ */
+struct ksm_scan_entry {
+	struct rmap_item *rmap_item;
+	struct page *page;
+	unsigned int checksum;
+	bool has_checksum;
+};
+
+/**
+ * struct ksm_scan_batch - rmap_items shared out among the scan threads
+ * @entries: the rmap_items gathered
+ * @nr: number of @entries in use
+ * @nr_shards: number of threads checksumming @entries
+ * @work: work for shard i is @work[i]; ksmd does shard 0 itself
+ * @runtime: CPU time the scan threads other than ksmd spent, in ns
+ */
+static struct ksm_scan_batch {
+	struct ksm_scan_entry entries[KSM_SCAN_BATCH];
+	unsigned int nr;
+	unsigned int nr_shards;
+	struct work_struct work[KSM_SCAN_THREADS_MAX];
+	atomic64_t runtime;
+} ksm_scan_batch;
+
+/* Allocated the first time scan_threads goes above 1 */
+static struct workqueue_struct *ksm_scan_wq;
+
 /* Checksum of an empty (zeroed) page */
 static unsigned int zero_checksum __read_mostly;
 
@@ -357,20 +453,24 @@ static inline void stable_node_dup_del(struct stable_node *dup)
 #endif
 }
 
-static inline struct rmap_item *alloc_rmap_item(void)
+static inline struct rmap_item *alloc_rmap_item(struct mm_struct *mm)
 {
 	struct rmap_item *rmap_item;
 
 	rmap_item = kmem_cache_zalloc(rmap_item_cache, GFP_KERNEL |
 						__GFP_NORETRY | __GFP_NOWARN);
-	if (rmap_item)
+	if (rmap_item) {
 		ksm_rmap_items++;
+		mm->ksm_rmap_items++;
+		rmap_item->mm = mm;
+	}
 	return rmap_item;
 }
 
 static inline void free_rmap_item(struct rmap_item *rmap_item)
 {
 	ksm_rmap_items--;
+	rmap_item->mm->ksm_rmap_items--;
 	rmap_item->mm = NULL;	/* debug safety */
 	kmem_cache_free(rmap_item_cache, rmap_item);
 }
@@ -623,6 +723,7 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
 			ksm_pages_sharing--;
 		else
 			ksm_pages_shared--;
+		rmap_item->mm->ksm_merging_pages--;
 		VM_BUG_ON(stable_node->rmap_hlist_len <= 0);
 		stable_node->rmap_hlist_len--;
 		put_anon_vma(rmap_item->anon_vma);
@@ -764,6 +865,7 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 			ksm_pages_sharing--;
 		else
 			ksm_pages_shared--;
+		rmap_item->mm->ksm_merging_pages--;
 		VM_BUG_ON(stable_node->rmap_hlist_len <= 0);
 		stable_node->rmap_hlist_len--;
 
@@ -1039,6 +1141,9 @@ static int write_protect_page(struct vm_area_struct *vma, struct page *page,
 		goto out_mn;
 	if (WARN_ONCE(!pvmw.pte, "Unexpected PMD mapping?"))
 		goto out_unlock;
+	/* Tables shared copy-on-write after fork are left alone */
+	if (pmd_cow_table(*pvmw.pmd))
+		goto out_unlock;
 
 	if (pte_write(*pvmw.pte) || pte_dirty(*pvmw.pte) ||
 	    (pte_protnone(*pvmw.pte) && pte_savedwrite(*pvmw.pte)) ||
@@ -1987,6 +2092,44 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 		ksm_pages_sharing++;
 	else
 		ksm_pages_shared++;
+	rmap_item->mm->ksm_merging_pages++;
+	advisor_ctx.merged++;
+}
+
+/*
+ * Number of scans to skip an rmap_item for, once its checksum has changed
+ * on @volatile_scans consecutive scans: pages which are rewritten all the
+ * time are never going to be merged, so back off from them exponentially.
+ */
+static u8 volatile_skip_scans(u8 volatile_scans)
+{
+	if (volatile_scans < 3)
+		return 0;
+	if (volatile_scans < 5)
+		return 1;
+	if (volatile_scans < 8)
+		return 2;
+	if (volatile_scans < 12)
+		return 4;
+	return 8;
+}
+
+static bool should_skip_rmap_item(struct page *page,
+				  struct rmap_item *rmap_item)
+{
+	if (!ksm_smart_scan)
+		return false;
+
+	/* Never skip a page which is already shared */
+	if (PageKsm(page))
+		return false;
+
+	if (rmap_item->remaining_skips) {
+		rmap_item->remaining_skips--;
+		ksm_pages_skipped++;
+		return true;
+	}
+	return false;
 }
 
 /*
@@ -1997,8 +2140,10 @@ static void stable_tree_append(struct rmap_item *rmap_item,
  *
  * @page: the page that we are searching identical page to.
  * @rmap_item: the reverse mapping into the virtual address of this page
+ * @precomputed: checksum of the page if already known, or NULL
  */
-static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
+static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item,
+			       const unsigned int *precomputed)
 {
 	struct mm_struct *mm = rmap_item->mm;
 	struct rmap_item *tree_rmap_item;
@@ -2060,11 +2205,16 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
 	 */
-	checksum = calc_checksum(page);
+	checksum = precomputed ? *precomputed : calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
+		if (rmap_item->volatile_scans < U8_MAX)
+			rmap_item->volatile_scans++;
+		rmap_item->remaining_skips =
+			volatile_skip_scans(rmap_item->volatile_scans);
 		return;
 	}
+	rmap_item->volatile_scans = 0;
 
 	/*
 	 * Same checksum as an empty page. We attempt to merge it with the
@@ -2173,10 +2323,9 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 		free_rmap_item(rmap_item);
 	}
 
-	rmap_item = alloc_rmap_item();
+	rmap_item = alloc_rmap_item(mm_slot->mm);
 	if (rmap_item) {
 		/* It has already been zeroed */
-		rmap_item->mm = mm_slot->mm;
 		rmap_item->address = addr;
 		rmap_item->rmap_list = *rmap_list;
 		*rmap_list = rmap_item;
@@ -2184,6 +2333,94 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
+/* CPU time ksmd and its scan threads have used, in ns */
+static unsigned long long ksm_scan_runtime(void)
+{
+	return task_sched_runtime(current) +
+	       atomic64_read(&ksm_scan_batch.runtime);
+}
+
+static void advisor_start_scan(void)
+{
+	if (ksm_advisor == KSM_ADVISOR_NONE)
+		return;
+
+	advisor_ctx.start_scan = ktime_get();
+	advisor_ctx.cpu_time = ksm_scan_runtime();
+	advisor_ctx.merged = 0;
+}
+
+/* Exponentially weighted moving average, giving 30% to the new sample */
+static unsigned long advisor_ewma(unsigned long prev, unsigned long curr)
+{
+	if (!prev)
+		return curr;
+	return (70 * prev + 30 * curr) / 100;
+}
+
+/*
+ * Called at the end of a full scan: pick pages_to_scan so that the next
+ * full scan takes about advisor_target_scan_time seconds, within what
+ * advisor_max_cpu allows ksmd to burn.  The time of the scan threads is
+ * charged to ksmd, so the budget covers all of them.  A scan that merged nothing backs
+ * off to half the rate, so that ksmd quiets down once merging converged.
+ */
+static void advisor_stop_scan(void)
+{
+	unsigned long scan_time, last_scan_time, change;
+	unsigned long cpu_percent, pages_per_cpu_percent;
+	unsigned long long cpu_time, cpu_time_ms;
+	unsigned long pages;
+
+	if (ksm_advisor == KSM_ADVISOR_NONE || !advisor_ctx.start_scan)
+		return;
+
+	scan_time = div_s64(ktime_ms_delta(ktime_get(), advisor_ctx.start_scan),
+			    MSEC_PER_SEC);
+	scan_time = max(scan_time, 1UL);
+
+	/* CPU share ksmd used over the scan, at least 1% */
+	cpu_time = ksm_scan_runtime();
+	cpu_time_ms = div_u64(cpu_time - advisor_ctx.cpu_time, NSEC_PER_MSEC);
+	cpu_percent = div_u64(cpu_time_ms * 100, scan_time * MSEC_PER_SEC);
+	cpu_percent = max(cpu_percent, 1UL);
+
+	last_scan_time = advisor_ctx.scan_time ? : scan_time;
+	change = max(scan_time * 100 / last_scan_time, 1UL);
+	change = advisor_ewma(advisor_ctx.change, change);
+
+	if (advisor_ctx.merged) {
+		/* Scale the rate by how far off the target this scan was */
+		pages = ksm_thread_pages_to_scan * scan_time /
+			ksm_advisor_target_scan_time;
+		pages = pages * change / 100;
+
+		pages_per_cpu_percent = ksm_thread_pages_to_scan / cpu_percent;
+		pages_per_cpu_percent = max(pages_per_cpu_percent, 1UL);
+		pages = min(pages, pages_per_cpu_percent * ksm_advisor_max_cpu);
+	} else {
+		pages = ksm_thread_pages_to_scan / 2;
+	}
+
+	pages = clamp(pages, ksm_advisor_min_pages_to_scan,
+		      ksm_advisor_max_pages_to_scan);
+
+	advisor_ctx.scan_time = scan_time;
+	advisor_ctx.change = change;
+	advisor_ctx.start_scan = 0;
+	ksm_thread_pages_to_scan = pages;
+}
+
+static void set_advisor_defaults(void)
+{
+	if (ksm_advisor == KSM_ADVISOR_NONE) {
+		ksm_thread_pages_to_scan = DEFAULT_PAGES_TO_SCAN;
+	} else {
+		memset(&advisor_ctx, 0, sizeof(advisor_ctx));
+		ksm_thread_pages_to_scan = ksm_advisor_min_pages_to_scan;
+	}
+}
+
 static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 {
 	struct mm_struct *mm;
@@ -2209,6 +2446,8 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 		 */
 		lru_add_drain_all();
 
+		advisor_start_scan();
+
 		/*
 		 * Whereas stale stable_nodes on the stable_tree itself
 		 * get pruned in the regular course of stable_tree_search(),
@@ -2278,12 +2517,16 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 				if (rmap_item) {
 					ksm_scan.rmap_list =
 							&rmap_item->rmap_list;
+					if (should_skip_rmap_item(*page,
+								  rmap_item))
+						goto next_page;
 					ksm_scan.address += PAGE_SIZE;
 				} else
 					put_page(*page);
 				up_read(&mm->mmap_sem);
 				return rmap_item;
 			}
+next_page:
 			put_page(*page);
 			ksm_scan.address += PAGE_SIZE;
 			cond_resched();
@@ -2339,9 +2582,119 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 		goto next_mm;
 
 	ksm_scan.seqnr++;
+	advisor_stop_scan();
 	return NULL;
 }
 
+static void ksm_checksum_work(struct work_struct *work)
+{
+	struct ksm_scan_batch *batch = &ksm_scan_batch;
+	struct ksm_scan_entry *entry;
+	u64 start = 0;
+	unsigned int i;
+
+	/* ksmd's own shard is in its runtime already */
+	if (work != &batch->work[0])
+		start = task_sched_runtime(current);
+
+	for (i = work - batch->work; i < batch->nr; i += batch->nr_shards) {
+		entry = &batch->entries[i];
+		entry->has_checksum = !PageKsm(entry->page);
+		if (entry->has_checksum)
+			entry->checksum = calc_checksum(entry->page);
+		cond_resched();
+	}
+
+	if (work != &batch->work[0])
+		atomic64_add(task_sched_runtime(current) - start,
+			     &batch->runtime);
+}
+
+/* Checksum the first @nr entries of ksm_scan_batch on the scan threads */
+static void ksm_checksum_batch(unsigned int nr)
+{
+	struct ksm_scan_batch *batch = &ksm_scan_batch;
+	unsigned int i;
+
+	batch->nr = nr;
+	batch->nr_shards = min(ksm_scan_threads, nr);
+	for (i = 1; i < batch->nr_shards; i++)
+		queue_work(ksm_scan_wq, &batch->work[i]);
+	ksm_checksum_work(&batch->work[0]);
+	for (i = 1; i < batch->nr_shards; i++)
+		flush_work(&batch->work[i]);
+}
+
+/*
+ * ksm_do_scan_batch - ksm_do_scan() with the checksums done in parallel.
+ *
+ * ksmd gathers up to KSM_SCAN_BATCH rmap_items of one mm, has the scan
+ * threads checksum their pages, then merges them one at a time just as
+ * ksm_do_scan() does: the stable and unstable trees are still only ever
+ * touched by ksmd, under ksm_thread_mutex.
+ *
+ * A batch never spans two mms or two full scans.  Together with holding
+ * mm_users, that keeps scan_get_next_rmap_item() from freeing any of the
+ * rmap_items gathered so far.
+ */
+static void ksm_do_scan_batch(unsigned int scan_npages)
+{
+	struct ksm_scan_batch *batch = &ksm_scan_batch;
+	struct ksm_scan_entry next = { .rmap_item = NULL };
+	struct ksm_scan_entry *entry;
+	struct mm_struct *mm;
+	unsigned int i, nr, limit;
+	bool pinned, more = true;
+
+	while (more && scan_npages && likely(!freezing(current))) {
+		if (!next.rmap_item) {
+			cond_resched();
+			next.rmap_item = scan_get_next_rmap_item(&next.page);
+			if (!next.rmap_item)
+				return;
+		}
+		mm = next.rmap_item->mm;
+		batch->entries[0] = next;
+		next.rmap_item = NULL;
+		nr = 1;
+
+		limit = min_t(unsigned int, scan_npages, KSM_SCAN_BATCH);
+		pinned = mmget_not_zero(mm);
+		while (pinned && nr < limit) {
+			cond_resched();
+			next.rmap_item = scan_get_next_rmap_item(&next.page);
+			if (!next.rmap_item) {
+				more = false;
+				break;
+			}
+			if (next.rmap_item->mm != mm)
+				break;
+			batch->entries[nr++] = next;
+			next.rmap_item = NULL;
+		}
+
+		ksm_checksum_batch(nr);
+		for (i = 0; i < nr; i++) {
+			entry = &batch->entries[i];
+			cmp_and_merge_page(entry->page, entry->rmap_item,
+				entry->has_checksum ? &entry->checksum : NULL);
+			put_page(entry->page);
+			ksm_pages_scanned++;
+			cond_resched();
+		}
+		if (pinned)
+			mmput(mm);
+		scan_npages -= nr;
+	}
+
+	/* Frozen with the first rmap_item of another mm in hand */
+	if (next.rmap_item) {
+		cmp_and_merge_page(next.page, next.rmap_item, NULL);
+		put_page(next.page);
+		ksm_pages_scanned++;
+	}
+}
+
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
  * @scan_npages - number of pages we want to scan before we return.
@@ -2351,13 +2704,19 @@ static void ksm_do_scan(unsigned int scan_npages)
 	struct rmap_item *rmap_item;
 	struct page *page;
 
+	if (ksm_scan_threads > 1) {
+		ksm_do_scan_batch(scan_npages);
+		return;
+	}
+
 	while (scan_npages-- && likely(!freezing(current))) {
 		cond_resched();
 		rmap_item = scan_get_next_rmap_item(&page);
 		if (!rmap_item)
 			return;
-		cmp_and_merge_page(page, rmap_item);
+		cmp_and_merge_page(page, rmap_item, NULL);
 		put_page(page);
+		ksm_pages_scanned++;
 	}
 }
 
@@ -2546,6 +2905,12 @@ struct page *ksm_might_need_to_copy(struct page *page,
 	return new_page;
 }
 
+long ksm_process_profit(struct mm_struct *mm)
+{
+	return mm->ksm_merging_pages * PAGE_SIZE -
+		mm->ksm_rmap_items * sizeof(struct rmap_item);
+}
+
 void rmap_walk_ksm(struct page *page, struct rmap_walk_control *rwc)
 {
 	struct stable_node *stable_node;
@@ -2812,6 +3177,9 @@ static ssize_t pages_to_scan_store(struct kobject *kobj,
 	int err;
 	unsigned long nr_pages;
 
+	if (ksm_advisor != KSM_ADVISOR_NONE)
+		return -EINVAL;
+
 	err = kstrtoul(buf, 10, &nr_pages);
 	if (err || nr_pages > UINT_MAX)
 		return -EINVAL;
@@ -3076,6 +3444,209 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t pages_scanned_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_scanned);
+}
+KSM_ATTR_RO(pages_scanned);
+
+static ssize_t pages_skipped_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_skipped);
+}
+KSM_ATTR_RO(pages_skipped);
+
+static ssize_t general_profit_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	long general_profit;
+
+	general_profit = ksm_pages_sharing * PAGE_SIZE -
+				ksm_rmap_items * sizeof(struct rmap_item);
+	return sprintf(buf, "%ld\n", general_profit);
+}
+KSM_ATTR_RO(general_profit);
+
+static ssize_t smart_scan_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_smart_scan);
+}
+
+static ssize_t smart_scan_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	int err;
+	bool value;
+
+	err = kstrtobool(buf, &value);
+	if (err)
+		return -EINVAL;
+
+	ksm_smart_scan = value;
+	return count;
+}
+KSM_ATTR(smart_scan);
+
+static ssize_t scan_threads_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_scan_threads);
+}
+
+static ssize_t scan_threads_store(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  const char *buf, size_t count)
+{
+	unsigned int threads;
+	int err;
+
+	err = kstrtouint(buf, 10, &threads);
+	if (err || !threads || threads > KSM_SCAN_THREADS_MAX)
+		return -EINVAL;
+
+	mutex_lock(&ksm_thread_mutex);
+	if (threads > 1 && !ksm_scan_wq) {
+		ksm_scan_wq = alloc_workqueue("ksm_scan", WQ_UNBOUND,
+					      KSM_SCAN_THREADS_MAX);
+		if (!ksm_scan_wq)
+			err = -ENOMEM;
+	}
+	if (!err)
+		ksm_scan_threads = threads;
+	mutex_unlock(&ksm_thread_mutex);
+
+	return err ? err : count;
+}
+KSM_ATTR(scan_threads);
+
+static ssize_t advisor_mode_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	if (ksm_advisor == KSM_ADVISOR_SCAN_TIME)
+		return sprintf(buf, "none [scan-time]\n");
+	return sprintf(buf, "[none] scan-time\n");
+}
+
+static ssize_t advisor_mode_store(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  const char *buf, size_t count)
+{
+	enum ksm_advisor_type advisor;
+
+	if (sysfs_streq(buf, "scan-time"))
+		advisor = KSM_ADVISOR_SCAN_TIME;
+	else if (sysfs_streq(buf, "none"))
+		advisor = KSM_ADVISOR_NONE;
+	else
+		return -EINVAL;
+
+	mutex_lock(&ksm_thread_mutex);
+	if (ksm_advisor != advisor) {
+		ksm_advisor = advisor;
+		set_advisor_defaults();
+	}
+	mutex_unlock(&ksm_thread_mutex);
+
+	return count;
+}
+KSM_ATTR(advisor_mode);
+
+static ssize_t advisor_max_cpu_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_advisor_max_cpu);
+}
+
+static ssize_t advisor_max_cpu_store(struct kobject *kobj,
+				     struct kobj_attribute *attr,
+				     const char *buf, size_t count)
+{
+	unsigned long percent;
+	int err;
+
+	err = kstrtoul(buf, 10, &percent);
+	if (err || !percent || percent > 100)
+		return -EINVAL;
+
+	ksm_advisor_max_cpu = percent;
+	return count;
+}
+KSM_ATTR(advisor_max_cpu);
+
+static ssize_t advisor_min_pages_to_scan_show(struct kobject *kobj,
+					      struct kobj_attribute *attr,
+					      char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_advisor_min_pages_to_scan);
+}
+
+static ssize_t advisor_min_pages_to_scan_store(struct kobject *kobj,
+					       struct kobj_attribute *attr,
+					       const char *buf, size_t count)
+{
+	unsigned long nr_pages;
+	int err;
+
+	err = kstrtoul(buf, 10, &nr_pages);
+	if (err || !nr_pages || nr_pages > ksm_advisor_max_pages_to_scan)
+		return -EINVAL;
+
+	ksm_advisor_min_pages_to_scan = nr_pages;
+	return count;
+}
+KSM_ATTR(advisor_min_pages_to_scan);
+
+static ssize_t advisor_max_pages_to_scan_show(struct kobject *kobj,
+					      struct kobj_attribute *attr,
+					      char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_advisor_max_pages_to_scan);
+}
+
+static ssize_t advisor_max_pages_to_scan_store(struct kobject *kobj,
+					       struct kobj_attribute *attr,
+					       const char *buf, size_t count)
+{
+	unsigned long nr_pages;
+	int err;
+
+	err = kstrtoul(buf, 10, &nr_pages);
+	if (err || nr_pages < ksm_advisor_min_pages_to_scan ||
+	    nr_pages > UINT_MAX)
+		return -EINVAL;
+
+	ksm_advisor_max_pages_to_scan = nr_pages;
+	return count;
+}
+KSM_ATTR(advisor_max_pages_to_scan);
+
+static ssize_t advisor_target_scan_time_show(struct kobject *kobj,
+					     struct kobj_attribute *attr,
+					     char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_advisor_target_scan_time);
+}
+
+static ssize_t advisor_target_scan_time_store(struct kobject *kobj,
+					      struct kobj_attribute *attr,
+					      const char *buf, size_t count)
+{
+	unsigned long secs;
+	int err;
+
+	err = kstrtoul(buf, 10, &secs);
+	if (err || !secs)
+		return -EINVAL;
+
+	ksm_advisor_target_scan_time = secs;
+	return count;
+}
+KSM_ATTR(advisor_target_scan_time);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -3093,6 +3664,16 @@ static struct attribute *ksm_attrs[] = {
 	&stable_node_dups_attr.attr,
 	&stable_node_chains_prune_millisecs_attr.attr,
 	&use_zero_pages_attr.attr,
+	&pages_scanned_attr.attr,
+	&pages_skipped_attr.attr,
+	&general_profit_attr.attr,
+	&smart_scan_attr.attr,
+	&scan_threads_attr.attr,
+	&advisor_mode_attr.attr,
+	&advisor_max_cpu_attr.attr,
+	&advisor_min_pages_to_scan_attr.attr,
+	&advisor_max_pages_to_scan_attr.attr,
+	&advisor_target_scan_time_attr.attr,
 	NULL,
 };
 
@@ -3105,13 +3686,16 @@ static const struct attribute_group ksm_attr_group = {
 static int __init ksm_init(void)
 {
 	struct task_struct *ksm_thread;
-	int err;
+	int err, i;
 
 	/* The correct value depends on page size and endianness */
 	zero_checksum = calc_checksum(ZERO_PAGE(0));
 	/* Default to false for backwards compatibility */
 	ksm_use_zero_pages = false;
 
+	for (i = 0; i < KSM_SCAN_THREADS_MAX; i++)
+		INIT_WORK(&ksm_scan_batch.work[i], ksm_checksum_work);
+
 	err = ksm_slab_init();
 	if (err)
 		goto out;
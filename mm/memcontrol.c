@@ -32,6 +32,7 @@
  */
 
 #include <linux/page_counter.h>
+#include <linux/srcu.h>
 #include <linux/memcontrol.h>
 #include <linux/cgroup.h>
 #include <linux/mm.h>
@@ -65,6 +66,7 @@
 #include <linux/lockdep.h>
 #include <linux/file.h>
 #include <linux/tracehook.h>
+#include <linux/tick.h>
 #include "internal.h"
 #include <net/sock.h>
 #include <net/ip.h>
@@ -246,11 +248,6 @@ struct cgroup_subsys_state *vmpressure_to_css(struct vmpressure *vmpr)
 	return &container_of(vmpr, struct mem_cgroup, vmpressure)->css;
 }
 
-static inline bool mem_cgroup_is_root(struct mem_cgroup *memcg)
-{
-	return (memcg == root_mem_cgroup);
-}
-
 #ifndef CONFIG_SLOB
 /*
  * This will be the memcg's index in each cache's ->memcg_params.memcg_caches.
@@ -542,10 +539,97 @@ mem_cgroup_largest_soft_limit_node(struct mem_cgroup_tree_per_node *mctz)
 	return mz;
 }
 
-static unsigned long memcg_sum_events(struct mem_cgroup *memcg,
-				      int event)
+/*
+ * Statistics are kept in per-cpu counters of each memcg and folded into
+ * the hierarchical totals by cgroup rstat flushing, which only visits
+ * the cgroups that have been updated since the last flush.  Readers call
+ * mem_cgroup_flush_stats(), which skips the flush until enough updates
+ * have accumulated to make a difference.  Beside that, the stats are
+ * flushed every 2 seconds so they never get too stale.
+ */
+static void flush_memcg_stats_dwork(struct work_struct *w);
+static DECLARE_DEFERRABLE_WORK(stats_flush_dwork, flush_memcg_stats_dwork);
+static DEFINE_PER_CPU(unsigned int, stats_updates);
+static atomic_t stats_flush_threshold = ATOMIC_INIT(0);
+static atomic_t stats_flush_ongoing = ATOMIC_INIT(0);
+
+static inline void memcg_rstat_updated(struct mem_cgroup *memcg, int val)
+{
+	unsigned int x;
+
+	cgroup_rstat_updated(memcg->css.cgroup, smp_processor_id());
+
+	x = __this_cpu_add_return(stats_updates, abs(val));
+	if (x > MEMCG_CHARGE_BATCH) {
+		/* Don't bounce the cacheline once a flush is due anyway */
+		if (atomic_read(&stats_flush_threshold) <= num_online_cpus())
+			atomic_add(x / MEMCG_CHARGE_BATCH,
+				   &stats_flush_threshold);
+		__this_cpu_write(stats_updates, 0);
+	}
+}
+
+static void __mem_cgroup_flush_stats(void)
+{
+	/* One flusher at a time, the others can make do with its result */
+	if (atomic_xchg(&stats_flush_ongoing, 1))
+		return;
+
+	atomic_set(&stats_flush_threshold, 0);
+	cgroup_rstat_flush(root_mem_cgroup->css.cgroup);
+	atomic_set(&stats_flush_ongoing, 0);
+}
+
+/**
+ * mem_cgroup_flush_stats - bring the memcg statistics up to date
+ *
+ * Flush the per-cpu deltas into the totals if the error they could
+ * introduce has grown beyond MEMCG_CHARGE_BATCH pages per cpu.
+ * Might sleep.
+ */
+void mem_cgroup_flush_stats(void)
+{
+	if (mem_cgroup_disabled())
+		return;
+
+	if (atomic_read(&stats_flush_threshold) > num_online_cpus())
+		__mem_cgroup_flush_stats();
+}
+
+static void flush_memcg_stats_dwork(struct work_struct *w)
+{
+	__mem_cgroup_flush_stats();
+	queue_delayed_work(system_unbound_wq, &stats_flush_dwork, 2UL * HZ);
+}
+
+/* idx can be of type enum memcg_stat_item or node_stat_item */
+void __mod_memcg_state(struct mem_cgroup *memcg, int idx, int val)
+{
+	if (mem_cgroup_disabled())
+		return;
+
+	__this_cpu_add(memcg->stat_cpu->count[idx], val);
+	memcg_rstat_updated(memcg, val);
+}
+
+void __count_memcg_events(struct mem_cgroup *memcg, enum vm_event_item idx,
+			  unsigned long count)
+{
+	if (mem_cgroup_disabled())
+		return;
+
+	__this_cpu_add(memcg->stat_cpu->events[idx], count);
+	memcg_rstat_updated(memcg, count);
+}
+
+static unsigned long memcg_events(struct mem_cgroup *memcg, int event)
 {
-	return atomic_long_read(&memcg->events[event]);
+	return READ_ONCE(memcg->events[event]);
+}
+
+static unsigned long memcg_events_local(struct mem_cgroup *memcg, int event)
+{
+	return READ_ONCE(memcg->events_local[event]);
 }
 
 static void mem_cgroup_charge_statistics(struct mem_cgroup *memcg,
@@ -1011,6 +1095,9 @@ void mem_cgroup_update_lru_size(struct lruvec *lruvec, enum lru_list lru,
 
 	if (nr_pages > 0)
 		*lru_size += nr_pages;
+
+	/* For the hierarchical totals in memory.stat */
+	__mod_memcg_state(mz->memcg, NR_LRU_BASE + lru, nr_pages);
 }
 
 bool task_in_mem_cgroup(struct task_struct *task, struct mem_cgroup *memcg)
@@ -1184,7 +1271,8 @@ void mem_cgroup_print_oom_info(struct mem_cgroup *memcg, struct task_struct *p)
 			if (memcg1_stats[i] == MEMCG_SWAP && !do_swap_account)
 				continue;
 			pr_cont(" %s:%luKB", memcg1_stat_names[i],
-				K(memcg_page_state(iter, memcg1_stats[i])));
+				K(memcg_page_state_local(iter,
+							 memcg1_stats[i])));
 		}
 
 		for (i = 0; i < NR_LRU_LISTS; i++)
@@ -1848,20 +1936,17 @@ static int memcg_hotplug_cpu_dead(unsigned int cpu)
 	stock = &per_cpu(memcg_stock, cpu);
 	drain_stock(stock);
 
+	/*
+	 * The memcg stats and events of the dead cpu are left alone, rstat
+	 * flushing covers all possible cpus.
+	 */
 	for_each_mem_cgroup(memcg) {
 		int i;
 
-		for (i = 0; i < MEMCG_NR_STAT; i++) {
+		for (i = 0; i < NR_VM_NODE_STAT_ITEMS; i++) {
 			int nid;
 			long x;
 
-			x = this_cpu_xchg(memcg->stat_cpu->count[i], 0);
-			if (x)
-				atomic_long_add(x, &memcg->stat[i]);
-
-			if (i >= NR_VM_NODE_STAT_ITEMS)
-				continue;
-
 			for_each_node(nid) {
 				struct mem_cgroup_per_node *pn;
 
@@ -1871,28 +1956,42 @@ static int memcg_hotplug_cpu_dead(unsigned int cpu)
 					atomic_long_add(x, &pn->lruvec_stat[i]);
 			}
 		}
-
-		for (i = 0; i < NR_VM_EVENT_ITEMS; i++) {
-			long x;
-
-			x = this_cpu_xchg(memcg->stat_cpu->events[i], 0);
-			if (x)
-				atomic_long_add(x, &memcg->events[i]);
-		}
 	}
 
 	return 0;
 }
 
+/*
+ * Account pages reclaimed on behalf of @memcg's limits, split into
+ * reclaim done by workers in the background and reclaim done by the
+ * charging tasks themselves.
+ */
+static void memcg_count_reclaim(struct mem_cgroup *memcg,
+				unsigned long nr_reclaimed, bool background)
+{
+	enum vm_event_item item;
+
+	if (!nr_reclaimed)
+		return;
+
+	item = background ? PGSTEAL_MEMCG_BACKGROUND : PGSTEAL_MEMCG_DIRECT;
+	count_vm_events(item, nr_reclaimed);
+	count_memcg_events(memcg, item, nr_reclaimed);
+}
+
 static void reclaim_high(struct mem_cgroup *memcg,
 			 unsigned int nr_pages,
-			 gfp_t gfp_mask)
+			 gfp_t gfp_mask, bool background)
 {
+	unsigned long nr_reclaimed;
+
 	do {
 		if (page_counter_read(&memcg->memory) <= memcg->high)
 			continue;
 		memcg_memory_event(memcg, MEMCG_HIGH);
-		try_to_free_mem_cgroup_pages(memcg, nr_pages, gfp_mask, true);
+		nr_reclaimed = try_to_free_mem_cgroup_pages(memcg, nr_pages,
+							    gfp_mask, true);
+		memcg_count_reclaim(memcg, nr_reclaimed, background);
 	} while ((memcg = parent_mem_cgroup(memcg)));
 }
 
@@ -1901,7 +2000,7 @@ static void high_work_func(struct work_struct *work)
 	struct mem_cgroup *memcg;
 
 	memcg = container_of(work, struct mem_cgroup, high_work);
-	reclaim_high(memcg, MEMCG_CHARGE_BATCH, GFP_KERNEL);
+	reclaim_high(memcg, MEMCG_CHARGE_BATCH, GFP_KERNEL, true);
 }
 
 /*
@@ -1917,11 +2016,99 @@ void mem_cgroup_handle_over_high(void)
 		return;
 
 	memcg = get_mem_cgroup_from_mm(current->mm);
-	reclaim_high(memcg, nr_pages, GFP_KERNEL);
+	reclaim_high(memcg, nr_pages, GFP_KERNEL, false);
 	css_put(&memcg->css);
 	current->memcg_nr_pages_over_high = 0;
 }
 
+/*
+ * Background reclaim: once a group's usage crosses wmark_high, a worker
+ * on memcg_wmark_wq reclaims it back down to wmark_low.  The watermarks
+ * sit below memory.high, so charging tasks of a group that is being
+ * kept in check this way rarely have to reclaim themselves.
+ *
+ * The workqueue is unbound and restricted to the housekeeping CPUs; it
+ * is visible in sysfs, so its cpumask can be narrowed further.
+ */
+#define MEMCG_WMARK_RECLAIM_BATCH	1024UL
+
+static struct workqueue_struct *memcg_wmark_wq;
+
+static void setup_memcg_wmark(struct mem_cgroup *memcg)
+{
+	unsigned long high = READ_ONCE(memcg->high);
+	unsigned int ratio = READ_ONCE(memcg->wmark_ratio);
+	unsigned long wmark_high = PAGE_COUNTER_MAX;
+	unsigned long wmark_low = PAGE_COUNTER_MAX;
+
+	if (ratio && high != PAGE_COUNTER_MAX) {
+		unsigned long gap;
+
+		/* reclaim 1% of the high limit past the watermark */
+		wmark_high = mult_frac(high, ratio, 100);
+		gap = max_t(unsigned long, high / 100, MEMCG_CHARGE_BATCH);
+		wmark_low = wmark_high > gap ? wmark_high - gap : 0;
+	}
+
+	WRITE_ONCE(memcg->wmark_high, wmark_high);
+	WRITE_ONCE(memcg->wmark_low, wmark_low);
+}
+
+static void wmark_work_func(struct work_struct *work)
+{
+	int nr_retries = MEM_CGROUP_RECLAIM_RETRIES;
+	struct mem_cgroup *memcg;
+
+	memcg = container_of(work, struct mem_cgroup, wmark_work);
+
+	while (nr_retries) {
+		unsigned long usage = page_counter_read(&memcg->memory);
+		unsigned long wmark_low = READ_ONCE(memcg->wmark_low);
+		unsigned long nr_reclaimed;
+
+		if (usage <= wmark_low)
+			break;
+
+		nr_reclaimed = try_to_free_mem_cgroup_pages(memcg,
+				min(usage - wmark_low, MEMCG_WMARK_RECLAIM_BATCH),
+				GFP_KERNEL, true);
+		memcg_count_reclaim(memcg, nr_reclaimed, true);
+		if (!nr_reclaimed)
+			nr_retries--;
+
+		cond_resched();
+	}
+}
+
+/* Kick background reclaim for every group above its watermark */
+static void memcg_check_wmark(struct mem_cgroup *memcg)
+{
+	do {
+		if (page_counter_read(&memcg->memory) <=
+		    READ_ONCE(memcg->wmark_high))
+			continue;
+		if (!work_pending(&memcg->wmark_work))
+			queue_work(memcg_wmark_wq, &memcg->wmark_work);
+	} while ((memcg = parent_mem_cgroup(memcg)));
+}
+
+static void __init memcg_wmark_wq_init(void)
+{
+	struct workqueue_attrs *attrs;
+
+	memcg_wmark_wq = alloc_workqueue("memcg_wmark", WQ_MEM_RECLAIM |
+					 WQ_UNBOUND | WQ_FREEZABLE | WQ_SYSFS, 0);
+	BUG_ON(!memcg_wmark_wq);
+
+	/* stay off nohz_full CPUs */
+	attrs = alloc_workqueue_attrs(GFP_KERNEL);
+	if (!attrs)
+		return;
+	cpumask_copy(attrs->cpumask, housekeeping_cpumask());
+	apply_workqueue_attrs(memcg_wmark_wq, attrs);
+	free_workqueue_attrs(attrs);
+}
+
 static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 		      unsigned int nr_pages)
 {
@@ -1986,6 +2173,7 @@ static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 
 	nr_reclaimed = try_to_free_mem_cgroup_pages(mem_over_limit, nr_pages,
 						    gfp_mask, may_swap);
+	memcg_count_reclaim(mem_over_limit, nr_reclaimed, false);
 
 	if (mem_cgroup_margin(mem_over_limit) >= nr_pages)
 		goto retry;
@@ -2050,6 +2238,8 @@ static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 	if (batch > nr_pages)
 		refill_stock(memcg, batch - nr_pages);
 
+	memcg_check_wmark(memcg);
+
 	/*
 	 * If the hierarchy is above the normal consumption range, schedule
 	 * reclaim on returning to userland.  We can perform reclaim here
@@ -2772,45 +2962,15 @@ static int mem_cgroup_hierarchy_write(struct cgroup_subsys_state *css,
 	return retval;
 }
 
-static void tree_stat(struct mem_cgroup *memcg, unsigned long *stat)
-{
-	struct mem_cgroup *iter;
-	int i;
-
-	memset(stat, 0, sizeof(*stat) * MEMCG_NR_STAT);
-
-	for_each_mem_cgroup_tree(iter, memcg) {
-		for (i = 0; i < MEMCG_NR_STAT; i++)
-			stat[i] += memcg_page_state(iter, i);
-	}
-}
-
-static void tree_events(struct mem_cgroup *memcg, unsigned long *events)
-{
-	struct mem_cgroup *iter;
-	int i;
-
-	memset(events, 0, sizeof(*events) * NR_VM_EVENT_ITEMS);
-
-	for_each_mem_cgroup_tree(iter, memcg) {
-		for (i = 0; i < NR_VM_EVENT_ITEMS; i++)
-			events[i] += memcg_sum_events(iter, i);
-	}
-}
-
 static unsigned long mem_cgroup_usage(struct mem_cgroup *memcg, bool swap)
 {
 	unsigned long val = 0;
 
 	if (mem_cgroup_is_root(memcg)) {
-		struct mem_cgroup *iter;
-
-		for_each_mem_cgroup_tree(iter, memcg) {
-			val += memcg_page_state(iter, MEMCG_CACHE);
-			val += memcg_page_state(iter, MEMCG_RSS);
-			if (swap)
-				val += memcg_page_state(iter, MEMCG_SWAP);
-		}
+		val += memcg_page_state(memcg, MEMCG_CACHE);
+		val += memcg_page_state(memcg, MEMCG_RSS);
+		if (swap)
+			val += memcg_page_state(memcg, MEMCG_SWAP);
 	} else {
 		if (!swap)
 			val = page_counter_read(&memcg->memory);
@@ -2853,6 +3013,8 @@ static u64 mem_cgroup_read_u64(struct cgroup_subsys_state *css,
 
 	switch (MEMFILE_ATTR(cft->private)) {
 	case RES_USAGE:
+		if (mem_cgroup_is_root(memcg))
+			mem_cgroup_flush_stats();
 		if (counter == &memcg->memory)
 			return (u64)mem_cgroup_usage(memcg, false) * PAGE_SIZE;
 		if (counter == &memcg->memsw)
@@ -2872,6 +3034,166 @@ static u64 mem_cgroup_read_u64(struct cgroup_subsys_state *css,
 }
 
 #ifndef CONFIG_SLOB
+/*
+ * Size of the memcg shrinker maps in bytes, enough for all the ids
+ * handed out to memcg aware shrinkers.  Growing the maps is serialized
+ * with allocating them for new memcgs by memcg_shrinker_map_mutex.
+ */
+static int memcg_shrinker_map_size;
+static DEFINE_MUTEX(memcg_shrinker_map_mutex);
+
+static void memcg_free_shrinker_map_rcu(struct rcu_head *head)
+{
+	kvfree(container_of(head, struct memcg_shrinker_map, rcu));
+}
+
+static void memcg_free_shrinker_maps(struct mem_cgroup *memcg)
+{
+	struct mem_cgroup_per_node *pn;
+	struct memcg_shrinker_map *map;
+	int nid;
+
+	if (mem_cgroup_is_root(memcg))
+		return;
+
+	for_each_node(nid) {
+		pn = mem_cgroup_nodeinfo(memcg, nid);
+		map = rcu_dereference_protected(pn->shrinker_map, true);
+		if (map)
+			kvfree(map);
+		rcu_assign_pointer(pn->shrinker_map, NULL);
+	}
+}
+
+static int memcg_alloc_shrinker_maps(struct mem_cgroup *memcg)
+{
+	struct memcg_shrinker_map *map;
+	int nid, size, ret = 0;
+
+	if (mem_cgroup_is_root(memcg))
+		return 0;
+
+	mutex_lock(&memcg_shrinker_map_mutex);
+	size = memcg_shrinker_map_size;
+	for_each_node(nid) {
+		map = kvzalloc(sizeof(*map) + size, GFP_KERNEL);
+		if (!map) {
+			memcg_free_shrinker_maps(memcg);
+			ret = -ENOMEM;
+			break;
+		}
+		rcu_assign_pointer(memcg->nodeinfo[nid]->shrinker_map, map);
+	}
+	mutex_unlock(&memcg_shrinker_map_mutex);
+
+	return ret;
+}
+
+static int memcg_expand_one_shrinker_map(struct mem_cgroup *memcg,
+					 int size, int old_size)
+{
+	struct memcg_shrinker_map *new, *old;
+	int nid;
+
+	lockdep_assert_held(&memcg_shrinker_map_mutex);
+
+	for_each_node(nid) {
+		old = rcu_dereference_protected(
+			mem_cgroup_nodeinfo(memcg, nid)->shrinker_map, true);
+		/* Not yet online memcg */
+		if (!old)
+			return 0;
+
+		new = kvmalloc(sizeof(*new) + size, GFP_KERNEL);
+		if (!new)
+			return -ENOMEM;
+
+		/*
+		 * The bits may have been cleared by a racing shrink_slab()
+		 * or set by a list_lru_add() into the old map: copying it
+		 * could lose a bit, so set all the old ones and let reclaim
+		 * clear them again.
+		 */
+		memset(new->map, (int)0xff, old_size);
+		memset((void *)new->map + old_size, 0, size - old_size);
+
+		rcu_assign_pointer(memcg->nodeinfo[nid]->shrinker_map, new);
+		call_srcu(&shrinker_srcu, &old->rcu,
+			  memcg_free_shrinker_map_rcu);
+	}
+
+	return 0;
+}
+
+/*
+ * Make the shrinker maps of all memcgs big enough for @new_id.  Called
+ * by the shrinker code under its own mutex, before the id is used.
+ */
+int memcg_expand_shrinker_maps(int new_id)
+{
+	int size, old_size, ret = 0;
+	struct mem_cgroup *memcg;
+
+	size = DIV_ROUND_UP(new_id + 1, BITS_PER_LONG) * sizeof(unsigned long);
+	old_size = memcg_shrinker_map_size;
+	if (size <= old_size)
+		return 0;
+
+	mutex_lock(&memcg_shrinker_map_mutex);
+	/* Shrinkers registered before memcg init, there are no maps yet */
+	if (!root_mem_cgroup)
+		goto unlock;
+
+	for_each_mem_cgroup(memcg) {
+		if (mem_cgroup_is_root(memcg))
+			continue;
+		ret = memcg_expand_one_shrinker_map(memcg, size, old_size);
+		if (ret) {
+			mem_cgroup_iter_break(NULL, memcg);
+			goto unlock;
+		}
+	}
+unlock:
+	if (!ret)
+		memcg_shrinker_map_size = size;
+	mutex_unlock(&memcg_shrinker_map_mutex);
+	return ret;
+}
+
+/**
+ * memcg_set_shrinker_bit - note that a memcg has objects for a shrinker
+ * @memcg: memcg the objects are charged to
+ * @nid: node the objects are on
+ * @shrinker_id: id of the shrinker, or -1 for a memcg unaware list_lru
+ *
+ * Objects charged to a memcg which is not kmem-online anymore sit on the
+ * lists of the ancestor it was reparented to, so the bit is set there.
+ */
+void memcg_set_shrinker_bit(struct mem_cgroup *memcg, int nid, int shrinker_id)
+{
+	struct memcg_shrinker_map *map;
+	int srcu_idx;
+
+	if (shrinker_id < 0 || !memcg)
+		return;
+
+	while (memcg->kmem_state != KMEM_ONLINE && !mem_cgroup_is_root(memcg))
+		memcg = parent_mem_cgroup(memcg) ?: root_mem_cgroup;
+	/* The root memcg's objects are on the global lists */
+	if (mem_cgroup_is_root(memcg))
+		return;
+
+	srcu_idx = srcu_read_lock(&shrinker_srcu);
+	map = srcu_dereference(memcg->nodeinfo[nid]->shrinker_map,
+			       &shrinker_srcu);
+	if (map) {
+		/* Pairs with smp mb in shrink_slab_memcg() */
+		smp_mb__before_atomic();
+		set_bit(shrinker_id, map->map);
+	}
+	srcu_read_unlock(&shrinker_srcu, srcu_idx);
+}
+
 static int memcg_online_kmem(struct mem_cgroup *memcg)
 {
 	int memcg_id;
@@ -2943,7 +3265,7 @@ static void memcg_offline_kmem(struct mem_cgroup *memcg)
 	}
 	rcu_read_unlock();
 
-	memcg_drain_all_list_lrus(kmemcg_id, parent->kmemcg_id);
+	memcg_drain_all_list_lrus(kmemcg_id, parent);
 
 	memcg_free_cache_id(kmemcg_id);
 }
@@ -2961,6 +3283,13 @@ static void memcg_free_kmem(struct mem_cgroup *memcg)
 	}
 }
 #else
+static int memcg_alloc_shrinker_maps(struct mem_cgroup *memcg)
+{
+	return 0;
+}
+static void memcg_free_shrinker_maps(struct mem_cgroup *memcg)
+{
+}
 static int memcg_online_kmem(struct mem_cgroup *memcg)
 {
 	return 0;
@@ -3199,6 +3528,25 @@ static const char *const memcg1_event_names[] = {
 	"pgmajfault",
 };
 
+/*
+ * The totals of the memcgs a cgroup1 memcg's "total_" stats cover: its
+ * whole subtree with use_hierarchy, just itself otherwise.  The root
+ * always covers everything.
+ */
+static unsigned long memcg1_tree_state(struct mem_cgroup *memcg, int idx)
+{
+	if (memcg->use_hierarchy || mem_cgroup_is_root(memcg))
+		return memcg_page_state(memcg, idx);
+	return memcg_page_state_local(memcg, idx);
+}
+
+static unsigned long memcg1_tree_events(struct mem_cgroup *memcg, int event)
+{
+	if (memcg->use_hierarchy || mem_cgroup_is_root(memcg))
+		return memcg_events(memcg, event);
+	return memcg_events_local(memcg, event);
+}
+
 static int memcg_stat_show(struct seq_file *m, void *v)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
@@ -3209,17 +3557,19 @@ static int memcg_stat_show(struct seq_file *m, void *v)
 	BUILD_BUG_ON(ARRAY_SIZE(memcg1_stat_names) != ARRAY_SIZE(memcg1_stats));
 	BUILD_BUG_ON(ARRAY_SIZE(mem_cgroup_lru_names) != NR_LRU_LISTS);
 
+	mem_cgroup_flush_stats();
+
 	for (i = 0; i < ARRAY_SIZE(memcg1_stats); i++) {
 		if (memcg1_stats[i] == MEMCG_SWAP && !do_memsw_account())
 			continue;
 		seq_printf(m, "%s %lu\n", memcg1_stat_names[i],
-			   memcg_page_state(memcg, memcg1_stats[i]) *
+			   memcg_page_state_local(memcg, memcg1_stats[i]) *
 			   PAGE_SIZE);
 	}
 
 	for (i = 0; i < ARRAY_SIZE(memcg1_events); i++)
 		seq_printf(m, "%s %lu\n", memcg1_event_names[i],
-			   memcg_sum_events(memcg, memcg1_events[i]));
+			   memcg_events_local(memcg, memcg1_events[i]));
 
 	for (i = 0; i < NR_LRU_LISTS; i++)
 		seq_printf(m, "%s %lu\n", mem_cgroup_lru_names[i],
@@ -3238,31 +3588,21 @@ static int memcg_stat_show(struct seq_file *m, void *v)
 			   (u64)memsw * PAGE_SIZE);
 
 	for (i = 0; i < ARRAY_SIZE(memcg1_stats); i++) {
-		unsigned long long val = 0;
-
 		if (memcg1_stats[i] == MEMCG_SWAP && !do_memsw_account())
 			continue;
-		for_each_mem_cgroup_tree(mi, memcg)
-			val += memcg_page_state(mi, memcg1_stats[i]) *
-			PAGE_SIZE;
-		seq_printf(m, "total_%s %llu\n", memcg1_stat_names[i], val);
-	}
-
-	for (i = 0; i < ARRAY_SIZE(memcg1_events); i++) {
-		unsigned long long val = 0;
-
-		for_each_mem_cgroup_tree(mi, memcg)
-			val += memcg_sum_events(mi, memcg1_events[i]);
-		seq_printf(m, "total_%s %llu\n", memcg1_event_names[i], val);
+		seq_printf(m, "total_%s %llu\n", memcg1_stat_names[i],
+			   (u64)memcg1_tree_state(memcg, memcg1_stats[i]) *
+			   PAGE_SIZE);
 	}
 
-	for (i = 0; i < NR_LRU_LISTS; i++) {
-		unsigned long long val = 0;
+	for (i = 0; i < ARRAY_SIZE(memcg1_events); i++)
+		seq_printf(m, "total_%s %llu\n", memcg1_event_names[i],
+			   (u64)memcg1_tree_events(memcg, memcg1_events[i]));
 
-		for_each_mem_cgroup_tree(mi, memcg)
-			val += mem_cgroup_nr_lru_pages(mi, BIT(i)) * PAGE_SIZE;
-		seq_printf(m, "total_%s %llu\n", mem_cgroup_lru_names[i], val);
-	}
+	for (i = 0; i < NR_LRU_LISTS; i++)
+		seq_printf(m, "total_%s %llu\n", mem_cgroup_lru_names[i],
+			   (u64)memcg1_tree_state(memcg, NR_LRU_BASE + i) *
+			   PAGE_SIZE);
 
 #ifdef CONFIG_DEBUG_VM
 	{
@@ -3702,15 +4042,16 @@ struct wb_domain *mem_cgroup_wb_domain(struct bdi_writeback *wb)
 }
 
 /*
- * idx can be of type enum memcg_stat_item or node_stat_item.
- * Keep in sync with memcg_exact_page().
+ * The dirty throttling compares these against small per-memcg limits,
+ * so they can't be off by the flush batching: sum the cpu counters of
+ * @memcg, which are never reset, instead of reading the flushed total.
  */
 static unsigned long memcg_exact_page_state(struct mem_cgroup *memcg, int idx)
 {
-	long x = atomic_long_read(&memcg->stat[idx]);
+	long x = 0;
 	int cpu;
 
-	for_each_online_cpu(cpu)
+	for_each_possible_cpu(cpu)
 		x += per_cpu_ptr(memcg->stat_cpu, cpu)->count[idx];
 	if (x < 0)
 		x = 0;
@@ -4305,6 +4646,7 @@ static struct mem_cgroup *mem_cgroup_alloc(void)
 		goto fail;
 
 	INIT_WORK(&memcg->high_work, high_work_func);
+	INIT_WORK(&memcg->wmark_work, wmark_work_func);
 	memcg->last_scanned_node = MAX_NUMNODES;
 	INIT_LIST_HEAD(&memcg->oom_notify);
 	mutex_init(&memcg->thresholds_lock);
@@ -4340,9 +4682,12 @@ mem_cgroup_css_alloc(struct cgroup_subsys_state *parent_css)
 
 	memcg->high = PAGE_COUNTER_MAX;
 	memcg->soft_limit = PAGE_COUNTER_MAX;
+	memcg->wmark_high = PAGE_COUNTER_MAX;
+	memcg->wmark_low = PAGE_COUNTER_MAX;
 	if (parent) {
 		memcg->swappiness = mem_cgroup_swappiness(parent);
 		memcg->oom_kill_disable = parent->oom_kill_disable;
+		memcg->wmark_ratio = parent->wmark_ratio;
 	}
 	if (parent && parent->use_hierarchy) {
 		memcg->use_hierarchy = true;
@@ -4390,9 +4735,21 @@ static int mem_cgroup_css_online(struct cgroup_subsys_state *css)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
 
+	/*
+	 * A memcg must be visible for memcg_expand_shrinker_maps()
+	 * by the time the maps are allocated. So, we allocate maps
+	 * here, when for_each_mem_cgroup() can't skip it.
+	 */
+	if (memcg_alloc_shrinker_maps(memcg))
+		return -ENOMEM;
+
 	/* Online state pins memcg ID, memcg ID pins CSS */
 	atomic_set(&memcg->id.ref, 1);
 	css_get(css);
+
+	if (unlikely(mem_cgroup_is_root(memcg)))
+		queue_delayed_work(system_unbound_wq, &stats_flush_dwork,
+				   2UL * HZ);
 	return 0;
 }
 
@@ -4440,7 +4797,9 @@ static void mem_cgroup_css_free(struct cgroup_subsys_state *css)
 
 	vmpressure_cleanup(&memcg->vmpressure);
 	cancel_work_sync(&memcg->high_work);
+	cancel_work_sync(&memcg->wmark_work);
 	mem_cgroup_remove_from_trees(memcg);
+	memcg_free_shrinker_maps(memcg);
 	memcg_free_kmem(memcg);
 	mem_cgroup_free(memcg);
 }
@@ -4470,9 +4829,73 @@ static void mem_cgroup_css_reset(struct cgroup_subsys_state *css)
 	memcg->low = 0;
 	memcg->high = PAGE_COUNTER_MAX;
 	memcg->soft_limit = PAGE_COUNTER_MAX;
+	setup_memcg_wmark(memcg);
 	memcg_wb_domain_size_changed(memcg);
 }
 
+/*
+ * Fold the changes made on @cpu since the last flush into @memcg's
+ * totals and hand them on to the parent.  rstat flushes the children
+ * first, so their changes are already waiting in ->stat_pending.  The
+ * propagation follows the cgroup tree regardless of use_hierarchy, the
+ * cgroup1 readers choose between the local and the hierarchical values.
+ */
+static void mem_cgroup_css_rstat_flush(struct cgroup_subsys_state *css, int cpu)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+	struct mem_cgroup *parent = mem_cgroup_from_css(css->parent);
+	struct mem_cgroup_stat_cpu *statc;
+	long delta, v;
+	int i;
+
+	statc = per_cpu_ptr(memcg->stat_cpu, cpu);
+
+	for (i = 0; i < MEMCG_NR_STAT; i++) {
+		/*
+		 * The pending changes of the subtree below are a global
+		 * counter, the first cpu of the flush collects them.
+		 */
+		delta = memcg->stat_pending[i];
+		if (delta)
+			memcg->stat_pending[i] = 0;
+
+		/* Add the changes on this cpu at this level */
+		v = READ_ONCE(statc->count[i]);
+		if (v != statc->count_prev[i]) {
+			memcg->stat_local[i] += v - statc->count_prev[i];
+			delta += v - statc->count_prev[i];
+			statc->count_prev[i] = v;
+		}
+
+		if (!delta)
+			continue;
+
+		memcg->stat[i] += delta;
+		if (parent)
+			parent->stat_pending[i] += delta;
+	}
+
+	for (i = 0; i < NR_VM_EVENT_ITEMS; i++) {
+		delta = memcg->events_pending[i];
+		if (delta)
+			memcg->events_pending[i] = 0;
+
+		v = READ_ONCE(statc->events[i]);
+		if (v != statc->events_prev[i]) {
+			memcg->events_local[i] += v - statc->events_prev[i];
+			delta += v - statc->events_prev[i];
+			statc->events_prev[i] = v;
+		}
+
+		if (!delta)
+			continue;
+
+		memcg->events[i] += delta;
+		if (parent)
+			parent->events_pending[i] += delta;
+	}
+}
+
 #ifdef CONFIG_MMU
 /* Handlers for move charge at task migration. */
 static int mem_cgroup_do_precharge(unsigned long count)
@@ -5264,6 +5687,7 @@ static ssize_t memory_high_write(struct kernfs_open_file *of,
 		return err;
 
 	memcg->high = high;
+	setup_memcg_wmark(memcg);
 
 	nr_pages = page_counter_read(&memcg->memory);
 	if (nr_pages > high)
@@ -5274,6 +5698,37 @@ static ssize_t memory_high_write(struct kernfs_open_file *of,
 	return nbytes;
 }
 
+static int memory_wmark_ratio_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
+
+	seq_printf(m, "%u\n", READ_ONCE(memcg->wmark_ratio));
+
+	return 0;
+}
+
+static ssize_t memory_wmark_ratio_write(struct kernfs_open_file *of,
+					char *buf, size_t nbytes, loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	unsigned int ratio;
+	int err;
+
+	buf = strstrip(buf);
+	err = kstrtouint(buf, 0, &ratio);
+	if (err)
+		return err;
+
+	if (ratio > 100)
+		return -EINVAL;
+
+	memcg->wmark_ratio = ratio;
+	setup_memcg_wmark(memcg);
+	memcg_check_wmark(memcg);
+
+	return nbytes;
+}
+
 static int memory_max_show(struct seq_file *m, void *v)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
@@ -5357,8 +5812,6 @@ static int memory_events_show(struct seq_file *m, void *v)
 static int memory_stat_show(struct seq_file *m, void *v)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
-	unsigned long stat[MEMCG_NR_STAT];
-	unsigned long events[NR_VM_EVENT_ITEMS];
 	int i;
 
 	/*
@@ -5372,66 +5825,77 @@ static int memory_stat_show(struct seq_file *m, void *v)
 	 * Current memory state:
 	 */
 
-	tree_stat(memcg, stat);
-	tree_events(memcg, events);
+	mem_cgroup_flush_stats();
 
 	seq_printf(m, "anon %llu\n",
-		   (u64)stat[MEMCG_RSS] * PAGE_SIZE);
+		   (u64)memcg_page_state(memcg, MEMCG_RSS) * PAGE_SIZE);
 	seq_printf(m, "file %llu\n",
-		   (u64)stat[MEMCG_CACHE] * PAGE_SIZE);
+		   (u64)memcg_page_state(memcg, MEMCG_CACHE) * PAGE_SIZE);
 	seq_printf(m, "kernel_stack %llu\n",
-		   (u64)stat[MEMCG_KERNEL_STACK_KB] * 1024);
+		   (u64)memcg_page_state(memcg, MEMCG_KERNEL_STACK_KB) *
+		   1024);
 	seq_printf(m, "slab %llu\n",
-		   (u64)(stat[NR_SLAB_RECLAIMABLE] +
-			 stat[NR_SLAB_UNRECLAIMABLE]) * PAGE_SIZE);
+		   (u64)(memcg_page_state(memcg, NR_SLAB_RECLAIMABLE) +
+			 memcg_page_state(memcg, NR_SLAB_UNRECLAIMABLE)) *
+		   PAGE_SIZE);
 	seq_printf(m, "sock %llu\n",
-		   (u64)stat[MEMCG_SOCK] * PAGE_SIZE);
+		   (u64)memcg_page_state(memcg, MEMCG_SOCK) * PAGE_SIZE);
 
 	seq_printf(m, "shmem %llu\n",
-		   (u64)stat[NR_SHMEM] * PAGE_SIZE);
+		   (u64)memcg_page_state(memcg, NR_SHMEM) * PAGE_SIZE);
 	seq_printf(m, "file_mapped %llu\n",
-		   (u64)stat[NR_FILE_MAPPED] * PAGE_SIZE);
+		   (u64)memcg_page_state(memcg, NR_FILE_MAPPED) * PAGE_SIZE);
 	seq_printf(m, "file_dirty %llu\n",
-		   (u64)stat[NR_FILE_DIRTY] * PAGE_SIZE);
+		   (u64)memcg_page_state(memcg, NR_FILE_DIRTY) * PAGE_SIZE);
 	seq_printf(m, "file_writeback %llu\n",
-		   (u64)stat[NR_WRITEBACK] * PAGE_SIZE);
-
-	for (i = 0; i < NR_LRU_LISTS; i++) {
-		struct mem_cgroup *mi;
-		unsigned long val = 0;
+		   (u64)memcg_page_state(memcg, NR_WRITEBACK) * PAGE_SIZE);
 
-		for_each_mem_cgroup_tree(mi, memcg)
-			val += mem_cgroup_nr_lru_pages(mi, BIT(i));
-		seq_printf(m, "%s %llu\n",
-			   mem_cgroup_lru_names[i], (u64)val * PAGE_SIZE);
-	}
+	for (i = 0; i < NR_LRU_LISTS; i++)
+		seq_printf(m, "%s %llu\n", mem_cgroup_lru_names[i],
+			   (u64)memcg_page_state(memcg, NR_LRU_BASE + i) *
+			   PAGE_SIZE);
 
 	seq_printf(m, "slab_reclaimable %llu\n",
-		   (u64)stat[NR_SLAB_RECLAIMABLE] * PAGE_SIZE);
+		   (u64)memcg_page_state(memcg, NR_SLAB_RECLAIMABLE) *
+		   PAGE_SIZE);
 	seq_printf(m, "slab_unreclaimable %llu\n",
-		   (u64)stat[NR_SLAB_UNRECLAIMABLE] * PAGE_SIZE);
+		   (u64)memcg_page_state(memcg, NR_SLAB_UNRECLAIMABLE) *
+		   PAGE_SIZE);
 
 	/* Accumulated memory events */
 
-	seq_printf(m, "pgfault %lu\n", events[PGFAULT]);
-	seq_printf(m, "pgmajfault %lu\n", events[PGMAJFAULT]);
-
-	seq_printf(m, "pgrefill %lu\n", events[PGREFILL]);
-	seq_printf(m, "pgscan %lu\n", events[PGSCAN_KSWAPD] +
-		   events[PGSCAN_DIRECT]);
-	seq_printf(m, "pgsteal %lu\n", events[PGSTEAL_KSWAPD] +
-		   events[PGSTEAL_DIRECT]);
-	seq_printf(m, "pgactivate %lu\n", events[PGACTIVATE]);
-	seq_printf(m, "pgdeactivate %lu\n", events[PGDEACTIVATE]);
-	seq_printf(m, "pglazyfree %lu\n", events[PGLAZYFREE]);
-	seq_printf(m, "pglazyfreed %lu\n", events[PGLAZYFREED]);
+	seq_printf(m, "pgfault %lu\n", memcg_events(memcg, PGFAULT));
+	seq_printf(m, "pgmajfault %lu\n", memcg_events(memcg, PGMAJFAULT));
+
+	seq_printf(m, "pgrefill %lu\n", memcg_events(memcg, PGREFILL));
+	seq_printf(m, "pgscan %lu\n", memcg_events(memcg, PGSCAN_KSWAPD) +
+		   memcg_events(memcg, PGSCAN_DIRECT));
+	seq_printf(m, "pgsteal %lu\n", memcg_events(memcg, PGSTEAL_KSWAPD) +
+		   memcg_events(memcg, PGSTEAL_DIRECT));
+	seq_printf(m, "pgactivate %lu\n", memcg_events(memcg, PGACTIVATE));
+	seq_printf(m, "pgdeactivate %lu\n",
+		   memcg_events(memcg, PGDEACTIVATE));
+	seq_printf(m, "pglazyfree %lu\n", memcg_events(memcg, PGLAZYFREE));
+	seq_printf(m, "pglazyfreed %lu\n", memcg_events(memcg, PGLAZYFREED));
+	seq_printf(m, "pgsteal_memcg_background %lu\n",
+		   memcg_events(memcg, PGSTEAL_MEMCG_BACKGROUND));
+	seq_printf(m, "pgsteal_memcg_direct %lu\n",
+		   memcg_events(memcg, PGSTEAL_MEMCG_DIRECT));
 
 	seq_printf(m, "workingset_refault %lu\n",
-		   stat[WORKINGSET_REFAULT]);
+		   memcg_page_state(memcg, WORKINGSET_REFAULT));
+	seq_printf(m, "workingset_refault_anon %lu\n",
+		   memcg_page_state(memcg, WORKINGSET_REFAULT_ANON));
+	seq_printf(m, "workingset_refault_file %lu\n",
+		   memcg_page_state(memcg, WORKINGSET_REFAULT_FILE));
 	seq_printf(m, "workingset_activate %lu\n",
-		   stat[WORKINGSET_ACTIVATE]);
+		   memcg_page_state(memcg, WORKINGSET_ACTIVATE));
+	seq_printf(m, "workingset_activate_anon %lu\n",
+		   memcg_page_state(memcg, WORKINGSET_ACTIVATE_ANON));
+	seq_printf(m, "workingset_activate_file %lu\n",
+		   memcg_page_state(memcg, WORKINGSET_ACTIVATE_FILE));
 	seq_printf(m, "workingset_nodereclaim %lu\n",
-		   stat[WORKINGSET_NODERECLAIM]);
+		   memcg_page_state(memcg, WORKINGSET_NODERECLAIM));
 
 	return 0;
 }
@@ -5454,6 +5918,12 @@ static struct cftype memory_files[] = {
 		.seq_show = memory_high_show,
 		.write = memory_high_write,
 	},
+	{
+		.name = "wmark_ratio",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = memory_wmark_ratio_show,
+		.write = memory_wmark_ratio_write,
+	},
 	{
 		.name = "max",
 		.flags = CFTYPE_NOT_ON_ROOT,
@@ -5481,6 +5951,7 @@ struct cgroup_subsys memory_cgrp_subsys = {
 	.css_released = mem_cgroup_css_released,
 	.css_free = mem_cgroup_css_free,
 	.css_reset = mem_cgroup_css_reset,
+	.css_rstat_flush = mem_cgroup_css_rstat_flush,
 	.can_attach = mem_cgroup_can_attach,
 	.cancel_attach = mem_cgroup_cancel_attach,
 	.post_attach = mem_cgroup_move_task,
@@ -6016,6 +6487,8 @@ static int __init mem_cgroup_init(void)
 	BUG_ON(!memcg_kmem_cache_wq);
 #endif
 
+	memcg_wmark_wq_init();
+
 	cpuhp_setup_state_nocalls(CPUHP_MM_MEMCQ_DEAD, "mm/memctrl:dead", NULL,
 				  memcg_hotplug_cpu_dead);
 
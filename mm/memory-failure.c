@@ -57,6 +57,7 @@
 #include <linux/mm_inline.h>
 #include <linux/kfifo.h>
 #include <linux/ratelimit.h>
+#include <linux/page_replica.h>
 #include "internal.h"
 #include "ras/ras_event.h"
 
@@ -520,6 +521,7 @@ static const char * const action_page_types[] = {
 	[MF_MSG_DIRTY_LRU]		= "dirty LRU page",
 	[MF_MSG_CLEAN_LRU]		= "clean LRU page",
 	[MF_MSG_TRUNCATED_LRU]		= "already truncated LRU page",
+	[MF_MSG_REPLICA]		= "page cache replica",
 	[MF_MSG_BUDDY]			= "free buddy page",
 	[MF_MSG_BUDDY_2ND]		= "free buddy page (2nd try)",
 	[MF_MSG_UNKNOWN]		= "unknown page",
@@ -740,6 +742,18 @@ static int me_swapcache_clean(struct page *p, unsigned long pfn)
 		return MF_FAILED;
 }
 
+#ifdef CONFIG_PAGECACHE_REPLICATION
+/*
+ * Page cache replica: a clean copy of a page cache page, which is not
+ * in the page cache itself.  Unmap it and drop it, and the tasks using
+ * it fault on the page cache page again.
+ */
+static int me_replica(struct page *p, unsigned long pfn)
+{
+	return page_replica_drop(p) ? MF_RECOVERED : MF_FAILED;
+}
+#endif
+
 /*
  * Huge pages. Needs work.
  * Issues:
@@ -797,6 +811,9 @@ static int me_huge_page(struct page *p, unsigned long pfn)
 #define head		(1UL << PG_head)
 #define slab		(1UL << PG_slab)
 #define reserved	(1UL << PG_reserved)
+#ifdef CONFIG_PAGECACHE_REPLICATION
+#define replica		(1UL << PG_replica)
+#endif
 
 static struct page_state {
 	unsigned long mask;
@@ -819,6 +836,10 @@ static struct page_state {
 
 	{ head,		head,		MF_MSG_HUGE,		me_huge_page },
 
+#ifdef CONFIG_PAGECACHE_REPLICATION
+	{ replica,	replica,	MF_MSG_REPLICA,	me_replica },
+#endif
+
 	{ sc|dirty,	sc|dirty,	MF_MSG_DIRTY_SWAPCACHE,	me_swapcache_dirty },
 	{ sc|dirty,	sc,		MF_MSG_CLEAN_SWAPCACHE,	me_swapcache_clean },
 
@@ -846,6 +867,7 @@ static struct page_state {
 #undef head
 #undef slab
 #undef reserved
+#undef replica
 
 /*
  * "Dirty/Clean" indication is not 100% accurate due to the possibility of
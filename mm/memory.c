@@ -52,6 +52,8 @@
 #include <linux/memremap.h>
 #include <linux/ksm.h>
 #include <linux/rmap.h>
+#include <linux/pt_share.h>
+#include <linux/pt_cow.h>
 #include <linux/export.h>
 #include <linux/delayacct.h>
 #include <linux/init.h>
@@ -973,10 +975,10 @@ struct page *vm_normal_page_pmd(struct vm_area_struct *vma, unsigned long addr,
  * covered by this vma.
  */
 
-static inline unsigned long
+unsigned long
 copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
-		pte_t *dst_pte, pte_t *src_pte, struct vm_area_struct *vma,
-		unsigned long addr, int *rss)
+		pte_t *dst_pte, pte_t *src_pte, struct vm_area_struct *dst_vma,
+		struct vm_area_struct *vma, unsigned long addr, int *rss)
 {
 	unsigned long vm_flags = vma->vm_flags;
 	pte_t pte = *src_pte;
@@ -1014,6 +1016,8 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 				pte = swp_entry_to_pte(entry);
 				if (pte_swp_soft_dirty(*src_pte))
 					pte = pte_swp_mksoft_dirty(pte);
+				if (pte_swp_uffd_wp(*src_pte))
+					pte = pte_swp_mkuffd_wp(pte);
 				set_pte_at(src_mm, addr, src_pte, pte);
 			}
 		} else if (is_device_private_entry(entry)) {
@@ -1087,13 +1091,24 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 	}
 
 out_set_pte:
+	/*
+	 * The child's vma only keeps VM_UFFD_WP if its userfaultfd context
+	 * follows the fork: otherwise drop the marker with the flag.
+	 */
+	if (!(dst_vma->vm_flags & VM_UFFD_WP)) {
+		if (pte_present(pte))
+			pte = pte_clear_uffd_wp(pte);
+		else if (pte_swp_uffd_wp(pte))
+			pte = pte_swp_clear_uffd_wp(pte);
+	}
 	set_pte_at(dst_mm, addr, dst_pte, pte);
 	return 0;
 }
 
 static int copy_pte_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
-		   pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *vma,
-		   unsigned long addr, unsigned long end)
+		   pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *dst_vma,
+		   struct vm_area_struct *vma, unsigned long addr,
+		   unsigned long end)
 {
 	pte_t *orig_src_pte, *orig_dst_pte;
 	pte_t *src_pte, *dst_pte;
@@ -1131,7 +1146,7 @@ static int copy_pte_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 			continue;
 		}
 		entry.val = copy_one_pte(dst_mm, src_mm, dst_pte, src_pte,
-							vma, addr, rss);
+					 dst_vma, vma, addr, rss);
 		if (entry.val)
 			break;
 		progress += 8;
@@ -1155,8 +1170,8 @@ static int copy_pte_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 }
 
 static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
-		pud_t *dst_pud, pud_t *src_pud, struct vm_area_struct *vma,
-		unsigned long addr, unsigned long end)
+		pud_t *dst_pud, pud_t *src_pud, struct vm_area_struct *dst_vma,
+		struct vm_area_struct *vma, unsigned long addr, unsigned long end)
 {
 	pmd_t *src_pmd, *dst_pmd;
 	unsigned long next;
@@ -1181,16 +1196,19 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 		}
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
+		if (pt_cow_fork(dst_mm, src_mm, dst_pmd, src_pmd,
+				vma, addr, next))
+			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
-						vma, addr, next))
+						dst_vma, vma, addr, next))
 			return -ENOMEM;
 	} while (dst_pmd++, src_pmd++, addr = next, addr != end);
 	return 0;
 }
 
 static inline int copy_pud_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
-		p4d_t *dst_p4d, p4d_t *src_p4d, struct vm_area_struct *vma,
-		unsigned long addr, unsigned long end)
+		p4d_t *dst_p4d, p4d_t *src_p4d, struct vm_area_struct *dst_vma,
+		struct vm_area_struct *vma, unsigned long addr, unsigned long end)
 {
 	pud_t *src_pud, *dst_pud;
 	unsigned long next;
@@ -1216,15 +1234,15 @@ static inline int copy_pud_range(struct mm_struct *dst_mm, struct mm_struct *src
 		if (pud_none_or_clear_bad(src_pud))
 			continue;
 		if (copy_pmd_range(dst_mm, src_mm, dst_pud, src_pud,
-						vma, addr, next))
+						dst_vma, vma, addr, next))
 			return -ENOMEM;
 	} while (dst_pud++, src_pud++, addr = next, addr != end);
 	return 0;
 }
 
 static inline int copy_p4d_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
-		pgd_t *dst_pgd, pgd_t *src_pgd, struct vm_area_struct *vma,
-		unsigned long addr, unsigned long end)
+		pgd_t *dst_pgd, pgd_t *src_pgd, struct vm_area_struct *dst_vma,
+		struct vm_area_struct *vma, unsigned long addr, unsigned long end)
 {
 	p4d_t *src_p4d, *dst_p4d;
 	unsigned long next;
@@ -1238,14 +1256,14 @@ static inline int copy_p4d_range(struct mm_struct *dst_mm, struct mm_struct *src
 		if (p4d_none_or_clear_bad(src_p4d))
 			continue;
 		if (copy_pud_range(dst_mm, src_mm, dst_p4d, src_p4d,
-						vma, addr, next))
+						dst_vma, vma, addr, next))
 			return -ENOMEM;
 	} while (dst_p4d++, src_p4d++, addr = next, addr != end);
 	return 0;
 }
 
 int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
-		struct vm_area_struct *vma)
+		struct vm_area_struct *dst_vma, struct vm_area_struct *vma)
 {
 	pgd_t *src_pgd, *dst_pgd;
 	unsigned long next;
@@ -1253,7 +1271,7 @@ int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 	unsigned long end = vma->vm_end;
 	unsigned long mmun_start;	/* For mmu_notifiers */
 	unsigned long mmun_end;		/* For mmu_notifiers */
-	bool is_cow;
+	bool is_cow, cow_pt;
 	int ret;
 
 	/*
@@ -1292,6 +1310,11 @@ int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		mmu_notifier_invalidate_range_start(src_mm, mmun_start,
 						    mmun_end);
 
+	/* Speculative faults must not fill a table being shared */
+	cow_pt = vma_pt_cow(vma);
+	if (cow_pt)
+		vm_write_begin(vma);
+
 	ret = 0;
 	dst_pgd = pgd_offset(dst_mm, addr);
 	src_pgd = pgd_offset(src_mm, addr);
@@ -1300,12 +1323,14 @@ int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		if (pgd_none_or_clear_bad(src_pgd))
 			continue;
 		if (unlikely(copy_p4d_range(dst_mm, src_mm, dst_pgd, src_pgd,
-					    vma, addr, next))) {
+					    dst_vma, vma, addr, next))) {
 			ret = -ENOMEM;
 			break;
 		}
 	} while (dst_pgd++, src_pgd++, addr = next, addr != end);
 
+	if (cow_pt)
+		vm_write_end(vma);
 	if (is_cow)
 		mmu_notifier_invalidate_range_end(src_mm, mmun_start, mmun_end);
 	return ret;
@@ -1430,7 +1455,9 @@ static unsigned long zap_pte_range(struct mmu_gather *tlb,
 		pte_clear_not_present_full(mm, addr, pte, tlb->fullmm);
 	} while (pte++, addr += PAGE_SIZE, addr != end);
 
-	add_mm_rss_vec(mm, rss);
+	/* Pages mapped through shareable tables are not counted, see pt_share.c */
+	if (!(vma->vm_flags & VM_SHARED_PT))
+		add_mm_rss_vec(mm, rss);
 	arch_leave_lazy_mmu_mode();
 
 	/* Do the actual TLB flush before dropping ptl */
@@ -1481,6 +1508,12 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		 */
 		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			goto next;
+		if (unlikely(vma->vm_flags & VM_SHARED_PT) &&
+		    pt_unshare(vma, pmd, addr))
+			goto next;
+		if (unlikely(pmd_cow_table(*pmd)) &&
+		    pt_cow_zap(vma, pmd, addr, next))
+			goto next;
 		next = zap_pte_range(tlb, vma, pmd, addr, next, details);
 next:
 		cond_resched();
@@ -1596,6 +1629,14 @@ static void unmap_single_vma(struct mmu_gather *tlb,
 				__unmap_hugepage_range_final(tlb, vma, start, end, NULL);
 				i_mmap_unlock_write(vma->vm_file->f_mapping);
 			}
+		} else if (unlikely(vma->vm_flags & VM_SHARED_PT) && !details) {
+			/*
+			 * Shared PTE tables are detached under i_mmap_rwsem,
+			 * which unmap_mapping_range() already holds.
+			 */
+			i_mmap_lock_write(vma->vm_file->f_mapping);
+			unmap_page_range(tlb, vma, start, end, details);
+			i_mmap_unlock_write(vma->vm_file->f_mapping);
 		} else
 			unmap_page_range(tlb, vma, start, end, details);
 	}
@@ -2340,6 +2381,117 @@ int apply_to_page_range(struct mm_struct *mm, unsigned long addr,
 }
 EXPORT_SYMBOL_GPL(apply_to_page_range);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * A speculative fault works on a snapshot of the vma taken without
+ * mmap_sem.  The real vma may since have been unlinked from the tree
+ * or modified, in which case the fault has to be retried the classic way.
+ */
+static inline bool vma_has_changed(struct vm_fault *vmf)
+{
+	struct vm_area_struct *vma = vmf->spec_vma;
+
+	return RB_EMPTY_NODE(&vma->vm_rb) ||
+	       read_seqcount_retry(&vma->vm_sequence, vmf->sequence);
+}
+
+/*
+ * Take the pte lock of a speculative fault.  Interrupts are disabled
+ * while the pmd is checked, which holds off the TLB shootdown that must
+ * precede freeing the page table.  The lock is only tried: its holder
+ * may be waiting for that very shootdown to be acknowledged by us.
+ */
+static bool pte_spinlock(struct vm_fault *vmf)
+{
+	bool ret = false;
+	pmd_t pmdval;
+
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE)) {
+		vmf->ptl = pte_lockptr(vmf->vma->vm_mm, vmf->pmd);
+		spin_lock(vmf->ptl);
+		return true;
+	}
+
+	local_irq_disable();
+	if (vma_has_changed(vmf))
+		goto out;
+
+	pmdval = READ_ONCE(*vmf->pmd);
+	if (!pmd_same(pmdval, vmf->orig_pmd))
+		goto out;
+
+	vmf->ptl = pte_lockptr(vmf->vma->vm_mm, &pmdval);
+	if (unlikely(!spin_trylock(vmf->ptl)))
+		goto out;
+
+	if (vma_has_changed(vmf)) {
+		spin_unlock(vmf->ptl);
+		goto out;
+	}
+
+	ret = true;
+out:
+	local_irq_enable();
+	return ret;
+}
+
+/* As pte_spinlock(), but also (re)maps vmf->pte. */
+static bool pte_map_lock(struct vm_fault *vmf)
+{
+	bool ret = false;
+	pte_t *pte;
+	spinlock_t *ptl;
+	pmd_t pmdval;
+
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE)) {
+		vmf->pte = pte_offset_map_lock(vmf->vma->vm_mm, vmf->pmd,
+					       vmf->address, &vmf->ptl);
+		return true;
+	}
+
+	local_irq_disable();
+	if (vma_has_changed(vmf))
+		goto out;
+
+	pmdval = READ_ONCE(*vmf->pmd);
+	if (!pmd_same(pmdval, vmf->orig_pmd))
+		goto out;
+
+	ptl = pte_lockptr(vmf->vma->vm_mm, &pmdval);
+	pte = pte_offset_map(&pmdval, vmf->address);
+	if (unlikely(!spin_trylock(ptl))) {
+		pte_unmap(pte);
+		goto out;
+	}
+
+	if (vma_has_changed(vmf)) {
+		pte_unmap_unlock(pte, ptl);
+		goto out;
+	}
+
+	vmf->pte = pte;
+	vmf->ptl = ptl;
+	ret = true;
+out:
+	local_irq_enable();
+	return ret;
+}
+#else
+static inline bool pte_spinlock(struct vm_fault *vmf)
+{
+	vmf->ptl = pte_lockptr(vmf->vma->vm_mm, vmf->pmd);
+	spin_lock(vmf->ptl);
+	return true;
+}
+
+static inline bool pte_map_lock(struct vm_fault *vmf)
+{
+	vmf->pte = pte_offset_map_lock(vmf->vma->vm_mm, vmf->pmd,
+				       vmf->address, &vmf->ptl);
+	return true;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 /*
  * handle_pte_fault chooses page fault handler according to an entry which was
  * read non-atomically.  Before making any commitment, on those architectures
@@ -2637,7 +2789,14 @@ static int wp_page_copy(struct vm_fault *vmf)
 	/*
 	 * Re-check the pte - we dropped the lock
 	 */
-	vmf->pte = pte_offset_map_lock(mm, vmf->pmd, vmf->address, &vmf->ptl);
+	if (!pte_map_lock(vmf)) {
+		mmu_notifier_invalidate_range_end(mm, mmun_start, mmun_end);
+		mem_cgroup_cancel_charge(new_page, memcg, false);
+		put_page(new_page);
+		if (old_page)
+			put_page(old_page);
+		return VM_FAULT_RETRY;
+	}
 	if (likely(pte_same(*vmf->pte, vmf->orig_pte))) {
 		if (old_page) {
 			if (!PageAnon(old_page)) {
@@ -2838,6 +2997,11 @@ static int do_wp_page(struct vm_fault *vmf)
 {
 	struct vm_area_struct *vma = vmf->vma;
 
+	if (userfaultfd_pte_wp(vma, *vmf->pte)) {
+		pte_unmap_unlock(vmf->pte, vmf->ptl);
+		return handle_userfault(vmf, VM_UFFD_WP);
+	}
+
 	vmf->page = vm_normal_page(vma, vmf->address, vmf->orig_pte);
 	if (!vmf->page) {
 		/*
@@ -2865,8 +3029,11 @@ static int do_wp_page(struct vm_fault *vmf)
 			get_page(vmf->page);
 			pte_unmap_unlock(vmf->pte, vmf->ptl);
 			lock_page(vmf->page);
-			vmf->pte = pte_offset_map_lock(vma->vm_mm, vmf->pmd,
-					vmf->address, &vmf->ptl);
+			if (!pte_map_lock(vmf)) {
+				unlock_page(vmf->page);
+				put_page(vmf->page);
+				return VM_FAULT_RETRY;
+			}
 			if (!pte_same(*vmf->pte, vmf->orig_pte)) {
 				unlock_page(vmf->page);
 				pte_unmap_unlock(vmf->pte, vmf->ptl);
@@ -2993,7 +3160,7 @@ EXPORT_SYMBOL(unmap_mapping_range);
 int do_swap_page(struct vm_fault *vmf)
 {
 	struct vm_area_struct *vma = vmf->vma;
-	struct page *page = NULL, *swapcache;
+	struct page *page = NULL, *swapcache = NULL;
 	struct mem_cgroup *memcg;
 	struct vma_swap_readahead swap_ra;
 	swp_entry_t entry;
@@ -3002,9 +3169,13 @@ int do_swap_page(struct vm_fault *vmf)
 	int exclusive = 0;
 	int ret = 0;
 	bool vma_readahead = swap_use_vma_readahead();
+	bool need_clear_cache = false;
 
-	if (vma_readahead)
+	if (vma_readahead) {
 		page = swap_readahead_detect(vmf, &swap_ra);
+		swapcache = page;
+	}
+
 	if (!pte_unmap_same(vma->vm_mm, vmf->pmd, vmf->pte, vmf->orig_pte)) {
 		if (page)
 			put_page(page);
@@ -3033,16 +3204,54 @@ int do_swap_page(struct vm_fault *vmf)
 		goto out;
 	}
 	delayacct_set_flag(DELAYACCT_PF_SWAPIN);
-	if (!page)
+	if (!page) {
 		page = lookup_swap_cache(entry, vma_readahead ? vma : NULL,
 					 vmf->address);
+		swapcache = page;
+	}
+
 	if (!page) {
-		if (vma_readahead)
-			page = do_swap_page_readahead(entry,
-				GFP_HIGHUSER_MOVABLE, vmf, &swap_ra);
-		else
-			page = swapin_readahead(entry,
-				GFP_HIGHUSER_MOVABLE, vma, vmf->address);
+		struct swap_info_struct *si = swp_swap_info(entry);
+
+		if (si->flags & SWP_SYNCHRONOUS_IO &&
+				__swp_swapcount(entry) == 1) {
+			/*
+			 * The entry is mapped only here: skip the swapcache
+			 * and readahead, and read straight into a new page.
+			 * SWAP_HAS_CACHE still keeps a racing fault on the
+			 * same entry, or swapoff, from reading it in too: if
+			 * somebody has it, let them finish and fault again.
+			 */
+			if (swapcache_prepare(entry)) {
+				delayacct_clear_flag(DELAYACCT_PF_SWAPIN);
+				schedule_timeout_uninterruptible(1);
+				goto out;
+			}
+			need_clear_cache = true;
+			page = alloc_page_vma(GFP_HIGHUSER_MOVABLE, vma,
+					      vmf->address);
+			if (page) {
+				void *shadow;
+
+				__SetPageLocked(page);
+				__SetPageSwapBacked(page);
+				set_page_private(page, entry.val);
+				shadow = get_shadow_from_swap_cache(entry);
+				if (shadow && workingset_refault(page, shadow))
+					SetPageActive(page);
+				lru_cache_add_anon(page);
+				swap_readpage(page, true);
+			}
+		} else {
+			if (vma_readahead)
+				page = do_swap_page_readahead(entry,
+					GFP_HIGHUSER_MOVABLE, vmf, &swap_ra);
+			else
+				page = swapin_readahead(entry,
+					GFP_HIGHUSER_MOVABLE, vma, vmf->address);
+			swapcache = page;
+		}
+
 		if (!page) {
 			/*
 			 * Back out if somebody else faulted in this pte
@@ -3067,11 +3276,9 @@ int do_swap_page(struct vm_fault *vmf)
 		 */
 		ret = VM_FAULT_HWPOISON;
 		delayacct_clear_flag(DELAYACCT_PF_SWAPIN);
-		swapcache = page;
 		goto out_release;
 	}
 
-	swapcache = page;
 	locked = lock_page_or_retry(page, vma->vm_mm, vmf->flags);
 
 	delayacct_clear_flag(DELAYACCT_PF_SWAPIN);
@@ -3086,7 +3293,8 @@ int do_swap_page(struct vm_fault *vmf)
 	 * test below, are not enough to exclude that.  Even if it is still
 	 * swapcache, we need to check that the page's swap has not changed.
 	 */
-	if (unlikely(!PageSwapCache(page) || page_private(page) != entry.val))
+	if (unlikely((!PageSwapCache(page) ||
+			page_private(page) != entry.val)) && swapcache)
 		goto out_page;
 
 	page = ksm_might_need_to_copy(page, vma, vmf->address);
@@ -3137,24 +3345,31 @@ int do_swap_page(struct vm_fault *vmf)
 	flush_icache_page(vma, page);
 	if (pte_swp_soft_dirty(vmf->orig_pte))
 		pte = pte_mksoft_dirty(pte);
+	if (pte_swp_uffd_wp(vmf->orig_pte)) {
+		pte = pte_mkuffd_wp(pte);
+		pte = pte_wrprotect(pte);
+	}
 	set_pte_at(vma->vm_mm, vmf->address, vmf->pte, pte);
 	vmf->orig_pte = pte;
-	if (page == swapcache) {
-		do_page_add_anon_rmap(page, vma, vmf->address, exclusive);
-		mem_cgroup_commit_charge(page, memcg, true, false);
-		activate_page(page);
-	} else { /* ksm created a completely new copy */
+	if (unlikely(page != swapcache && swapcache)) {
+		/* ksm created a completely new copy */
 		page_add_new_anon_rmap(page, vma, vmf->address, false);
 		mem_cgroup_commit_charge(page, memcg, false, false);
 		lru_cache_add_active_or_unevictable(page, vma);
+	} else {
+		do_page_add_anon_rmap(page, vma, vmf->address, exclusive);
+		mem_cgroup_commit_charge(page, memcg, true, false);
+		activate_page(page);
 	}
 
 	swap_free(entry);
+	if (!swapcache)
+		set_page_private(page, 0);
 	if (mem_cgroup_swap_full(page) ||
 	    (vma->vm_flags & VM_LOCKED) || PageMlocked(page))
 		try_to_free_swap(page);
 	unlock_page(page);
-	if (page != swapcache) {
+	if (page != swapcache && swapcache) {
 		/*
 		 * Hold the lock to avoid the swap entry to be reused
 		 * until we take the PT lock for the pte_same() check
@@ -3179,6 +3394,9 @@ int do_swap_page(struct vm_fault *vmf)
 unlock:
 	pte_unmap_unlock(vmf->pte, vmf->ptl);
 out:
+	/* The pte is set up or backed out: the entry can be reused now */
+	if (need_clear_cache)
+		swapcache_clear(entry);
 	return ret;
 out_nomap:
 	mem_cgroup_cancel_charge(page, memcg, false);
@@ -3187,10 +3405,12 @@ int do_swap_page(struct vm_fault *vmf)
 	unlock_page(page);
 out_release:
 	put_page(page);
-	if (page != swapcache) {
+	if (page != swapcache && swapcache) {
 		unlock_page(swapcache);
 		put_page(swapcache);
 	}
+	if (need_clear_cache)
+		swapcache_clear(entry);
 	return ret;
 }
 
@@ -3220,21 +3440,27 @@ static int do_anonymous_page(struct vm_fault *vmf)
 	 * parallel threads are excluded by other means.
 	 *
 	 * Here we only have down_read(mmap_sem).
+	 *
+	 * A speculative fault only gets here with a page table already in
+	 * place: handle_speculative_fault() checked that on its walk and
+	 * pte_map_lock() revalidates it.
 	 */
-	if (pte_alloc(vma->vm_mm, vmf->pmd, vmf->address))
-		return VM_FAULT_OOM;
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE)) {
+		if (pte_alloc(vma->vm_mm, vmf->pmd, vmf->address))
+			return VM_FAULT_OOM;
 
-	/* See the comment in pte_alloc_one_map() */
-	if (unlikely(pmd_trans_unstable(vmf->pmd)))
-		return 0;
+		/* See the comment in pte_alloc_one_map() */
+		if (unlikely(pmd_trans_unstable(vmf->pmd)))
+			return 0;
+	}
 
 	/* Use the zero-page for reads */
 	if (!(vmf->flags & FAULT_FLAG_WRITE) &&
 			!mm_forbids_zeropage(vma->vm_mm)) {
 		entry = pte_mkspecial(pfn_pte(my_zero_pfn(vmf->address),
 						vma->vm_page_prot));
-		vmf->pte = pte_offset_map_lock(vma->vm_mm, vmf->pmd,
-				vmf->address, &vmf->ptl);
+		if (!pte_map_lock(vmf))
+			return VM_FAULT_RETRY;
 		if (!pte_none(*vmf->pte))
 			goto unlock;
 		ret = check_stable_address_space(vma->vm_mm);
@@ -3269,8 +3495,10 @@ static int do_anonymous_page(struct vm_fault *vmf)
 	if (vma->vm_flags & VM_WRITE)
 		entry = pte_mkwrite(pte_mkdirty(entry));
 
-	vmf->pte = pte_offset_map_lock(vma->vm_mm, vmf->pmd, vmf->address,
-			&vmf->ptl);
+	if (!pte_map_lock(vmf)) {
+		ret = VM_FAULT_RETRY;
+		goto release_nolock;
+	}
 	if (!pte_none(*vmf->pte))
 		goto release;
 
@@ -3302,6 +3530,10 @@ static int do_anonymous_page(struct vm_fault *vmf)
 	mem_cgroup_cancel_charge(page, memcg, false);
 	put_page(page);
 	goto unlock;
+release_nolock:
+	mem_cgroup_cancel_charge(page, memcg, false);
+	put_page(page);
+	return ret;
 oom_free_page:
 	put_page(page);
 oom:
@@ -3382,6 +3614,9 @@ static int pte_alloc_one_map(struct vm_fault *vmf)
 {
 	struct vm_area_struct *vma = vmf->vma;
 
+	/* The speculative walk only gets here with a page table in place */
+	if (vmf->flags & FAULT_FLAG_SPECULATIVE)
+		goto lock_pte;
 	if (!pmd_none(*vmf->pmd))
 		goto map_pte;
 	if (vmf->prealloc_pte) {
@@ -3422,8 +3657,9 @@ static int pte_alloc_one_map(struct vm_fault *vmf)
 	 * pte_none() under vmf->ptl protection when we return to
 	 * alloc_set_pte().
 	 */
-	vmf->pte = pte_offset_map_lock(vma->vm_mm, vmf->pmd, vmf->address,
-			&vmf->ptl);
+lock_pte:
+	if (!pte_map_lock(vmf))
+		return VM_FAULT_RETRY;
 	return 0;
 }
 
@@ -3539,7 +3775,8 @@ int alloc_set_pte(struct vm_fault *vmf, struct mem_cgroup *memcg,
 	pte_t entry;
 	int ret;
 
-	if (pmd_none(*vmf->pmd) && PageTransCompound(page) &&
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE) &&
+			pmd_none(*vmf->pmd) && PageTransCompound(page) &&
 			IS_ENABLED(CONFIG_TRANSPARENT_HUGE_PAGECACHE)) {
 		/* THP on COW? */
 		VM_BUG_ON_PAGE(memcg, page);
@@ -3570,7 +3807,8 @@ int alloc_set_pte(struct vm_fault *vmf, struct mem_cgroup *memcg,
 		mem_cgroup_commit_charge(page, memcg, false, false);
 		lru_cache_add_active_or_unevictable(page, vma);
 	} else {
-		inc_mm_counter_fast(vma->vm_mm, mm_counter_file(page));
+		if (!(vma->vm_flags & VM_SHARED_PT))
+			inc_mm_counter_fast(vma->vm_mm, mm_counter_file(page));
 		page_add_file_rmap(page, false);
 	}
 	set_pte_at(vma->vm_mm, vmf->address, vmf->pte, entry);
@@ -3709,7 +3947,7 @@ static int do_fault_around(struct vm_fault *vmf)
 	end_pgoff = min3(end_pgoff, vma_pages(vmf->vma) + vmf->vma->vm_pgoff - 1,
 			start_pgoff + nr_pages - 1);
 
-	if (pmd_none(*vmf->pmd)) {
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE) && pmd_none(*vmf->pmd)) {
 		vmf->prealloc_pte = pte_alloc_one(vmf->vma->vm_mm,
 						  vmf->address);
 		if (!vmf->prealloc_pte)
@@ -3720,7 +3958,8 @@ static int do_fault_around(struct vm_fault *vmf)
 	vmf->vma->vm_ops->map_pages(vmf, start_pgoff, end_pgoff);
 
 	/* Huge page is mapped? Page fault is solved */
-	if (pmd_trans_huge(*vmf->pmd)) {
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE) &&
+	    pmd_trans_huge(*vmf->pmd)) {
 		ret = VM_FAULT_NOPAGE;
 		goto out;
 	}
@@ -3756,6 +3995,10 @@ static int do_read_fault(struct vm_fault *vmf)
 			return ret;
 	}
 
+	/* Only page cache hits are mapped without mmap_sem */
+	if (vmf->flags & FAULT_FLAG_SPECULATIVE)
+		return VM_FAULT_RETRY;
+
 	ret = __do_fault(vmf);
 	if (unlikely(ret & (VM_FAULT_ERROR | VM_FAULT_NOPAGE | VM_FAULT_RETRY)))
 		return ret;
@@ -3852,6 +4095,10 @@ static int do_fault(struct vm_fault *vmf)
 	struct vm_area_struct *vma = vmf->vma;
 	int ret;
 
+	if ((vmf->flags & FAULT_FLAG_SPECULATIVE) &&
+	    (!vma->vm_ops->fault || (vmf->flags & FAULT_FLAG_WRITE)))
+		return VM_FAULT_RETRY;
+
 	/*
 	 * The VMA was not fully populated on mmap() or missing VM_DONTEXPAND
 	 */
@@ -4072,7 +4319,16 @@ static int handle_pte_fault(struct vm_fault *vmf)
 {
 	pte_t entry;
 
-	if (unlikely(pmd_none(*vmf->pmd))) {
+	if (vmf->flags & FAULT_FLAG_SPECULATIVE) {
+		/*
+		 * handle_speculative_fault() already walked the page table
+		 * and sampled the pte; nothing below may trust *vmf->pmd.
+		 */
+		if (pte_none(vmf->orig_pte)) {
+			pte_unmap(vmf->pte);
+			vmf->pte = NULL;
+		}
+	} else if (unlikely(pmd_none(*vmf->pmd))) {
 		/*
 		 * Leave __pte_alloc() until later: because vm_ops->fault may
 		 * want to allocate huge page, and if we expose page table
@@ -4115,14 +4371,26 @@ static int handle_pte_fault(struct vm_fault *vmf)
 			return do_fault(vmf);
 	}
 
-	if (!pte_present(vmf->orig_pte))
+	if (!pte_present(vmf->orig_pte)) {
+		if (vmf->flags & FAULT_FLAG_SPECULATIVE) {
+			pte_unmap(vmf->pte);
+			return VM_FAULT_RETRY;
+		}
 		return do_swap_page(vmf);
+	}
 
-	if (pte_protnone(vmf->orig_pte) && vma_is_accessible(vmf->vma))
+	if (pte_protnone(vmf->orig_pte) && vma_is_accessible(vmf->vma)) {
+		if (vmf->flags & FAULT_FLAG_SPECULATIVE) {
+			pte_unmap(vmf->pte);
+			return VM_FAULT_RETRY;
+		}
 		return do_numa_page(vmf);
+	}
 
-	vmf->ptl = pte_lockptr(vmf->vma->vm_mm, vmf->pmd);
-	spin_lock(vmf->ptl);
+	if (!pte_spinlock(vmf)) {
+		pte_unmap(vmf->pte);
+		return VM_FAULT_RETRY;
+	}
 	entry = vmf->orig_pte;
 	if (unlikely(!pte_same(*vmf->pte, entry)))
 		goto unlock;
@@ -4236,6 +4504,15 @@ static int __handle_mm_fault(struct vm_area_struct *vma, unsigned long address,
 		}
 	}
 
+	if (unlikely(vma->vm_flags & VM_SHARED_PT) && pmd_none(*vmf.pmd) &&
+	    vma_pt_shareable(vma, address))
+		pt_share(vma, address, vmf.pmd);
+
+	/* Any fault on a PTE table shared with a forked mm copies it */
+	if (unlikely(pmd_cow_table(*vmf.pmd)) &&
+	    pt_cow_unshare(vma, vmf.pmd, address, GFP_KERNEL_ACCOUNT))
+		return VM_FAULT_OOM;
+
 	return handle_pte_fault(&vmf);
 }
 
@@ -4291,6 +4568,142 @@ int handle_mm_fault(struct vm_area_struct *vma, unsigned long address,
 }
 EXPORT_SYMBOL_GPL(handle_mm_fault);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Try to handle a user page fault without taking mmap_sem.  Only the
+ * simple cases are dealt with: anonymous memory, and read faults on file
+ * mappings whose pages are already in the page cache.  Anything else, or
+ * any change to the vma or the page table noticed on the way, returns
+ * VM_FAULT_RETRY and the caller falls back to handle_mm_fault().
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_fault vmf = {
+		.address = address & PAGE_MASK,
+	};
+	struct vm_area_struct *vma, vma_copy;
+	pgd_t *pgd, pgdval;
+	p4d_t *p4d, p4dval;
+	pud_t pudval;
+	int ret;
+
+	/* Nothing here may drop mmap_sem, we don't hold it */
+	flags &= ~(FAULT_FLAG_ALLOW_RETRY | FAULT_FLAG_KILLABLE);
+	flags |= FAULT_FLAG_SPECULATIVE;
+
+	vma = get_vma(mm, address);
+	if (!vma)
+		goto out_abort;
+
+	vmf.sequence = raw_read_seqcount(&vma->vm_sequence);
+	if (vmf.sequence & 1)
+		goto out_put;
+
+	/*
+	 * userfaultfd, NUMA policies and special mappings need mmap_sem.
+	 * For files, only the page cache fault-around path is handled.
+	 * A table shared with other mappings may be detached and freed
+	 * under i_mmap_rwsem alone, which vm_sequence doesn't cover.
+	 */
+	if (vma->vm_flags & (VM_UFFD_MISSING | VM_UFFD_WP | VM_SHARED_PT))
+		goto out_put;
+	if (vma_policy(vma))
+		goto out_put;
+	if (is_vm_hugetlb_page(vma) ||
+	    (vma->vm_flags & (VM_PFNMAP | VM_MIXEDMAP | VM_IO)))
+		goto out_put;
+	if (vma->vm_ops && vma->vm_ops->map_pages != filemap_map_pages)
+		goto out_put;
+
+	if (flags & FAULT_FLAG_WRITE) {
+		if (!(vma->vm_flags & VM_WRITE) ||
+		    (vma->vm_flags & VM_SHARED))
+			goto out_put;
+		/* anon_vma_prepare() may need mmap_sem */
+		if (!vma->anon_vma)
+			goto out_put;
+	} else if (!(vma->vm_flags & (VM_READ | VM_EXEC | VM_WRITE))) {
+		goto out_put;
+	}
+
+	if (!arch_vma_access_permitted(vma, flags & FAULT_FLAG_WRITE,
+				       flags & FAULT_FLAG_INSTRUCTION,
+				       flags & FAULT_FLAG_REMOTE))
+		goto out_put;
+
+	/* Work on a stable copy; the checks above are redone at the end */
+	vma_copy = *vma;
+	if (read_seqcount_retry(&vma->vm_sequence, vmf.sequence))
+		goto out_put;
+	if (address < vma_copy.vm_start || address >= vma_copy.vm_end)
+		goto out_put;
+
+	vmf.vma = &vma_copy;
+	vmf.spec_vma = vma;
+	vmf.flags = flags;
+	vmf.pgoff = linear_page_index(&vma_copy, address);
+	vmf.gfp_mask = __get_fault_gfp_mask(&vma_copy);
+
+	/*
+	 * Walk the page table with interrupts disabled so that it can't be
+	 * freed under us, see pte_spinlock().  Huge pages and missing page
+	 * tables are left to the locked path: a none pmd could also be a
+	 * THP collapse in progress.
+	 */
+	local_irq_disable();
+	pgd = pgd_offset(mm, address);
+	pgdval = READ_ONCE(*pgd);
+	if (pgd_none(pgdval) || unlikely(pgd_bad(pgdval)))
+		goto out_walk;
+
+	p4d = p4d_offset(pgd, address);
+	p4dval = READ_ONCE(*p4d);
+	if (p4d_none(p4dval) || unlikely(p4d_bad(p4dval)))
+		goto out_walk;
+
+	vmf.pud = pud_offset(p4d, address);
+	pudval = READ_ONCE(*vmf.pud);
+	if (pud_none(pudval) || pud_trans_huge(pudval) ||
+	    pud_devmap(pudval) || unlikely(pud_bad(pudval)))
+		goto out_walk;
+
+	vmf.pmd = pmd_offset(vmf.pud, address);
+	vmf.orig_pmd = READ_ONCE(*vmf.pmd);
+	if (unlikely(pmd_none(vmf.orig_pmd) || is_swap_pmd(vmf.orig_pmd) ||
+		     pmd_trans_huge(vmf.orig_pmd) || pmd_devmap(vmf.orig_pmd) ||
+		     pmd_cow_table(vmf.orig_pmd)))
+		goto out_walk;
+
+	vmf.pte = pte_offset_map(&vmf.orig_pmd, address);
+	vmf.orig_pte = READ_ONCE(*vmf.pte);
+	local_irq_enable();
+
+	__set_current_state(TASK_RUNNING);
+	check_sync_rss_stat(current);
+
+	ret = handle_pte_fault(&vmf);
+	put_vma(vma);
+
+	/* Let the locked path report errors, OOM included */
+	if (ret & (VM_FAULT_RETRY | VM_FAULT_ERROR))
+		goto out_abort;
+
+	count_vm_event(PGFAULT);
+	count_memcg_event_mm(mm, PGFAULT);
+	count_vm_event(SPECULATIVE_PGFAULT);
+	return ret;
+
+out_walk:
+	local_irq_enable();
+out_put:
+	put_vma(vma);
+out_abort:
+	count_vm_event(SPECULATIVE_PGFAULT_ABORT);
+	return VM_FAULT_RETRY;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_P4D_FOLDED
 /*
  * Allocate p4d page table.
@@ -600,7 +600,8 @@ unsigned long change_prot_numa(struct vm_area_struct *vma,
 {
 	int nr_updated;
 
-	nr_updated = change_protection(vma, addr, end, PAGE_NONE, 0, 1);
+	nr_updated = change_protection(vma, addr, end, PAGE_NONE,
+				       MM_CP_PROT_NUMA);
 	if (nr_updated)
 		count_vm_numa_events(NUMA_PTE_UPDATES, nr_updated);
 
@@ -648,7 +649,7 @@ static int queue_pages_test_walk(unsigned long start, unsigned long end,
 		/* Similar to task_numa_work, skip inaccessible VMAs */
 		if (!is_vm_hugetlb_page(vma) &&
 			(vma->vm_flags & (VM_READ | VM_EXEC | VM_WRITE)) &&
-			!(vma->vm_flags & VM_MIXEDMAP))
+			!(vma->vm_flags & (VM_MIXEDMAP | VM_SHARED_PT)))
 			change_prot_numa(vma, start, endvma);
 		return 1;
 	}
@@ -714,8 +715,10 @@ static int vma_replace_policy(struct vm_area_struct *vma,
 			goto err_out;
 	}
 
+	vm_write_begin(vma);
 	old = vma->vm_policy;
 	vma->vm_policy = new; /* protected by mmap_sem */
+	vm_write_end(vma);
 	mpol_put(old);
 
 	return 0;
@@ -46,6 +46,7 @@
 #include <linux/page_owner.h>
 #include <linux/sched/mm.h>
 #include <linux/ptrace.h>
+#include <linux/memory.h>
 
 #include <asm/tlbflush.h>
 
@@ -240,6 +241,8 @@ static bool remove_migration_pte(struct page *page, struct vm_area_struct *vma,
 		entry = pte_to_swp_entry(*pvmw.pte);
 		if (is_write_migration_entry(entry))
 			pte = maybe_mkwrite(pte, vma);
+		else if (pte_swp_uffd_wp(*pvmw.pte))
+			pte = pte_mkuffd_wp(pte);
 
 		if (unlikely(is_zone_device_page(new))) {
 			if (is_device_private_page(new)) {
@@ -1466,6 +1469,187 @@ int migrate_pages(struct list_head *from, new_page_t get_new_page,
 }
 
 #ifdef CONFIG_NUMA
+#ifdef CONFIG_NUMA_DEMOTION
+/*
+ * Memory tiering: reclaim on a node with CPUs may migrate its cold pages
+ * to a slower memory-only node (e.g. persistent memory exposed through the
+ * kmem driver) instead of evicting them, see shrink_page_list().
+ *
+ * node_demotion[] maps every node with CPUs to the nearest node that has
+ * memory but no CPUs.  Memory-only nodes have no target themselves, so
+ * demotion can never cycle.  The table is read locklessly by reclaim and
+ * rebuilt on memory hotplug under demotion_mutex.
+ */
+static int node_demotion[MAX_NUMNODES] __read_mostly =
+	{[0 ... MAX_NUMNODES - 1] = NUMA_NO_NODE};
+static nodemask_t demotion_targets __read_mostly;
+static DEFINE_MUTEX(demotion_mutex);
+
+bool numa_demotion_enabled __read_mostly;
+
+/**
+ * next_demotion_node() - Get the next node in the demotion path
+ * @node: The starting node to lookup the next node
+ *
+ * Return: node id for next memory node in the demotion path hierarchy
+ * from @node; NUMA_NO_NODE if @node is terminal.  This does not keep
+ * @node online or guarantee that it *continues* to be the next demotion
+ * target.
+ */
+int next_demotion_node(int node)
+{
+	return READ_ONCE(node_demotion[node]);
+}
+
+/* Is @node the demotion target of some faster node? */
+bool node_is_demotion_target(int node)
+{
+	return node_isset(node, demotion_targets);
+}
+
+static void establish_demotion_targets(void)
+{
+	nodemask_t targets = NODE_MASK_NONE;
+	int node, target, best, best_distance;
+
+	mutex_lock(&demotion_mutex);
+	for_each_node(node) {
+		best = NUMA_NO_NODE;
+		best_distance = INT_MAX;
+		if (node_state(node, N_MEMORY) && node_state(node, N_CPU)) {
+			for_each_node_state(target, N_MEMORY) {
+				if (node_state(target, N_CPU))
+					continue;
+				if (node_distance(node, target) < best_distance) {
+					best = target;
+					best_distance = node_distance(node, target);
+				}
+			}
+		}
+		WRITE_ONCE(node_demotion[node], best);
+		if (best != NUMA_NO_NODE)
+			node_set(best, targets);
+	}
+	demotion_targets = targets;
+	mutex_unlock(&demotion_mutex);
+}
+
+static int demotion_memory_callback(struct notifier_block *self,
+				    unsigned long action, void *arg)
+{
+	switch (action) {
+	case MEM_ONLINE:
+	case MEM_OFFLINE:
+		establish_demotion_targets();
+		break;
+	}
+	return notifier_from_errno(0);
+}
+
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Promotion of pages found hot on a demotion target is limited to this
+ * many MB per second and node, so that NUMA hinting faults on a large
+ * slow tier do not saturate the memory bus.  0 disables promotion.
+ */
+static unsigned int promote_rate_limit_mbps __read_mostly = 65536;
+#endif
+
+#ifdef CONFIG_SYSFS
+static ssize_t demotion_enabled_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n", numa_demotion_enabled ? "true" : "false");
+}
+
+static ssize_t demotion_enabled_store(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      const char *buf, size_t count)
+{
+	if (!strncmp(buf, "true", 4) || !strncmp(buf, "1", 1))
+		numa_demotion_enabled = true;
+	else if (!strncmp(buf, "false", 5) || !strncmp(buf, "0", 1))
+		numa_demotion_enabled = false;
+	else
+		return -EINVAL;
+
+	return count;
+}
+static struct kobj_attribute demotion_enabled_attr =
+	__ATTR(demotion_enabled, 0644, demotion_enabled_show,
+	       demotion_enabled_store);
+
+#ifdef CONFIG_NUMA_BALANCING
+static ssize_t promote_rate_limit_MBps_show(struct kobject *kobj,
+					    struct kobj_attribute *attr,
+					    char *buf)
+{
+	return sprintf(buf, "%u\n", promote_rate_limit_mbps);
+}
+
+static ssize_t promote_rate_limit_MBps_store(struct kobject *kobj,
+					     struct kobj_attribute *attr,
+					     const char *buf, size_t count)
+{
+	unsigned int val;
+	int err;
+
+	err = kstrtouint(buf, 10, &val);
+	if (err)
+		return err;
+	promote_rate_limit_mbps = val;
+	return count;
+}
+static struct kobj_attribute promote_rate_limit_MBps_attr =
+	__ATTR(promote_rate_limit_MBps, 0644, promote_rate_limit_MBps_show,
+	       promote_rate_limit_MBps_store);
+#endif
+
+static struct attribute *numa_attrs[] = {
+	&demotion_enabled_attr.attr,
+#ifdef CONFIG_NUMA_BALANCING
+	&promote_rate_limit_MBps_attr.attr,
+#endif
+	NULL,
+};
+
+static struct attribute_group numa_attr_group = {
+	.attrs = numa_attrs,
+};
+
+static int __init numa_init_sysfs(void)
+{
+	int err;
+	struct kobject *numa_kobj;
+
+	numa_kobj = kobject_create_and_add("numa", mm_kobj);
+	if (!numa_kobj) {
+		pr_err("failed to create numa kobject\n");
+		return -ENOMEM;
+	}
+	err = sysfs_create_group(numa_kobj, &numa_attr_group);
+	if (err) {
+		pr_err("failed to register numa group\n");
+		goto delete_obj;
+	}
+	return 0;
+
+delete_obj:
+	kobject_put(numa_kobj);
+	return err;
+}
+subsys_initcall(numa_init_sysfs);
+#endif /* CONFIG_SYSFS */
+
+static int __init demotion_init(void)
+{
+	establish_demotion_targets();
+	hotplug_memory_notifier(demotion_memory_callback, 100);
+	return 0;
+}
+late_initcall(demotion_init);
+#endif /* CONFIG_NUMA_DEMOTION */
+
 /*
  * Move a list of individual pages
  */
@@ -1913,6 +2097,40 @@ static bool numamigrate_update_ratelimit(pg_data_t *pgdat,
 	return false;
 }
 
+#ifdef CONFIG_NUMA_DEMOTION
+/*
+ * Returns true if promoting @nr_pages from a demotion target to @pgdat
+ * would exceed promote_rate_limit_mbps in the current one second window.
+ */
+static bool numa_promotion_ratelimited(pg_data_t *pgdat,
+				       unsigned long nr_pages)
+{
+	unsigned long limit;
+
+	limit = (unsigned long)promote_rate_limit_mbps << (20 - PAGE_SHIFT);
+	if (time_after(jiffies, pgdat->numabalancing_promote_next_window)) {
+		spin_lock(&pgdat->numabalancing_migrate_lock);
+		pgdat->numabalancing_promote_nr_pages = 0;
+		pgdat->numabalancing_promote_next_window = jiffies + HZ;
+		spin_unlock(&pgdat->numabalancing_migrate_lock);
+	}
+	if (pgdat->numabalancing_promote_nr_pages + nr_pages > limit) {
+		count_vm_events(PGPROMOTE_RATELIMITED, nr_pages);
+		return true;
+	}
+
+	/* Unlocked like numabalancing_migrate_nr_pages above */
+	pgdat->numabalancing_promote_nr_pages += nr_pages;
+	return false;
+}
+#else
+static inline bool numa_promotion_ratelimited(pg_data_t *pgdat,
+					      unsigned long nr_pages)
+{
+	return false;
+}
+#endif
+
 static int numamigrate_isolate_page(pg_data_t *pgdat, struct page *page)
 {
 	int page_lru;
@@ -1966,6 +2184,7 @@ int migrate_misplaced_page(struct page *page, struct vm_area_struct *vma,
 			   int node)
 {
 	pg_data_t *pgdat = NODE_DATA(node);
+	bool promote = node_is_demotion_target(page_to_nid(page));
 	int isolated;
 	int nr_remaining;
 	LIST_HEAD(migratepages);
@@ -1985,6 +2204,8 @@ int migrate_misplaced_page(struct page *page, struct vm_area_struct *vma,
 	 */
 	if (numamigrate_update_ratelimit(pgdat, 1))
 		goto out;
+	if (promote && numa_promotion_ratelimited(pgdat, 1))
+		goto out;
 
 	isolated = numamigrate_isolate_page(pgdat, page);
 	if (!isolated)
@@ -2002,8 +2223,11 @@ int migrate_misplaced_page(struct page *page, struct vm_area_struct *vma,
 			putback_lru_page(page);
 		}
 		isolated = 0;
-	} else
+	} else {
 		count_vm_numa_event(NUMA_PAGE_MIGRATE);
+		if (promote)
+			count_vm_event(PGPROMOTE_SUCCESS);
+	}
 	BUG_ON(!list_empty(&migratepages));
 	return isolated;
 
@@ -2029,6 +2253,7 @@ int migrate_misplaced_transhuge_page(struct mm_struct *mm,
 	int isolated = 0;
 	struct page *new_page = NULL;
 	int page_lru = page_is_file_cache(page);
+	bool promote = node_is_demotion_target(page_to_nid(page));
 	unsigned long mmun_start = address & HPAGE_PMD_MASK;
 	unsigned long mmun_end = mmun_start + HPAGE_PMD_SIZE;
 
@@ -2039,6 +2264,8 @@ int migrate_misplaced_transhuge_page(struct mm_struct *mm,
 	 */
 	if (numamigrate_update_ratelimit(pgdat, HPAGE_PMD_NR))
 		goto out_dropref;
+	if (promote && numa_promotion_ratelimited(pgdat, HPAGE_PMD_NR))
+		goto out_dropref;
 
 	new_page = alloc_pages_node(node,
 		(GFP_TRANSHUGE_LIGHT | __GFP_THISNODE),
@@ -2124,6 +2351,8 @@ int migrate_misplaced_transhuge_page(struct mm_struct *mm,
 
 	count_vm_events(PGMIGRATE_SUCCESS, HPAGE_PMD_NR);
 	count_vm_numa_events(NUMA_PAGE_MIGRATE, HPAGE_PMD_NR);
+	if (promote)
+		count_vm_events(PGPROMOTE_SUCCESS, HPAGE_PMD_NR);
 
 	mod_node_page_state(page_pgdat(page),
 			NR_ISOLATED_ANON + page_lru,
@@ -2245,7 +2474,7 @@ static int migrate_vma_collect_pmd(pmd_t *pmdp,
 		}
 	}
 
-	if (unlikely(pmd_bad(*pmdp)))
+	if (unlikely(pmd_bad(*pmdp) || pmd_cow_table(*pmdp)))
 		return migrate_vma_collect_skip(start, end, walk);
 
 	ptep = pte_offset_map_lock(mm, pmdp, addr, &ptl);
@@ -2331,6 +2560,8 @@ static int migrate_vma_collect_pmd(pmd_t *pmdp,
 			swp_pte = swp_entry_to_pte(entry);
 			if (pte_soft_dirty(pte))
 				swp_pte = pte_swp_mksoft_dirty(swp_pte);
+			if (pte_uffd_wp(pte))
+				swp_pte = pte_swp_mkuffd_wp(swp_pte);
 			set_pte_at(mm, addr, ptep, swp_pte);
 
 			/*
@@ -2670,7 +2901,7 @@ static void migrate_vma_insert_page(struct migrate_vma *migrate,
 		goto abort;
 
 	/* See the comment in pte_alloc_one_map() */
-	if (unlikely(pmd_trans_unstable(pmdp)))
+	if (unlikely(pmd_trans_unstable(pmdp) || pmd_cow_table(*pmdp)))
 		goto abort;
 
 	if (unlikely(anon_vma_prepare(vma)))
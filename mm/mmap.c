@@ -155,6 +155,75 @@ void unlink_file_vma(struct vm_area_struct *vma)
 	}
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+static void __free_vma_rcu(struct rcu_head *head)
+{
+	struct vm_area_struct *vma = container_of(head, struct vm_area_struct,
+						  vm_rcu);
+
+	kmem_cache_free(vm_area_cachep, vma);
+}
+#endif
+
+static void __free_vma(struct vm_area_struct *vma)
+{
+	if (vma->vm_file)
+		fput(vma->vm_file);
+	mpol_put(vma_policy(vma));
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	/* Lockless rbtree walkers in get_vma() may still look at it */
+	call_rcu(&vma->vm_rcu, __free_vma_rcu);
+#else
+	kmem_cache_free(vm_area_cachep, vma);
+#endif
+}
+
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Find the VMA covering @addr without holding mmap_sem and take a reference
+ * on it.  The rbtree may be modified under us: the walk then either misses
+ * or finds a VMA that is being changed, which the caller detects through
+ * vm_sequence.  Either way the caller has to fall back to the locked path.
+ */
+struct vm_area_struct *get_vma(struct mm_struct *mm, unsigned long addr)
+{
+	struct vm_area_struct *vma = NULL;
+	struct rb_node *rb_node;
+
+	rcu_read_lock();
+	rb_node = READ_ONCE(mm->mm_rb.rb_node);
+	while (rb_node) {
+		struct vm_area_struct *tmp;
+
+		tmp = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+		if (READ_ONCE(tmp->vm_end) > addr) {
+			if (READ_ONCE(tmp->vm_start) <= addr) {
+				vma = tmp;
+				break;
+			}
+			rb_node = READ_ONCE(rb_node->rb_left);
+		} else
+			rb_node = READ_ONCE(rb_node->rb_right);
+	}
+	if (vma && !atomic_inc_not_zero(&vma->vm_ref_count))
+		vma = NULL;
+	rcu_read_unlock();
+
+	return vma;
+}
+
+void put_vma(struct vm_area_struct *vma)
+{
+	if (atomic_dec_and_test(&vma->vm_ref_count))
+		__free_vma(vma);
+}
+#else
+static inline void put_vma(struct vm_area_struct *vma)
+{
+	__free_vma(vma);
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 /*
  * Close a vm structure and free it, returning the next.
  */
@@ -165,10 +234,7 @@ static struct vm_area_struct *remove_vma(struct vm_area_struct *vma)
 	might_sleep();
 	if (vma->vm_ops && vma->vm_ops->close)
 		vma->vm_ops->close(vma);
-	if (vma->vm_file)
-		fput(vma->vm_file);
-	mpol_put(vma_policy(vma));
-	kmem_cache_free(vm_area_cachep, vma);
+	put_vma(vma);
 	return next;
 }
 
@@ -422,6 +488,8 @@ static void __vma_rb_erase(struct vm_area_struct *vma, struct rb_root *root)
 	 * augmented rbtree callbacks.
 	 */
 	rb_erase_augmented(&vma->vm_rb, root, &vma_gap_callbacks);
+	/* Tells speculative page faults that the vma is gone */
+	RB_CLEAR_NODE(&vma->vm_rb);
 }
 
 static __always_inline void vma_rb_erase_ignore(struct vm_area_struct *vma,
@@ -772,6 +840,10 @@ int __vma_adjust(struct vm_area_struct *vma, unsigned long start,
 		}
 	}
 again:
+	vm_write_begin(vma);
+	if (next)
+		vm_write_begin(next);
+
 	vma_adjust_trans_huge(orig_vma, start, end, adjust_next);
 
 	if (file) {
@@ -888,16 +960,17 @@ int __vma_adjust(struct vm_area_struct *vma, unsigned long start,
 			uprobe_mmap(next);
 	}
 
+	if (next)
+		vm_write_end(next);
+	vm_write_end(vma);
+
 	if (remove_next) {
-		if (file) {
+		if (file)
 			uprobe_munmap(next, next->vm_start, next->vm_end);
-			fput(file);
-		}
 		if (next->anon_vma)
 			anon_vma_merge(vma, next);
 		mm->map_count--;
-		mpol_put(vma_policy(next));
-		kmem_cache_free(vm_area_cachep, next);
+		put_vma(next);
 		/*
 		 * In mprotect's case 6 (see comments on vma_merge),
 		 * we must remove another next too. It would clutter
@@ -1699,6 +1772,7 @@ unsigned long mmap_region(struct file *file, unsigned long addr,
 	vma->vm_page_prot = vm_get_page_prot(vm_flags);
 	vma->vm_pgoff = pgoff;
 	INIT_LIST_HEAD(&vma->anon_vma_chain);
+	vma_init_speculative(vma);
 
 	if (file) {
 		if (vm_flags & VM_DENYWRITE) {
@@ -1760,8 +1834,11 @@ unsigned long mmap_region(struct file *file, unsigned long addr,
 			vma->vm_flags &= VM_LOCKED_CLEAR_MASK;
 	}
 
-	if (file)
+	if (file) {
 		uprobe_mmap(vma);
+		/* khugepaged may collapse read-only text of the file */
+		khugepaged_enter_vma_merge(vma, vma->vm_flags);
+	}
 
 	/*
 	 * New (or expanded) vma always get soft dirty status.
@@ -1770,9 +1847,11 @@ unsigned long mmap_region(struct file *file, unsigned long addr,
 	 * then new mapped in-place (which must be aimed as
 	 * a completely new data area).
 	 */
+	vm_write_begin(vma);
 	vma->vm_flags |= VM_SOFTDIRTY;
 
 	vma_set_page_prot(vma);
+	vm_write_end(vma);
 
 	return addr;
 
@@ -2320,9 +2399,11 @@ int expand_upwards(struct vm_area_struct *vma, unsigned long address)
 				if (vma->vm_flags & VM_LOCKED)
 					mm->locked_vm += grow;
 				vm_stat_account(mm, vma->vm_flags, grow);
+				vm_write_begin(vma);
 				anon_vma_interval_tree_pre_update_vma(vma);
 				vma->vm_end = address;
 				anon_vma_interval_tree_post_update_vma(vma);
+				vm_write_end(vma);
 				if (vma->vm_next)
 					vma_gap_update(vma->vm_next);
 				else
@@ -2400,10 +2481,12 @@ int expand_downwards(struct vm_area_struct *vma,
 				if (vma->vm_flags & VM_LOCKED)
 					mm->locked_vm += grow;
 				vm_stat_account(mm, vma->vm_flags, grow);
+				vm_write_begin(vma);
 				anon_vma_interval_tree_pre_update_vma(vma);
 				vma->vm_start = address;
 				vma->vm_pgoff -= grow;
 				anon_vma_interval_tree_post_update_vma(vma);
+				vm_write_end(vma);
 				vma_gap_update(vma);
 				spin_unlock(&mm->page_table_lock);
 
@@ -2565,7 +2648,9 @@ detach_vmas_to_be_unmapped(struct mm_struct *mm, struct vm_area_struct *vma,
 	insertion_point = (prev ? &prev->vm_next : &mm->mmap);
 	vma->vm_prev = NULL;
 	do {
+		vm_write_begin(vma);
 		vma_rb_erase(vma, &mm->mm_rb);
+		vm_write_end(vma);
 		mm->map_count--;
 		tail_vma = vma;
 		vma = vma->vm_next;
@@ -2606,6 +2691,7 @@ int __split_vma(struct mm_struct *mm, struct vm_area_struct *vma,
 	*new = *vma;
 
 	INIT_LIST_HEAD(&new->anon_vma_chain);
+	vma_init_speculative(new);
 
 	if (new_below)
 		new->vm_end = addr;
@@ -2969,6 +3055,7 @@ static int do_brk_flags(unsigned long addr, unsigned long len, unsigned long fla
 	}
 
 	INIT_LIST_HEAD(&vma->anon_vma_chain);
+	vma_init_speculative(vma);
 	vma->vm_mm = mm;
 	vma->vm_start = addr;
 	vma->vm_end = addr + len;
@@ -3191,6 +3278,7 @@ struct vm_area_struct *copy_vma(struct vm_area_struct **vmap,
 		if (vma_dup_policy(vma, new_vma))
 			goto out_free_vma;
 		INIT_LIST_HEAD(&new_vma->anon_vma_chain);
+		vma_init_speculative(new_vma);
 		if (anon_vma_clone(new_vma, vma))
 			goto out_free_mempol;
 		if (new_vma->vm_file)
@@ -3332,6 +3420,7 @@ static struct vm_area_struct *__install_special_mapping(
 		return ERR_PTR(-ENOMEM);
 
 	INIT_LIST_HEAD(&vma->anon_vma_chain);
+	vma_init_speculative(vma);
 	vma->vm_mm = mm;
 	vma->vm_start = addr;
 	vma->vm_end = addr + len;
@@ -24,18 +24,18 @@
 #include <linux/uaccess.h>
 #include <linux/mm-arch-hooks.h>
 #include <linux/userfaultfd_k.h>
+#include <linux/pt_cow.h>
 
 #include <asm/cacheflush.h>
 #include <asm/tlbflush.h>
 
 #include "internal.h"
 
-static pmd_t *get_old_pmd(struct mm_struct *mm, unsigned long addr)
+static pud_t *get_old_pud(struct mm_struct *mm, unsigned long addr)
 {
 	pgd_t *pgd;
 	p4d_t *p4d;
 	pud_t *pud;
-	pmd_t *pmd;
 
 	pgd = pgd_offset(mm, addr);
 	if (pgd_none_or_clear_bad(pgd))
@@ -49,6 +49,18 @@ static pmd_t *get_old_pmd(struct mm_struct *mm, unsigned long addr)
 	if (pud_none_or_clear_bad(pud))
 		return NULL;
 
+	return pud;
+}
+
+static pmd_t *get_old_pmd(struct mm_struct *mm, unsigned long addr)
+{
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pud = get_old_pud(mm, addr);
+	if (!pud)
+		return NULL;
+
 	pmd = pmd_offset(pud, addr);
 	if (pmd_none(*pmd))
 		return NULL;
@@ -56,19 +68,27 @@ static pmd_t *get_old_pmd(struct mm_struct *mm, unsigned long addr)
 	return pmd;
 }
 
-static pmd_t *alloc_new_pmd(struct mm_struct *mm, struct vm_area_struct *vma,
+static pud_t *alloc_new_pud(struct mm_struct *mm, struct vm_area_struct *vma,
 			    unsigned long addr)
 {
 	pgd_t *pgd;
 	p4d_t *p4d;
-	pud_t *pud;
-	pmd_t *pmd;
 
 	pgd = pgd_offset(mm, addr);
 	p4d = p4d_alloc(mm, pgd, addr);
 	if (!p4d)
 		return NULL;
-	pud = pud_alloc(mm, p4d, addr);
+
+	return pud_alloc(mm, p4d, addr);
+}
+
+static pmd_t *alloc_new_pmd(struct mm_struct *mm, struct vm_area_struct *vma,
+			    unsigned long addr)
+{
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pud = alloc_new_pud(mm, vma, addr);
 	if (!pud)
 		return NULL;
 
@@ -191,6 +211,145 @@ static void move_ptes(struct vm_area_struct *vma, pmd_t *old_pmd,
 		drop_rmap_locks(vma);
 }
 
+#ifdef CONFIG_HAVE_MOVE_PMD
+/*
+ * Move a whole page table page by relocating the pmd entry pointing to
+ * it, instead of copying the ptes one by one.  The caller must make sure
+ * that both ranges cover the full PMD_SIZE extent.
+ */
+static bool move_normal_pmd(struct vm_area_struct *vma, unsigned long old_addr,
+		  unsigned long new_addr, pmd_t *old_pmd, pmd_t *new_pmd)
+{
+	spinlock_t *old_ptl, *new_ptl;
+	struct mm_struct *mm = vma->vm_mm;
+	pmd_t pmd;
+
+	/*
+	 * The destination pmd is normally empty, free_pgtables() released
+	 * it.  shift_arg_pages() moves overlapping ranges though, so fall
+	 * back to moving the ptes when a table is already installed.
+	 */
+	if (!pmd_none(*new_pmd))
+		return false;
+
+	/*
+	 * We don't have to worry about the ordering of src and dst
+	 * ptlocks because exclusive mmap_sem prevents deadlock.
+	 */
+	old_ptl = pmd_lock(mm, old_pmd);
+	new_ptl = pmd_lockptr(mm, new_pmd);
+	if (new_ptl != old_ptl)
+		spin_lock_nested(new_ptl, SINGLE_DEPTH_NESTING);
+
+	pmd = *old_pmd;
+	pmd_clear(old_pmd);
+
+	VM_BUG_ON(!pmd_none(*new_pmd));
+
+	/* Soft-dirty is not tracked at the pmd level for pte tables */
+	set_pmd_at(mm, new_addr, new_pmd, pmd);
+	flush_tlb_range(vma, old_addr, old_addr + PMD_SIZE);
+	if (new_ptl != old_ptl)
+		spin_unlock(new_ptl);
+	spin_unlock(old_ptl);
+
+	return true;
+}
+#else
+static inline bool move_normal_pmd(struct vm_area_struct *vma,
+		unsigned long old_addr, unsigned long new_addr, pmd_t *old_pmd,
+		pmd_t *new_pmd)
+{
+	return false;
+}
+#endif
+
+#ifdef CONFIG_HAVE_MOVE_PUD
+/*
+ * Same as move_normal_pmd() one level up: the pmd table, and every pte
+ * table hanging off it, changes address by rewriting a single pud.
+ */
+static bool move_normal_pud(struct vm_area_struct *vma, unsigned long old_addr,
+		  unsigned long new_addr, pud_t *old_pud, pud_t *new_pud)
+{
+	spinlock_t *old_ptl, *new_ptl;
+	struct mm_struct *mm = vma->vm_mm;
+	pud_t pud;
+
+	if (!pud_none(*new_pud))
+		return false;
+
+	old_ptl = pud_lock(mm, old_pud);
+	new_ptl = pud_lockptr(mm, new_pud);
+	if (new_ptl != old_ptl)
+		spin_lock_nested(new_ptl, SINGLE_DEPTH_NESTING);
+
+	pud = *old_pud;
+	pud_clear(old_pud);
+
+	VM_BUG_ON(!pud_none(*new_pud));
+
+	set_pud_at(mm, new_addr, new_pud, pud);
+	flush_tlb_range(vma, old_addr, old_addr + PUD_SIZE);
+	if (new_ptl != old_ptl)
+		spin_unlock(new_ptl);
+	spin_unlock(old_ptl);
+
+	return true;
+}
+#else
+static inline bool move_normal_pud(struct vm_area_struct *vma,
+		unsigned long old_addr, unsigned long new_addr, pud_t *old_pud,
+		pud_t *new_pud)
+{
+	return false;
+}
+#endif
+
+/*
+ * Size of the next step when moving at @size granularity: the distance to
+ * the next @size boundary of both the old and the new address, capped by
+ * what is left to move.
+ */
+static unsigned long get_extent(unsigned long old_addr, unsigned long old_end,
+				unsigned long new_addr, unsigned long size)
+{
+	unsigned long next, extent;
+
+	next = (old_addr + size) & ~(size - 1);
+	/* even if next overflowed, extent below will be ok */
+	extent = next - old_addr;
+	if (extent > old_end - old_addr)
+		extent = old_end - old_addr;
+	next = (new_addr + size) & ~(size - 1);
+	if (extent > next - new_addr)
+		extent = next - new_addr;
+	return extent;
+}
+
+/*
+ * Page table level moves do not take the pte lock, so rmap walkers could
+ * find the page mapped at neither address, or through a stale TLB entry
+ * after they unmapped it.  Always hold the rmap locks around them.
+ */
+static bool move_pgt_entry(struct vm_area_struct *vma, unsigned long old_addr,
+			   unsigned long new_addr, void *old_entry,
+			   void *new_entry, bool pud_level)
+{
+	bool moved;
+
+	take_rmap_locks(vma);
+	if (pud_level)
+		moved = move_normal_pud(vma, old_addr, new_addr,
+					old_entry, new_entry);
+	else
+		moved = move_normal_pmd(vma, old_addr, new_addr,
+					old_entry, new_entry);
+	drop_rmap_locks(vma);
+
+	return moved;
+}
+
 #define LATENCY_LIMIT	(64 * PAGE_SIZE)
 
 unsigned long move_page_tables(struct vm_area_struct *vma,
@@ -215,6 +374,26 @@ unsigned long move_page_tables(struct vm_area_struct *vma,
 
 	for (; old_addr < old_end; old_addr += extent, new_addr += extent) {
 		cond_resched();
+		/*
+		 * If both ranges cover a whole aligned PUD, move the pmd
+		 * table at once.
+		 */
+		extent = get_extent(old_addr, old_end, new_addr, PUD_SIZE);
+		if (IS_ENABLED(CONFIG_HAVE_MOVE_PUD) && extent == PUD_SIZE &&
+		    !is_vm_hugetlb_page(vma)) {
+			pud_t *old_pud, *new_pud;
+
+			old_pud = get_old_pud(vma->vm_mm, old_addr);
+			if (!old_pud)
+				continue;
+			new_pud = alloc_new_pud(vma->vm_mm, vma, new_addr);
+			if (!new_pud)
+				break;
+			if (move_pgt_entry(vma, old_addr, new_addr,
+					   old_pud, new_pud, true))
+				continue;
+		}
+
 		next = (old_addr + PMD_SIZE) & PMD_MASK;
 		/* even if next overflowed, extent below will be ok */
 		extent = next - old_addr;
@@ -243,11 +422,23 @@ unsigned long move_page_tables(struct vm_area_struct *vma,
 			if (pmd_trans_unstable(old_pmd))
 				continue;
 		}
-		if (pte_alloc(new_vma->vm_mm, new_pmd, new_addr))
-			break;
 		next = (new_addr + PMD_SIZE) & PMD_MASK;
 		if (extent > next - new_addr)
 			extent = next - new_addr;
+		/*
+		 * A whole pte table to move: hand it over to the new pmd
+		 * instead of moving its entries one by one.
+		 */
+		if (IS_ENABLED(CONFIG_HAVE_MOVE_PMD) && extent == PMD_SIZE) {
+			if (move_pgt_entry(vma, old_addr, new_addr,
+					   old_pmd, new_pmd, false))
+				continue;
+		}
+		if (unlikely(pmd_cow_table(*old_pmd)) &&
+		    pt_cow_unshare(vma, old_pmd, old_addr, GFP_KERNEL_ACCOUNT))
+			break;
+		if (pte_alloc(new_vma->vm_mm, new_pmd, new_addr))
+			break;
 		if (extent > LATENCY_LIMIT)
 			extent = LATENCY_LIMIT;
 		move_ptes(vma, old_pmd, old_addr, old_addr + extent, new_vma,
@@ -295,12 +486,27 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 	if (err)
 		return err;
 
+	/*
+	 * PTEs are not moved out of shareable tables: drop them, the new
+	 * range refaults and may share again.
+	 */
+	if (vma->vm_flags & VM_SHARED_PT)
+		zap_page_range(vma, old_addr, old_len);
+
 	new_pgoff = vma->vm_pgoff + ((old_addr - vma->vm_start) >> PAGE_SHIFT);
 	new_vma = copy_vma(&vma, new_addr, new_len, new_pgoff,
 			   &need_rmap_locks);
 	if (!new_vma)
 		return -ENOMEM;
 
+	/*
+	 * Keep speculative faults off both areas while page table entries
+	 * are moved underneath them; copy_vma() may have handed back the
+	 * source vma itself when moving within a merged area.
+	 */
+	vm_write_begin(vma);
+	if (new_vma != vma)
+		vm_write_begin(new_vma);
 	moved_len = move_page_tables(vma, old_addr, new_vma, new_addr, old_len,
 				     need_rmap_locks);
 	if (moved_len < old_len) {
@@ -317,11 +523,17 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 		 */
 		move_page_tables(new_vma, new_addr, vma, old_addr, moved_len,
 				 true);
+		if (new_vma != vma)
+			vm_write_end(new_vma);
+		vm_write_end(vma);
 		vma = new_vma;
 		old_len = new_len;
 		old_addr = new_addr;
 		new_addr = err;
 	} else {
+		if (new_vma != vma)
+			vm_write_end(new_vma);
+		vm_write_end(vma);
 		mremap_userfaultfd_prep(new_vma, uf);
 		arch_remap(mm, old_addr, old_addr + old_len,
 			   new_addr, new_addr + new_len);
@@ -68,6 +68,8 @@
 #include <linux/lockdep.h>
 #include <linux/nmi.h>
 #include <linux/khugepaged.h>
+#include <linux/psi.h>
+#include <linux/padata.h>
 
 #include <asm/sections.h>
 #include <asm/tlbflush.h>
@@ -191,6 +193,7 @@ unsigned int pageblock_order __read_mostly;
 #endif
 
 static void __free_pages_ok(struct page *page, unsigned int order);
+static void free_the_page(struct page *page, unsigned int order);
 
 /*
  * results with 256, 32 in the lowmem_reserve sysctl:
@@ -597,7 +600,7 @@ static void bad_page(struct page *page, const char *reason,
 
 void free_compound_page(struct page *page)
 {
-	__free_pages_ok(page, compound_order(page));
+	free_the_page(page, compound_order(page));
 }
 
 void prep_compound_page(struct page *page, unsigned int order)
@@ -780,6 +783,58 @@ static inline int page_is_buddy(struct page *page, struct page *buddy,
 	return 0;
 }
 
+#ifdef CONFIG_COMPACTION
+static inline struct capture_control *task_capc(struct zone *zone)
+{
+	struct capture_control *capc = current->capture_control;
+
+	return capc &&
+		!(current->flags & PF_KTHREAD) &&
+		!capc->page &&
+		capc->cc->zone == zone &&
+		capc->cc->direct_compaction ? capc : NULL;
+}
+
+static inline bool
+compaction_capture(struct capture_control *capc, struct page *page,
+		   int order, int migratetype)
+{
+	if (!capc || order != capc->cc->order)
+		return false;
+
+	/* Do not accidentally pollute CMA or isolated regions*/
+	if (is_migrate_cma(migratetype) ||
+	    is_migrate_isolate(migratetype))
+		return false;
+
+	/*
+	 * Do not let lower order allocations polluate a movable pageblock.
+	 * This might let an unmovable request use a reclaimable pageblock
+	 * and vice-versa but no more than normal fallback logic which can
+	 * have trouble finding a high-order free page.
+	 */
+	if (order < pageblock_order && migratetype == MIGRATE_MOVABLE &&
+	    capc->cc->migratetype != MIGRATE_MOVABLE)
+		return false;
+
+	capc->page = page;
+	return true;
+}
+
+#else
+static inline struct capture_control *task_capc(struct zone *zone)
+{
+	return NULL;
+}
+
+static inline bool
+compaction_capture(struct capture_control *capc, struct page *page,
+		   int order, int migratetype)
+{
+	return false;
+}
+#endif /* CONFIG_COMPACTION */
+
 /*
  * Freeing function for a buddy system allocator.
  *
@@ -814,6 +869,7 @@ static inline void __free_one_page(struct page *page,
 	unsigned long uninitialized_var(buddy_pfn);
 	struct page *buddy;
 	unsigned int max_order;
+	struct capture_control *capc = task_capc(zone);
 
 	max_order = min_t(unsigned int, MAX_ORDER - 1, pageblock_order);
 
@@ -829,6 +885,11 @@ static inline void __free_one_page(struct page *page,
 
 continue_merging:
 	while (order < max_order) {
+		if (compaction_capture(capc, page, order, migratetype)) {
+			__mod_zone_freepage_state(zone, -(1 << order),
+								migratetype);
+			return;
+		}
 		buddy_pfn = __find_buddy_pfn(pfn, order);
 		buddy = page + (buddy_pfn - pfn);
 
@@ -878,6 +939,11 @@ static inline void __free_one_page(struct page *page,
 	}
 
 done_merging:
+	/* The loop above stops short of pageblock sized requests */
+	if (compaction_capture(capc, page, order, migratetype)) {
+		__mod_zone_freepage_state(zone, -(1 << order), migratetype);
+		return;
+	}
 	set_page_order(page, order);
 
 	/*
@@ -1073,9 +1139,9 @@ static __always_inline bool free_pages_prepare(struct page *page,
 }
 
 #ifdef CONFIG_DEBUG_VM
-static inline bool free_pcp_prepare(struct page *page)
+static inline bool free_pcp_prepare(struct page *page, unsigned int order)
 {
-	return free_pages_prepare(page, 0, true);
+	return free_pages_prepare(page, order, true);
 }
 
 static inline bool bulkfree_pcp_prepare(struct page *page)
@@ -1083,9 +1149,9 @@ static inline bool bulkfree_pcp_prepare(struct page *page)
 	return false;
 }
 #else
-static bool free_pcp_prepare(struct page *page)
+static bool free_pcp_prepare(struct page *page, unsigned int order)
 {
-	return free_pages_prepare(page, 0, false);
+	return free_pages_prepare(page, order, false);
 }
 
 static bool bulkfree_pcp_prepare(struct page *page)
@@ -1094,10 +1160,71 @@ static bool bulkfree_pcp_prepare(struct page *page)
 }
 #endif /* CONFIG_DEBUG_VM */
 
+static inline bool pcp_allowed_order(unsigned int order)
+{
+	if (order <= PAGE_ALLOC_COSTLY_ORDER)
+		return true;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (order == HPAGE_PMD_ORDER)
+		return true;
+#endif
+	return false;
+}
+
+static inline unsigned int order_to_pindex(int migratetype, unsigned int order)
+{
+	unsigned int base = order;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (order > PAGE_ALLOC_COSTLY_ORDER) {
+		VM_BUG_ON(order != HPAGE_PMD_ORDER);
+		base = PAGE_ALLOC_COSTLY_ORDER + 1;
+	}
+#else
+	VM_BUG_ON(order > PAGE_ALLOC_COSTLY_ORDER);
+#endif
+
+	return MIGRATE_PCPTYPES * base + migratetype;
+}
+
+static inline unsigned int pindex_to_order(unsigned int pindex)
+{
+	unsigned int order = pindex / MIGRATE_PCPTYPES;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (order > PAGE_ALLOC_COSTLY_ORDER)
+		order = HPAGE_PMD_ORDER;
+#endif
+
+	return order;
+}
+
+/* Give a page taken off a pcp-list back to the buddy lists */
+static inline void free_pcppage(struct zone *zone, struct page *page,
+				unsigned int order, bool isolated_pageblocks)
+{
+	int mt;	/* migratetype of the to-be-freed page */
+
+	mt = get_pcppage_migratetype(page);
+	/* MIGRATE_ISOLATE page should not go to pcplists */
+	VM_BUG_ON_PAGE(is_migrate_isolate(mt), page);
+	/* Pageblock could have been isolated meanwhile */
+	if (unlikely(isolated_pageblocks))
+		mt = get_pageblock_migratetype(page);
+
+	if (bulkfree_pcp_prepare(page))
+		return;
+
+	__free_one_page(page, page_to_pfn(page), zone, order, mt);
+	trace_mm_page_pcpu_drain(page, order, mt);
+}
+
 /*
  * Frees a number of pages from the PCP lists
- * Assumes all pages on list are in same zone, and of same order.
- * count is the number of pages to free.
+ * Assumes all pages on list are in same zone.
+ * count is the number of base pages to free; the THP lists are only
+ * freed when count covers the whole pageset, see drain_zone_thps() for
+ * the rest of the time.
  *
  * If the zone was previously in an "all pages pinned" state then look to
  * see if this freeing clears that state.
@@ -1108,21 +1235,30 @@ static bool bulkfree_pcp_prepare(struct page *page)
 static void free_pcppages_bulk(struct zone *zone, int count,
 					struct per_cpu_pages *pcp)
 {
-	int migratetype = 0;
+	int pindex = 0;
 	int batch_free = 0;
+	int nr_lists = NR_PCP_LISTS;
 	bool isolated_pageblocks;
 
-	spin_lock(&zone->lock);
-	isolated_pageblocks = has_isolate_pageblock(zone);
-
 	/*
 	 * Ensure proper count is passed which otherwise would stuck in the
 	 * below while (list_empty(list)) loop.
 	 */
-	count = min(pcp->count, count);
-	while (count) {
+	if (count < pcp->count) {
+		nr_lists = NR_LOWORDER_PCP_LISTS;
+		count = min(pcp->count - pcp->thp_count, count);
+	} else {
+		count = pcp->count;
+	}
+
+	spin_lock(&zone->lock);
+	isolated_pageblocks = has_isolate_pageblock(zone);
+
+	while (count > 0) {
 		struct page *page;
 		struct list_head *list;
+		unsigned int order;
+		int nr_pages;
 
 		/*
 		 * Remove pages from lists in a round-robin fashion. A
@@ -1133,38 +1269,68 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 		 */
 		do {
 			batch_free++;
-			if (++migratetype == MIGRATE_PCPTYPES)
-				migratetype = 0;
-			list = &pcp->lists[migratetype];
+			if (++pindex == nr_lists)
+				pindex = 0;
+			list = &pcp->lists[pindex];
 		} while (list_empty(list));
 
 		/* This is the only non-empty list. Free them all. */
-		if (batch_free == MIGRATE_PCPTYPES)
+		if (batch_free == nr_lists)
 			batch_free = count;
 
+		order = pindex_to_order(pindex);
+		nr_pages = 1 << order;
 		do {
-			int mt;	/* migratetype of the to-be-freed page */
-
 			page = list_last_entry(list, struct page, lru);
 			/* must delete as __free_one_page list manipulates */
 			list_del(&page->lru);
+			pcp->count -= nr_pages;
+			if (pindex >= NR_LOWORDER_PCP_LISTS)
+				pcp->thp_count -= nr_pages;
+			count -= nr_pages;
 
-			mt = get_pcppage_migratetype(page);
-			/* MIGRATE_ISOLATE page should not go to pcplists */
-			VM_BUG_ON_PAGE(is_migrate_isolate(mt), page);
-			/* Pageblock could have been isolated meanwhile */
-			if (unlikely(isolated_pageblocks))
-				mt = get_pageblock_migratetype(page);
+			free_pcppage(zone, page, order, isolated_pageblocks);
+		} while (count > 0 && --batch_free && !list_empty(list));
+	}
+	spin_unlock(&zone->lock);
+}
 
-			if (bulkfree_pcp_prepare(page))
-				continue;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Give the THPs cached on this processor's pageset of @zone back to the
+ * buddy allocator.  They don't count against ->high, so nothing else
+ * frees them short of a full drain: the vmstat updater calls this every
+ * interval to keep them from hiding from NR_FREE_PAGES and the watermark
+ * checks for long.
+ */
+void drain_zone_thps(struct zone *zone, struct per_cpu_pages *pcp)
+{
+	unsigned long flags;
+	int pindex;
+
+	local_irq_save(flags);
+	if (!pcp->thp_count)
+		goto out;
 
-			__free_one_page(page, page_to_pfn(page), zone, 0, mt);
-			trace_mm_page_pcpu_drain(page, 0, mt);
-		} while (--count && --batch_free && !list_empty(list));
+	spin_lock(&zone->lock);
+	for (pindex = NR_LOWORDER_PCP_LISTS; pindex < NR_PCP_LISTS; pindex++) {
+		struct list_head *list = &pcp->lists[pindex];
+		struct page *page;
+
+		while (!list_empty(list)) {
+			page = list_last_entry(list, struct page, lru);
+			list_del(&page->lru);
+			pcp->count -= HPAGE_PMD_NR;
+			pcp->thp_count -= HPAGE_PMD_NR;
+			free_pcppage(zone, page, HPAGE_PMD_ORDER,
+				     has_isolate_pageblock(zone));
+		}
 	}
 	spin_unlock(&zone->lock);
+out:
+	local_irq_restore(flags);
 }
+#endif
 
 static void free_one_page(struct zone *zone,
 				struct page *page, unsigned long pfn,
@@ -1269,7 +1435,8 @@ static void __free_pages_ok(struct page *page, unsigned int order)
 	local_irq_restore(flags);
 }
 
-static void __init __free_pages_boot_core(struct page *page, unsigned int order)
+static void __init __free_pages_boot_prepare(struct page *page,
+					      unsigned int order)
 {
 	unsigned int nr_pages = 1 << order;
 	struct page *p = page;
@@ -1283,8 +1450,13 @@ static void __init __free_pages_boot_core(struct page *page, unsigned int order)
 	}
 	__ClearPageReserved(p);
 	set_page_count(p, 0);
+}
+
+static void __init __free_pages_boot_core(struct page *page, unsigned int order)
+{
+	__free_pages_boot_prepare(page, order);
 
-	page_zone(page)->managed_pages += nr_pages;
+	page_zone(page)->managed_pages += 1 << order;
 	set_page_refcounted(page);
 	__free_pages(page, order);
 }
@@ -1424,6 +1596,17 @@ void clear_zone_contiguous(struct zone *zone)
 }
 
 #ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
+/*
+ * Like __free_pages_boot_core(), but zone->managed_pages is left to the
+ * caller: deferred init frees from several threads at once.
+ */
+static void __init deferred_free_pages(struct page *page, unsigned int order)
+{
+	__free_pages_boot_prepare(page, order);
+	set_page_refcounted(page);
+	__free_pages(page, order);
+}
+
 static void __init deferred_free_range(struct page *page,
 					unsigned long pfn, int nr_pages)
 {
@@ -1436,14 +1619,14 @@ static void __init deferred_free_range(struct page *page,
 	if (nr_pages == pageblock_nr_pages &&
 	    (pfn & (pageblock_nr_pages - 1)) == 0) {
 		set_pageblock_migratetype(page, MIGRATE_MOVABLE);
-		__free_pages_boot_core(page, pageblock_order);
+		deferred_free_pages(page, pageblock_order);
 		return;
 	}
 
 	for (i = 0; i < nr_pages; i++, page++, pfn++) {
 		if ((pfn & (pageblock_nr_pages - 1)) == 0)
 			set_pageblock_migratetype(page, MIGRATE_MOVABLE);
-		__free_pages_boot_core(page, 0);
+		deferred_free_pages(page, 0);
 	}
 }
 
@@ -1457,56 +1640,40 @@ static inline void __init pgdat_init_report_one_done(void)
 		complete(&pgdat_init_all_done_comp);
 }
 
-/* Initialise remaining memory on a node */
-static int __init deferred_init_memmap(void *data)
+struct deferred_init_args {
+	struct zone *zone;
+	atomic_long_t nr_pages;
+};
+
+/*
+ * Initialise and free the struct pages of the deferred zone in
+ * [start_pfn, end_pfn).  Called concurrently for disjoint, section
+ * aligned ranges of the same zone.
+ */
+static void __init deferred_init_memmap_chunk(unsigned long start_pfn,
+					      unsigned long end_pfn, void *arg)
 {
-	pg_data_t *pgdat = data;
-	int nid = pgdat->node_id;
+	struct deferred_init_args *args = arg;
+	struct zone *zone = args->zone;
+	int nid = zone_to_nid(zone);
+	int zid = zone_idx(zone);
 	struct mminit_pfnnid_cache nid_init_state = { };
-	unsigned long start = jiffies;
-	unsigned long nr_pages = 0;
 	unsigned long walk_start, walk_end;
-	int i, zid;
-	struct zone *zone;
-	unsigned long first_init_pfn = pgdat->first_deferred_pfn;
-	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
-
-	if (first_init_pfn == ULONG_MAX) {
-		pgdat_init_report_one_done();
-		return 0;
-	}
-
-	/* Bind memory initialisation thread to a local node if possible */
-	if (!cpumask_empty(cpumask))
-		set_cpus_allowed_ptr(current, cpumask);
-
-	/* Sanity check boundaries */
-	BUG_ON(pgdat->first_deferred_pfn < pgdat->node_start_pfn);
-	BUG_ON(pgdat->first_deferred_pfn > pgdat_end_pfn(pgdat));
-	pgdat->first_deferred_pfn = ULONG_MAX;
-
-	/* Only the highest zone is deferred so find it */
-	for (zid = 0; zid < MAX_NR_ZONES; zid++) {
-		zone = pgdat->node_zones + zid;
-		if (first_init_pfn < zone_end_pfn(zone))
-			break;
-	}
+	unsigned long nr_pages = 0;
+	unsigned long flags;
+	int i;
 
 	for_each_mem_pfn_range(i, nid, &walk_start, &walk_end, NULL) {
-		unsigned long pfn, end_pfn;
+		unsigned long pfn, end_pfn_range;
 		struct page *page = NULL;
 		struct page *free_base_page = NULL;
 		unsigned long free_base_pfn = 0;
 		int nr_to_free = 0;
 
-		end_pfn = min(walk_end, zone_end_pfn(zone));
-		pfn = first_init_pfn;
-		if (pfn < walk_start)
-			pfn = walk_start;
-		if (pfn < zone->zone_start_pfn)
-			pfn = zone->zone_start_pfn;
+		pfn = max(walk_start, start_pfn);
+		end_pfn_range = min(walk_end, end_pfn);
 
-		for (; pfn < end_pfn; pfn++) {
+		for (; pfn < end_pfn_range; pfn++) {
 			if (!pfn_valid_within(pfn))
 				goto free_range;
 
@@ -1566,15 +1733,74 @@ static int __init deferred_init_memmap(void *data)
 		/* Free the last block of pages to allocator */
 		nr_pages += nr_to_free;
 		deferred_free_range(free_base_page, free_base_pfn, nr_to_free);
+	}
+
+	/* managed_pages is a plain counter, serialise the threads on it */
+	spin_lock_irqsave(&zone->lock, flags);
+	zone->managed_pages += nr_pages;
+	spin_unlock_irqrestore(&zone->lock, flags);
+
+	atomic_long_add(nr_pages, &args->nr_pages);
+}
+
+/* Initialise remaining memory on a node */
+static int __init deferred_init_memmap(void *data)
+{
+	pg_data_t *pgdat = data;
+	int nid = pgdat->node_id;
+	ktime_t start = ktime_get();
+	struct deferred_init_args args;
+	struct padata_mt_job job;
+	int zid, nr_threads;
+	struct zone *zone;
+	unsigned long first_init_pfn = pgdat->first_deferred_pfn;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	if (first_init_pfn == ULONG_MAX) {
+		pgdat_init_report_one_done();
+		return 0;
+	}
+
+	/* Bind memory initialisation thread to a local node if possible */
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+
+	/* Sanity check boundaries */
+	BUG_ON(pgdat->first_deferred_pfn < pgdat->node_start_pfn);
+	BUG_ON(pgdat->first_deferred_pfn > pgdat_end_pfn(pgdat));
+	pgdat->first_deferred_pfn = ULONG_MAX;
 
-		first_init_pfn = max(end_pfn, first_init_pfn);
+	/* Only the highest zone is deferred so find it */
+	for (zid = 0; zid < MAX_NR_ZONES; zid++) {
+		zone = pgdat->node_zones + zid;
+		if (first_init_pfn < zone_end_pfn(zone))
+			break;
 	}
+	first_init_pfn = max(first_init_pfn, zone->zone_start_pfn);
+
+	/*
+	 * Split the zone between all the CPUs of the node, the workers are
+	 * queued from here so they stay on the node.
+	 */
+	args.zone = zone;
+	atomic_long_set(&args.nr_pages, 0);
+	job = (struct padata_mt_job) {
+		.thread_fn   = deferred_init_memmap_chunk,
+		.fn_arg      = &args,
+		.start       = first_init_pfn,
+		.size        = zone_end_pfn(zone) - first_init_pfn,
+		.align       = PAGES_PER_SECTION,
+		.min_chunk   = PAGES_PER_SECTION,
+		.max_threads = max(cpumask_weight(cpumask), 1u),
+	};
+	nr_threads = padata_do_multithreaded(&job);
 
 	/* Sanity check that the next zone really is unpopulated */
 	WARN_ON(++zid < MAX_NR_ZONES && populated_zone(++zone));
 
-	pr_info("node %d initialised, %lu pages in %ums\n", nid, nr_pages,
-					jiffies_to_msecs(jiffies - start));
+	pr_info("node %d initialised, %lu pages in %lldms with %d threads\n",
+		nid, atomic_long_read(&args.nr_pages),
+		ktime_ms_delta(ktime_get(), start), nr_threads);
 
 	pgdat_init_report_one_done();
 	return 0;
@@ -1729,40 +1955,40 @@ static inline bool free_pages_prezeroed(void)
 		page_poisoning_enabled();
 }
 
+static bool check_new_pages(struct page *page, unsigned int order)
+{
+	int i;
+	for (i = 0; i < (1 << order); i++) {
+		struct page *p = page + i;
+
+		if (unlikely(check_new_page(p)))
+			return true;
+	}
+
+	return false;
+}
+
 #ifdef CONFIG_DEBUG_VM
-static bool check_pcp_refill(struct page *page)
+static bool check_pcp_refill(struct page *page, unsigned int order)
 {
 	return false;
 }
 
-static bool check_new_pcp(struct page *page)
+static bool check_new_pcp(struct page *page, unsigned int order)
 {
-	return check_new_page(page);
+	return check_new_pages(page, order);
 }
 #else
-static bool check_pcp_refill(struct page *page)
+static bool check_pcp_refill(struct page *page, unsigned int order)
 {
-	return check_new_page(page);
+	return check_new_pages(page, order);
 }
-static bool check_new_pcp(struct page *page)
+static bool check_new_pcp(struct page *page, unsigned int order)
 {
 	return false;
 }
 #endif /* CONFIG_DEBUG_VM */
 
-static bool check_new_pages(struct page *page, unsigned int order)
-{
-	int i;
-	for (i = 0; i < (1 << order); i++) {
-		struct page *p = page + i;
-
-		if (unlikely(check_new_page(p)))
-			return true;
-	}
-
-	return false;
-}
-
 inline void post_alloc_hook(struct page *page, unsigned int order,
 				gfp_t gfp_flags)
 {
@@ -2339,7 +2565,7 @@ static int rmqueue_bulk(struct zone *zone, unsigned int order,
 		if (unlikely(page == NULL))
 			break;
 
-		if (unlikely(check_pcp_refill(page)))
+		if (unlikely(check_pcp_refill(page, order)))
 			continue;
 
 		/*
@@ -2390,10 +2616,8 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 	local_irq_save(flags);
 	batch = READ_ONCE(pcp->batch);
 	to_drain = min(pcp->count, batch);
-	if (to_drain > 0) {
+	if (to_drain > 0)
 		free_pcppages_bulk(zone, to_drain, pcp);
-		pcp->count -= to_drain;
-	}
 	local_irq_restore(flags);
 }
 #endif
@@ -2415,10 +2639,8 @@ static void drain_pages_zone(unsigned int cpu, struct zone *zone)
 	pset = per_cpu_ptr(zone->pageset, cpu);
 
 	pcp = &pset->pcp;
-	if (pcp->count) {
+	if (pcp->count)
 		free_pcppages_bulk(zone, pcp->count, pcp);
-		pcp->count = 0;
-	}
 	local_irq_restore(flags);
 }
 
@@ -2601,24 +2823,25 @@ void mark_free_pages(struct zone *zone)
 #endif /* CONFIG_PM */
 
 /*
- * Free a 0-order page
+ * Free a page of an order the pcp-lists hold
  * cold == true ? free a cold page : free a hot page
  */
-void free_hot_cold_page(struct page *page, bool cold)
+static void __free_hot_cold_page(struct page *page, unsigned int order,
+				 bool cold)
 {
 	struct zone *zone = page_zone(page);
 	struct per_cpu_pages *pcp;
 	unsigned long flags;
 	unsigned long pfn = page_to_pfn(page);
-	int migratetype;
+	int migratetype, pindex;
 
-	if (!free_pcp_prepare(page))
+	if (!free_pcp_prepare(page, order))
 		return;
 
 	migratetype = get_pfnblock_migratetype(page, pfn);
 	set_pcppage_migratetype(page, migratetype);
 	local_irq_save(flags);
-	__count_vm_event(PGFREE);
+	__count_vm_events(PGFREE, 1 << order);
 
 	/*
 	 * We only track unmovable, reclaimable and movable on pcp lists.
@@ -2629,28 +2852,51 @@ void free_hot_cold_page(struct page *page, bool cold)
 	 */
 	if (migratetype >= MIGRATE_PCPTYPES) {
 		if (unlikely(is_migrate_isolate(migratetype))) {
-			free_one_page(zone, page, pfn, 0, migratetype);
+			free_one_page(zone, page, pfn, order, migratetype);
 			goto out;
 		}
 		migratetype = MIGRATE_MOVABLE;
 	}
 
 	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	pindex = order_to_pindex(migratetype, order);
+	if (pindex >= NR_LOWORDER_PCP_LISTS) {
+		/*
+		 * Keep one THP per list, and none on the boot pageset
+		 * which never gets drained.  Nor when the zone is short
+		 * of free pages: the watermark checks don't see it here.
+		 */
+		if (!pcp->high || !list_empty(&pcp->lists[pindex]) ||
+		    zone_page_state(zone, NR_FREE_PAGES) <=
+		    high_wmark_pages(zone) + (1 << order)) {
+			free_one_page(zone, page, pfn, order, migratetype);
+			goto out;
+		}
+		pcp->thp_count += 1 << order;
+	}
 	if (!cold)
-		list_add(&page->lru, &pcp->lists[migratetype]);
+		list_add(&page->lru, &pcp->lists[pindex]);
 	else
-		list_add_tail(&page->lru, &pcp->lists[migratetype]);
-	pcp->count++;
-	if (pcp->count >= pcp->high) {
+		list_add_tail(&page->lru, &pcp->lists[pindex]);
+	pcp->count += 1 << order;
+	if (pcp->count - pcp->thp_count >= pcp->high) {
 		unsigned long batch = READ_ONCE(pcp->batch);
 		free_pcppages_bulk(zone, batch, pcp);
-		pcp->count -= batch;
 	}
 
 out:
 	local_irq_restore(flags);
 }
 
+/*
+ * Free a 0-order page
+ * cold == true ? free a cold page : free a hot page
+ */
+void free_hot_cold_page(struct page *page, bool cold)
+{
+	__free_hot_cold_page(page, 0, cold);
+}
+
 /*
  * Free a list of 0-order pages
  */
@@ -2758,17 +3004,37 @@ static inline void zone_statistics(struct zone *preferred_zone, struct zone *z)
 }
 
 /* Remove page from the per-cpu list, caller must protect the list */
-static struct page *__rmqueue_pcplist(struct zone *zone, int migratetype,
-			bool cold, struct per_cpu_pages *pcp,
+static struct page *__rmqueue_pcplist(struct zone *zone, unsigned int order,
+			int migratetype, bool cold, struct per_cpu_pages *pcp,
 			struct list_head *list)
 {
+	bool thp = order > PAGE_ALLOC_COSTLY_ORDER;
+	bool refilled = false;
 	struct page *page;
 
 	do {
 		if (list_empty(list)) {
-			pcp->count += rmqueue_bulk(zone, 0,
-					pcp->batch, list,
-					migratetype, cold);
+			int batch = READ_ONCE(pcp->batch);
+			int alloced;
+
+			/*
+			 * Scale the batch down with the order, so a refill
+			 * takes about as much from the buddy lists as an
+			 * order-0 one, but keep a page or so for the next
+			 * allocation.  A THP refill takes just the page
+			 * being allocated, so THPs stay cached only when
+			 * freed.
+			 */
+			if (thp)
+				batch = 1;
+			else if (order && batch > 1)
+				batch = max(batch >> order, 2);
+			alloced = rmqueue_bulk(zone, order, batch, list,
+					       migratetype, cold);
+			pcp->count += alloced << order;
+			if (thp)
+				pcp->thp_count += alloced << order;
+			refilled = true;
 			if (unlikely(list_empty(list)))
 				return NULL;
 		}
@@ -2779,8 +3045,17 @@ static struct page *__rmqueue_pcplist(struct zone *zone, int migratetype,
 			page = list_first_entry(list, struct page, lru);
 
 		list_del(&page->lru);
-		pcp->count--;
-	} while (check_new_pcp(page));
+		pcp->count -= 1 << order;
+		if (thp)
+			pcp->thp_count -= 1 << order;
+	} while (check_new_pcp(page, order));
+
+	if (order) {
+		if (refilled)
+			pcp->high_order_miss++;
+		else
+			pcp->high_order_hit++;
+	}
 
 	return page;
 }
@@ -2798,8 +3073,8 @@ static struct page *rmqueue_pcplist(struct zone *preferred_zone,
 
 	local_irq_save(flags);
 	pcp = &this_cpu_ptr(zone->pageset)->pcp;
-	list = &pcp->lists[migratetype];
-	page = __rmqueue_pcplist(zone,  migratetype, cold, pcp, list);
+	list = &pcp->lists[order_to_pindex(migratetype, order)];
+	page = __rmqueue_pcplist(zone, order, migratetype, cold, pcp, list);
 	if (page) {
 		__count_zid_vm_events(PGALLOC, page_zonenum(page), 1 << order);
 		zone_statistics(preferred_zone, zone);
@@ -2809,7 +3084,8 @@ static struct page *rmqueue_pcplist(struct zone *preferred_zone,
 }
 
 /*
- * Allocate a page from the given zone. Use pcplists for order-0 allocations.
+ * Allocate a page from the given zone. Use pcplists for the orders they
+ * hold, see pcp_allowed_order().
  */
 static inline
 struct page *rmqueue(struct zone *preferred_zone,
@@ -2820,10 +3096,12 @@ struct page *rmqueue(struct zone *preferred_zone,
 	unsigned long flags;
 	struct page *page;
 
-	if (likely(order == 0)) {
+	if (likely(pcp_allowed_order(order))) {
 		page = rmqueue_pcplist(preferred_zone, zone, order,
 				gfp_flags, migratetype);
-		goto out;
+		/* Atomic high-order allocations may still use the reserves */
+		if (likely(page) || !order)
+			goto out;
 	}
 
 	/*
@@ -3377,19 +3655,26 @@ __alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
 		unsigned int alloc_flags, const struct alloc_context *ac,
 		enum compact_priority prio, enum compact_result *compact_result)
 {
-	struct page *page;
+	struct page *page = NULL;
+	unsigned long pflags;
 	unsigned int noreclaim_flag;
 
 	if (!order)
 		return NULL;
 
+	psi_memstall_enter(&pflags);
 	noreclaim_flag = memalloc_noreclaim_save();
+
 	*compact_result = try_to_compact_pages(gfp_mask, order, alloc_flags, ac,
-									prio);
+								prio, &page);
+
 	memalloc_noreclaim_restore(noreclaim_flag);
+	psi_memstall_leave(&pflags);
 
-	if (*compact_result <= COMPACT_INACTIVE)
+	if (*compact_result <= COMPACT_INACTIVE) {
+		WARN_ON_ONCE(page);
 		return NULL;
+	}
 
 	/*
 	 * At least in one zone compaction wasn't deferred or skipped, so let's
@@ -3397,7 +3682,13 @@ __alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
 	 */
 	count_vm_event(COMPACTSTALL);
 
-	page = get_page_from_freelist(gfp_mask, order, alloc_flags, ac);
+	/* Prep a captured page if available */
+	if (page)
+		prep_new_page(page, order, gfp_mask, alloc_flags);
+
+	/* Try get a page from the freelist if available */
+	if (!page)
+		page = get_page_from_freelist(gfp_mask, order, alloc_flags, ac);
 
 	if (page) {
 		struct zone *zone = page_zone(page);
@@ -3599,11 +3890,13 @@ __perform_reclaim(gfp_t gfp_mask, unsigned int order,
 	struct reclaim_state reclaim_state;
 	int progress;
 	unsigned int noreclaim_flag;
+	unsigned long pflags;
 
 	cond_resched();
 
 	/* We now go into synchronous reclaim */
 	cpuset_memory_pressure_bump();
+	psi_memstall_enter(&pflags);
 	noreclaim_flag = memalloc_noreclaim_save();
 	fs_reclaim_acquire(gfp_mask);
 	reclaim_state.reclaimed_slab = 0;
@@ -3615,6 +3908,7 @@ __perform_reclaim(gfp_t gfp_mask, unsigned int order,
 	current->reclaim_state = NULL;
 	fs_reclaim_release(gfp_mask);
 	memalloc_noreclaim_restore(noreclaim_flag);
+	psi_memstall_leave(&pflags);
 
 	cond_resched();
 
@@ -4277,14 +4571,18 @@ unsigned long get_zeroed_page(gfp_t gfp_mask)
 }
 EXPORT_SYMBOL(get_zeroed_page);
 
+static void free_the_page(struct page *page, unsigned int order)
+{
+	if (pcp_allowed_order(order))
+		__free_hot_cold_page(page, order, false);
+	else
+		__free_pages_ok(page, order);
+}
+
 void __free_pages(struct page *page, unsigned int order)
 {
-	if (put_page_testzero(page)) {
-		if (order == 0)
-			free_hot_cold_page(page, false);
-		else
-			__free_pages_ok(page, order);
-	}
+	if (put_page_testzero(page))
+		free_the_page(page, order);
 }
 
 EXPORT_SYMBOL(__free_pages);
@@ -4335,14 +4633,8 @@ void __page_frag_cache_drain(struct page *page, unsigned int count)
 {
 	VM_BUG_ON_PAGE(page_ref_count(page) == 0, page);
 
-	if (page_ref_sub_and_test(page, count)) {
-		unsigned int order = compound_order(page);
-
-		if (order == 0)
-			free_hot_cold_page(page, false);
-		else
-			__free_pages_ok(page, order);
-	}
+	if (page_ref_sub_and_test(page, count))
+		free_the_page(page, compound_order(page));
 }
 EXPORT_SYMBOL(__page_frag_cache_drain);
 
@@ -4420,7 +4712,7 @@ void page_frag_free(void *addr)
 	struct page *page = virt_to_head_page(addr);
 
 	if (unlikely(put_page_testzero(page)))
-		__free_pages_ok(page, compound_order(page));
+		free_the_page(page, compound_order(page));
 }
 EXPORT_SYMBOL(page_frag_free);
 
@@ -5518,14 +5810,14 @@ static void pageset_set_batch(struct per_cpu_pageset *p, unsigned long batch)
 static void pageset_init(struct per_cpu_pageset *p)
 {
 	struct per_cpu_pages *pcp;
-	int migratetype;
+	int pindex;
 
 	memset(p, 0, sizeof(*p));
 
 	pcp = &p->pcp;
 	pcp->count = 0;
-	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
-		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	for (pindex = 0; pindex < NR_PCP_LISTS; pindex++)
+		INIT_LIST_HEAD(&pcp->lists[pindex]);
 }
 
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
@@ -6092,6 +6384,8 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat)
 	spin_lock_init(&pgdat->numabalancing_migrate_lock);
 	pgdat->numabalancing_migrate_nr_pages = 0;
 	pgdat->numabalancing_migrate_next_window = jiffies;
+	pgdat->numabalancing_promote_nr_pages = 0;
+	pgdat->numabalancing_promote_next_window = jiffies;
 #endif
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 	spin_lock_init(&pgdat->split_queue_lock);
@@ -0,0 +1,469 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Per-node replication of read-only page cache.
+ *
+ * Each page of the page cache lives on a single node, usually the one
+ * which first read it, so a file mapped by tasks on every node of a
+ * large NUMA machine is mostly accessed across the interconnect.  For
+ * files which ask for it with fadvise(FADV_REPLICATE), or which live on
+ * a mount with MS_REPLICATE, a read fault from another node copies the
+ * page cache page to a page on the faulting node, a replica, and maps
+ * that instead.  The replicas of a file are kept in one radix tree per
+ * node hanging off its address_space, indexed like the page cache, so
+ * that all the tasks of a node map the same copy.
+ *
+ * A replica is not in the page cache: it carries the ->mapping and
+ * ->index of the page it was copied from, so that rmap finds where it is
+ * mapped, but it is not on the LRU and find_get_page() never returns it.
+ * PG_replica tells it apart from the page cache for the code that would
+ * otherwise take any page with a ->mapping for one: NR_FILE_MAPPED
+ * doesn't count it, truncation and page cache deletion refuse it, and
+ * memory failure simply drops it.
+ * Only clean, uptodate, small pages of regular files which nobody has
+ * open for writing are replicated, and replicas are only mapped by read
+ * faults: a write to a private mapping copies the page as usual, and
+ * shared mappings which could be made writable are never replicated.
+ *
+ * All the replicas of a file go as soon as it is opened for writing, see
+ * do_dentry_open(), and those of a range when it is truncated or
+ * invalidated.  Every invalidation bumps the sequence count of the file,
+ * so that a fault which copied a page before the invalidation throws the
+ * copy away instead of installing it.  A shrinker unmaps and frees the
+ * replicas which haven't been accessed recently.
+ *
+ * Replicas are not charged to any memory cgroup: they are not on the LRU
+ * and only the global shrinker frees them, so a memcg at its limit could
+ * not reclaim its own.  Nor are they movable, as compaction could not
+ * migrate them.  Hence only the owner of a file or CAP_SYS_ADMIN may ask
+ * for its replication, and only CAP_SYS_ADMIN may mount with
+ * MS_REPLICATE.  Replicas are counted as nr_replica_pages in
+ * /proc/vmstat, and their creation, mapping and removal as
+ * pgreplica_alloc, pgreplica_map and pgreplica_drop.
+ */
+
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/page_replica.h>
+#include <linux/pagevec.h>
+#include <linux/radix-tree.h>
+#include <linux/rmap.h>
+#include <linux/shrinker.h>
+#include <linux/slab.h>
+#include <linux/swap.h>
+
+#include "internal.h"
+
+struct page_replicas {
+	spinlock_t		lock;		/* protects seq and the trees */
+	unsigned long		seq;		/* bumped by every invalidation */
+	struct radix_tree_root	trees[];	/* one per node */
+};
+
+/* Per-node lists of replicas for the shrinker, linked through page->lru */
+struct replica_list {
+	spinlock_t		lock;
+	struct list_head	list;
+	unsigned long		nr;
+};
+
+static struct replica_list *replica_lists __read_mostly;
+
+static struct page_replicas *page_replicas_get(struct address_space *mapping)
+{
+	struct page_replicas *replicas, *old;
+	int nid;
+
+	replicas = READ_ONCE(mapping->replicas);
+	if (replicas)
+		return replicas;
+
+	replicas = kzalloc(sizeof(*replicas) +
+			   nr_node_ids * sizeof(struct radix_tree_root),
+			   GFP_KERNEL);
+	if (!replicas)
+		return NULL;
+	spin_lock_init(&replicas->lock);
+	for (nid = 0; nid < nr_node_ids; nid++)
+		INIT_RADIX_TREE(&replicas->trees[nid],
+				GFP_NOWAIT | __GFP_NOWARN);
+
+	old = cmpxchg(&mapping->replicas, NULL, replicas);
+	if (old) {
+		kfree(replicas);
+		replicas = old;
+	}
+	return replicas;
+}
+
+/* Whether a read fault from node @nid should map a replica of @page */
+static bool replica_wanted(struct vm_fault *vmf, struct page *page, int nid)
+{
+	if (unlikely(!replica_lists))
+		return false;
+	if (page_to_nid(page) == nid || PageTransCompound(page))
+		return false;
+	if (PageDirty(page) || PageWriteback(page))
+		return false;
+	if (!vma_page_replica(vmf->vma))
+		return false;
+	return !inode_is_open_for_write(page->mapping->host);
+}
+
+/* Find the replica of @index on @nid and take a reference on it */
+static struct page *replica_lookup(struct page_replicas *replicas, int nid,
+				   pgoff_t index)
+{
+	struct page *page;
+	void **slot;
+
+	rcu_read_lock();
+repeat:
+	page = NULL;
+	slot = radix_tree_lookup_slot(&replicas->trees[nid], index);
+	if (slot) {
+		page = radix_tree_deref_slot(slot);
+		if (unlikely(!page))
+			goto out;
+		if (radix_tree_deref_retry(page))
+			goto repeat;
+		if (!page_cache_get_speculative(page))
+			goto repeat;
+		/* Has the replica been dropped and the page reused? */
+		if (unlikely(page != *slot)) {
+			put_page(page);
+			goto repeat;
+		}
+	}
+out:
+	rcu_read_unlock();
+	return page;
+}
+
+/*
+ * Copy @page to node @nid and install the copy, unless the file was
+ * invalidated since @seq was read or is open for writing.  Returns the
+ * new replica locked and with a reference, or NULL.
+ */
+static struct page *replica_create(struct address_space *mapping,
+				   struct page_replicas *replicas,
+				   struct page *page, int nid,
+				   unsigned long seq)
+{
+	struct replica_list *rl = &replica_lists[nid];
+	struct page *new;
+	int err;
+
+	new = alloc_pages_node(nid, GFP_HIGHUSER | __GFP_THISNODE |
+			       __GFP_NORETRY | __GFP_NOWARN, 0);
+	if (!new)
+		return NULL;
+	copy_highpage(new, page);
+	__SetPageLocked(new);
+	__SetPageReplica(new);
+	SetPageUptodate(new);
+	new->mapping = mapping;
+	new->index = page->index;
+
+	err = radix_tree_preload(mapping_gfp_constraint(mapping, GFP_KERNEL) &
+				 GFP_RECLAIM_MASK);
+	if (err)
+		goto free;
+
+	spin_lock(&replicas->lock);
+	if (replicas->seq != seq || inode_is_open_for_write(mapping->host))
+		err = -EAGAIN;
+	else
+		err = radix_tree_insert(&replicas->trees[nid], new->index, new);
+	if (!err) {
+		spin_lock(&rl->lock);
+		list_add_tail(&new->lru, &rl->list);
+		rl->nr++;
+		spin_unlock(&rl->lock);
+	}
+	spin_unlock(&replicas->lock);
+	radix_tree_preload_end();
+	if (err)
+		goto free;
+
+	/* The tree keeps the reference from the allocation */
+	get_page(new);
+	inc_node_page_state(new, NR_REPLICA_PAGES);
+	count_vm_event(PGREPLICA_ALLOC);
+	return new;
+free:
+	new->mapping = NULL;
+	ClearPageReplica(new);
+	__ClearPageLocked(new);
+	put_page(new);
+	return NULL;
+}
+
+/*
+ * Called by filemap_fault() with the page cache page it found, locked
+ * and with a reference.  Returns the page to map: either @page, or a
+ * replica on the local node, locked and with a reference, after
+ * unlocking and releasing @page.
+ */
+struct page *page_replica_fault(struct vm_fault *vmf, struct page *page)
+{
+	struct address_space *mapping = page->mapping;
+	struct page_replicas *replicas;
+	struct page *replica;
+	int nid = numa_mem_id();
+	unsigned long seq;
+
+	if ((vmf->flags & FAULT_FLAG_WRITE) || !replica_wanted(vmf, page, nid))
+		return page;
+
+	replicas = page_replicas_get(mapping);
+	if (!replicas)
+		return page;
+	/*
+	 * Paired with the smp_mb() in do_dentry_open(): either it sees the
+	 * replicas and invalidates them, or we see its i_writecount below.
+	 */
+	smp_mb();
+	seq = READ_ONCE(replicas->seq);
+
+	replica = replica_lookup(replicas, nid, page->index);
+	if (replica) {
+		lock_page(replica);
+		if (likely(replica->mapping == mapping))
+			goto found;
+		unlock_page(replica);
+		put_page(replica);
+	}
+
+	replica = replica_create(mapping, replicas, page, nid, seq);
+	if (!replica)
+		return page;
+found:
+	unlock_page(page);
+	put_page(page);
+	count_vm_event(PGREPLICA_MAP);
+	return replica;
+}
+
+/*
+ * Called by filemap_map_pages() under RCU, with a page cache page it is
+ * about to map, locked and with a reference.  Returns the page to map,
+ * locked and with a reference: @page, or its replica on the local node.
+ * If @page should be replicated but no replica exists yet, returns NULL
+ * after releasing @page, and the fault on that address makes one.
+ */
+struct page *page_replica_map(struct vm_fault *vmf, struct page *page)
+{
+	struct address_space *mapping = page->mapping;
+	struct page_replicas *replicas;
+	struct page *replica = NULL;
+	int nid = numa_mem_id();
+
+	if (!replica_wanted(vmf, page, nid))
+		return page;
+
+	replicas = READ_ONCE(mapping->replicas);
+	if (replicas)
+		replica = replica_lookup(replicas, nid, page->index);
+	unlock_page(page);
+	put_page(page);
+	if (!replica)
+		return NULL;
+
+	if (!trylock_page(replica))
+		goto put;
+	if (unlikely(replica->mapping != mapping)) {
+		unlock_page(replica);
+		goto put;
+	}
+	count_vm_event(PGREPLICA_MAP);
+	return replica;
+put:
+	put_page(replica);
+	return NULL;
+}
+
+/*
+ * Take a locked, unmapped replica out of its tree and drop the reference
+ * of the tree.  The caller holds another reference.
+ */
+static void replica_remove(struct page_replicas *replicas, struct page *page)
+{
+	int nid = page_to_nid(page);
+	struct replica_list *rl = &replica_lists[nid];
+
+	spin_lock(&replicas->lock);
+	radix_tree_delete(&replicas->trees[nid], page->index);
+	spin_lock(&rl->lock);
+	list_del(&page->lru);
+	rl->nr--;
+	spin_unlock(&rl->lock);
+	spin_unlock(&replicas->lock);
+
+	dec_node_page_state(page, NR_REPLICA_PAGES);
+	count_vm_event(PGREPLICA_DROP);
+	/* mark_page_accessed() and mlock don't know this isn't on the LRU */
+	ClearPageActive(page);
+	ClearPageReferenced(page);
+	clear_page_mlock(page);
+	page->mapping = NULL;
+	ClearPageReplica(page);
+	put_page(page);
+}
+
+/*
+ * Unmap and drop the locked replica @page, for memory failure.  The
+ * tasks which mapped it fault on the page cache again.  Returns false if
+ * it is still mapped.
+ */
+bool page_replica_drop(struct page *page)
+{
+	struct address_space *mapping = page->mapping;
+
+	VM_BUG_ON_PAGE(!PageLocked(page), page);
+	/* Dropped by the shrinker or an invalidation already? */
+	if (!mapping)
+		return true;
+	if (page_mapped(page) &&
+	    !try_to_unmap(page, TTU_IGNORE_MLOCK | TTU_IGNORE_ACCESS))
+		return false;
+	replica_remove(mapping->replicas, page);
+	return true;
+}
+
+void __page_replica_invalidate(struct address_space *mapping,
+			       pgoff_t start, pgoff_t end)
+{
+	struct page_replicas *replicas = mapping->replicas;
+	struct page *pages[PAGEVEC_SIZE];
+	pgoff_t index;
+	int nid, i, nr;
+
+	spin_lock(&replicas->lock);
+	replicas->seq++;
+	spin_unlock(&replicas->lock);
+
+	for_each_node(nid) {
+		index = start;
+		do {
+			spin_lock(&replicas->lock);
+			nr = radix_tree_gang_lookup(&replicas->trees[nid],
+						    (void **)pages, index,
+						    PAGEVEC_SIZE);
+			for (i = 0; i < nr && pages[i]->index <= end; i++)
+				get_page(pages[i]);
+			spin_unlock(&replicas->lock);
+			nr = i;
+			if (nr)
+				index = pages[nr - 1]->index + 1;
+
+			for (i = 0; i < nr; i++) {
+				struct page *page = pages[i];
+
+				lock_page(page);
+				/* Dropped by the shrinker in the meantime? */
+				if (page->mapping == mapping) {
+					if (page_mapped(page))
+						try_to_unmap(page,
+							     TTU_IGNORE_MLOCK);
+					WARN_ON_ONCE(page_mapped(page));
+					replica_remove(replicas, page);
+				}
+				unlock_page(page);
+				put_page(page);
+			}
+			cond_resched();
+		} while (nr == PAGEVEC_SIZE && index && index <= end);
+	}
+}
+
+/* Called when the inode goes away */
+void page_replica_free(struct address_space *mapping)
+{
+	if (!mapping->replicas)
+		return;
+	__page_replica_invalidate(mapping, 0, -1);
+	kfree(mapping->replicas);
+	mapping->replicas = NULL;
+}
+
+static unsigned long replica_shrink_count(struct shrinker *shrink,
+					  struct shrink_control *sc)
+{
+	return READ_ONCE(replica_lists[sc->nid].nr);
+}
+
+static unsigned long replica_shrink_scan(struct shrinker *shrink,
+					 struct shrink_control *sc)
+{
+	struct replica_list *rl = &replica_lists[sc->nid];
+	struct address_space *mapping;
+	unsigned long vm_flags;
+	unsigned long freed = 0;
+	unsigned long scanned;
+	struct page *page;
+
+	for (scanned = 0; scanned < sc->nr_to_scan; scanned++) {
+		spin_lock(&rl->lock);
+		if (list_empty(&rl->list)) {
+			spin_unlock(&rl->lock);
+			break;
+		}
+		page = list_first_entry(&rl->list, struct page, lru);
+		list_move_tail(&page->lru, &rl->list);
+		/* The tree's reference can't go while it's on the list */
+		get_page(page);
+		spin_unlock(&rl->lock);
+
+		if (!trylock_page(page))
+			goto put;
+		mapping = page->mapping;
+		if (!mapping)
+			goto unlock;
+		if (page_mapped(page)) {
+			if (page_referenced(page, 1, NULL, &vm_flags))
+				goto unlock;
+			if (!try_to_unmap(page, 0))
+				goto unlock;
+		}
+		replica_remove(mapping->replicas, page);
+		freed++;
+unlock:
+		unlock_page(page);
+put:
+		put_page(page);
+	}
+
+	return freed;
+}
+
+static struct shrinker replica_shrinker = {
+	.count_objects	= replica_shrink_count,
+	.scan_objects	= replica_shrink_scan,
+	.seeks		= DEFAULT_SEEKS,
+	.flags		= SHRINKER_NUMA_AWARE,
+};
+
+static int __init page_replica_init(void)
+{
+	struct replica_list *lists;
+	int nid;
+
+	lists = kcalloc(nr_node_ids, sizeof(*lists), GFP_KERNEL);
+	if (!lists)
+		return -ENOMEM;
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		spin_lock_init(&lists[nid].lock);
+		INIT_LIST_HEAD(&lists[nid].list);
+	}
+
+	replica_lists = lists;
+	if (register_shrinker(&replica_shrinker)) {
+		replica_lists = NULL;
+		kfree(lists);
+		return -ENOMEM;
+	}
+	return 0;
+}
+subsys_initcall(page_replica_init);
@@ -0,0 +1,346 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copy-on-write sharing of anonymous PTE tables at fork.
+ *
+ * copy_page_range() visits every PTE of the parent, taking a reference
+ * and a mapcount on every page, so forking a process with a very large
+ * heap stops it for a long time.  For an mm marked with
+ * PR_SET_COW_PGTABLE, fork instead takes a reference on each PTE table
+ * of its private anonymous mappings and maps it in both mms through a
+ * pmd with the write bit clear (pmd_mkcow_table()): the hardware faults
+ * on any write through the table.  A user gets its own copy of the
+ * table, made the way fork would have copied it, before anything
+ * changes a PTE in it: on a fault in its range, mprotect(), mremap() or
+ * a partial unmap.  Unmapping the whole range just drops the reference,
+ * and the last user takes the table over by making its pmd writable.
+ *
+ * The PTEs of a shared table count as a single mapping of each page:
+ * an rmap walk finds the same PTE through the vma of every user.
+ * try_to_unmap_one() gives each user it visits a copy of the table
+ * first, so reclaim, migration, compaction, CMA and memory offlining
+ * still get the page unmapped; they only back off when the copy can't
+ * be allocated without waiting.  KSM, khugepaged and uprobes, which
+ * find the pmd with mm_find_pmd(), leave shared tables alone.  The
+ * other walks only clear accessed bits.
+ *
+ * As for shared file tables (see pt_share.c), the refcount of the
+ * table's page is the number of pmds pointing at it and its split PTE
+ * lock serializes all of them; the refcount only changes under that
+ * lock.  The pages mapped by a shared table are accounted in the RSS of
+ * one of its users only, the mm which owned the table before the first
+ * fork, recorded in page->index of the table.  Once that user goes, the
+ * pages are not accounted until the last user takes the table over.
+ */
+
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/rmap.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/pt_cow.h>
+
+#include <asm/pgalloc.h>
+#include <asm/tlbflush.h>
+
+#include "internal.h"
+
+static inline struct mm_struct *pt_cow_owner(struct page *table)
+{
+	return (struct mm_struct *)table->index;
+}
+
+static inline void pt_cow_set_owner(struct page *table, struct mm_struct *mm)
+{
+	table->index = (pgoff_t)mm;
+}
+
+static void pt_cow_add_rss(struct mm_struct *mm, int *rss, int sign)
+{
+	int i;
+
+	for (i = 0; i < NR_MM_COUNTERS; i++)
+		if (rss[i])
+			add_mm_counter(mm, i, sign * rss[i]);
+}
+
+/* Count the pages mapped by the table at @pmd the way zap_pte_range() does */
+static void pt_cow_count_rss(struct vm_area_struct *vma, pmd_t *pmd,
+			     unsigned long addr, int *rss)
+{
+	pte_t *start_pte, *pte;
+	int i;
+
+	memset(rss, 0, sizeof(int) * NR_MM_COUNTERS);
+	addr &= PMD_MASK;
+	start_pte = pte = pte_offset_map(pmd, addr);
+	for (i = 0; i < PTRS_PER_PTE; i++, pte++, addr += PAGE_SIZE) {
+		pte_t ptent = *pte;
+		struct page *page;
+		swp_entry_t entry;
+
+		if (pte_none(ptent))
+			continue;
+		if (pte_present(ptent)) {
+			page = vm_normal_page(vma, addr, ptent);
+			if (page)
+				rss[mm_counter(page)]++;
+			continue;
+		}
+		entry = pte_to_swp_entry(ptent);
+		if (!non_swap_entry(entry))
+			rss[MM_SWAPENTS]++;
+		else if (is_migration_entry(entry))
+			rss[mm_counter(migration_entry_to_page(entry))]++;
+		else if (is_device_private_entry(entry))
+			rss[mm_counter(device_private_entry_to_page(entry))]++;
+	}
+	pte_unmap(start_pte);
+}
+
+/*
+ * The last user of a shared table gets it for itself.  Both locks are
+ * held.
+ */
+static void pt_cow_take_over(struct vm_area_struct *vma, pmd_t *pmd,
+			     unsigned long addr, struct page *table)
+{
+	struct mm_struct *mm = vma->vm_mm;
+
+	if (pt_cow_owner(table) != mm) {
+		int rss[NR_MM_COUNTERS];
+
+		pt_cow_count_rss(vma, pmd, addr, rss);
+		pt_cow_add_rss(mm, rss, 1);
+	}
+	pt_cow_set_owner(table, NULL);
+	set_pmd(pmd, pmd_clear_cow_table(*pmd));
+}
+
+static pgtable_t pt_cow_alloc(gfp_t gfp)
+{
+	struct page *page;
+
+	do {
+		page = alloc_page(gfp | __GFP_ZERO);
+		if (page && !pgtable_page_ctor(page)) {
+			__free_page(page);
+			page = NULL;
+		}
+	} while (!page && (gfp & __GFP_NOFAIL));
+
+	return page;
+}
+
+/* Drop what copy_one_pte() took for the first @nr PTEs of a copy */
+static void pt_cow_free_copy(struct vm_area_struct *vma, pte_t *pte,
+			     unsigned long addr, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++, pte++, addr += PAGE_SIZE) {
+		pte_t ptent = *pte;
+		struct page *page = NULL;
+		swp_entry_t entry;
+
+		if (pte_none(ptent))
+			continue;
+		if (pte_present(ptent)) {
+			page = vm_normal_page(vma, addr, ptent);
+		} else {
+			entry = pte_to_swp_entry(ptent);
+			if (!non_swap_entry(entry))
+				swap_free(entry);
+			else if (is_device_private_entry(entry))
+				page = device_private_entry_to_page(entry);
+		}
+		if (page) {
+			page_remove_rmap(page, false);
+			put_page(page);
+		}
+		pte_clear(vma->vm_mm, addr, pte);
+	}
+}
+
+/*
+ * Share the PTE table at @src_pmd with the child instead of copying it.
+ * Returns false if the range doesn't qualify, and the caller copies the
+ * PTEs as usual.  Called with the parent's mmap_sem held for write.
+ */
+bool pt_cow_fork(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		 pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *vma,
+		 unsigned long addr, unsigned long end)
+{
+	struct page *table;
+	spinlock_t *ptl;
+	pmd_t pmd;
+
+	if (!vma_pt_cow(vma) || (addr & ~PMD_MASK) || end - addr != PMD_SIZE)
+		return false;
+
+	ptl = pte_lockptr(src_mm, src_pmd);
+	spin_lock(ptl);
+	pmd = *src_pmd;
+	table = pmd_page(pmd);
+	if (!pmd_cow_table(pmd)) {
+		/*
+		 * The parent keeps accounting the pages.  Its TLB is flushed
+		 * by dup_mmap() once all the vmas are done.
+		 */
+		pt_cow_set_owner(table, src_mm);
+		pmd = pmd_mkcow_table(pmd);
+		set_pmd(src_pmd, pmd);
+	}
+	get_page(table);
+	set_pmd(dst_pmd, pmd);
+	atomic_long_inc(&dst_mm->nr_ptes);
+	spin_unlock(ptl);
+
+	return true;
+}
+
+/*
+ * Give this mm its own copy of the shared PTE table at @pmd, or take the
+ * table over if nobody else uses it anymore.  Returns -ENOMEM if a new
+ * table couldn't be allocated.
+ */
+int pt_cow_unshare(struct vm_area_struct *vma, pmd_t *pmd,
+		   unsigned long addr, gfp_t gfp)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long haddr = addr & PMD_MASK;
+	int rss[NR_MM_COUNTERS];
+	spinlock_t *pmd_ptl, *ptl;
+	pte_t *src_pte, *dst_pte;
+	pgtable_t new = NULL;
+	struct page *table;
+	swp_entry_t entry;
+	int i;
+
+again:
+	pmd_ptl = pmd_lock(mm, pmd);
+	if (!pmd_cow_table(*pmd)) {
+		/* Another thread got there first */
+		spin_unlock(pmd_ptl);
+		goto out;
+	}
+	table = pmd_page(*pmd);
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock_nested(ptl, SINGLE_DEPTH_NESTING);
+	if (page_count(table) == 1) {
+		pt_cow_take_over(vma, pmd, haddr, table);
+		goto out_unlock;
+	}
+	if (!new) {
+		spin_unlock(ptl);
+		spin_unlock(pmd_ptl);
+		new = pt_cow_alloc(gfp);
+		if (!new)
+			return -ENOMEM;
+		goto again;
+	}
+
+	memset(rss, 0, sizeof(rss));
+	entry.val = 0;
+	src_pte = pte_offset_map(pmd, haddr);
+	dst_pte = kmap_atomic(new);
+	arch_enter_lazy_mmu_mode();
+	for (i = 0; i < PTRS_PER_PTE; i++) {
+		if (pte_none(src_pte[i]))
+			continue;
+		entry.val = copy_one_pte(mm, mm, dst_pte + i, src_pte + i, vma,
+					 vma, haddr + i * PAGE_SIZE, rss);
+		if (entry.val)
+			break;
+	}
+	arch_leave_lazy_mmu_mode();
+
+	if (entry.val) {
+		/*
+		 * The swap count of @entry needs a continuation, which can't
+		 * be allocated under the locks: start over after that.
+		 */
+		pt_cow_free_copy(vma, dst_pte, haddr, i);
+		kunmap_atomic(dst_pte);
+		pte_unmap(src_pte);
+		spin_unlock(ptl);
+		spin_unlock(pmd_ptl);
+		if (add_swap_count_continuation(entry, gfp) < 0) {
+			pte_free(mm, new);
+			return -ENOMEM;
+		}
+		goto again;
+	}
+	kunmap_atomic(dst_pte);
+	pte_unmap(src_pte);
+
+	/* The PTEs must be visible before the pmd, see __pte_alloc() */
+	smp_wmb();
+	pmd_populate(mm, pmd, new);
+	new = NULL;
+	/* No paging-structure cache may keep pointing at the shared table */
+	flush_tlb_range(vma, haddr, haddr + PMD_SIZE);
+
+	/* The owner already accounts the pages, now in its copy */
+	if (pt_cow_owner(table) == mm)
+		pt_cow_set_owner(table, NULL);
+	else
+		pt_cow_add_rss(mm, rss, 1);
+	page_ref_dec(table);
+out_unlock:
+	spin_unlock(ptl);
+	spin_unlock(pmd_ptl);
+out:
+	if (new)
+		pte_free(mm, new);
+	return 0;
+}
+
+/*
+ * Called from zap_pmd_range() on a shared table.  If the whole table is
+ * being zapped, drop this mm's reference and return true: the PTEs stay
+ * for the other users.  Otherwise return false after making the table
+ * private, and the caller zaps the PTEs as usual.
+ */
+bool pt_cow_zap(struct vm_area_struct *vma, pmd_t *pmd,
+		unsigned long addr, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	spinlock_t *pmd_ptl, *ptl;
+	struct page *table;
+	bool dropped = false;
+
+	/* Only some of the PTEs go, keep a copy of the others */
+	if ((addr & ~PMD_MASK) || end - addr != PMD_SIZE) {
+		pt_cow_unshare(vma, pmd, addr,
+			       GFP_KERNEL_ACCOUNT | __GFP_NOFAIL);
+		return false;
+	}
+
+	pmd_ptl = pmd_lock(mm, pmd);
+	/* MADV_DONTNEED may race with a fault copying the table */
+	if (!pmd_cow_table(*pmd))
+		goto out;
+	table = pmd_page(*pmd);
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock_nested(ptl, SINGLE_DEPTH_NESTING);
+	if (page_count(table) == 1) {
+		pt_cow_take_over(vma, pmd, addr, table);
+	} else {
+		if (pt_cow_owner(table) == mm) {
+			int rss[NR_MM_COUNTERS];
+
+			pt_cow_count_rss(vma, pmd, addr, rss);
+			pt_cow_add_rss(mm, rss, -1);
+			pt_cow_set_owner(table, NULL);
+		}
+		pmd_clear(pmd);
+		flush_tlb_range(vma, addr, end);
+		page_ref_dec(table);
+		atomic_long_dec(&mm->nr_ptes);
+		dropped = true;
+	}
+	spin_unlock(ptl);
+out:
+	spin_unlock(pmd_ptl);
+	return dropped;
+}
@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Sharing of PTE tables between MAP_SHARED mappings of the same file.
+ *
+ * A mapping marked with MADV_SHARE_PT picks up the PTE table of another
+ * such mapping of the same file range on its first fault in a PMD, the
+ * way hugetlb shares PMD tables (see huge_pmd_share()).  That needs
+ * both mappings to cover the whole PMD range, to place the file at the
+ * same offset in it and to have identical vm_flags, so that every PTE
+ * in the table is right for both.  Hundreds of processes mapping one
+ * large file then use a single set of PTE tables instead of each
+ * building its own.
+ *
+ * The refcount of the table's page is the number of page tables
+ * pointing at it, and the split PTE lock in the page serializes all of
+ * them.  Tables are attached and detached under i_mmap_rwsem held for
+ * write: zapping such a mapping either drops the mm's reference, when
+ * other users remain, or zaps the PTEs as usual when it is the last.
+ *
+ * Any user may install a PTE and any user may end up zapping it, so
+ * the pages mapped through the PTEs of these mappings are not counted
+ * in the RSS of any mm.  A PTE of a shared table counts as a single
+ * mapping in the page's mapcount: /proc/pid/smaps splits its Pss among
+ * the users of the table as well, and reports the page table memory
+ * saved as PgTablesSaved.
+ *
+ * Nothing records which mms use a table, so when rmap clears or
+ * write-protects a PTE of a shared table, pt_share_flush() has to flush
+ * the TLBs of every CPU.  That is one broadcast per page unmapped or
+ * cleaned, the price of not walking every mapping of the file for each.
+ */
+
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/mman.h>
+#include <linux/rmap.h>
+#include <linux/sched/mm.h>
+#include <linux/mmu_notifier.h>
+#include <linux/pt_share.h>
+
+#include <asm/pgalloc.h>
+
+#include "internal.h"
+
+/*
+ * Return the address at which @svma maps the PTE table that @vma needs
+ * for @addr, or 0 if it can't share it.
+ */
+static unsigned long pt_shareable(struct vm_area_struct *svma,
+				  struct vm_area_struct *vma,
+				  unsigned long addr, pgoff_t idx)
+{
+	unsigned long saddr = ((idx - svma->vm_pgoff) << PAGE_SHIFT) +
+				svma->vm_start;
+	unsigned long sbase = saddr & PMD_MASK;
+
+	/*
+	 * Unlike hugetlb, VM_LOCKED has to match as well: reclaim would
+	 * unmap a page through the table from under the mlocked user.
+	 */
+	if ((addr & ~PMD_MASK) != (saddr & ~PMD_MASK) ||
+	    vma->vm_flags != svma->vm_flags ||
+	    !range_in_vma(svma, sbase, sbase + PMD_SIZE))
+		return 0;
+
+	return saddr;
+}
+
+/*
+ * Look for a PTE table to share for @addr in the other mappings of the
+ * file and install it at @pmd.  Called from the fault path when @pmd is
+ * none; if nothing is found, the caller allocates a table as usual and
+ * that one becomes shareable in turn.
+ */
+void pt_share(struct vm_area_struct *vma, unsigned long addr, pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct address_space *mapping = vma->vm_file->f_mapping;
+	pgoff_t idx = linear_page_index(vma, addr);
+	struct vm_area_struct *svma;
+	struct page *table = NULL;
+	pgtable_t token;
+	spinlock_t *ptl;
+
+	if (mm_has_notifiers(mm))
+		return;
+
+	i_mmap_lock_write(mapping);
+	vma_interval_tree_foreach(svma, &mapping->i_mmap, idx, idx) {
+		struct mm_struct *smm = svma->vm_mm;
+		unsigned long saddr;
+		pmd_t *spmd;
+
+		if (svma == vma)
+			continue;
+
+		saddr = pt_shareable(svma, vma, addr, idx);
+		if (!saddr || mm_has_notifiers(smm))
+			continue;
+
+		/*
+		 * munmap(), mremap() and mprotect() free the tables of a
+		 * mapping with mmap_sem held for write, and exit_mmap()
+		 * zaps them under i_mmap_rwsem once mm_users is zero, so a
+		 * table found with mmap_sem held and users left is not on
+		 * its way out.  Like khugepaged, don't wait for mmap_sem.
+		 */
+		if (!down_read_trylock(&smm->mmap_sem))
+			continue;
+		if (atomic_read(&smm->mm_users)) {
+			spmd = mm_find_pmd(smm, saddr);
+			if (spmd && !pmd_devmap(*spmd)) {
+				table = pmd_page(*spmd);
+				token = pmd_pgtable(*spmd);
+				get_page(table);
+			}
+		}
+		up_read(&smm->mmap_sem);
+		if (table)
+			break;
+	}
+
+	if (!table)
+		goto out;
+
+	ptl = pmd_lock(mm, pmd);
+	if (pmd_none(*pmd)) {
+		atomic_long_inc(&mm->nr_ptes);
+		pmd_populate(mm, pmd, token);
+	} else {
+		put_page(table);
+	}
+	spin_unlock(ptl);
+out:
+	i_mmap_unlock_write(mapping);
+}
+
+/*
+ * Detach the PTE table at @pmd from this mm if other page tables still
+ * use it, leaving the PTEs in place for them.  Called when zapping with
+ * i_mmap_rwsem held for write.  Returns false if this is the last user,
+ * which then zaps the PTEs as usual.
+ */
+bool pt_unshare(struct vm_area_struct *vma, pmd_t *pmd, unsigned long addr)
+{
+	struct page *table = pmd_page(*pmd);
+	spinlock_t *ptl;
+
+	VM_BUG_ON_PAGE(!page_count(table), table);
+	if (page_count(table) == 1)
+		return false;
+
+	ptl = pmd_lock(vma->vm_mm, pmd);
+	pmd_clear(pmd);
+	spin_unlock(ptl);
+	/*
+	 * Once the reference is dropped another user may free the table,
+	 * and its pte_free() only flushes its own CPUs: flush this mm's
+	 * paging-structure caches, and wait out lockless walks, first.
+	 */
+	flush_tlb_range(vma, addr & PMD_MASK, (addr & PMD_MASK) + PMD_SIZE);
+	put_page(table);
+	atomic_long_dec(&vma->vm_mm->nr_ptes);
+	return true;
+}
+
+int pt_share_madvise(struct vm_area_struct *vma, unsigned long start,
+		     unsigned long end, int advice, unsigned long *vm_flags)
+{
+	switch (advice) {
+	case MADV_SHARE_PT:
+		/* Users of a table have to agree on its PTE lock */
+		if (!USE_SPLIT_PTE_PTLOCKS)
+			return -EINVAL;
+		/* Only page cache backed MAP_SHARED mappings */
+		if (!(*vm_flags & VM_SHARED) ||
+		    *vm_flags & (VM_SPECIAL | VM_HUGETLB |
+				 VM_UFFD_MISSING | VM_UFFD_WP) ||
+		    !vma->vm_ops || vma->vm_ops->map_pages != filemap_map_pages)
+			return -EINVAL;
+		if (*vm_flags & VM_SHARED_PT)
+			return 0;
+		*vm_flags |= VM_SHARED_PT;
+		break;
+	case MADV_NOSHARE_PT:
+		if (!(*vm_flags & VM_SHARED_PT))
+			return 0;
+		*vm_flags &= ~VM_SHARED_PT;
+		break;
+	}
+
+	/*
+	 * RSS is counted differently on either side: zap the range with
+	 * the old flags, the PTEs will be refaulted under the new ones.
+	 */
+	zap_page_range(vma, start, end - start);
+	return 0;
+}
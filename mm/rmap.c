@@ -65,6 +65,8 @@
 #include <linux/page_idle.h>
 #include <linux/memremap.h>
 #include <linux/userfaultfd_k.h>
+#include <linux/pt_share.h>
+#include <linux/pt_cow.h>
 
 #include <asm/tlbflush.h>
 
@@ -735,7 +737,8 @@ pmd_t *mm_find_pmd(struct mm_struct *mm, unsigned long address)
 	 */
 	pmde = *pmd;
 	barrier();
-	if (!pmd_present(pmde) || pmd_trans_huge(pmde))
+	/* Nor may PTEs be changed in a table shared with a forked mm */
+	if (!pmd_present(pmde) || pmd_trans_huge(pmde) || pmd_cow_table(pmde))
 		pmd = NULL;
 out:
 	return pmd;
@@ -913,6 +916,7 @@ static bool page_mkclean_one(struct page *page, struct vm_area_struct *vma,
 
 			flush_cache_page(vma, address, pte_pfn(*pte));
 			entry = ptep_clear_flush(vma, address, pte);
+			pt_share_flush(vma, pvmw.pmd);
 			entry = pte_wrprotect(entry);
 			entry = pte_mkclean(entry);
 			set_pte_at(vma->vm_mm, address, pte, entry);
@@ -1185,8 +1189,10 @@ void page_add_file_rmap(struct page *page, bool compound)
 		}
 		if (!atomic_inc_and_test(compound_mapcount_ptr(page)))
 			goto out;
-		VM_BUG_ON_PAGE(!PageSwapBacked(page), page);
-		__inc_node_page_state(page, NR_SHMEM_PMDMAPPED);
+		if (PageSwapBacked(page))
+			__inc_node_page_state(page, NR_SHMEM_PMDMAPPED);
+		else
+			__inc_node_page_state(page, NR_FILE_PMDMAPPED);
 	} else {
 		if (PageTransCompound(page) && page_mapping(page)) {
 			VM_WARN_ON_ONCE(!PageLocked(page));
@@ -1198,7 +1204,9 @@ void page_add_file_rmap(struct page *page, bool compound)
 		if (!atomic_inc_and_test(&page->_mapcount))
 			goto out;
 	}
-	__mod_lruvec_page_state(page, NR_FILE_MAPPED, nr);
+	/* Replicas aren't page cache, nr_replica_pages counts them */
+	if (!PageReplica(page))
+		__mod_lruvec_page_state(page, NR_FILE_MAPPED, nr);
 out:
 	unlock_page_memcg(page);
 }
@@ -1225,8 +1233,10 @@ static void page_remove_file_rmap(struct page *page, bool compound)
 		}
 		if (!atomic_add_negative(-1, compound_mapcount_ptr(page)))
 			goto out;
-		VM_BUG_ON_PAGE(!PageSwapBacked(page), page);
-		__dec_node_page_state(page, NR_SHMEM_PMDMAPPED);
+		if (PageSwapBacked(page))
+			__dec_node_page_state(page, NR_SHMEM_PMDMAPPED);
+		else
+			__dec_node_page_state(page, NR_FILE_PMDMAPPED);
 	} else {
 		if (!atomic_add_negative(-1, &page->_mapcount))
 			goto out;
@@ -1237,7 +1247,8 @@ static void page_remove_file_rmap(struct page *page, bool compound)
 	 * these counters are not modified in interrupt context, and
 	 * pte lock(a spinlock) is held, which implies preemption disabled.
 	 */
-	__mod_lruvec_page_state(page, NR_FILE_MAPPED, -nr);
+	if (!PageReplica(page))
+		__mod_lruvec_page_state(page, NR_FILE_MAPPED, -nr);
 
 	if (unlikely(PageMlocked(page)))
 		clear_page_mlock(page);
@@ -1425,6 +1436,30 @@ static bool try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 		/* Unexpected PMD-mapped THP? */
 		VM_BUG_ON_PAGE(!pvmw.pte, page);
 
+		/*
+		 * The PTE may be in a table shared copy-on-write with a
+		 * forked mm, which can't be changed from here.  Give this
+		 * mm a copy of its own, as a fault would, and look for the
+		 * page again in that.  The anon_vma lock keeps the pmd from
+		 * being freed meanwhile.  Back off only if the copy can't
+		 * be had without waiting.
+		 */
+		if (pmd_cow_table(*pvmw.pmd)) {
+			pmd_t *pmd = pvmw.pmd;
+
+			page_vma_mapped_walk_done(&pvmw);
+			if (pt_cow_unshare(vma, pmd, pvmw.address,
+					   GFP_NOWAIT | __GFP_NOWARN |
+					   __GFP_NOMEMALLOC)) {
+				ret = false;
+				break;
+			}
+			pvmw.pmd = NULL;
+			pvmw.pte = NULL;
+			pvmw.ptl = NULL;
+			continue;
+		}
+
 		subpage = page - page_to_pfn(page) + pte_pfn(*pvmw.pte);
 		address = pvmw.address;
 
@@ -1472,6 +1507,8 @@ static bool try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 			swp_pte = swp_entry_to_pte(entry);
 			if (pte_soft_dirty(pteval))
 				swp_pte = pte_swp_mksoft_dirty(swp_pte);
+			if (pte_uffd_wp(pteval))
+				swp_pte = pte_swp_mkuffd_wp(swp_pte);
 			set_pte_at(mm, pvmw.address, pvmw.pte, swp_pte);
 			goto discard;
 		}
@@ -1502,6 +1539,7 @@ static bool try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 		} else {
 			pteval = ptep_clear_flush(vma, address, pvmw.pte);
 		}
+		pt_share_flush(vma, pvmw.pmd);
 
 		/* Move the dirty bit to the page. Now the pte is gone. */
 		if (pte_dirty(pteval))
@@ -1519,7 +1557,8 @@ static bool try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 						     pvmw.pte, pteval,
 						     vma_mmu_pagesize(vma));
 			} else {
-				dec_mm_counter(mm, mm_counter(page));
+				if (!(vma->vm_flags & VM_SHARED_PT))
+					dec_mm_counter(mm, mm_counter(page));
 				set_pte_at(mm, address, pvmw.pte, pteval);
 			}
 
@@ -1534,7 +1573,8 @@ static bool try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 			 * migration) will not expect userfaults on already
 			 * copied pages.
 			 */
-			dec_mm_counter(mm, mm_counter(page));
+			if (!(vma->vm_flags & VM_SHARED_PT))
+				dec_mm_counter(mm, mm_counter(page));
 		} else if (IS_ENABLED(CONFIG_MIGRATION) &&
 				(flags & (TTU_MIGRATION|TTU_SPLIT_FREEZE))) {
 			swp_entry_t entry;
@@ -1549,6 +1589,8 @@ static bool try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 			swp_pte = swp_entry_to_pte(entry);
 			if (pte_soft_dirty(pteval))
 				swp_pte = pte_swp_mksoft_dirty(swp_pte);
+			if (pte_uffd_wp(pteval))
+				swp_pte = pte_swp_mkuffd_wp(swp_pte);
 			set_pte_at(mm, address, pvmw.pte, swp_pte);
 		} else if (PageAnon(page)) {
 			swp_entry_t entry = { .val = page_private(subpage) };
@@ -1623,8 +1665,10 @@ static bool try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 			swp_pte = swp_entry_to_pte(entry);
 			if (pte_soft_dirty(pteval))
 				swp_pte = pte_swp_mksoft_dirty(swp_pte);
+			if (pte_uffd_wp(pteval))
+				swp_pte = pte_swp_mkuffd_wp(swp_pte);
 			set_pte_at(mm, address, pvmw.pte, swp_pte);
-		} else
+		} else if (!(vma->vm_flags & VM_SHARED_PT))
 			dec_mm_counter(mm, mm_counter_file(page));
 discard:
 		page_remove_rmap(subpage, PageHuge(page));
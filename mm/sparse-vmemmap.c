@@ -20,6 +20,7 @@
  */
 #include <linux/mm.h>
 #include <linux/mmzone.h>
+#include <linux/memory_hotplug.h>
 #include <linux/bootmem.h>
 #include <linux/memremap.h>
 #include <linux/highmem.h>
@@ -30,6 +31,7 @@
 #include <asm/dma.h>
 #include <asm/pgalloc.h>
 #include <asm/pgtable.h>
+#include <asm/tlbflush.h>
 
 /*
  * Allocate a block of memory to be used to back the virtual memory map
@@ -317,3 +319,142 @@ void __init sparse_mem_maps_populate_node(struct page **map_map,
 		vmemmap_buf_end = NULL;
 	}
 }
+
+#ifdef CONFIG_HUGETLB_PAGE_FREE_VMEMMAP
+/*
+ * Return the kernel pte mapping @addr of the vmemmap, or NULL if @addr is
+ * not mapped by a base page.
+ */
+static pte_t *vmemmap_lookup_pte(unsigned long addr)
+{
+	pgd_t *pgd;
+	p4d_t *p4d;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset_k(addr);
+	if (pgd_none(*pgd))
+		return NULL;
+	p4d = p4d_offset(pgd, addr);
+	if (p4d_none(*p4d))
+		return NULL;
+	pud = pud_offset(p4d, addr);
+	if (pud_none(*pud) || pud_large(*pud))
+		return NULL;
+	pmd = pmd_offset(pud, addr);
+	if (pmd_none(*pmd) || pmd_large(*pmd))
+		return NULL;
+	return pte_offset_kernel(pmd, addr);
+}
+
+static void free_vmemmap_page(struct page *page)
+{
+	if (!PageReserved(page)) {
+		__free_page(page);
+		return;
+	}
+
+#ifdef CONFIG_HAVE_BOOTMEM_INFO_NODE
+	/* Registered by register_page_bootmem_memmap() for memory hotplug */
+	if (PagePrivate(page)) {
+		put_page_bootmem(page);
+		return;
+	}
+#endif
+	free_reserved_page(page);
+}
+
+/**
+ * vmemmap_remap_free - remap the vmemmap virtual address range [@start, @end)
+ *			to the page which @reuse is mapped to, then free the
+ *			pages which the range was mapped to.
+ * @start:	start address of the vmemmap virtual address range to remap.
+ * @end:	end address of the vmemmap virtual address range to remap.
+ * @reuse:	reuse address, which must be the page right before @start.
+ *
+ * The range ends up mapped read-only, so that any write to the struct pages
+ * it covers faults instead of silently changing every alias.
+ *
+ * Return: 0 on success, -ENOTSUPP if the range is not mapped by base pages.
+ */
+int vmemmap_remap_free(unsigned long start, unsigned long end,
+		       unsigned long reuse)
+{
+	LIST_HEAD(vmemmap_pages);
+	struct page *reuse_page, *page, *next;
+	unsigned long addr;
+	pte_t *pte;
+
+	BUG_ON(start - reuse != PAGE_SIZE);
+
+	/* Never leave the range half remapped: check everything up front. */
+	for (addr = reuse; addr < end; addr += PAGE_SIZE)
+		if (!vmemmap_lookup_pte(addr))
+			return -ENOTSUPP;
+
+	reuse_page = pte_page(*vmemmap_lookup_pte(reuse));
+	for (addr = start; addr < end; addr += PAGE_SIZE) {
+		pte = vmemmap_lookup_pte(addr);
+		page = pte_page(*pte);
+		list_add_tail(&page->lru, &vmemmap_pages);
+		set_pte_at(&init_mm, addr, pte,
+			   mk_pte(reuse_page, PAGE_KERNEL_RO));
+	}
+	flush_tlb_kernel_range(start, end);
+
+	list_for_each_entry_safe(page, next, &vmemmap_pages, lru) {
+		list_del(&page->lru);
+		free_vmemmap_page(page);
+	}
+
+	return 0;
+}
+
+/**
+ * vmemmap_remap_alloc - remap the vmemmap virtual address range [@start, @end)
+ *			 to freshly allocated pages, each a copy of the page
+ *			 @reuse is mapped to.
+ * @start:	start address of the vmemmap virtual address range to remap.
+ * @end:	end address of the vmemmap virtual address range to remap.
+ * @reuse:	reuse address, which must be the page right before @start.
+ * @gfp_mask:	GFP flag for allocating vmemmap pages.
+ *
+ * This undoes vmemmap_remap_free().
+ *
+ * Return: 0 on success, -ENOMEM if the pages could not be allocated, in
+ * which case the range is left untouched.
+ */
+int vmemmap_remap_alloc(unsigned long start, unsigned long end,
+			unsigned long reuse, gfp_t gfp_mask)
+{
+	LIST_HEAD(vmemmap_pages);
+	int nid = page_to_nid((struct page *)start);
+	struct page *page, *next;
+	unsigned long addr;
+	pte_t *pte;
+
+	BUG_ON(start - reuse != PAGE_SIZE);
+
+	for (addr = start; addr < end; addr += PAGE_SIZE) {
+		page = alloc_pages_node(nid, gfp_mask, 0);
+		if (!page)
+			goto out;
+		list_add_tail(&page->lru, &vmemmap_pages);
+	}
+
+	for (addr = start; addr < end; addr += PAGE_SIZE) {
+		pte = vmemmap_lookup_pte(addr);
+		page = list_first_entry(&vmemmap_pages, struct page, lru);
+		list_del(&page->lru);
+		copy_page(page_address(page), (void *)reuse);
+		set_pte_at(&init_mm, addr, pte, mk_pte(page, PAGE_KERNEL));
+	}
+	flush_tlb_kernel_range(start, end);
+
+	return 0;
+out:
+	list_for_each_entry_safe(page, next, &vmemmap_pages, lru)
+		__free_page(page);
+	return -ENOMEM;
+}
+#endif /* CONFIG_HUGETLB_PAGE_FREE_VMEMMAP */
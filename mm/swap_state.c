@@ -109,13 +109,17 @@ void show_swap_cache_info(void)
 
 /*
  * __add_to_swap_cache resembles add_to_page_cache_locked on swapper_space,
- * but sets SwapCache flag and private instead of mapping and index.
+ * but sets SwapCache flag and private instead of mapping and index.  If
+ * @shadowp is not NULL, the shadow entry left by the eviction of the page
+ * previously stored in the slot is returned there.
  */
-int __add_to_swap_cache(struct page *page, swp_entry_t entry)
+int __add_to_swap_cache(struct page *page, swp_entry_t entry, void **shadowp)
 {
 	int error, i, nr = hpage_nr_pages(page);
 	struct address_space *address_space;
 	pgoff_t idx = swp_offset(entry);
+	struct radix_tree_node *node;
+	void **slot, *p;
 
 	VM_BUG_ON_PAGE(!PageLocked(page), page);
 	VM_BUG_ON_PAGE(PageSwapCache(page), page);
@@ -128,10 +132,22 @@ int __add_to_swap_cache(struct page *page, swp_entry_t entry)
 	spin_lock_irq(&address_space->tree_lock);
 	for (i = 0; i < nr; i++) {
 		set_page_private(page + i, entry.val + i);
-		error = radix_tree_insert(&address_space->page_tree,
-					  idx + i, page + i);
+		error = __radix_tree_create(&address_space->page_tree,
+					    idx + i, 0, &node, &slot);
 		if (unlikely(error))
 			break;
+		p = radix_tree_deref_slot_protected(slot,
+						    &address_space->tree_lock);
+		if (p) {
+			/* The shadow of an evicted page */
+			VM_BUG_ON(!radix_tree_exceptional_entry(p));
+			address_space->nrexceptional--;
+			if (shadowp)
+				*shadowp = p;
+		}
+		__radix_tree_replace(&address_space->page_tree, node, slot,
+				     page + i, workingset_update_node,
+				     address_space);
 	}
 	if (likely(!error)) {
 		address_space->nrpages += nr;
@@ -146,7 +162,11 @@ int __add_to_swap_cache(struct page *page, swp_entry_t entry)
 		VM_BUG_ON(error == -EEXIST);
 		set_page_private(page + i, 0UL);
 		while (i--) {
-			radix_tree_delete(&address_space->page_tree, idx + i);
+			__radix_tree_lookup(&address_space->page_tree, idx + i,
+					    &node, &slot);
+			__radix_tree_replace(&address_space->page_tree, node,
+					     slot, NULL, workingset_update_node,
+					     address_space);
 			set_page_private(page + i, 0UL);
 		}
 		ClearPageSwapCache(page);
@@ -164,7 +184,7 @@ int add_to_swap_cache(struct page *page, swp_entry_t entry, gfp_t gfp_mask)
 
 	error = radix_tree_maybe_preload_order(gfp_mask, compound_order(page));
 	if (!error) {
-		error = __add_to_swap_cache(page, entry);
+		error = __add_to_swap_cache(page, entry, NULL);
 		radix_tree_preload_end();
 	}
 	return error;
@@ -172,13 +192,16 @@ int add_to_swap_cache(struct page *page, swp_entry_t entry, gfp_t gfp_mask)
 
 /*
  * This must be called only on pages that have
- * been verified to be in the swap cache.
+ * been verified to be in the swap cache.  The slots of the page are
+ * left with @shadow, which may be NULL.
  */
-void __delete_from_swap_cache(struct page *page)
+void __delete_from_swap_cache(struct page *page, void *shadow)
 {
 	struct address_space *address_space;
 	int i, nr = hpage_nr_pages(page);
+	struct radix_tree_node *node;
 	swp_entry_t entry;
+	void **slot;
 	pgoff_t idx;
 
 	VM_BUG_ON_PAGE(!PageLocked(page), page);
@@ -189,10 +212,17 @@ void __delete_from_swap_cache(struct page *page)
 	address_space = swap_address_space(entry);
 	idx = swp_offset(entry);
 	for (i = 0; i < nr; i++) {
-		radix_tree_delete(&address_space->page_tree, idx + i);
+		__radix_tree_lookup(&address_space->page_tree, idx + i,
+				    &node, &slot);
+		radix_tree_clear_tags(&address_space->page_tree, node, slot);
+		__radix_tree_replace(&address_space->page_tree, node, slot,
+				     shadow, workingset_update_node,
+				     address_space);
 		set_page_private(page + i, 0);
 	}
 	ClearPageSwapCache(page);
+	if (shadow)
+		address_space->nrexceptional += nr;
 	address_space->nrpages -= nr;
 	__mod_node_page_state(page_pgdat(page), NR_FILE_PAGES, -nr);
 	ADD_CACHE_INFO(del_total, nr);
@@ -274,13 +304,70 @@ void delete_from_swap_cache(struct page *page)
 
 	address_space = swap_address_space(entry);
 	spin_lock_irq(&address_space->tree_lock);
-	__delete_from_swap_cache(page);
+	__delete_from_swap_cache(page, NULL);
 	spin_unlock_irq(&address_space->tree_lock);
 
 	put_swap_page(page, entry);
 	page_ref_sub(page, hpage_nr_pages(page));
 }
 
+/*
+ * Return the shadow entry left in the swap cache slot of @entry by the
+ * eviction of an anon page, or NULL if there is none.
+ */
+void *get_shadow_from_swap_cache(swp_entry_t entry)
+{
+	struct address_space *address_space = swap_address_space(entry);
+	struct page *page;
+
+	page = find_get_entry(address_space, swp_offset(entry));
+	if (radix_tree_exceptional_entry(page))
+		return page;
+	if (page)
+		put_page(page);
+	return NULL;
+}
+
+/*
+ * Drop the shadow entries of the swap slots @begin to @end, inclusive, of
+ * swap device @type, which are being freed.
+ */
+void clear_shadow_from_swap_cache(int type, unsigned long begin,
+				  unsigned long end)
+{
+	struct address_space *address_space;
+	struct radix_tree_node *node;
+	unsigned long curr, last;
+	unsigned long flags;
+	void **slot, *p;
+
+	for (curr = begin; curr <= end; curr = last + 1) {
+		address_space = swap_address_space(swp_entry(type, curr));
+		last = min(end, curr | (SWAP_ADDRESS_SPACE_PAGES - 1));
+
+		/*
+		 * Shadows are only left in slots that are still in use, and
+		 * the swap device locks order that against the freeing.
+		 */
+		if (!address_space->nrexceptional)
+			continue;
+
+		/* Swap slots may be freed with interrupts disabled */
+		spin_lock_irqsave(&address_space->tree_lock, flags);
+		for (; curr <= last; curr++) {
+			p = __radix_tree_lookup(&address_space->page_tree, curr,
+						&node, &slot);
+			if (!radix_tree_exceptional_entry(p))
+				continue;
+			__radix_tree_replace(&address_space->page_tree, node,
+					     slot, NULL, workingset_update_node,
+					     address_space);
+			address_space->nrexceptional--;
+		}
+		spin_unlock_irqrestore(&address_space->tree_lock, flags);
+	}
+}
+
 /* 
  * If we are the only user, then try to free up the swap cache. 
  * 
@@ -368,6 +455,7 @@ struct page *__read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 {
 	struct page *found_page, *new_page = NULL;
 	struct address_space *swapper_space = swap_address_space(entry);
+	void *shadow;
 	int err;
 	*new_page_allocated = false;
 
@@ -430,9 +518,12 @@ struct page *__read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		/* May fail (-ENOMEM) if radix-tree node allocation failed. */
 		__SetPageLocked(new_page);
 		__SetPageSwapBacked(new_page);
-		err = __add_to_swap_cache(new_page, entry);
+		shadow = NULL;
+		err = __add_to_swap_cache(new_page, entry, &shadow);
 		if (likely(!err)) {
 			radix_tree_preload_end();
+			if (shadow && workingset_refault(new_page, shadow))
+				SetPageActive(new_page);
 			/*
 			 * Initiate read into locked page and return.
 			 */
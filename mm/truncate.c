@@ -23,6 +23,7 @@
 #include <linux/shmem_fs.h>
 #include <linux/cleancache.h>
 #include <linux/rmap.h>
+#include <linux/page_replica.h>
 #include "internal.h"
 
 static void clear_shadow_entry(struct address_space *mapping, pgoff_t index,
@@ -181,7 +182,21 @@ invalidate_complete_page(struct address_space *mapping, struct page *page)
 int truncate_inode_page(struct address_space *mapping, struct page *page)
 {
 	loff_t holelen;
-	VM_BUG_ON_PAGE(PageTail(page), page);
+
+	/*
+	 * Only the THPs khugepaged collapses read-only file text into show
+	 * up here as tails (shmem splits its own).  They are never dirty:
+	 * drop the whole huge page, the part outside the range is read back
+	 * from disk on the next access.
+	 */
+	if (PageTail(page)) {
+		VM_BUG_ON_PAGE(PageSwapBacked(page), page);
+		page = compound_head(page);
+	}
+
+	/* Not in the page cache: its index may hold the real page */
+	if (WARN_ON_ONCE(PageReplica(page)))
+		return -EIO;
 
 	holelen = PageTransHuge(page) ? HPAGE_PMD_SIZE : PAGE_SIZE;
 	if (page_mapped(page)) {
@@ -408,6 +423,12 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	}
 
 out:
+	/*
+	 * Last, so that a replica made from a page before it was truncated
+	 * goes too.  That includes the partial pages at both ends.
+	 */
+	page_replica_invalidate(mapping, lstart >> PAGE_SHIFT,
+				lend >> PAGE_SHIFT);
 	cleancache_invalidate_inode(mapping);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
@@ -708,6 +729,7 @@ int invalidate_inode_pages2_range(struct address_space *mapping,
 				    (loff_t)(end - start + 1) << PAGE_SHIFT, 0);
 	}
 out:
+	page_replica_invalidate(mapping, start, end);
 	cleancache_invalidate_inode(mapping);
 	return ret;
 }
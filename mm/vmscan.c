@@ -49,12 +49,18 @@
 #include <linux/prefetch.h>
 #include <linux/printk.h>
 #include <linux/dax.h>
+#include <linux/migrate.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
 
 #include <linux/swapops.h>
 #include <linux/balloon_compaction.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/psi.h>
+#include <linux/srcu.h>
+#include <linux/idr.h>
 
 #include "internal.h"
 
@@ -156,8 +162,92 @@ int vm_swappiness = 60;
  */
 unsigned long vm_total_pages;
 
+/*
+ * shrink_slab() walks the shrinkers under RCU only, so that reclaim
+ * never waits for a shrinker to be registered and vice versa.  It pins
+ * each shrinker with a reference for the call and drops the RCU lock
+ * meanwhile.  Registration and removal are serialized by shrinker_mutex;
+ * unregister_shrinker() drops the registration reference, waits for the
+ * calls still running in its own shrinker and then for one RCU grace
+ * period, as the struct shrinker is usually embedded in the object the
+ * caller frees next.  That costs a few milliseconds, where waiting for
+ * every running shrink_slab() took as long as the slowest shrinker.
+ */
 static LIST_HEAD(shrinker_list);
-static DECLARE_RWSEM(shrinker_rwsem);
+static DEFINE_MUTEX(shrinker_mutex);
+
+static bool shrinker_try_get(struct shrinker *shrinker)
+{
+	return refcount_inc_not_zero(&shrinker->refcount);
+}
+
+static void shrinker_put(struct shrinker *shrinker)
+{
+	if (refcount_dec_and_test(&shrinker->refcount))
+		complete(&shrinker->done);
+}
+
+#ifdef CONFIG_MEMCG_KMEM
+/*
+ * Memcg aware shrinkers get an id, which is their bit in the shrinker
+ * maps of the memcgs: list_lru sets the bit of a memcg on a node when it
+ * puts the first object of the memcg on a list there, and shrink_slab()
+ * clears it when the shrinker reports SHRINK_EMPTY.  Reclaim of a memcg
+ * then only calls the shrinkers which have something in it.
+ */
+static DEFINE_IDR(shrinker_idr);
+static int shrinker_nr_max;
+
+/*
+ * The maps are walked while the shrinkers run, so the old ones left by
+ * memcg_expand_shrinker_maps() are freed after an SRCU grace period.
+ * Nothing waits for it synchronously.
+ */
+DEFINE_SRCU(shrinker_srcu);
+
+/* Placeholder in shrinker_idr between prealloc and registration */
+#define SHRINKER_REGISTERING ((struct shrinker *)~0UL)
+
+static int prealloc_memcg_shrinker(struct shrinker *shrinker)
+{
+	int id, ret = -ENOMEM;
+
+	mutex_lock(&shrinker_mutex);
+	id = idr_alloc(&shrinker_idr, SHRINKER_REGISTERING, 0, 0, GFP_KERNEL);
+	if (id < 0)
+		goto unlock;
+
+	if (id >= shrinker_nr_max) {
+		if (memcg_expand_shrinker_maps(id)) {
+			idr_remove(&shrinker_idr, id);
+			goto unlock;
+		}
+		/* The maps must be visible first, see shrink_slab_memcg() */
+		smp_wmb();
+		WRITE_ONCE(shrinker_nr_max, id + 1);
+	}
+	shrinker->id = id;
+	ret = 0;
+unlock:
+	mutex_unlock(&shrinker_mutex);
+	return ret;
+}
+
+static void unregister_memcg_shrinker(struct shrinker *shrinker)
+{
+	lockdep_assert_held(&shrinker_mutex);
+	idr_remove(&shrinker_idr, shrinker->id);
+}
+#else /* CONFIG_MEMCG_KMEM */
+static int prealloc_memcg_shrinker(struct shrinker *shrinker)
+{
+	return 0;
+}
+
+static void unregister_memcg_shrinker(struct shrinker *shrinker)
+{
+}
+#endif /* CONFIG_MEMCG_KMEM */
 
 #ifdef CONFIG_MEMCG
 static bool global_reclaim(struct scan_control *sc)
@@ -202,6 +292,19 @@ static bool sane_reclaim(struct scan_control *sc)
 }
 #endif
 
+/*
+ * Can cold pages on @nid be demoted to a slower node instead of being
+ * reclaimed?  Demotion keeps the memory charged to the cgroup, so it is
+ * of no use to limit reclaim.
+ */
+static bool can_demote(int nid, struct scan_control *sc)
+{
+	if (!numa_demotion_enabled || !global_reclaim(sc))
+		return false;
+
+	return next_demotion_node(nid) != NUMA_NO_NODE;
+}
+
 /*
  * This misses isolated pages which are not accounted for to save counters.
  * As the data only determines if reclaim or compaction continues, it is
@@ -272,9 +375,11 @@ unsigned long lruvec_lru_size(struct lruvec *lruvec, enum lru_list lru, int zone
 }
 
 /*
- * Add a shrinker callback to be called from the vm.
+ * Allocate what a shrinker needs before it can be registered.  Memcg
+ * aware shrinkers get their id here, which the list_lrus they use must
+ * know before any object is added to them.
  */
-int register_shrinker(struct shrinker *shrinker)
+int prealloc_shrinker(struct shrinker *shrinker)
 {
 	size_t size = sizeof(*shrinker->nr_deferred);
 
@@ -285,23 +390,78 @@ int register_shrinker(struct shrinker *shrinker)
 	if (!shrinker->nr_deferred)
 		return -ENOMEM;
 
-	down_write(&shrinker_rwsem);
-	list_add_tail(&shrinker->list, &shrinker_list);
-	up_write(&shrinker_rwsem);
+	if (shrinker->flags & SHRINKER_MEMCG_AWARE) {
+		if (prealloc_memcg_shrinker(shrinker)) {
+			kfree(shrinker->nr_deferred);
+			shrinker->nr_deferred = NULL;
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+void free_prealloced_shrinker(struct shrinker *shrinker)
+{
+	if (!shrinker->nr_deferred)
+		return;
+
+	if (shrinker->flags & SHRINKER_MEMCG_AWARE) {
+		mutex_lock(&shrinker_mutex);
+		unregister_memcg_shrinker(shrinker);
+		mutex_unlock(&shrinker_mutex);
+	}
+
+	kfree(shrinker->nr_deferred);
+	shrinker->nr_deferred = NULL;
+}
+
+void register_shrinker_prepared(struct shrinker *shrinker)
+{
+	refcount_set(&shrinker->refcount, 1);
+	init_completion(&shrinker->done);
+	mutex_lock(&shrinker_mutex);
+	list_add_tail_rcu(&shrinker->list, &shrinker_list);
+#ifdef CONFIG_MEMCG_KMEM
+	if (shrinker->flags & SHRINKER_MEMCG_AWARE)
+		idr_replace(&shrinker_idr, shrinker, shrinker->id);
+#endif
+	mutex_unlock(&shrinker_mutex);
+}
+
+/*
+ * Add a shrinker callback to be called from the vm.
+ */
+int register_shrinker(struct shrinker *shrinker)
+{
+	int err = prealloc_shrinker(shrinker);
+
+	if (err)
+		return err;
+	register_shrinker_prepared(shrinker);
 	return 0;
 }
 EXPORT_SYMBOL(register_shrinker);
 
 /*
- * Remove one
+ * Remove one.  Must not be called from a shrinker callback, as it waits
+ * for those to finish.
  */
 void unregister_shrinker(struct shrinker *shrinker)
 {
 	if (!shrinker->nr_deferred)
 		return;
-	down_write(&shrinker_rwsem);
-	list_del(&shrinker->list);
-	up_write(&shrinker_rwsem);
+	shrinker_put(shrinker);
+	wait_for_completion(&shrinker->done);
+
+	mutex_lock(&shrinker_mutex);
+	list_del_rcu(&shrinker->list);
+	if (shrinker->flags & SHRINKER_MEMCG_AWARE)
+		unregister_memcg_shrinker(shrinker);
+	mutex_unlock(&shrinker_mutex);
+
+	synchronize_rcu();
+
 	kfree(shrinker->nr_deferred);
 	shrinker->nr_deferred = NULL;
 }
@@ -326,8 +486,8 @@ static unsigned long do_shrink_slab(struct shrink_control *shrinkctl,
 	long scanned = 0, next_deferred;
 
 	freeable = shrinker->count_objects(shrinker, shrinkctl);
-	if (freeable == 0)
-		return 0;
+	if (freeable == 0 || freeable == SHRINK_EMPTY)
+		return freeable;
 
 	/*
 	 * copy the current shrinker scan count into a local variable
@@ -429,6 +589,92 @@ static unsigned long do_shrink_slab(struct shrink_control *shrinkctl,
 	return freed;
 }
 
+#ifdef CONFIG_MEMCG_KMEM
+static unsigned long shrink_slab_memcg(gfp_t gfp_mask, int nid,
+				       struct mem_cgroup *memcg,
+				       unsigned long nr_scanned,
+				       unsigned long nr_eligible)
+{
+	struct memcg_shrinker_map *map;
+	unsigned long freed = 0;
+	int i, nr_max, srcu_idx;
+
+	srcu_idx = srcu_read_lock(&shrinker_srcu);
+	/* Paired with the smp_wmb() in prealloc_memcg_shrinker() */
+	nr_max = READ_ONCE(shrinker_nr_max);
+	smp_rmb();
+	map = srcu_dereference(memcg->nodeinfo[nid]->shrinker_map,
+			       &shrinker_srcu);
+	if (unlikely(!map))
+		goto unlock;
+
+	for_each_set_bit(i, map->map, nr_max) {
+		struct shrink_control sc = {
+			.gfp_mask = gfp_mask,
+			.nid = nid,
+			.memcg = memcg,
+		};
+		struct shrinker *shrinker;
+		unsigned long ret;
+
+		rcu_read_lock();
+		shrinker = idr_find(&shrinker_idr, i);
+		if (unlikely(!shrinker || shrinker == SHRINKER_REGISTERING)) {
+			rcu_read_unlock();
+			if (!shrinker)
+				clear_bit(i, map->map);
+			continue;
+		}
+		if (!shrinker_try_get(shrinker)) {
+			rcu_read_unlock();
+			continue;
+		}
+		rcu_read_unlock();
+
+		if (!(shrinker->flags & SHRINKER_NUMA_AWARE))
+			sc.nid = 0;
+
+		ret = do_shrink_slab(&sc, shrinker, nr_scanned, nr_eligible);
+		if (ret == SHRINK_EMPTY) {
+			clear_bit(i, map->map);
+			/*
+			 * An object may have been added after the shrinker
+			 * found none but before the bit was cleared, and the
+			 * bit would stay clear with the object on the list.
+			 * Call the shrinker once more and set the bit again
+			 * if it isn't empty anymore.  Paired with the barrier
+			 * in memcg_set_shrinker_bit():
+			 *
+			 * list_lru_add()     shrink_slab_memcg()
+			 *   list_add_tail()    clear_bit()
+			 *   <MB>               <MB>
+			 *   set_bit()          do_shrink_slab()
+			 */
+			smp_mb__after_atomic();
+			ret = do_shrink_slab(&sc, shrinker, nr_scanned,
+					     nr_eligible);
+			if (ret == SHRINK_EMPTY)
+				ret = 0;
+			else
+				memcg_set_shrinker_bit(memcg, nid, i);
+		}
+		shrinker_put(shrinker);
+		freed += ret;
+	}
+unlock:
+	srcu_read_unlock(&shrinker_srcu, srcu_idx);
+	return freed;
+}
+#else /* CONFIG_MEMCG_KMEM */
+static unsigned long shrink_slab_memcg(gfp_t gfp_mask, int nid,
+				       struct mem_cgroup *memcg,
+				       unsigned long nr_scanned,
+				       unsigned long nr_eligible)
+{
+	return 0;
+}
+#endif /* CONFIG_MEMCG_KMEM */
+
 /**
  * shrink_slab - shrink slab caches
  * @gfp_mask: allocation context
@@ -445,7 +691,8 @@ static unsigned long do_shrink_slab(struct shrink_control *shrinkctl,
  * @memcg specifies the memory cgroup to target. If it is not NULL,
  * only shrinkers with SHRINKER_MEMCG_AWARE set will be called to scan
  * objects from the memory cgroup specified. Otherwise, only unaware
- * shrinkers are called.
+ * shrinkers are called.  For memcgs other than the root, only the
+ * shrinkers set in the memcg's shrinker map for @nid are called.
  *
  * @nr_scanned and @nr_eligible form a ratio that indicate how much of
  * the available objects should be scanned.  Page reclaim for example
@@ -464,6 +711,7 @@ static unsigned long shrink_slab(gfp_t gfp_mask, int nid,
 {
 	struct shrinker *shrinker;
 	unsigned long freed = 0;
+	unsigned long ret;
 
 	if (memcg && (!memcg_kmem_enabled() || !mem_cgroup_online(memcg)))
 		return 0;
@@ -471,18 +719,14 @@ static unsigned long shrink_slab(gfp_t gfp_mask, int nid,
 	if (nr_scanned == 0)
 		nr_scanned = SWAP_CLUSTER_MAX;
 
-	if (!down_read_trylock(&shrinker_rwsem)) {
-		/*
-		 * If we would return 0, our callers would understand that we
-		 * have nothing else to shrink and give up trying. By returning
-		 * 1 we keep it going and assume we'll be able to shrink next
-		 * time.
-		 */
-		freed = 1;
+	if (memcg && !mem_cgroup_is_root(memcg)) {
+		freed = shrink_slab_memcg(gfp_mask, nid, memcg, nr_scanned,
+					  nr_eligible);
 		goto out;
 	}
 
-	list_for_each_entry(shrinker, &shrinker_list, list) {
+	rcu_read_lock();
+	list_for_each_entry_rcu(shrinker, &shrinker_list, list) {
 		struct shrink_control sc = {
 			.gfp_mask = gfp_mask,
 			.nid = nid,
@@ -501,19 +745,23 @@ static unsigned long shrink_slab(gfp_t gfp_mask, int nid,
 		if (!(shrinker->flags & SHRINKER_NUMA_AWARE))
 			sc.nid = 0;
 
-		freed += do_shrink_slab(&sc, shrinker, nr_scanned, nr_eligible);
 		/*
-		 * Bail out if someone want to register a new shrinker to
-		 * prevent the regsitration from being stalled for long periods
-		 * by parallel ongoing shrinking.
+		 * A pinned shrinker stays on the list, so the walk can go
+		 * on from it after the RCU lock has been dropped.
 		 */
-		if (rwsem_is_contended(&shrinker_rwsem)) {
-			freed = freed ? : 1;
-			break;
-		}
-	}
+		if (!shrinker_try_get(shrinker))
+			continue;
+		rcu_read_unlock();
+
+		ret = do_shrink_slab(&sc, shrinker, nr_scanned, nr_eligible);
+		if (ret == SHRINK_EMPTY)
+			ret = 0;
+		freed += ret;
 
-	up_read(&shrinker_rwsem);
+		rcu_read_lock();
+		shrinker_put(shrinker);
+	}
+	rcu_read_unlock();
 out:
 	cond_resched();
 	return freed;
@@ -549,8 +797,7 @@ static inline int is_page_cache_freeable(struct page *page)
 	 * that isolated the page, the page cache radix tree and
 	 * optional buffer heads at page->private.
 	 */
-	int radix_pins = PageTransHuge(page) && PageSwapCache(page) ?
-		HPAGE_PMD_NR : 1;
+	int radix_pins = PageTransHuge(page) ? HPAGE_PMD_NR : 1;
 	return page_count(page) - page_has_private(page) == 1 + radix_pins;
 }
 
@@ -712,7 +959,8 @@ static int __remove_mapping(struct address_space *mapping, struct page *page,
 	 * Note that if SetPageDirty is always performed via set_page_dirty,
 	 * and thus under tree_lock, then this ordering is not required.
 	 */
-	if (unlikely(PageTransHuge(page)) && PageSwapCache(page))
+	/* A THP in the swap or page cache has one reference per subpage */
+	if (unlikely(PageTransHuge(page)))
 		refcount = 1 + HPAGE_PMD_NR;
 	else
 		refcount = 2;
@@ -726,8 +974,17 @@ static int __remove_mapping(struct address_space *mapping, struct page *page,
 
 	if (PageSwapCache(page)) {
 		swp_entry_t swap = { .val = page_private(page) };
+		void *shadow = NULL;
+
+		/*
+		 * Anon pages leave a shadow entry in the swap cache, too.
+		 * This is done before mem_cgroup_swapout() takes the page
+		 * away from its memcg.
+		 */
+		if (reclaimed && !mapping_exiting(mapping))
+			shadow = workingset_eviction(mapping, page);
 		mem_cgroup_swapout(page, swap);
-		__delete_from_swap_cache(page);
+		__delete_from_swap_cache(page, shadow);
 		spin_unlock_irqrestore(&mapping->tree_lock, flags);
 		put_swap_page(page, swap);
 	} else {
@@ -963,6 +1220,103 @@ struct reclaim_stat {
 	unsigned nr_unmap_fail;
 };
 
+#ifdef CONFIG_NUMA_DEMOTION
+struct demote_control {
+	int nid;
+	unsigned long nr_demoted;
+};
+
+static struct page *alloc_demote_page(struct page *page, unsigned long private,
+				      int **result)
+{
+	struct demote_control *dc = (struct demote_control *)private;
+	struct page *newpage;
+
+	/*
+	 * Demotion must not dip into reserves or enter reclaim on the target
+	 * node: failing is fine, the page is then reclaimed instead.
+	 */
+	if (PageTransHuge(page)) {
+		newpage = alloc_pages_node(dc->nid, GFP_TRANSHUGE_LIGHT |
+					   __GFP_THISNODE, HPAGE_PMD_ORDER);
+		if (newpage)
+			prep_transhuge_page(newpage);
+	} else {
+		newpage = __alloc_pages_node(dc->nid,
+					     (GFP_HIGHUSER_MOVABLE &
+					      ~__GFP_RECLAIM) |
+					     __GFP_THISNODE | __GFP_NOWARN |
+					     __GFP_NOMEMALLOC | GFP_NOWAIT, 0);
+	}
+	if (newpage)
+		dc->nr_demoted += hpage_nr_pages(newpage);
+
+	return newpage;
+}
+
+static void free_demote_page(struct page *page, unsigned long private)
+{
+	struct demote_control *dc = (struct demote_control *)private;
+
+	dc->nr_demoted -= hpage_nr_pages(page);
+	put_page(page);
+}
+
+/*
+ * Take pages on @demote_pages and attempt to demote them to the next
+ * node in the demotion path.  Returns the number of base pages demoted.
+ *
+ * Pages migrate_pages() gave up on for lack of a target page, or after
+ * its retries, are left on the list.  Those that failed for any other
+ * reason, e.g. pinned or under writeback, were put back on the LRU by
+ * migrate_pages() itself: they are neither demoted nor reclaimed.
+ */
+static unsigned long demote_page_list(struct list_head *demote_pages,
+				      struct pglist_data *pgdat)
+{
+	struct demote_control dc = {
+		.nid = next_demotion_node(pgdat->node_id),
+	};
+	unsigned long nr_isolated[2] = { 0, };
+	struct page *page;
+	int i;
+
+	if (list_empty(demote_pages) || dc.nid == NUMA_NO_NODE)
+		return 0;
+
+	list_for_each_entry(page, demote_pages, lru)
+		nr_isolated[page_is_file_cache(page)] += hpage_nr_pages(page);
+
+	/* Demotion ignores all cpuset and mempolicy settings */
+	migrate_pages(demote_pages, alloc_demote_page, free_demote_page,
+		      (unsigned long)&dc, MIGRATE_ASYNC, MR_DEMOTION);
+
+	/*
+	 * migrate_pages() drops NR_ISOLATED_* for every page it takes off
+	 * the list, but our caller will drop it for all pages it isolated.
+	 */
+	list_for_each_entry(page, demote_pages, lru)
+		nr_isolated[page_is_file_cache(page)] -= hpage_nr_pages(page);
+	for (i = 0; i < 2; i++)
+		if (nr_isolated[i])
+			mod_node_page_state(pgdat, NR_ISOLATED_ANON + i,
+					    nr_isolated[i]);
+
+	if (current_is_kswapd())
+		count_vm_events(PGDEMOTE_KSWAPD, dc.nr_demoted);
+	else
+		count_vm_events(PGDEMOTE_DIRECT, dc.nr_demoted);
+
+	return dc.nr_demoted;
+}
+#else
+static unsigned long demote_page_list(struct list_head *demote_pages,
+				      struct pglist_data *pgdat)
+{
+	return 0;
+}
+#endif
+
 /*
  * shrink_page_list() returns the number of reclaimed pages
  */
@@ -984,9 +1338,13 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 	unsigned nr_immediate = 0;
 	unsigned nr_ref_keep = 0;
 	unsigned nr_unmap_fail = 0;
+	LIST_HEAD(demote_pages);
+	bool do_demote_pass;
 
 	cond_resched();
+	do_demote_pass = !force_reclaim && can_demote(pgdat->node_id, sc);
 
+retry:
 	while (!list_empty(page_list)) {
 		struct address_space *mapping;
 		struct page *page;
@@ -1137,6 +1495,17 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			; /* try to reclaim the page below */
 		}
 
+		/*
+		 * Before reclaiming the page, try to relocate its contents
+		 * to a slower node, see demote_page_list().
+		 */
+		if (do_demote_pass &&
+		    (thp_migration_supported() || !PageTransHuge(page))) {
+			list_add(&page->lru, &demote_pages);
+			unlock_page(page);
+			continue;
+		}
+
 		/*
 		 * Anonymous process memory has backing store?
 		 * Try to allocate it some swap space here.
@@ -1359,6 +1728,15 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		VM_BUG_ON_PAGE(PageLRU(page) || PageUnevictable(page), page);
 	}
 
+	/* Migrate pages selected for demotion */
+	nr_reclaimed += demote_page_list(&demote_pages, pgdat);
+	/* Pages still on the list are reclaimed the usual way */
+	if (!list_empty(&demote_pages)) {
+		list_splice_init(&demote_pages, page_list);
+		do_demote_pass = false;
+		goto retry;
+	}
+
 	mem_cgroup_uncharge_list(&free_pages);
 	try_to_unmap_flush();
 	free_hot_cold_page_list(&free_pages, true);
@@ -1406,6 +1784,71 @@ unsigned long reclaim_clean_pages_from_list(struct zone *zone,
 	return ret;
 }
 
+static unsigned long reclaim_node_pages(struct list_head *page_list,
+					int nid, struct scan_control *sc)
+{
+	struct reclaim_stat dummy_stat;
+	unsigned long nr_reclaimed;
+	struct page *page;
+
+	nr_reclaimed = shrink_page_list(page_list, NODE_DATA(nid), sc, 0,
+					&dummy_stat, false);
+	while (!list_empty(page_list)) {
+		page = lru_to_page(page_list);
+		list_del(&page->lru);
+		putback_lru_page(page);
+	}
+
+	return nr_reclaimed;
+}
+
+/**
+ * reclaim_pages - reclaim a list of isolated pages right away
+ * @page_list: pages isolated from the LRU with isolate_lru_page()
+ *
+ * Pages are handed to shrink_page_list() one node at a time, so anon
+ * pages are swapped out as in regular reclaim.  Dirty file pages are
+ * not written from here, only kswapd does that: they are left to the
+ * flusher.  Whatever cannot be reclaimed is put back on the LRU.
+ * Returns the number of reclaimed pages.
+ */
+unsigned long reclaim_pages(struct list_head *page_list)
+{
+	int nid = -1;
+	unsigned long nr_reclaimed = 0;
+	LIST_HEAD(node_page_list);
+	struct page *page;
+	struct scan_control sc = {
+		.gfp_mask = GFP_KERNEL,
+		.priority = DEF_PRIORITY,
+		.may_writepage = 1,
+		.may_unmap = 1,
+		.may_swap = 1,
+	};
+
+	while (!list_empty(page_list)) {
+		page = lru_to_page(page_list);
+		if (nid == -1) {
+			nid = page_to_nid(page);
+			INIT_LIST_HEAD(&node_page_list);
+		}
+
+		if (nid == page_to_nid(page)) {
+			ClearPageActive(page);
+			list_move(&page->lru, &node_page_list);
+			continue;
+		}
+
+		nr_reclaimed += reclaim_node_pages(&node_page_list, nid, &sc);
+		nid = -1;
+	}
+
+	if (!list_empty(&node_page_list))
+		nr_reclaimed += reclaim_node_pages(&node_page_list, nid, &sc);
+
+	return nr_reclaimed;
+}
+
 /*
  * Attempt to remove the specified page from its LRU.  Only take this page
  * if it is of the appropriate PageActive status.  Pages which are being
@@ -2134,7 +2577,7 @@ static bool inactive_list_is_low(struct lruvec *lruvec, bool file,
 	 * If we don't have swap space, anonymous page deactivation
 	 * is pointless.
 	 */
-	if (!file && !total_swap_pages)
+	if (!file && !total_swap_pages && !can_demote(pgdat->node_id, sc))
 		return false;
 
 	inactive = lruvec_lru_size(lruvec, inactive_lru, sc->reclaim_idx);
@@ -2145,8 +2588,8 @@ static bool inactive_list_is_low(struct lruvec *lruvec, bool file,
 	 * is being established. Disable active list protection to get
 	 * rid of the stale workingset quickly.
 	 */
-	refaults = lruvec_page_state(lruvec, WORKINGSET_ACTIVATE);
-	if (file && lruvec->refaults != refaults) {
+	refaults = lruvec_page_state(lruvec, WORKINGSET_ACTIVATE_BASE + file);
+	if (lruvec->refaults[file] != refaults) {
 		inactive_ratio = 0;
 	} else {
 		gb = (inactive + active) >> (30 - PAGE_SHIFT);
@@ -2209,7 +2652,8 @@ static void get_scan_count(struct lruvec *lruvec, struct mem_cgroup *memcg,
 	enum lru_list lru;
 
 	/* If we have no swap space, do not bother scanning anon pages. */
-	if (!sc->may_swap || mem_cgroup_get_nr_swap_pages(memcg) <= 0) {
+	if (!sc->may_swap || (mem_cgroup_get_nr_swap_pages(memcg) <= 0 &&
+			      !can_demote(pgdat->node_id, sc))) {
 		scan_balance = SCAN_FILE;
 		goto out;
 	}
@@ -2334,6 +2778,9 @@ static void get_scan_count(struct lruvec *lruvec, struct mem_cgroup *memcg,
 	 * The amount of pressure on anon vs file pages is inversely
 	 * proportional to the fraction of recently scanned pages on
 	 * each list that were recently referenced and in active use.
+	 * Refaulting pages of either type that are part of the
+	 * workingset are added to the active list and count as
+	 * rotated, too, so a type that is thrashing gets less pressure.
 	 */
 	ap = anon_prio * (reclaim_stat->recent_scanned[0] + 1);
 	ap /= reclaim_stat->recent_rotated[0] + 1;
@@ -2396,6 +2843,600 @@ static void get_scan_count(struct lruvec *lruvec, struct mem_cgroup *memcg,
 	}
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Multi-gen LRU
+ *
+ * Evictable pages are kept in generations instead of on the active and
+ * inactive lists, see struct lru_gen_struct.  Aging does not walk the
+ * rmap of each page: it starts a new generation and then scans the page
+ * tables of the processes using the memcg, moving the pages it finds
+ * accessed into the new generation a batch at a time.  Reclaim evicts
+ * from the oldest generation of each type, anon or file, picking the
+ * older of the two.
+ */
+
+#ifdef CONFIG_LRU_GEN_ENABLED
+DEFINE_STATIC_KEY_TRUE(lru_gen_key);
+#else
+DEFINE_STATIC_KEY_FALSE(lru_gen_key);
+#endif
+
+/* Pages found young by a page table walk, moved under one lru_lock */
+#define LRU_GEN_WALK_BATCH	32
+
+static int __init setup_lru_gen(char *str)
+{
+	bool enable;
+
+	if (kstrtobool(str, &enable))
+		return 0;
+
+	if (enable)
+		static_branch_enable(&lru_gen_key);
+	else
+		static_branch_disable(&lru_gen_key);
+	return 1;
+}
+__setup("lru_gen=", setup_lru_gen);
+
+void lru_gen_init_lruvec(struct lruvec *lruvec)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int gen, type, zone;
+
+	lrugen->max_seq = MIN_NR_GENS - 1;
+	for (gen = 0; gen < MAX_NR_GENS; gen++) {
+		lrugen->timestamps[gen] = jiffies;
+		for (type = 0; type < 2; type++)
+			for (zone = 0; zone < MAX_NR_ZONES; zone++)
+				INIT_LIST_HEAD(&lrugen->lists[gen][type][zone]);
+	}
+}
+
+/*
+ * Every mm is on this list from mm_init() to __mmput(), so that aging can
+ * find the page tables mapping the pages of a memcg.
+ */
+static LIST_HEAD(lru_gen_mm_list);
+static DEFINE_SPINLOCK(lru_gen_mm_lock);
+
+void lru_gen_add_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_add_tail(&mm->lru_gen_list, &lru_gen_mm_list);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+void lru_gen_del_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_del_init(&mm->lru_gen_list);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+static unsigned long lru_gen_nr_pages(struct lruvec *lruvec, int type,
+				      int reclaim_idx)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	unsigned long seq;
+	long total = 0;
+	int zone;
+
+	for (seq = lrugen->min_seq[type]; seq <= lrugen->max_seq; seq++) {
+		int gen = lru_gen_from_seq(seq);
+
+		for (zone = 0; zone <= reclaim_idx; zone++)
+			total += READ_ONCE(lrugen->nr_pages[gen][type][zone]);
+	}
+
+	return max(total, 0L);
+}
+
+/* Fold the oldest generation of @type into the next one */
+static void lru_gen_inc_min_seq(struct lruvec *lruvec, int type)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int old_gen = lru_gen_from_seq(lrugen->min_seq[type]);
+	int new_gen = lru_gen_from_seq(lrugen->min_seq[type] + 1);
+	int zone;
+
+	lockdep_assert_held(&lruvec_pgdat(lruvec)->lru_lock);
+	VM_BUG_ON(lrugen->max_seq - lrugen->min_seq[type] + 1 <= MIN_NR_GENS);
+
+	for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+		struct list_head *head = &lrugen->lists[old_gen][type][zone];
+		struct page *page;
+
+		list_for_each_entry(page, head, lru) {
+			lru_gen_update_size(lruvec, page, old_gen, new_gen);
+			set_mask_bits(&page->flags, LRU_GEN_MASK,
+				      (new_gen + 1UL) << LRU_GEN_PGOFF);
+		}
+		/* older than anything already there, so they go to the tail */
+		list_splice_tail_init(head, &lrugen->lists[new_gen][type][zone]);
+	}
+
+	lrugen->min_seq[type]++;
+}
+
+/* Start a new generation, unless somebody else already did since @max_seq */
+static bool lru_gen_inc_max_seq(struct lruvec *lruvec, unsigned long max_seq)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int gen, type, zone;
+
+	lockdep_assert_held(&lruvec_pgdat(lruvec)->lru_lock);
+
+	if (max_seq != lrugen->max_seq)
+		return false;
+
+	for (type = 0; type < 2; type++)
+		while (max_seq - lrugen->min_seq[type] + 1 >= MAX_NR_GENS)
+			lru_gen_inc_min_seq(lruvec, type);
+
+	/* The second youngest generation is about to become inactive */
+	gen = lru_gen_from_seq(max_seq - 1);
+	for (type = 0; type < 2; type++) {
+		enum lru_list lru = type ? LRU_INACTIVE_FILE : LRU_INACTIVE_ANON;
+
+		for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+			long delta = lrugen->nr_pages[gen][type][zone];
+
+			if (!delta)
+				continue;
+			update_lru_size(lruvec, lru + LRU_ACTIVE, zone, -delta);
+			update_lru_size(lruvec, lru, zone, delta);
+		}
+	}
+
+	gen = lru_gen_from_seq(max_seq + 1);
+	lrugen->timestamps[gen] = jiffies;
+	WRITE_ONCE(lrugen->max_seq, max_seq + 1);
+
+	return true;
+}
+
+struct lru_gen_walk {
+	struct lruvec *lruvec;
+	int nr;
+	struct page *pages[LRU_GEN_WALK_BATCH];
+};
+
+/* Move the pages collected by the walk into the youngest generation */
+static void lru_gen_walk_flush(struct lru_gen_walk *args)
+{
+	struct lruvec *lruvec = args->lruvec;
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	struct pglist_data *pgdat = lruvec_pgdat(lruvec);
+	int i;
+
+	spin_lock_irq(&pgdat->lru_lock);
+	for (i = 0; i < args->nr; i++) {
+		struct page *page = args->pages[i];
+		int old_gen = page_lru_gen(page);
+		int new_gen = lru_gen_from_seq(lrugen->max_seq);
+
+		/* Isolated, or charged to another memcg since? */
+		if (!PageLRU(page) || old_gen < 0 || old_gen == new_gen ||
+		    mem_cgroup_page_lruvec(page, pgdat) != lruvec)
+			continue;
+
+		lru_gen_update_size(lruvec, page, old_gen, new_gen);
+		set_mask_bits(&page->flags, LRU_GEN_MASK,
+			      (new_gen + 1UL) << LRU_GEN_PGOFF);
+		list_move(&page->lru, &lrugen->lists[new_gen]
+				[page_is_file_cache(page)][page_zonenum(page)]);
+	}
+	spin_unlock_irq(&pgdat->lru_lock);
+
+	for (i = 0; i < args->nr; i++)
+		put_page(args->pages[i]);
+	args->nr = 0;
+}
+
+static void lru_gen_walk_add(struct lru_gen_walk *args, struct page *page)
+{
+	if (!PageLRU(page) ||
+	    page_pgdat(page) != lruvec_pgdat(args->lruvec))
+		return;
+
+	get_page(page);
+	args->pages[args->nr++] = page;
+	if (args->nr == LRU_GEN_WALK_BATCH)
+		lru_gen_walk_flush(args);
+}
+
+static int lru_gen_walk_pmd(pmd_t *pmd, unsigned long addr,
+			    unsigned long end, struct mm_walk *walk)
+{
+	struct lru_gen_walk *args = walk->private;
+	struct vm_area_struct *vma = walk->vma;
+	pte_t *orig_pte, *pte;
+	spinlock_t *ptl;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	ptl = pmd_trans_huge_lock(pmd, vma);
+	if (ptl) {
+		if (pmd_present(*pmd) &&
+		    pmdp_test_and_clear_young(vma, addr, pmd))
+			lru_gen_walk_add(args, pmd_page(*pmd));
+		spin_unlock(ptl);
+		return 0;
+	}
+#endif
+	if (pmd_trans_unstable(pmd))
+		return 0;
+
+	/*
+	 * The accessed bits are cleared without flushing the TLB, like
+	 * page_referenced() does on x86: a stale entry only makes us miss
+	 * an access until the next aging.
+	 */
+	orig_pte = pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		struct page *page;
+
+		if (!pte_present(*pte) || !pte_young(*pte))
+			continue;
+
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page)
+			continue;
+
+		if (ptep_test_and_clear_young(vma, addr, pte))
+			lru_gen_walk_add(args, compound_head(page));
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+	cond_resched();
+
+	return 0;
+}
+
+static int lru_gen_walk_test(unsigned long start, unsigned long end,
+			     struct mm_walk *walk)
+{
+	struct vm_area_struct *vma = walk->vma;
+
+	/* mlocked pages are not on the LRU lists we age */
+	if ((vma->vm_flags & (VM_LOCKED | VM_SPECIAL)) ||
+	    is_vm_hugetlb_page(vma))
+		return 1;
+
+	return 0;
+}
+
+static void lru_gen_walk_mm(struct mm_struct *mm, struct lru_gen_walk *args)
+{
+	struct mm_walk walk = {
+		.pmd_entry = lru_gen_walk_pmd,
+		.test_walk = lru_gen_walk_test,
+		.mm = mm,
+		.private = args,
+	};
+
+	/* Aging must not wait for page faults or mmap() */
+	if (!down_read_trylock(&mm->mmap_sem))
+		return;
+
+	walk_page_range(0, mm->highest_vm_end, &walk);
+	up_read(&mm->mmap_sem);
+
+	if (args->nr)
+		lru_gen_walk_flush(args);
+}
+
+/*
+ * Age @lruvec: start a new generation and move the pages mapped by the
+ * processes of its memcg and accessed since the last walk into it.
+ */
+static void lru_gen_age(struct lruvec *lruvec, unsigned long max_seq)
+{
+	struct pglist_data *pgdat = lruvec_pgdat(lruvec);
+	struct mem_cgroup *memcg = lruvec_memcg(lruvec);
+	struct lru_gen_walk args = {
+		.lruvec = lruvec,
+	};
+	struct mm_struct *mm, *prev = NULL;
+	struct list_head *pos;
+	bool success;
+
+	spin_lock_irq(&pgdat->lru_lock);
+	success = lru_gen_inc_max_seq(lruvec, max_seq);
+	spin_unlock_irq(&pgdat->lru_lock);
+	if (!success)
+		return;
+
+	/*
+	 * Same as in try_to_unuse(): the reference we hold on the mm we
+	 * last walked keeps it on the list, so we can continue from it.
+	 */
+	spin_lock(&lru_gen_mm_lock);
+	for (pos = lru_gen_mm_list.next; pos != &lru_gen_mm_list;
+	     pos = pos->next) {
+		mm = list_entry(pos, struct mm_struct, lru_gen_list);
+		if (memcg && !mm_match_cgroup(mm, memcg))
+			continue;
+		if (!mmget_not_zero(mm))
+			continue;
+		spin_unlock(&lru_gen_mm_lock);
+
+		if (prev)
+			mmput_async(prev);
+		prev = mm;
+		lru_gen_walk_mm(mm, &args);
+
+		spin_lock(&lru_gen_mm_lock);
+	}
+	spin_unlock(&lru_gen_mm_lock);
+
+	if (prev)
+		mmput_async(prev);
+}
+
+/*
+ * Isolate pages of @type from the oldest generation.  If that has no
+ * pages left in the zones we can reclaim from, fold it into the next
+ * one; once only MIN_NR_GENS are left, set @need_aging and return.
+ */
+static unsigned long lru_gen_isolate(struct lruvec *lruvec,
+				     struct scan_control *sc, int type,
+				     struct list_head *page_list,
+				     unsigned long *nr_scanned,
+				     unsigned long *need_aging)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	isolate_mode_t mode = sc->may_unmap ? 0 : ISOLATE_UNMAPPED;
+	unsigned long nr_taken = 0, scanned = 0;
+	int gen, zone;
+
+	while (!nr_taken) {
+		if (lrugen->max_seq - lrugen->min_seq[type] + 1 <= MIN_NR_GENS) {
+			*need_aging = lrugen->max_seq;
+			break;
+		}
+
+		gen = lru_gen_from_seq(lrugen->min_seq[type]);
+		for (zone = sc->reclaim_idx; zone >= 0; zone--) {
+			struct list_head *head = &lrugen->lists[gen][type][zone];
+			int remaining = SWAP_CLUSTER_MAX;
+
+			while (!list_empty(head) && remaining-- > 0 &&
+			       nr_taken < SWAP_CLUSTER_MAX) {
+				struct page *page = lru_to_page(head);
+				int nr_pages = hpage_nr_pages(page);
+
+				scanned += nr_pages;
+				if (__isolate_lru_page(page, mode)) {
+					/* Look at the others first */
+					list_move(&page->lru, head);
+					continue;
+				}
+
+				lru_gen_del_page(lruvec, page, true);
+				list_add(&page->lru, page_list);
+				nr_taken += nr_pages;
+			}
+		}
+
+		if (nr_taken || scanned)
+			break;
+
+		lru_gen_inc_min_seq(lruvec, type);
+	}
+
+	*nr_scanned = scanned;
+	return nr_taken;
+}
+
+static unsigned long lru_gen_evict(struct lruvec *lruvec,
+				   struct scan_control *sc, int type,
+				   unsigned long *need_aging)
+{
+	struct pglist_data *pgdat = lruvec_pgdat(lruvec);
+	struct mem_cgroup *memcg = lruvec_memcg(lruvec);
+	struct reclaim_stat stat = {};
+	unsigned long nr_taken, nr_scanned, nr_reclaimed;
+	LIST_HEAD(page_list);
+
+	spin_lock_irq(&pgdat->lru_lock);
+	nr_taken = lru_gen_isolate(lruvec, sc, type, &page_list,
+				   &nr_scanned, need_aging);
+	__mod_node_page_state(pgdat, NR_ISOLATED_ANON + type, nr_taken);
+
+	if (current_is_kswapd()) {
+		if (global_reclaim(sc))
+			__count_vm_events(PGSCAN_KSWAPD, nr_scanned);
+		count_memcg_events(memcg, PGSCAN_KSWAPD, nr_scanned);
+	} else {
+		if (global_reclaim(sc))
+			__count_vm_events(PGSCAN_DIRECT, nr_scanned);
+		count_memcg_events(memcg, PGSCAN_DIRECT, nr_scanned);
+	}
+	spin_unlock_irq(&pgdat->lru_lock);
+
+	sc->nr_scanned += nr_scanned;
+	if (!nr_taken)
+		return nr_scanned;
+
+	nr_reclaimed = shrink_page_list(&page_list, pgdat, sc, 0, &stat, false);
+
+	spin_lock_irq(&pgdat->lru_lock);
+	if (current_is_kswapd()) {
+		if (global_reclaim(sc))
+			__count_vm_events(PGSTEAL_KSWAPD, nr_reclaimed);
+		count_memcg_events(memcg, PGSTEAL_KSWAPD, nr_reclaimed);
+	} else {
+		if (global_reclaim(sc))
+			__count_vm_events(PGSTEAL_DIRECT, nr_reclaimed);
+		count_memcg_events(memcg, PGSTEAL_DIRECT, nr_reclaimed);
+	}
+
+	/* Activated pages go to the youngest generation, the rest back */
+	putback_inactive_pages(lruvec, &page_list);
+	__mod_node_page_state(pgdat, NR_ISOLATED_ANON + type, -nr_taken);
+	spin_unlock_irq(&pgdat->lru_lock);
+
+	mem_cgroup_uncharge_list(&page_list);
+	free_hot_cold_page_list(&page_list, true);
+
+	sc->nr_reclaimed += nr_reclaimed;
+	return nr_scanned;
+}
+
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec,
+				  struct scan_control *sc,
+				  unsigned long *lru_pages)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	struct mem_cgroup *memcg = lruvec_memcg(lruvec);
+	unsigned long nr[2], nr_to_scan;
+	struct blk_plug plug;
+	bool aged = false;
+	int type;
+
+	nr[0] = 0;
+	if (sc->may_swap && mem_cgroup_swappiness(memcg) &&
+	    (get_nr_swap_pages() > 0 ||
+	     can_demote(lruvec_pgdat(lruvec)->node_id, sc)))
+		nr[0] = lru_gen_nr_pages(lruvec, 0, sc->reclaim_idx);
+	nr[1] = lru_gen_nr_pages(lruvec, 1, sc->reclaim_idx);
+
+	*lru_pages = nr[0] + nr[1];
+	nr_to_scan = *lru_pages >> sc->priority;
+	/* Scrape out the remaining pages of deleted cgroups */
+	if (!nr_to_scan && !mem_cgroup_online(memcg))
+		nr_to_scan = min(*lru_pages, SWAP_CLUSTER_MAX);
+
+	blk_start_plug(&plug);
+	while (nr_to_scan) {
+		unsigned long need_aging = 0;
+		unsigned long scanned;
+
+		/* Evict the older type of the two */
+		if (!nr[0])
+			type = 1;
+		else if (!nr[1])
+			type = 0;
+		else
+			type = READ_ONCE(lrugen->min_seq[0]) <
+			       READ_ONCE(lrugen->min_seq[1]) ? 0 : 1;
+
+		scanned = lru_gen_evict(lruvec, sc, type, &need_aging);
+		if (need_aging) {
+			if (aged)
+				break;
+			lru_gen_age(lruvec, need_aging);
+			aged = true;
+			continue;
+		}
+		if (!scanned)
+			break;
+
+		nr_to_scan -= min(nr_to_scan, scanned);
+		if (sc->nr_reclaimed >= sc->nr_to_reclaim)
+			break;
+	}
+	blk_finish_plug(&plug);
+}
+
+#ifdef CONFIG_DEBUG_FS
+/*
+ * /sys/kernel/debug/lru_gen lists the generations of each memcg and node,
+ * oldest first:
+ *
+ *   memcg  memcg_id  memcg_path
+ *     node  node_id
+ *       seq  age_in_ms  nr_anon_pages  nr_file_pages
+ */
+static void lru_gen_show_lruvec(struct seq_file *m, struct lruvec *lruvec)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	unsigned long seq, max_seq = READ_ONCE(lrugen->max_seq);
+	unsigned long min_seq = min(READ_ONCE(lrugen->min_seq[0]),
+				    READ_ONCE(lrugen->min_seq[1]));
+
+	for (seq = min_seq; seq <= max_seq; seq++) {
+		int gen = lru_gen_from_seq(seq);
+		long nr[2] = {};
+		int type, zone;
+
+		for (type = 0; type < 2; type++) {
+			if (seq < READ_ONCE(lrugen->min_seq[type]))
+				continue;
+			for (zone = 0; zone < MAX_NR_ZONES; zone++)
+				nr[type] += READ_ONCE(lrugen->nr_pages[gen][type][zone]);
+		}
+
+		seq_printf(m, "    %10lu %10u %10ld %10ld\n", seq,
+			   jiffies_to_msecs(jiffies -
+					    READ_ONCE(lrugen->timestamps[gen])),
+			   max(nr[0], 0L), max(nr[1], 0L));
+	}
+}
+
+static int lru_gen_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg;
+	char *path;
+	int nid;
+
+	if (!lru_gen_enabled()) {
+		seq_puts(m, "disabled, boot with lru_gen=1\n");
+		return 0;
+	}
+
+	path = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!path)
+		return -ENOMEM;
+
+	memcg = mem_cgroup_iter(NULL, NULL, NULL);
+	do {
+		path[0] = '\0';
+#ifdef CONFIG_MEMCG
+		if (memcg)
+			cgroup_path(memcg->css.cgroup, path, PATH_MAX);
+#endif
+		seq_printf(m, "memcg %5hu %s\n", mem_cgroup_id(memcg), path);
+
+		for_each_node_state(nid, N_MEMORY) {
+			seq_printf(m, "  node %5d\n", nid);
+			lru_gen_show_lruvec(m,
+				mem_cgroup_lruvec(NODE_DATA(nid), memcg));
+		}
+	} while ((memcg = mem_cgroup_iter(NULL, memcg, NULL)));
+
+	kfree(path);
+	return 0;
+}
+
+static int lru_gen_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lru_gen_show, NULL);
+}
+
+static const struct file_operations lru_gen_fops = {
+	.open		= lru_gen_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init lru_gen_debugfs_init(void)
+{
+	debugfs_create_file("lru_gen", 0444, NULL, NULL, &lru_gen_fops);
+	return 0;
+}
+late_initcall(lru_gen_debugfs_init);
+#endif /* CONFIG_DEBUG_FS */
+#else
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec,
+				  struct scan_control *sc,
+				  unsigned long *lru_pages)
+{
+}
+#endif /* CONFIG_LRU_GEN */
+
 /*
  * This is a basic per-node page freer.  Used by both kswapd and direct reclaim.
  */
@@ -2412,6 +3453,11 @@ static void shrink_node_memcg(struct pglist_data *pgdat, struct mem_cgroup *memc
 	struct blk_plug plug;
 	bool scan_adjusted;
 
+	if (lru_gen_enabled()) {
+		lru_gen_shrink_lruvec(lruvec, sc, lru_pages);
+		return;
+	}
+
 	get_scan_count(lruvec, memcg, sc, nr, lru_pages);
 
 	/* Record the original scan target for proportional adjustments later */
@@ -2832,12 +3878,13 @@ static void snapshot_refaults(struct mem_cgroup *root_memcg, pg_data_t *pgdat)
 
 	memcg = mem_cgroup_iter(root_memcg, NULL, NULL);
 	do {
-		unsigned long refaults;
 		struct lruvec *lruvec;
 
 		lruvec = mem_cgroup_lruvec(pgdat, memcg);
-		refaults = lruvec_page_state(lruvec, WORKINGSET_ACTIVATE);
-		lruvec->refaults = refaults;
+		lruvec->refaults[0] = lruvec_page_state(lruvec,
+						WORKINGSET_ACTIVATE_ANON);
+		lruvec->refaults[1] = lruvec_page_state(lruvec,
+						WORKINGSET_ACTIVATE_FILE);
 	} while ((memcg = mem_cgroup_iter(root_memcg, memcg, NULL)));
 }
 
@@ -3136,6 +4183,7 @@ unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *memcg,
 	struct zonelist *zonelist;
 	unsigned long nr_reclaimed;
 	int nid;
+	unsigned long pflags;
 	unsigned int noreclaim_flag;
 	struct scan_control sc = {
 		.nr_to_reclaim = max(nr_pages, SWAP_CLUSTER_MAX),
@@ -3163,9 +4211,13 @@ unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *memcg,
 					    sc.gfp_mask,
 					    sc.reclaim_idx);
 
+	psi_memstall_enter(&pflags);
 	noreclaim_flag = memalloc_noreclaim_save();
+
 	nr_reclaimed = do_try_to_free_pages(zonelist, &sc);
+
 	memalloc_noreclaim_restore(noreclaim_flag);
+	psi_memstall_leave(&pflags);
 
 	trace_mm_vmscan_memcg_reclaim_end(nr_reclaimed);
 
@@ -3178,7 +4230,9 @@ static void age_active_anon(struct pglist_data *pgdat,
 {
 	struct mem_cgroup *memcg;
 
-	if (!total_swap_pages)
+	/* The multi-gen LRU ages anon pages along with file pages */
+	if ((!total_swap_pages && !can_demote(pgdat->node_id, sc)) ||
+	    lru_gen_enabled())
 		return;
 
 	memcg = mem_cgroup_iter(NULL, NULL, NULL);
@@ -3330,6 +4384,7 @@ static int balance_pgdat(pg_data_t *pgdat, int order, int classzone_idx)
 	int i;
 	unsigned long nr_soft_reclaimed;
 	unsigned long nr_soft_scanned;
+	unsigned long pflags;
 	struct zone *zone;
 	struct scan_control sc = {
 		.gfp_mask = GFP_KERNEL,
@@ -3339,6 +4394,8 @@ static int balance_pgdat(pg_data_t *pgdat, int order, int classzone_idx)
 		.may_unmap = 1,
 		.may_swap = 1,
 	};
+
+	psi_memstall_enter(&pflags);
 	count_vm_event(PAGEOUTRUN);
 
 	do {
@@ -3433,6 +4490,7 @@ static int balance_pgdat(pg_data_t *pgdat, int order, int classzone_idx)
 
 out:
 	snapshot_refaults(NULL, pgdat);
+	psi_memstall_leave(&pflags);
 	/*
 	 * Return the order kswapd stopped reclaiming at as
 	 * prepare_kswapd_sleep() takes it into account. If another caller
@@ -699,6 +699,12 @@ static int refresh_cpu_vm_stats(bool do_pagesets)
 #endif
 			}
 		}
+
+		/* Cached THPs go back every interval, local zones included */
+		if (do_pagesets && __this_cpu_read(p->pcp.thp_count)) {
+			drain_zone_thps(zone, this_cpu_ptr(&p->pcp));
+			changes++;
+		}
 #ifdef CONFIG_NUMA
 		for (i = 0; i < NR_VM_NUMA_STAT_ITEMS; i++) {
 			int v;
@@ -1002,6 +1008,24 @@ static int __fragmentation_index(unsigned int order, struct contig_page_info *in
 	return 1000 - div_u64( (1000+(div_u64(info->free_pages * 1000ULL, requested))), info->free_blocks_total);
 }
 
+/*
+ * Calculates external fragmentation within a zone wrt the given order.
+ * It is defined as the percentage of free pages found in blocks of size
+ * less than 1 << order. It returns values in range [0, 100].
+ */
+unsigned int extfrag_for_order(struct zone *zone, unsigned int order)
+{
+	struct contig_page_info info;
+
+	fill_contig_page_info(zone, order, &info);
+	if (info.free_pages == 0)
+		return 0;
+
+	return div_u64((info.free_pages -
+			(info.free_blocks_suitable << order)) * 100,
+			info.free_pages);
+}
+
 /* Same as __fragmentation index but allocs contig_page_info on stack */
 int fragmentation_index(struct zone *zone, unsigned int order)
 {
@@ -1073,7 +1097,11 @@ const char * const vmstat_text[] = {
 	"nr_isolated_anon",
 	"nr_isolated_file",
 	"workingset_refault",
+	"workingset_refault_anon",
+	"workingset_refault_file",
 	"workingset_activate",
+	"workingset_activate_anon",
+	"workingset_activate_file",
 	"workingset_nodereclaim",
 	"nr_anon_pages",
 	"nr_mapped",
@@ -1084,6 +1112,9 @@ const char * const vmstat_text[] = {
 	"nr_shmem",
 	"nr_shmem_hugepages",
 	"nr_shmem_pmdmapped",
+	"nr_file_hugepages",
+	"nr_file_pmdmapped",
+	"nr_replica_pages",
 	"nr_anon_transparent_hugepages",
 	"nr_unstable",
 	"nr_vmscan_write",
@@ -1114,6 +1145,10 @@ const char * const vmstat_text[] = {
 
 	"pgfault",
 	"pgmajfault",
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	"speculative_pgfault",
+	"speculative_pgfault_abort",
+#endif
 	"pglazyfreed",
 
 	"pgrefill",
@@ -1125,6 +1160,10 @@ const char * const vmstat_text[] = {
 
 #ifdef CONFIG_NUMA
 	"zone_reclaim_failed",
+#endif
+#ifdef CONFIG_MEMCG
+	"pgsteal_memcg_background",
+	"pgsteal_memcg_direct",
 #endif
 	"pginodesteal",
 	"slabs_scanned",
@@ -1145,10 +1184,16 @@ const char * const vmstat_text[] = {
 	"numa_hint_faults",
 	"numa_hint_faults_local",
 	"numa_pages_migrated",
+	"pgpromote_success",
+	"pgpromote_ratelimited",
 #endif
 #ifdef CONFIG_MIGRATION
 	"pgmigrate_success",
 	"pgmigrate_fail",
+#ifdef CONFIG_NUMA
+	"pgdemote_kswapd",
+	"pgdemote_direct",
+#endif
 #endif
 #ifdef CONFIG_COMPACTION
 	"compact_migrate_scanned",
@@ -1181,6 +1226,8 @@ const char * const vmstat_text[] = {
 	"thp_collapse_alloc_failed",
 	"thp_file_alloc",
 	"thp_file_mapped",
+	"thp_collapse_file",
+	"thp_collapse_file_failed",
 	"thp_split_page",
 	"thp_split_page_failed",
 	"thp_deferred_split_page",
@@ -1215,6 +1262,11 @@ const char * const vmstat_text[] = {
 	"swap_ra",
 	"swap_ra_hit",
 #endif
+#ifdef CONFIG_PAGECACHE_REPLICATION
+	"pgreplica_alloc",
+	"pgreplica_map",
+	"pgreplica_drop",
+#endif
 #endif /* CONFIG_VM_EVENTS_COUNTERS */
 };
 #endif /* CONFIG_PROC_FS || CONFIG_SYSFS || CONFIG_NUMA */
@@ -1557,11 +1609,15 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 			   "\n    cpu: %i"
 			   "\n              count: %i"
 			   "\n              high:  %i"
-			   "\n              batch: %i",
+			   "\n              batch: %i"
+			   "\n              high_order_hit:  %lu"
+			   "\n              high_order_miss: %lu",
 			   i,
 			   pageset->pcp.count,
 			   pageset->pcp.high,
-			   pageset->pcp.batch);
+			   pageset->pcp.batch,
+			   pageset->pcp.high_order_hit,
+			   pageset->pcp.high_order_miss);
 #ifdef CONFIG_SMP
 		seq_printf(m, "\n  vm stats threshold: %d",
 				pageset->stat_threshold);
@@ -1817,6 +1873,9 @@ static bool need_update(int cpu)
 			       sizeof(p->vm_numa_stat_diff[0])))
 			return true;
 #endif
+		/* See refresh_cpu_vm_stats() */
+		if (p->pcp.thp_count)
+			return true;
 	}
 	return false;
 }
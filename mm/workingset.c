@@ -6,6 +6,7 @@
  */
 
 #include <linux/memcontrol.h>
+#include <linux/mm_inline.h>
 #include <linux/writeback.h>
 #include <linux/shmem_fs.h>
 #include <linux/pagemap.h>
@@ -19,8 +20,8 @@
 /*
  *		Double CLOCK lists
  *
- * Per node, two clock lists are maintained for file pages: the
- * inactive and the active list.  Freshly faulted pages start out at
+ * Per node, two clock lists are maintained for both anon and file
+ * pages: the inactive and the active list.  Freshly faulted pages start out at
  * the head of the inactive list and page reclaim scans pages from the
  * tail.  Pages that are accessed multiple times on the inactive list
  * are promoted to the active list, to protect them from reclaim,
@@ -142,14 +143,31 @@
  * and the used pages get to stay in cache.
  *
  *
+ *		Anonymous and file pages
+ *
+ * Anon and file pages compete for the same memory, so the refault
+ * distance of either is compared to all the memory that could be
+ * made available to it: the active pages of both types plus, for a
+ * refaulting page, the inactive pages of the other type.  Anon pages
+ * only compete while there is swap space to put them.  One counter of
+ * evictions and activations covers both types, such that a distance
+ * in one is comparable to the sizes of the other's lists.
+ *
+ * Activated refaults are counted as rotations by the LRU balancing in
+ * get_scan_count(), so the type that thrashes gets less pressure, and
+ * they make reclaim deactivate the stale part of the active list of
+ * their type (see inactive_list_is_low()).
+ *
+ *
  *		Implementation
  *
- * For each node's file LRU lists, a counter for inactive evictions
- * and activations is maintained (node->inactive_age).
+ * For each node's LRU lists, a counter for inactive evictions and
+ * activations is maintained (node->inactive_age).
  *
  * On eviction, a snapshot of this counter (along with some bits to
  * identify the node) is stored in the now empty page cache radix tree
- * slot of the evicted page.  This is called a shadow entry.
+ * slot of the evicted page, or the swap cache slot of an anon page.
+ * This is called a shadow entry.
  *
  * On cache misses for which there are shadow entries, an eligible
  * refault distance will immediately activate the refaulting page.
@@ -202,8 +220,9 @@ static void unpack_shadow(void *shadow, int *memcgidp, pg_data_t **pgdat,
  * @mapping: address space the page was backing
  * @page: the page being evicted
  *
- * Returns a shadow entry to be stored in @mapping->page_tree in place
- * of the evicted @page so that a later refault can be detected.
+ * Returns a shadow entry to be stored in @mapping->page_tree, or in the
+ * swap cache for an anon page, in place of the evicted @page so that a
+ * later refault can be detected.
  */
 void *workingset_eviction(struct address_space *mapping, struct page *page)
 {
@@ -225,17 +244,20 @@ void *workingset_eviction(struct address_space *mapping, struct page *page)
 
 /**
  * workingset_refault - evaluate the refault of a previously evicted page
+ * @page: the freshly allocated replacement page
  * @shadow: shadow entry of the evicted page
  *
  * Calculates and evaluates the refault distance of the previously
  * evicted page in the context of the node it was allocated in.
  *
  * Returns %true if the page should be activated, %false otherwise.
+ * An activation is accounted to the workingset here.
  */
-bool workingset_refault(void *shadow)
+bool workingset_refault(struct page *page, void *shadow)
 {
+	bool file = page_is_file_cache(page);
 	unsigned long refault_distance;
-	unsigned long active_file;
+	unsigned long workingset_size;
 	struct mem_cgroup *memcg;
 	unsigned long eviction;
 	struct lruvec *lruvec;
@@ -269,7 +291,6 @@ bool workingset_refault(void *shadow)
 	}
 	lruvec = mem_cgroup_lruvec(pgdat, memcg);
 	refault = atomic_long_read(&lruvec->inactive_age);
-	active_file = lruvec_lru_size(lruvec, LRU_ACTIVE_FILE, MAX_NR_ZONES);
 
 	/*
 	 * The unsigned subtraction here gives an accurate distance
@@ -290,14 +311,36 @@ bool workingset_refault(void *shadow)
 	refault_distance = (refault - eviction) & EVICTION_MASK;
 
 	inc_lruvec_state(lruvec, WORKINGSET_REFAULT);
+	inc_lruvec_state(lruvec, WORKINGSET_REFAULT_BASE + file);
+
+	/*
+	 * Compare the distance to the memory the page could have had,
+	 * see "Anonymous and file pages" above.
+	 */
+	workingset_size = lruvec_lru_size(lruvec, LRU_ACTIVE_FILE, MAX_NR_ZONES);
+	if (!file)
+		workingset_size += lruvec_lru_size(lruvec, LRU_INACTIVE_FILE,
+						   MAX_NR_ZONES);
+	if (mem_cgroup_get_nr_swap_pages(memcg) > 0) {
+		workingset_size += lruvec_lru_size(lruvec, LRU_ACTIVE_ANON,
+						   MAX_NR_ZONES);
+		if (file)
+			workingset_size += lruvec_lru_size(lruvec,
+							   LRU_INACTIVE_ANON,
+							   MAX_NR_ZONES);
+	}
 
-	if (refault_distance <= active_file) {
-		inc_lruvec_state(lruvec, WORKINGSET_ACTIVATE);
+	if (refault_distance > workingset_size) {
 		rcu_read_unlock();
-		return true;
+		return false;
 	}
+
+	/* The page is activated, see workingset_activation() */
+	atomic_long_inc(&lruvec->inactive_age);
+	inc_lruvec_state(lruvec, WORKINGSET_ACTIVATE);
+	inc_lruvec_state(lruvec, WORKINGSET_ACTIVATE_BASE + file);
 	rcu_read_unlock();
-	return false;
+	return true;
 }
 
 /**
@@ -344,7 +387,7 @@ void workingset_update_node(struct radix_tree_node *node, void *private)
 {
 	struct address_space *mapping = private;
 
-	/* Only regular page cache has shadow entries */
+	/* Only regular page cache and swap cache have shadow entries */
 	if (dax_mapping(mapping) || shmem_mapping(mapping))
 		return;
 
@@ -377,6 +420,9 @@ static unsigned long count_shadow_nodes(struct shrinker *shrinker,
 	nodes = list_lru_shrink_count(&shadow_nodes, sc);
 	local_irq_enable();
 
+	if (!nodes)
+		return SHRINK_EMPTY;
+
 	/*
 	 * Approximate a reasonable limit for the radix tree nodes
 	 * containing shadow entries. We don't need to keep more
@@ -385,7 +431,8 @@ static unsigned long count_shadow_nodes(struct shrinker *shrinker,
 	 *
 	 * The size of the active list converges toward 100% of
 	 * overall page cache as memory grows, with only a tiny
-	 * inactive list. Assume the total cache size for that.
+	 * inactive list. Assume the total cache size for that, and
+	 * count anon pages as cache too while they can be swapped.
 	 *
 	 * Nodes might be sparsely populated, with only one shadow
 	 * entry in the extreme case. Obviously, we cannot keep one
@@ -400,11 +447,20 @@ static unsigned long count_shadow_nodes(struct shrinker *shrinker,
 	 * PAGE_SIZE / radix_tree_nodes / node_entries * 8 / PAGE_SIZE
 	 */
 	if (sc->memcg) {
+		unsigned int lru_mask = LRU_ALL_FILE;
+
+		if (total_swap_pages)
+			lru_mask |= LRU_ALL_ANON;
 		cache = mem_cgroup_node_nr_lru_pages(sc->memcg, sc->nid,
-						     LRU_ALL_FILE);
+						     lru_mask);
 	} else {
-		cache = node_page_state(NODE_DATA(sc->nid), NR_ACTIVE_FILE) +
-			node_page_state(NODE_DATA(sc->nid), NR_INACTIVE_FILE);
+		pg_data_t *pgdat = NODE_DATA(sc->nid);
+
+		cache = node_page_state(pgdat, NR_ACTIVE_FILE) +
+			node_page_state(pgdat, NR_INACTIVE_FILE);
+		if (total_swap_pages)
+			cache += node_page_state(pgdat, NR_ACTIVE_ANON) +
+				 node_page_state(pgdat, NR_INACTIVE_ANON);
 	}
 	max_nodes = cache >> (RADIX_TREE_MAP_SHIFT - 3);
 
@@ -534,15 +590,17 @@ static int __init workingset_init(void)
 	pr_info("workingset: timestamp_bits=%d max_order=%d bucket_order=%u\n",
 	       timestamp_bits, max_order, bucket_order);
 
-	ret = __list_lru_init(&shadow_nodes, true, &shadow_nodes_key);
+	ret = prealloc_shrinker(&workingset_shadow_shrinker);
 	if (ret)
 		goto err;
-	ret = register_shrinker(&workingset_shadow_shrinker);
+	ret = __list_lru_init(&shadow_nodes, true, &shadow_nodes_key,
+			      &workingset_shadow_shrinker);
 	if (ret)
 		goto err_list_lru;
+	register_shrinker_prepared(&workingset_shadow_shrinker);
 	return 0;
 err_list_lru:
-	list_lru_destroy(&shadow_nodes);
+	free_prealloced_shrinker(&workingset_shadow_shrinker);
 err:
 	return ret;
 }
@@ -0,0 +1,322 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Async buffered read test, in the style of a fio randread job.
+ *
+ * A test file is written with every 4k block stamped with its own
+ * offset, dropped from the page cache, and then read back through
+ * io_submit() without O_DIRECT:
+ *
+ *  - cold: random block reads at the given queue depth, on an empty cache
+ *  - holey: large reads over a cache in which every other page is present,
+ *    so reads stop at uncached pages and have to be continued
+ *  - eof: a read across the end of the file must come back short
+ *
+ * All data is verified.  Submission and completion latencies are reported:
+ * with async buffered reads, io_submit() only copies what is cached and
+ * should stay far below the completion latency on a cold cache.
+ *
+ * usage: aio-buffered-read [-f file] [-m MB] [-d depth] [-n ios]
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+#define BLK_SIZE	4096
+#define HOLEY_BS	(64 * 1024)
+
+static const char *path = "aio-buffered-read.dat";
+static size_t file_size = 64UL << 20;
+static int depth = 32;
+static int nr_ios = 4096;
+
+static int io_setup(unsigned int nr, aio_context_t *ctx)
+{
+	return syscall(__NR_io_setup, nr, ctx);
+}
+
+static int io_destroy(aio_context_t ctx)
+{
+	return syscall(__NR_io_destroy, ctx);
+}
+
+static int io_submit(aio_context_t ctx, long nr, struct iocb **iocbs)
+{
+	return syscall(__NR_io_submit, ctx, nr, iocbs);
+}
+
+static int io_getevents(aio_context_t ctx, long min_nr, long nr,
+			struct io_event *events, struct timespec *timeout)
+{
+	return syscall(__NR_io_getevents, ctx, min_nr, nr, events, timeout);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void fill_block(uint64_t *p, uint64_t off)
+{
+	int i;
+
+	for (i = 0; i < BLK_SIZE / sizeof(*p); i++)
+		p[i] = off + i;
+}
+
+static int check_buf(const uint64_t *p, uint64_t off, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len / sizeof(*p); i++) {
+		uint64_t block = off + i * sizeof(*p);
+		uint64_t want = (block & ~(uint64_t)(BLK_SIZE - 1)) +
+				(block % BLK_SIZE) / sizeof(*p);
+
+		if (p[i] != want) {
+			fprintf(stderr, "bad data at %" PRIu64 ": %" PRIu64
+				" instead of %" PRIu64 "\n", block, p[i], want);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void create_file(int fd)
+{
+	uint64_t *buf;
+	size_t off;
+
+	buf = malloc(BLK_SIZE);
+	if (!buf)
+		err(1, "malloc");
+	for (off = 0; off < file_size; off += BLK_SIZE) {
+		fill_block(buf, off);
+		if (pwrite(fd, buf, BLK_SIZE, off) != BLK_SIZE)
+			err(1, "pwrite");
+	}
+	free(buf);
+	if (fsync(fd))
+		err(1, "fsync");
+}
+
+static void drop_cache(int fd)
+{
+	errno = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	if (errno)
+		err(1, "posix_fadvise");
+}
+
+struct job_stats {
+	uint64_t submit_ns, submit_max_ns;
+	uint64_t complete_ns;
+	int nr;
+};
+
+/*
+ * Keep @depth reads of @bs bytes in flight until @nr have completed.
+ * Offsets come from @next_off; every completion is checked against the
+ * expected length and content.
+ */
+static int run_job(aio_context_t ctx, int fd, size_t bs, int nr,
+		   uint64_t (*next_off)(int), struct job_stats *st)
+{
+	struct iocb *iocbs, *iocbp;
+	struct io_event *events;
+	uint64_t *start;
+	char *bufs;
+	int inflight = 0, submitted = 0, done = 0, ret = 0;
+	int i, n;
+
+	iocbs = calloc(depth, sizeof(*iocbs));
+	events = calloc(depth, sizeof(*events));
+	start = calloc(depth, sizeof(*start));
+	if (!iocbs || !events || !start ||
+	    posix_memalign((void **)&bufs, BLK_SIZE, depth * bs))
+		err(1, "alloc");
+	memset(st, 0, sizeof(*st));
+
+	for (i = 0; i < depth && submitted < nr; i++, submitted++) {
+		uint64_t t;
+
+		iocbs[i].aio_fildes = fd;
+		iocbs[i].aio_lio_opcode = IOCB_CMD_PREAD;
+		iocbs[i].aio_buf = (uintptr_t)(bufs + i * bs);
+		iocbs[i].aio_nbytes = bs;
+		iocbs[i].aio_offset = next_off(submitted);
+		iocbs[i].aio_data = i;
+		iocbp = &iocbs[i];
+
+		t = now_ns();
+		if (io_submit(ctx, 1, &iocbp) != 1)
+			err(1, "io_submit");
+		start[i] = now_ns();
+		t = start[i] - t;
+		st->submit_ns += t;
+		if (t > st->submit_max_ns)
+			st->submit_max_ns = t;
+		inflight++;
+	}
+
+	while (inflight) {
+		n = io_getevents(ctx, 1, depth, events, NULL);
+		if (n < 0)
+			err(1, "io_getevents");
+
+		for (i = 0; i < n; i++) {
+			int slot = events[i].data;
+			struct iocb *cb = &iocbs[slot];
+			size_t want = bs;
+			uint64_t t;
+
+			st->complete_ns += now_ns() - start[slot];
+			inflight--;
+			done++;
+
+			if (cb->aio_offset + want > file_size)
+				want = file_size - cb->aio_offset;
+			if (events[i].res != want) {
+				fprintf(stderr, "read at %llu returned %lld, expected %zu\n",
+					(unsigned long long)cb->aio_offset,
+					(long long)events[i].res, want);
+				ret = -1;
+			} else if (check_buf((uint64_t *)(bufs + slot * bs),
+					     cb->aio_offset, want)) {
+				ret = -1;
+			}
+
+			if (submitted == nr)
+				continue;
+
+			cb->aio_offset = next_off(submitted++);
+			iocbp = cb;
+			t = now_ns();
+			if (io_submit(ctx, 1, &iocbp) != 1)
+				err(1, "io_submit");
+			start[slot] = now_ns();
+			t = start[slot] - t;
+			st->submit_ns += t;
+			if (t > st->submit_max_ns)
+				st->submit_max_ns = t;
+			inflight++;
+		}
+	}
+
+	st->nr = done;
+	free(bufs);
+	free(start);
+	free(events);
+	free(iocbs);
+	return ret;
+}
+
+static void report(const char *name, struct job_stats *st, uint64_t elapsed)
+{
+	printf("%-6s %6d ios %8.0f iops  submit avg %6.1fus max %8.1fus  complete avg %8.1fus\n",
+	       name, st->nr, st->nr * 1e9 / elapsed,
+	       st->submit_ns / 1e3 / st->nr, st->submit_max_ns / 1e3,
+	       st->complete_ns / 1e3 / st->nr);
+}
+
+static uint64_t random_block(int i)
+{
+	return (uint64_t)(random() % (file_size / BLK_SIZE)) * BLK_SIZE;
+}
+
+static uint64_t holey_block(int i)
+{
+	return (uint64_t)(i % (file_size / HOLEY_BS)) * HOLEY_BS;
+}
+
+static uint64_t eof_block(int i)
+{
+	return file_size - BLK_SIZE / 2;
+}
+
+static void cache_every_other_page(int fd)
+{
+	char buf[BLK_SIZE];
+	size_t off;
+
+	for (off = 0; off < file_size; off += 2 * BLK_SIZE)
+		if (pread(fd, buf, BLK_SIZE, off) != BLK_SIZE)
+			err(1, "pread");
+}
+
+int main(int argc, char **argv)
+{
+	struct job_stats st;
+	aio_context_t ctx = 0;
+	uint64_t t;
+	int fd, opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "f:m:d:n:")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 'm':
+			file_size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'n':
+			nr_ios = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-f file] [-m MB] [-d depth] [-n ios]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!file_size || depth <= 0 || nr_ios <= 0)
+		errx(1, "invalid arguments");
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		err(1, "open %s", path);
+	unlink(path);
+	create_file(fd);
+
+	if (io_setup(depth, &ctx))
+		err(1, "io_setup");
+
+	drop_cache(fd);
+	t = now_ns();
+	if (run_job(ctx, fd, BLK_SIZE, nr_ios, random_block, &st))
+		ret = 1;
+	report("cold", &st, now_ns() - t);
+
+	drop_cache(fd);
+	cache_every_other_page(fd);
+	t = now_ns();
+	if (run_job(ctx, fd, HOLEY_BS, file_size / HOLEY_BS, holey_block, &st))
+		ret = 1;
+	report("holey", &st, now_ns() - t);
+
+	drop_cache(fd);
+	t = now_ns();
+	if (run_job(ctx, fd, BLK_SIZE, 1, eof_block, &st))
+		ret = 1;
+	report("eof", &st, now_ns() - t);
+
+	io_destroy(ctx);
+	close(fd);
+
+	printf("%s\n", ret ? "[FAIL]" : "[PASS]");
+	return ret;
+}
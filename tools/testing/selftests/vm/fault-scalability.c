@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Page fault scalability benchmark.
+ *
+ * A number of threads repeatedly fault in and zap private anonymous
+ * memory while another thread keeps taking mmap_sem for writing
+ * (mmap/mprotect/munmap) and for reading (/proc/self/maps).  With
+ * speculative page faults the faulting threads should mostly not be
+ * held up by the writer.  The fault rate is reported together with the
+ * speculative_pgfault counters from /proc/vmstat when they exist.
+ *
+ * usage: fault-scalability [-t threads] [-s seconds] [-m MB per thread] [-q]
+ *	-q disables the mmap_sem writer thread
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+static volatile int stop;
+static long page_size;
+static size_t region_size = 4UL << 20;
+
+struct worker {
+	pthread_t thread;
+	unsigned long faults;
+} __attribute__((aligned(64)));
+
+static void *fault_thread(void *arg)
+{
+	struct worker *w = arg;
+	char *p;
+	size_t off;
+
+	p = mmap(NULL, region_size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		err(1, "mmap");
+
+	while (!stop) {
+		for (off = 0; off < region_size; off += page_size)
+			p[off] = 1;
+		w->faults += region_size / page_size;
+		/* keeps the page tables, so the next pass faults on ptes */
+		if (madvise(p, region_size, MADV_DONTNEED))
+			err(1, "madvise");
+	}
+
+	munmap(p, region_size);
+	return NULL;
+}
+
+static void *mmap_sem_thread(void *arg)
+{
+	char buf[4096];
+	char *p;
+	int fd;
+
+	while (!stop) {
+		p = mmap(NULL, 16 * page_size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			err(1, "mmap");
+		p[0] = 1;
+		if (mprotect(p, page_size, PROT_READ))
+			err(1, "mprotect");
+		munmap(p, 16 * page_size);
+
+		fd = open("/proc/self/maps", O_RDONLY);
+		if (fd < 0)
+			err(1, "open /proc/self/maps");
+		while (read(fd, buf, sizeof(buf)) > 0)
+			;
+		close(fd);
+	}
+	return NULL;
+}
+
+static int read_vmstat(const char *name, unsigned long *val)
+{
+	char key[64];
+	unsigned long v;
+	FILE *f;
+	int ret = -1;
+
+	f = fopen("/proc/vmstat", "r");
+	if (!f)
+		return -1;
+	while (fscanf(f, "%63s %lu", key, &v) == 2) {
+		if (!strcmp(key, name)) {
+			*val = v;
+			ret = 0;
+			break;
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long spf_before, spf_after, abort_before, abort_after;
+	unsigned long total = 0;
+	int nr_threads = 64, seconds = 5, disturb = 1;
+	struct timeval start, end;
+	pthread_t disturber;
+	struct worker *workers;
+	int have_spf;
+	double elapsed;
+	int i, opt;
+
+	while ((opt = getopt(argc, argv, "t:s:m:q")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'm':
+			region_size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'q':
+			disturb = 0;
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-t threads] [-s seconds] [-m MB] [-q]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (nr_threads <= 0 || seconds <= 0 || !region_size)
+		errx(1, "invalid arguments");
+
+	page_size = sysconf(_SC_PAGESIZE);
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers)
+		err(1, "calloc");
+
+	have_spf = !read_vmstat("speculative_pgfault", &spf_before) &&
+		   !read_vmstat("speculative_pgfault_abort", &abort_before);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&workers[i].thread, NULL, fault_thread,
+				   &workers[i]))
+			errx(1, "pthread_create");
+	if (disturb && pthread_create(&disturber, NULL, mmap_sem_thread, NULL))
+		errx(1, "pthread_create");
+
+	sleep(seconds);
+	stop = 1;
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		total += workers[i].faults;
+	}
+	if (disturb)
+		pthread_join(disturber, NULL);
+	gettimeofday(&end, NULL);
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+		  (end.tv_usec - start.tv_usec) / 1e6;
+	printf("%d threads%s: %lu faults in %.2fs, %.0f faults/s\n",
+	       nr_threads, disturb ? " + mmap_sem writer" : "",
+	       total, elapsed, total / elapsed);
+
+	if (have_spf &&
+	    !read_vmstat("speculative_pgfault", &spf_after) &&
+	    !read_vmstat("speculative_pgfault_abort", &abort_after))
+		printf("speculative faults: %lu handled, %lu aborted\n",
+		       spf_after - spf_before, abort_after - abort_before);
+	else
+		printf("speculative fault counters not available\n");
+
+	free(workers);
+	return 0;
+}
@@ -0,0 +1,184 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * fork() latency benchmark.
+ *
+ * A private anonymous region of growing size is populated and the time
+ * the parent spends in fork() is measured, first with page tables
+ * copied the usual way and then with PR_SET_COW_PGTABLE, where fork
+ * shares the PTE tables copy-on-write.  The child exits right away.
+ * Transparent huge pages are disabled for the region so that fork has
+ * PTEs to copy.
+ *
+ * After the timed runs the child of one more fork writes to every PMD
+ * sized chunk of the region, and the parent checks that it still sees
+ * its own data.
+ *
+ * usage: fork_latency [-m max region size in MB] [-r repeats]
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#ifndef PR_SET_COW_PGTABLE
+#define PR_SET_COW_PGTABLE	0x53434f57
+#endif
+
+#define MIN_SIZE	(64UL << 20)
+#define PMD_SIZE	(2UL << 20)
+
+static unsigned long page_size;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Average time spent in fork() by the parent, or 0 on failure */
+static unsigned long long time_fork(int repeats)
+{
+	unsigned long long start, total = 0;
+	int r, status;
+	pid_t pid;
+
+	for (r = 0; r < repeats; r++) {
+		start = now_ns();
+		pid = fork();
+		if (!pid)
+			_exit(0);
+		total += now_ns() - start;
+		if (pid < 0) {
+			warn("fork");
+			return 0;
+		}
+		if (waitpid(pid, &status, 0) != pid) {
+			warn("waitpid");
+			return 0;
+		}
+	}
+
+	return total / repeats;
+}
+
+/* Let the child write all over the region, then check the parent's copy */
+static int check_cow(char *region, unsigned long size)
+{
+	unsigned long i;
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		warn("fork");
+		return -1;
+	}
+	if (!pid) {
+		for (i = 0; i < size; i += PMD_SIZE)
+			region[i] = (char)~(i / page_size);
+		for (i = 0; i < size; i += PMD_SIZE)
+			if (region[i] != (char)~(i / page_size))
+				_exit(1);
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) != pid) {
+		warn("waitpid");
+		return -1;
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		warnx("child saw wrong data");
+		return -1;
+	}
+
+	for (i = 0; i < size; i += page_size) {
+		if (region[i] != (char)(i / page_size)) {
+			warnx("parent data changed at offset 0x%lx", i);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long max_size = 4096UL << 20;
+	unsigned long long copy_ns, cow_ns;
+	unsigned long size, i;
+	int repeats = 5;
+	int opt, cow, ret = 0;
+	char *region;
+
+	while ((opt = getopt(argc, argv, "m:r:")) != -1) {
+		switch (opt) {
+		case 'm':
+			max_size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-m MB] [-r repeats]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (max_size < MIN_SIZE || repeats < 1)
+		errx(1, "invalid region size or repeat count");
+
+	cow = !prctl(PR_SET_COW_PGTABLE, 0, 0, 0, 0);
+	if (!cow)
+		printf("PR_SET_COW_PGTABLE not supported, copying only\n");
+
+	printf("%10s %16s %16s\n", "RSS (MB)", "copy (us)", "cow (us)");
+	for (size = MIN_SIZE; size <= max_size; size *= 2) {
+		region = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (region == MAP_FAILED) {
+			warn("mapping %lu MB", size >> 20);
+			ret = 1;
+			break;
+		}
+		madvise(region, size, MADV_NOHUGEPAGE);
+		for (i = 0; i < size; i += page_size)
+			region[i] = (char)(i / page_size);
+
+		prctl(PR_SET_COW_PGTABLE, 0, 0, 0, 0);
+		copy_ns = time_fork(repeats);
+
+		cow_ns = 0;
+		if (cow) {
+			prctl(PR_SET_COW_PGTABLE, 1, 0, 0, 0);
+			cow_ns = time_fork(repeats);
+			if (cow_ns && check_cow(region, size))
+				cow_ns = 0;
+			if (!cow_ns)
+				ret = 1;
+		}
+		if (!copy_ns)
+			ret = 1;
+
+		printf("%10lu %16.1f", size >> 20, copy_ns / 1000.0);
+		if (cow)
+			printf(" %16.1f", cow_ns / 1000.0);
+		printf("\n");
+
+		munmap(region, size);
+		if (ret)
+			break;
+	}
+
+	return ret;
+}
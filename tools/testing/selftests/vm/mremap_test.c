@@ -0,0 +1,155 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * mremap() throughput test.
+ *
+ * A populated private anonymous region is moved with
+ * MREMAP_MAYMOVE | MREMAP_FIXED to a destination that is page, PMD or
+ * PUD aligned relative to the source.  When both addresses share the
+ * PMD (or PUD) alignment the kernel can move whole page table pages
+ * instead of the individual ptes, which shows up as a large difference
+ * in throughput.  The contents are checked after every move.
+ *
+ * usage: mremap_test [-s region size in MB] [-r repeats]
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define PMD_ALIGN	(2UL << 20)
+#define PUD_ALIGN	(1UL << 30)
+
+static unsigned long page_size;
+
+struct test {
+	const char *name;
+	unsigned long dest_offset;
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Move a PUD aligned source region to a destination which is offset by
+ * @dest_offset from a PUD boundary.  Returns the time spent in mremap()
+ * in nanoseconds, or 0 on failure.
+ */
+static unsigned long long run_test(struct test *t, unsigned long size)
+{
+	unsigned long reserve_size = size * 2 + PUD_ALIGN * 3;
+	unsigned long long start, end;
+	char *reserve, *src, *dest, *moved;
+	unsigned long i;
+
+	/* Reserve enough address space to pick aligned addresses in it */
+	reserve = mmap(NULL, reserve_size, PROT_NONE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (reserve == MAP_FAILED) {
+		warn("reserving address space");
+		return 0;
+	}
+
+	src = (char *)(((unsigned long)reserve + PUD_ALIGN - 1) &
+		       ~(PUD_ALIGN - 1));
+	dest = src + ((size + PUD_ALIGN * 2 - 1) & ~(PUD_ALIGN - 1)) +
+	       t->dest_offset;
+
+	src = mmap(src, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+	if (src == MAP_FAILED) {
+		warn("mapping source");
+		munmap(reserve, reserve_size);
+		return 0;
+	}
+
+	for (i = 0; i < size; i += page_size)
+		src[i] = (char)(i / page_size);
+
+	start = now_ns();
+	moved = mremap(src, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, dest);
+	end = now_ns();
+	if (moved == MAP_FAILED) {
+		warn("mremap");
+		munmap(reserve, reserve_size);
+		return 0;
+	}
+
+	for (i = 0; i < size; i += page_size) {
+		if (moved[i] != (char)(i / page_size)) {
+			warnx("%s: data mismatch at offset 0x%lx", t->name, i);
+			end = start;
+			break;
+		}
+	}
+
+	munmap(reserve, reserve_size);
+	return end - start;
+}
+
+int main(int argc, char **argv)
+{
+	struct test tests[] = {
+		{ "page aligned", 0 },
+		{ "PMD aligned", 0 },
+		{ "PUD aligned", 0 },
+	};
+	unsigned long size = 1UL << 30;
+	int repeats = 3;
+	int i, r, opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "s:r:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s MB] [-r repeats]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (!size || size % page_size || repeats < 1)
+		errx(1, "invalid region size or repeat count");
+
+	tests[0].dest_offset = page_size;
+	tests[1].dest_offset = PMD_ALIGN;
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		unsigned long long total = 0, ns;
+
+		for (r = 0; r < repeats; r++) {
+			ns = run_test(&tests[i], size);
+			if (!ns) {
+				ret = 1;
+				break;
+			}
+			total += ns;
+		}
+		if (r < repeats) {
+			printf("%-14s: [FAIL]\n", tests[i].name);
+			continue;
+		}
+
+		ns = total / repeats;
+		printf("%-14s: %lu MB in %llu ns, %.2f GB/s\n", tests[i].name,
+		       size >> 20, ns, (double)size / ns);
+	}
+
+	return ret;
+}